@@ -150,6 +150,8 @@ static void play_video_once(uint64_t total_bytes, filehandle *video) {
   uint8_t *nextFrame = buffera;
 
   uint32_t start = *REG32(ST_CLO);
+  // 30fps on a 60hz screen, every video frame is queued for its own vsync, so a slow read shows up as a missed frame in hvs_present
+  uint32_t target = hvs_frame_count(channel) + 2;
   for (int i=0; i<frames; i++) {
     //printf("frame %d\n", i);
     ret = fs_read_file(video, nextFrame, i * frame_bytes, frame_bytes);
@@ -158,18 +160,20 @@ static void play_video_once(uint64_t total_bytes, filehandle *video) {
     // update dlist, so the newly loaded frame is visible
     d[4] = (uint32_t)nextFrame;
 
-    // schedule dlist update on next vsync
+    // schedule the flip for the target vsync
     mutex_acquire(&channels[channel].lock);
-    hvs_update_dlist(channel);
+    ret = hvs_present(channel, target, 0, NULL, NULL);
     mutex_release(&channels[channel].lock);
+    if (ret != NO_ERROR) printf("present error %d\n", ret);
 
     frameANext = !frameANext;
 
     nextFrame = frameANext ? buffera : bufferb;
 
     //printf("frame %d\n", i+1);
-    hvs_wait_vsync(channel);
-    hvs_wait_vsync(channel);
+    // the other buffer is on screen until this frame replaces it
+    hvs_present_wait(channel, target);
+    target += 2;
   }
   uint32_t stop = *REG32(ST_CLO);
   uint32_t spent = stop - start;
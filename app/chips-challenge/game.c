@@ -1,8 +1,12 @@
 #include <app.h>
 #include <lib/tga.h>
 #include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/hvs.h>
 #include <platform/bcm28xx/print_timestamp.h>
+#include <platform/bcm28xx/tilemap.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -31,55 +35,42 @@ extern uint32_t level_count;
 #define RED_KEY_FLOOR    0,2
 #define BLUE_KEY_FLOOR   1,2
 
-typedef struct {
-  hvs_layer *layer;
-} screen_tile_t;
-
-screen_tile_t tiles[9][9];
+#define TILE 34
+#define MAP_SIZE 32
+#define VIEW_TILES 9
 
 // x left<->right
 // y up<->down
 
-static void init_tile(screen_tile_t *t, int x, int y) {
-  t->layer = malloc(sizeof(*t->layer));
-  mk_unity_layer(t->layer, sprite_sheet, 60, 272, 714);
-  hvs_allocate_premade(t->layer, 7);
-  t->layer->x = 50 + (x * 34);
-  t->layer->y = 60 + (y * 34);
-  t->layer->w = 272;
-  t->layer->h = 714;
-  t->layer->viewport_x = 0;
-  t->layer->viewport_y = 0;
-  t->layer->viewport_w = 34;
-  t->layer->viewport_h = 34;
-  t->layer->fb = sprite_sheet;
-  t->layer->name = strdup("sprite sheet");
-  hvs_regen_noscale_viewport_noalpha(t->layer);
-  hvs_dlist_add(channel, t->layer);
-}
-
-static void tile_set_sprite(screen_tile_t *t, int tile) {
-  t->layer->viewport_x = (tile%8) * 34;
-  t->layer->viewport_y = (tile/8) * 34;
-  hvs_regen_noscale_viewport_noalpha(t->layer);
-}
+static tilemap map;
+static uint16_t map_tiles[MAP_SIZE * MAP_SIZE];
+// only set once tilemap_init() succeeded, until then every command that touches map refuses to run
+static bool map_ready = false;
 
 static int level = 0;
 static int camera_x = 0;
 static int camera_y = 0;
 
-static void redraw_map(void) {
-  for (int j=0; j<9; j++) {
-    const int y = j + camera_y;
-    for (int i=0; i<9; i++) {
-      const int x = i + camera_x;
-      uint8_t tile = map_data[(level * 1024) + (y * 32) + x];
-      tile_set_sprite(&tiles[i][j], tile-1);
-    }
+static void load_level(int n) {
+  for (int i=0; i < (MAP_SIZE * MAP_SIZE); i++) {
+    uint8_t tile = map_data[(n * 1024) + i];
+    map_tiles[i] = tile ? (tile - 1) : TILEMAP_EMPTY;
   }
 }
 
+static bool check_map(void) {
+  if (!map_ready) puts("no map, the game didnt start");
+  return map_ready;
+}
+
+static void redraw_map(void) {
+  map.scroll_x = camera_x * TILE;
+  map.scroll_y = camera_y * TILE;
+  tilemap_update(&map);
+}
+
 static int cmd_move(int argc, const console_cmd_args *argv) {
+  if (!check_map()) return ERR_NOT_READY;
   if (strcmp(argv[0].str, "down") == 0) {
     camera_y++;
   }
@@ -105,11 +96,106 @@ static int cmd_move(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
+static const char *mode_names[] = { "auto", "sprites", "surface" };
+
+static void print_stats(void) {
+  tilemap_dlist_words(&map);
+  const tilemap_stats *s = &map.stats;
+  printf("%s (%s): %d changed, %d dlist words, update %d us, estimate sprites %d ns surface %d ns, %d switches\n",
+      mode_names[map.active], mode_names[map.mode], s->changed, s->words, s->update_us,
+      s->sprites_ns, s->surface_ns, s->switches);
+}
+
+static int cmd_tilemap_mode(int argc, const console_cmd_args *argv) {
+  if (!check_map()) return ERR_NOT_READY;
+  if (argc >= 2) {
+    for (unsigned int i=0; i < countof(mode_names); i++) {
+      if (strcmp(argv[1].str, mode_names[i]) == 0) map.mode = i;
+    }
+  }
+  print_stats();
+  return 0;
+}
+
+// scrolls by a pixel amount, rather than a whole tile
+static int cmd_scroll(int argc, const console_cmd_args *argv) {
+  if (argc < 3) {
+    printf("usage: %s <dx> <dy>\n", argv[0].str);
+    return -1;
+  }
+  if (!check_map()) return ERR_NOT_READY;
+  mutex_acquire(&channels[channel].lock);
+  map.scroll_x += argv[1].i;
+  map.scroll_y += argv[2].i;
+  tilemap_update(&map);
+  hvs_update_dlist(channel);
+  mutex_release(&channels[channel].lock);
+  print_stats();
+  return 0;
+}
+
+typedef struct {
+  uint32_t steps, tilemap_us, dlist_us, words, changed;
+} bench_totals;
+
+static void bench_step(bench_totals *t) {
+  mutex_acquire(&channels[channel].lock);
+  uint32_t start = *REG32(ST_CLO);
+  tilemap_update(&map);
+  uint32_t mid = *REG32(ST_CLO);
+  hvs_update_dlist(channel);
+  uint32_t end = *REG32(ST_CLO);
+  mutex_release(&channels[channel].lock);
+  t->steps++;
+  t->tilemap_us += mid - start;
+  t->dlist_us += end - mid;
+  t->words += tilemap_dlist_words(&map);
+  t->changed += map.stats.changed;
+}
+
+// the same walk around the map in each mode, right along the top, down the right, back left along the bottom
+// once by whole tiles like the game does, once by 2 pixels which leaves every tile partly clipped
+static int cmd_tilemap_bench(int argc, const console_cmd_args *argv) {
+  static const enum tilemap_mode modes[] = { TILEMAP_SPRITES, TILEMAP_SURFACE, TILEMAP_AUTO };
+  static const int steps[] = { TILE, 2 };
+  if (!check_map()) return ERR_NOT_READY;
+  const enum tilemap_mode old = map.mode;
+  const int limit = (MAP_SIZE - VIEW_TILES) * TILE;
+  puts("mode     step  steps  changed/step  words/step  tilemap us/step  dlist us/step");
+  for (unsigned int m=0; m < countof(modes); m++) {
+    for (unsigned int s=0; s < countof(steps); s++) {
+      const int step = steps[s];
+      bench_totals t = {};
+      map.mode = modes[m];
+      // settle at the start first, so the switch into this mode isnt counted
+      map.scroll_x = map.scroll_y = 0;
+      bench_step(&t);
+      t = (bench_totals){};
+      for (map.scroll_x = step; map.scroll_x <= limit; map.scroll_x += step) bench_step(&t);
+      map.scroll_x -= step;
+      for (map.scroll_y = step; map.scroll_y <= limit; map.scroll_y += step) bench_step(&t);
+      map.scroll_y -= step;
+      for (map.scroll_x -= step; map.scroll_x >= 0; map.scroll_x -= step) bench_step(&t);
+      printf("%-8s %4d  %5d  %12d  %10d  %15d  %13d\n", mode_names[modes[m]], step, t.steps,
+          t.changed / t.steps, t.words / t.steps, t.tilemap_us / t.steps, t.dlist_us / t.steps);
+    }
+  }
+  map.mode = old;
+  mutex_acquire(&channels[channel].lock);
+  redraw_map();
+  hvs_update_dlist(channel);
+  mutex_release(&channels[channel].lock);
+  return 0;
+}
+
 STATIC_COMMAND_START
 STATIC_COMMAND("up", "", cmd_move)
 STATIC_COMMAND("down", "", cmd_move)
 STATIC_COMMAND("left", "", cmd_move)
 STATIC_COMMAND("right", "", cmd_move)
+STATIC_COMMAND("scroll", "scroll the map by a pixel amount", cmd_scroll)
+STATIC_COMMAND("tilemap_mode", "show or force the tilemap mode, auto|sprites|surface", cmd_tilemap_mode)
+STATIC_COMMAND("tilemap_bench", "dlist words and update time per scroll step, in every mode", cmd_tilemap_bench)
 STATIC_COMMAND_END(game);
 
 static void game_entry(const struct app_descriptor *app, void *args) {
@@ -118,25 +204,19 @@ static void game_entry(const struct app_descriptor *app, void *args) {
   printf("%p\n", sprite_sheet);
   if (!sprite_sheet) return;
 
-  mutex_acquire(&channels[channel].lock);
-  for (int i=0; i<9; i++) {
-    for (int j=0; j<9; j++) {
-      init_tile(&tiles[i][j], i, j);
-    }
-  }
-
-  for (int i=0; i<9; i++) {
-    for (int j=0; j<9; j++) {
-      tile_set_sprite(&tiles[i][j], FLOOR);
-    }
-  }
-
   printf("%d levels at %p\n", level_count, map_data);
+  load_level(level);
 
+  mutex_acquire(&channels[channel].lock);
+  if (tilemap_init(&map, channel, sprite_sheet, TILE, TILE, map_tiles, MAP_SIZE, MAP_SIZE,
+                   50, 60, VIEW_TILES * TILE, VIEW_TILES * TILE, 60) != NO_ERROR) {
+    mutex_release(&channels[channel].lock);
+    return;
+  }
+  map_ready = true;
   redraw_map();
   hvs_update_dlist(channel);
   mutex_release(&channels[channel].lock);
-
 }
 
 APP_START(game)
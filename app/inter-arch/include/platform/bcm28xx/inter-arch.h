@@ -10,6 +10,21 @@ typedef struct {
 
 #define INTER_ARCH_MAGIC 0xa8ca6706
 
+// stage2 builds the dtb right where the arm finds it, at dtb_base past end_of_ram, and this is all the room it gets
+// the arm maps exactly this much, once
+#define INTER_ARCH_DTB_MAX (16 * 1024)
+
+// the nodes the arm looks for, the u32 "index" property of the root has the offset of each, in this order
+enum inter_arch_node {
+  INTER_ARCH_FRAMEBUFFER,
+  INTER_ARCH_TIMESTAMPS,
+  INTER_ARCH_OTP,
+  INTER_ARCH_BOOT_TRACE,
+  INTER_ARCH_NODES,
+};
+
+#define INTER_ARCH_NODE_NAMES { "framebuffer", "timestamps", "otp", "boot-trace" }
+
 extern uint32_t fb_addr;
 // width/height of framebuffer
 extern uint32_t w, h;
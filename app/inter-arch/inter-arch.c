@@ -6,6 +6,7 @@
 #include <libfdt.h>
 #include <lk/err.h>
 #include <lk/init.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/inter-arch.h>
 #include <stdint.h>
 
@@ -53,13 +54,27 @@ status_t display_get_framebuffer(struct display_framebuffer *fb) {
 }
 
 #define checkerr if (ret < 0) { printf("%s():%d error %d %s\n", __FUNCTION__, __LINE__, ret, fdt_strerror(ret)); return NULL; }
+
+static const char *const node_names[INTER_ARCH_NODES] = INTER_ARCH_NODE_NAMES;
+
+// the offset arm.c recorded in the root "index", checked against the name, the subnode lookup is only for a dtb without one
+static int find_node(const void *fdt, const fdt32_t *index, int index_len, enum inter_arch_node node) {
+  if (index && (index_len >= (int)((node + 1) * sizeof(fdt32_t)))) {
+    const int offset = fdt32_to_cpu(index[node]);
+    const char *name = fdt_get_name(fdt, offset, NULL);
+    if (name && (strcmp(name, node_names[node]) == 0)) return offset;
+  }
+  return fdt_subnode_offset(fdt, 0, node_names[node]);
+}
+
 static bool parse_dtb_from_vpu(void) {
   printf("hdr: %p\n", &hdr);
   printf("DTB should be at 0x%x\n", hdr.dtb_base);
   void *v_fdt = NULL;
+  // arm.c never makes it bigger than INTER_ARCH_DTB_MAX, so one mapping always covers it
 #if ARCH_HAS_MMU == 1
   status_t ret2 = vmm_alloc_physical(vmm_get_kernel_aspace(),
-      "dtb", PAGE_SIZE, &v_fdt, 0,
+      "dtb", ROUNDUP(INTER_ARCH_DTB_MAX, PAGE_SIZE), &v_fdt, 0,
       hdr.dtb_base, 0, 0);
   assert(ret2 == NO_ERROR);
 #else
@@ -70,48 +85,47 @@ static bool parse_dtb_from_vpu(void) {
   int ret = fdt_check_header(v_fdt);
   checkerr;
   uint32_t size = fdt_totalsize(v_fdt);
-#if ARCH_HAS_MMU == 1
-  if (size > PAGE_SIZE) { // need to remap with a larger size
-    vmm_free_region(vmm_get_kernel_aspace(), (vaddr_t)v_fdt);
-    ret2 = vmm_alloc_physical(vmm_get_kernel_aspace(),
-        "dtb", ROUNDUP(size, PAGE_SIZE), &v_fdt, 0,
-        hdr.dtb_base, 0, 0);
-    assert(ret2 == NO_ERROR);
-    printf("remapped 0x%x to %p\n", hdr.dtb_base, v_fdt);
-  }
-#endif
   printf("DTB size is %d\n", size);
+  if (size > INTER_ARCH_DTB_MAX) {
+    printf("DTB is over the %d byte budget\n", INTER_ARCH_DTB_MAX);
+    return false;
+  }
 
-  int depth = 0;
-  int offset = 0;
-  for (;;) {
-    offset = fdt_next_node(v_fdt, offset, &depth);
-    if (offset < 0) break;
-    const char *name = fdt_get_name(v_fdt, offset, NULL);
-    if (!name) continue;
-    printf("offset:%d depth:%d name:%s\n", offset, depth, name);
-    if (strcmp(name, "framebuffer") == 0) {
-      if (!fdt_getprop_u32(v_fdt, offset, "width", &w)) puts("err1");
-      if (!fdt_getprop_u32(v_fdt, offset, "height", &h)) puts("err2");
-      if (!fdt_getprop_u32(v_fdt, offset, "reg", &fb_addr)) puts("err3");
+  int index_len;
+  const fdt32_t *index = fdt_getprop(v_fdt, 0, "index", &index_len);
+  int offset;
+
+  if ((offset = find_node(v_fdt, index, index_len, INTER_ARCH_FRAMEBUFFER)) >= 0) {
+    if (!fdt_getprop_u32(v_fdt, offset, "width", &w)) puts("err1");
+    if (!fdt_getprop_u32(v_fdt, offset, "height", &h)) puts("err2");
+    if (!fdt_getprop_u32(v_fdt, offset, "reg", &fb_addr)) puts("err3");
 
 #if ARCH_HAS_MMU == 1
-      ret2 = vmm_alloc_physical(vmm_get_kernel_aspace(),
-          "framebuffer", ROUNDUP(w * h * 4, PAGE_SIZE), (void **)&fb_addr_virt, 0,
-          fb_addr, 0, 0);
-      assert(ret2 == NO_ERROR);
+    ret2 = vmm_alloc_physical(vmm_get_kernel_aspace(),
+        "framebuffer", ROUNDUP(w * h * 4, PAGE_SIZE), (void **)&fb_addr_virt, 0,
+        fb_addr, 0, 0);
+    assert(ret2 == NO_ERROR);
 #else
-      fb_addr_virt = fb_addr;
+    fb_addr_virt = fb_addr;
 #endif
-      printf("%d x %d @ 0x%x / 0x%lx\n", w, h, fb_addr, fb_addr_virt);
-    } else if (strcmp(name, "timestamps") == 0) {
-      if (!fdt_getprop_u32(v_fdt, offset, "3stage2_arch_init", &stage2_arch_init)) puts("err4");
-      if (!fdt_getprop_u32(v_fdt, offset, "4stage2_arm_start", &stage2_arm_start)) puts("err5");
-    } else if (strcmp(name, "otp") == 0) {
-      if (!fdt_getprop_u32(v_fdt, offset, "revision", &hw_revision)) puts("err6");
-      if (!fdt_getprop_u32(v_fdt, offset, "serial", &hw_serial)) puts("err7");
-    }
+    printf("%d x %d @ 0x%x / 0x%lx\n", w, h, fb_addr, fb_addr_virt);
+  }
+  if ((offset = find_node(v_fdt, index, index_len, INTER_ARCH_TIMESTAMPS)) >= 0) {
+    if (!fdt_getprop_u32(v_fdt, offset, "3stage2_arch_init", &stage2_arch_init)) puts("err4");
+    if (!fdt_getprop_u32(v_fdt, offset, "4stage2_arm_start", &stage2_arm_start)) puts("err5");
+  }
+  if ((offset = find_node(v_fdt, index, index_len, INTER_ARCH_OTP)) >= 0) {
+    if (!fdt_getprop_u32(v_fdt, offset, "revision", &hw_revision)) puts("err6");
+    if (!fdt_getprop_u32(v_fdt, offset, "serial", &hw_serial)) puts("err7");
+  }
+  int imported = 0;
+  if ((offset = find_node(v_fdt, index, index_len, INTER_ARCH_BOOT_TRACE)) >= 0) {
+    int len;
+    const void *ring = fdt_getprop(v_fdt, offset, "ring", &len);
+    if (ring) imported = boot_trace_import(ring, len);
+    if (imported < 0) puts("err8");
   }
+  boot_trace(BT_ARM_INTER_ARCH, (imported < 0) ? 0 : imported);
   return true;
 }
 
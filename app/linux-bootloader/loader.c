@@ -20,6 +20,7 @@
 #include <lk/init.h>
 #include <lk/trace.h>
 #include <platform.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/clock.h>
 #ifdef GFX
 #include <platform/bcm28xx/hvs.h>
@@ -305,7 +306,7 @@ static void try_to_boot(const char *device) {
   }
   if (false) {
     puts("running linux in 60 seconds");
-    udelay(60 * 1000 * 1000);
+    usleep(60 * 1000 * 1000);
   }
   thread_sleep(1000);
 #ifdef ARCH_ARM64
@@ -441,6 +442,7 @@ static void enable_kms(void *v_fdt) {
 static bool patch_dtb(uint32_t initrd_size) {
   int ret;
   void* v_fdt = dtb_virtual;
+  boot_trace(BT_ARM_LINUX_LOADED, initrd_size / 1024);
 
   ret = fdt_open_into(v_fdt, v_fdt, 16 * 1024);
   if (ret) {
@@ -535,8 +537,13 @@ static bool patch_dtb(uint32_t initrd_size) {
   } else {
     fdt_setprop_u32(v_fdt, ret, "3stage2_arch_init", stage2_arch_init);
     fdt_setprop_u32(v_fdt, ret, "4stage2_arm_start", stage2_arm_start);
+    const uint32_t linux_soon = *REG32(ST_CLO);
     fdt_setprop_u32(v_fdt, ret, "5arm_platform_init", platform_init_timestamp);
-    fdt_setprop_u32(v_fdt, ret, "6arm_linux_soon", *REG32(ST_CLO));
+    fdt_setprop_u32(v_fdt, ret, "6arm_linux_soon", linux_soon);
+    // the whole boot so far, boot-trace.py can decode /proc/device-tree/timestamps/boot-trace
+    boot_trace_at(linux_soon, BT_ARM_LINUX_SOON, 0);
+    const boot_trace_ring *ring = boot_trace_get();
+    fdt_setprop(v_fdt, ret, "boot-trace", ring, sizeof(*ring));
   }
   return true;
 }
@@ -0,0 +1,140 @@
+#include <lk/reg.h>
+#include <platform/bcm28xx/cm.h>
+#include <platform/bcm28xx/pll_read.h>
+#include <property_tags.h>
+
+// clock and voltage tags, as used by the linux clk-raspberrypi and cpufreq drivers
+
+// clock id's from include/soc/bcm2835/raspberrypi-firmware.h
+enum {
+  CLK_EMMC = 1,
+  CLK_UART = 2,
+  CLK_ARM = 3,
+  CLK_CORE = 4,
+  CLK_V3D = 5,
+  CLK_H264 = 6,
+  CLK_ISP = 7,
+  CLK_SDRAM = 8,
+  CLK_PIXEL = 9,
+  CLK_PWM = 10,
+  CLK_EMMC2 = 12,
+  CLK_MAX,
+};
+
+typedef struct {
+  uint8_t mux;    // measure_clock() input
+  uint32_t ctl;   // CM_*CTL, 0 if we can only measure it
+  uint32_t div;   // CM_*DIV
+} fw_clock_t;
+
+static const fw_clock_t fw_clocks[CLK_MAX] = {
+  [CLK_EMMC]  = { .mux = 39 },
+  [CLK_UART]  = { .mux = 28, .ctl = CM_UARTCTL, .div = CM_UARTDIV },
+  [CLK_ARM]   = { .mux = 7 },
+  [CLK_CORE]  = { .mux = 5,  .ctl = CM_VPUCTL,  .div = CM_VPUDIV },
+  [CLK_V3D]   = { .mux = 4 },
+  [CLK_H264]  = { .mux = 1 },
+  [CLK_ISP]   = { .mux = 2 },
+  [CLK_SDRAM] = { .mux = 3 },
+  [CLK_PIXEL] = { .mux = 17, .ctl = CM_DPICTL,  .div = CM_DPIDIV },
+  [CLK_PWM]   = { .mux = 24, .ctl = CM_PWMCTL,  .div = CM_PWMDIV },
+  [CLK_EMMC2] = { .mux = 42 },
+};
+
+// measure_clock() blocks for 1ms, so the last measurement is kept
+static uint32_t measured[CLK_MAX];
+
+static uint32_t clock_measure(uint32_t id) {
+  measured[id] = measure_clock(fw_clocks[id].mux);
+  return measured[id];
+}
+
+static uint32_t clock_rate(uint32_t id) {
+  const fw_clock_t *clk = &fw_clocks[id];
+  if (clk->ctl) return clk_get_freq(clk->div, clk->ctl);
+  if (measured[id] == 0) return clock_measure(id);
+  return measured[id];
+}
+
+static bool valid_clock(uint32_t id) {
+  return (id < CLK_MAX) && (fw_clocks[id].mux != 0);
+}
+
+static bool tag_clock_rate(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t id = value32[0];
+  uint32_t reply[2] = { id, 0 };
+  if (valid_clock(id)) reply[1] = clock_rate(id);
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+static bool tag_measured_clock_rate(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t id = value32[0];
+  uint32_t reply[2] = { id, 0 };
+  if (valid_clock(id)) reply[1] = clock_measure(id);
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+static bool tag_clock_state(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t id = value32[0];
+  // bit 1 set means the clock doesnt exist
+  uint32_t reply[2] = { id, 2 };
+  if (valid_clock(id)) reply[1] = clock_rate(id) ? 1 : 0;
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+PROPERTY_TAG_START(get_clock_state) // RPI_FIRMWARE_GET_CLOCK_STATE
+  .tag = 0x00030001,
+  .handler = tag_clock_state,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_clock_rate) // RPI_FIRMWARE_GET_CLOCK_RATE
+  .tag = 0x00030002,
+  .handler = tag_clock_rate,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+// nothing does dvfs yet, so min and max are whatever the clock is at now
+PROPERTY_TAG_START(get_max_clock_rate) // RPI_FIRMWARE_GET_MAX_CLOCK_RATE
+  .tag = 0x00030004,
+  .handler = tag_clock_rate,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_min_clock_rate) // RPI_FIRMWARE_GET_MIN_CLOCK_RATE
+  .tag = 0x00030007,
+  .handler = tag_clock_rate,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_measured_clock_rate) // RPI_FIRMWARE_GET_CLOCK_MEASURED
+  .tag = 0x00030047,
+  .handler = tag_measured_clock_rate,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+// nothing here knows what the regulators are at, so fail rather than make a voltage up
+static bool tag_voltage(struct tagged_packet *packet) {
+  return true;
+}
+
+PROPERTY_TAG_START(get_voltage) // RPI_FIRMWARE_GET_VOLTAGE
+  .tag = 0x00030003,
+  .handler = tag_voltage,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_max_voltage) // RPI_FIRMWARE_GET_MAX_VOLTAGE
+  .tag = 0x00030005,
+  .handler = tag_voltage,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_min_voltage) // RPI_FIRMWARE_GET_MIN_VOLTAGE
+  .tag = 0x00030008,
+  .handler = tag_voltage,
+PROPERTY_TAG_END
@@ -0,0 +1,62 @@
+#pragma once
+
+// plain attributes instead of lk/compiler.h, so property-fuzz can build property.c on the host
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tagged_packet {
+  uint32_t tag;
+  uint32_t value_size;
+  uint32_t req_resp;
+  uint8_t value[0];
+};
+
+/*
+ * returns false if the tag has been handled
+ */
+typedef bool (*property_tag_handler)(struct tagged_packet *packet);
+
+// any module can add entries to the property_tags section, the server sorts them into a dispatch table at init
+// if handler is NULL, reply/reply_len (in bytes) is sent as-is, for tags whose answer never changes
+// request_len is how many bytes of value the handler reads, a smaller value buffer fails the tag without calling it
+typedef struct {
+  uint32_t              tag;
+  const char           *name;
+  property_tag_handler  handler;
+  const uint32_t       *reply;
+  uint32_t              reply_len;
+  uint32_t              request_len;
+} property_tag_t;
+
+#define PROPERTY_TAG_START(tagname) const property_tag_t _property_tag_##tagname __attribute__((used, aligned(sizeof(void*)), section("property_tags"))) = { .name = #tagname,
+#define PROPERTY_TAG_END };
+
+typedef struct {
+  uint32_t tags;
+  uint32_t unsupported;
+  uint32_t last_unsupported;
+  // tags that ran past the message, or had a value buffer too small for their request
+  uint32_t malformed;
+} property_tag_stats;
+
+// sorts the tags from start to stop into the dispatch table, false if it cant be allocated
+bool property_table_init(const property_tag_t *start, const property_tag_t *stop);
+uint32_t property_tag_count(void);
+// in tag order, NULL past the end
+const property_tag_t *property_tag_at(uint32_t i);
+const property_tag_stats *property_get_stats(void);
+
+// copies a reply into the packet, truncated to the buffer the ARM gave us, and flags it as a response
+void property_reply(struct tagged_packet *packet, const uint32_t *value, uint32_t len);
+
+// parses one property message in place, returns true if any tag failed
+// message[0] is the size of the whole buffer in bytes, nothing past it is read or written
+bool handle_property_message(uint32_t *message);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,225 @@
+// host check of the property message parser in property.c
+// every message is malloced at exactly message[0] bytes, so with the sanitizers on any read or write past it aborts
+// usage: property-fuzz [iterations] [seed]
+
+#include <property_tags.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// stands in for the clock tags, reads the id and replies with two words
+static bool tag_echo(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t reply[2] = { value32[0], 0x1234 };
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+static bool tag_fail(struct tagged_packet *packet) {
+  return true;
+}
+
+static const uint32_t constant[] = { 1, 2, 3, 4 };
+
+// out of order on purpose, property_table_init sorts it
+static const property_tag_t tags[] = {
+  { .tag = 0x30002, .name = "echo", .handler = tag_echo, .request_len = 4 },
+  { .tag = 0x1, .name = "constant", .reply = constant, .reply_len = sizeof(constant) },
+  { .tag = 0x30003, .name = "fail", .handler = tag_fail },
+  { .tag = 0x10005, .name = "short", .reply = constant, .reply_len = 8 },
+};
+
+static uint32_t *message_alloc(uint32_t bytes) {
+  uint32_t *m = calloc(1, bytes ? bytes : 1);
+  if (!m) abort();
+  if (bytes >= 4) m[0] = bytes;
+  return m;
+}
+
+static void check_table(void) {
+  CHECK(property_tag_count() == 4);
+  for (uint32_t i = 1; i < property_tag_count(); i++) CHECK(property_tag_at(i-1)->tag < property_tag_at(i)->tag);
+  CHECK(property_tag_at(property_tag_count()) == NULL);
+}
+
+static void check_good(void) {
+  uint32_t *m = message_alloc(4 * 14);
+  m[2] = 0x30002; m[3] = 8; m[4] = 0; m[5] = 3;
+  m[7] = 0x1; m[8] = 16; m[9] = 0;
+  m[13] = 0;
+  CHECK(!handle_property_message(m));
+  CHECK(m[1] == 0x80000000);
+  CHECK(m[4] == (0x80000000 | 8));
+  CHECK((m[5] == 3) && (m[6] == 0x1234));
+  CHECK(m[9] == (0x80000000 | 16));
+  CHECK(memcmp(&m[10], constant, 12) == 0);
+  free(m);
+}
+
+static void check_truncated_reply(void) {
+  // a 4 byte buffer for a 16 byte reply, only 4 are copied and req_resp says how much there was
+  uint32_t *m = message_alloc(4 * 6);
+  m[2] = 0x1; m[3] = 4; m[4] = 0;
+  CHECK(!handle_property_message(m));
+  CHECK(m[4] == (0x80000000 | 16));
+  CHECK(m[5] == constant[0]);
+  free(m);
+}
+
+static void check_malformed(void) {
+  const property_tag_stats *stats = property_get_stats();
+  uint32_t *m;
+
+  // value_size that wraps the old (value_size + 3) / 4 to 0
+  m = message_alloc(4 * 5);
+  m[2] = 0x1; m[3] = 0xffffffff; m[4] = 0;
+  uint32_t before = stats->malformed;
+  CHECK(handle_property_message(m));
+  CHECK(m[1] == 0x80000001);
+  CHECK(stats->malformed == before + 1);
+  free(m);
+
+  // every value_size near the top of the range
+  for (uint32_t size = 0xfffffff0; size != 0; size++) {
+    m = message_alloc(4 * 8);
+    m[2] = 0x30002; m[3] = size;
+    CHECK(handle_property_message(m));
+    free(m);
+  }
+
+  // a value that runs a word past the end
+  m = message_alloc(4 * 6);
+  m[2] = 0x1; m[3] = 8;
+  CHECK(handle_property_message(m));
+  free(m);
+
+  // a header cut short, the tag word is the last one in the buffer
+  m = message_alloc(4 * 3);
+  m[2] = 0x1;
+  CHECK(handle_property_message(m));
+  free(m);
+
+  // a header cut short by 1 word
+  m = message_alloc(4 * 4);
+  m[2] = 0x1; m[3] = 0;
+  CHECK(handle_property_message(m));
+  free(m);
+
+  // a size that isnt a multiple of 4, the tail is never read
+  m = message_alloc(4 * 6);
+  m[0] = 4 * 5 + 3;
+  m[2] = 0x1; m[3] = 0; m[4] = 0;
+  CHECK(!handle_property_message(m));
+  free(m);
+
+  // too short for the request/response word, nothing past message[0] is touched
+  m = message_alloc(4);
+  CHECK(handle_property_message(m));
+  free(m);
+  m = message_alloc(4);
+  m[0] = 0;
+  CHECK(handle_property_message(m));
+  free(m);
+
+  // a handler tag with a value buffer too small for its request is failed without calling it
+  m = message_alloc(4 * 6);
+  m[2] = 0x30002; m[3] = 0; m[4] = 0; m[5] = 0;
+  before = stats->malformed;
+  CHECK(handle_property_message(m));
+  CHECK(m[4] == 0);
+  CHECK(stats->malformed == before + 1);
+  free(m);
+
+  // unknown tags fail and are counted, but the ones after them still run
+  m = message_alloc(4 * 12);
+  m[2] = 0xdead; m[3] = 0; m[4] = 0;
+  m[5] = 0x30002; m[6] = 8; m[7] = 0; m[8] = 9;
+  before = stats->unsupported;
+  CHECK(handle_property_message(m));
+  CHECK(stats->unsupported == before + 1);
+  CHECK(stats->last_unsupported == 0xdead);
+  CHECK(m[7] == (0x80000000 | 8));
+  free(m);
+}
+
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+  // xorshift32
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// mostly valid messages with the sizes and tags mutated, so the parser gets past the first tag
+static void fuzz(uint32_t iterations) {
+  static const uint32_t known[] = { 0x1, 0x10005, 0x30002, 0x30003, 0xdead, 0 };
+  for (uint32_t n = 0; n < iterations; n++) {
+    const uint32_t words = 2 + (rng() % 32);
+    uint32_t *m = message_alloc(words * 4);
+    for (uint32_t i = 1; i < words; i++) m[i] = rng();
+    for (uint32_t pos = 2; (pos + 3) <= words;) {
+      m[pos] = known[rng() % (sizeof(known) / sizeof(known[0]))];
+      switch (rng() % 4) {
+      case 0: m[pos+1] = rng(); break;
+      case 1: m[pos+1] = 0xffffffff - (rng() % 8); break;
+      default: m[pos+1] = (rng() % 6) * 4; break;
+      }
+      m[pos+2] = 0;
+      pos += 3 + (m[pos+1] / 4);
+    }
+    if (rng() % 8 == 0) m[0] = rng() % (words * 4 + 1);
+    const uint32_t len = m[0];
+    handle_property_message(m);
+    CHECK(m[0] == len);
+    free(m);
+  }
+}
+
+// a rough host number for a typical clock query, the vpu is a lot slower but scales the same
+static void latency(void) {
+  uint32_t *m = message_alloc(4 * 8);
+  const uint32_t rounds = 1000000;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < rounds; i++) {
+    m[2] = 0x30002; m[3] = 8; m[4] = 0; m[5] = 3; m[7] = 0;
+    handle_property_message(m);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double ns = ((end.tv_sec - start.tv_sec) * 1e9) + (end.tv_nsec - start.tv_nsec);
+  printf("%.1f nSec per 1 tag message\n", ns / rounds);
+  free(m);
+}
+
+int main(int argc, char **argv) {
+  const uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+  rng_state = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0x5eed;
+  if (rng_state == 0) rng_state = 1;
+
+  if (!property_table_init(&tags[0], &tags[sizeof(tags) / sizeof(tags[0])])) {
+    puts("no memory");
+    return 1;
+  }
+  check_table();
+  check_good();
+  check_truncated_reply();
+  check_malformed();
+  fuzz(iterations);
+  latency();
+
+  const property_tag_stats *stats = property_get_stats();
+  printf("tags: %u, unsupported: %u, malformed: %u\n", stats->tags, stats->unsupported, stats->malformed);
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  puts("all passed");
+  return 0;
+}
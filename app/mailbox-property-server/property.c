@@ -0,0 +1,111 @@
+#include <property_tags.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the message parsing and the tag table, libc only so property-fuzz can run it on the host
+// server.c does the mailbox side
+
+// the registered tags, sorted by tag so lookups can binary search
+static const property_tag_t **tag_table;
+static uint32_t tag_count;
+
+static property_tag_stats stats;
+
+bool property_table_init(const property_tag_t *start, const property_tag_t *stop) {
+  const uint32_t count = stop - start;
+  tag_count = 0;
+  tag_table = malloc(sizeof(property_tag_t*) * (count ? count : 1));
+  if (!tag_table) return false;
+  for (const property_tag_t *entry = start; entry != stop; entry++) {
+    // insertion sort, the table is small and only built once
+    uint32_t i = tag_count++;
+    while ((i > 0) && (tag_table[i-1]->tag > entry->tag)) {
+      tag_table[i] = tag_table[i-1];
+      i--;
+    }
+    tag_table[i] = entry;
+  }
+  return true;
+}
+
+uint32_t property_tag_count(void) {
+  return tag_count;
+}
+
+const property_tag_t *property_tag_at(uint32_t i) {
+  return (i < tag_count) ? tag_table[i] : NULL;
+}
+
+const property_tag_stats *property_get_stats(void) {
+  return &stats;
+}
+
+void property_reply(struct tagged_packet *packet, const uint32_t *value, uint32_t len) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t copy = len;
+  if (copy > packet->value_size) copy = packet->value_size;
+  if (value != value32) memcpy(value32, value, copy);
+  // the ARM side compares this against value_size to detect truncation
+  packet->req_resp = 0x80000000 | len;
+}
+
+static const property_tag_t *find_tag(uint32_t tag) {
+  uint32_t low = 0;
+  uint32_t high = tag_count;
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    const property_tag_t *entry = tag_table[mid];
+    if (entry->tag == tag) return entry;
+    if (entry->tag < tag) low = mid + 1;
+    else high = mid;
+  }
+  return NULL;
+}
+
+/*
+ * returns false if the tag has been handled
+ */
+static bool handle_property_tag(struct tagged_packet *packet) {
+  const property_tag_t *entry = find_tag(packet->tag);
+  if (entry) {
+    if (packet->value_size < entry->request_len) {
+      stats.malformed++;
+      return true;
+    }
+    if (entry->handler) return entry->handler(packet);
+    property_reply(packet, entry->reply, entry->reply_len);
+    return false;
+  }
+  stats.unsupported++;
+  stats.last_unsupported = packet->tag;
+  return true;
+}
+
+bool handle_property_message(uint32_t *message) {
+  const uint32_t words = message[0] / 4;
+  // too short to even hold the request/response word
+  if (words < 2) return true;
+  bool error = false;
+  for (uint32_t position = 2; position < words;) {
+    struct tagged_packet *packet = (struct tagged_packet *)&message[position];
+    if (packet->tag == 0) break;
+    // a header or value running off the end of the buffer means the message is malformed
+    if ((words - position) < 3) {
+      stats.malformed++;
+      error = true;
+      break;
+    }
+    // value_size is rounded up without adding to it, so a huge one cant wrap around
+    const uint32_t value_words = (packet->value_size / 4) + ((packet->value_size & 3) ? 1 : 0);
+    if (value_words > (words - position - 3)) {
+      stats.malformed++;
+      error = true;
+      break;
+    }
+    position += 3 + value_words;
+    error |= handle_property_tag(packet);
+    stats.tags++;
+  }
+  message[1] = error ? 0x80000001 : 0x80000000;
+  return error;
+}
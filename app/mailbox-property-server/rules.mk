@@ -2,7 +2,10 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
-MODULE_SRCS += $(LOCAL_DIR)/server.c
+MODULE_SRCS += \
+	$(LOCAL_DIR)/clocks.c \
+	$(LOCAL_DIR)/property.c \
+	$(LOCAL_DIR)/server.c \
 
 MODULES += platform/bcm28xx/mailbox
 
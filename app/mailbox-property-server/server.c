@@ -1,18 +1,37 @@
 #include <app.h>
+#include <lk/console_cmd.h>
+#include <lk/reg.h>
+#include <lk/trace.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/mailbox.h>
+#include <platform/bcm28xx/udelay.h>
+#include <property_tags.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct tagged_packet {
-  uint32_t tag;
-  uint32_t value_size;
-  uint32_t req_resp;
-  uint8_t value[0];
-};
+#define LOCAL_TRACE 0
 
-static void property_init(const struct app_descriptor *app) {
-  mailbox_init();
-}
+// how many mailbox words to pull out of the fifo per wakeup
+#define MAX_BATCH 16
+
+extern const property_tag_t __start_property_tags __WEAK;
+extern const property_tag_t __stop_property_tags __WEAK;
+
+static int cmd_property_stats(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("property_stats", "show mailbox property server stats", &cmd_property_stats)
+STATIC_COMMAND_END(property_server);
+
+static struct {
+  uint32_t messages;
+  uint32_t wakeups;
+  uint32_t max_batch;
+  uint32_t total_usec;
+  uint32_t max_usec;
+} stats;
+
+static uint32_t firmware_hash[5];
 
 static uint32_t hash_chunk(const char *str, int offset) {
   char buffer[9];
@@ -21,106 +40,118 @@ static uint32_t hash_chunk(const char *str, int offset) {
   return strtoll(buffer, NULL, 16);
 }
 
-/*
- * returns false if the tag has been handled
- */
-bool handle_property_tag(struct tagged_packet *packet) {
-  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
-  switch (packet->tag) {
-    case 0x1: // RPI_FIRMWARE_GET_FIRMWARE_REVISION
-      // 32bit unix timestamp of the build, not 2038 safe
-      value32[0] = 1691978865;
-      packet->req_resp = 0x80000000 | 4;
-      return false;
-    case 0x2: // RPI_FIRMWARE_GET_FIRMWARE_VARIANT
-      // enum for unknown/start/start_x/start_db/start_cd
-      value32[0] = 0;
-      packet->req_resp = 0x80000000 | 4;
-      return false;
-    case 0x3: // RPI_FIRMWARE_GET_FIRMWARE_HASH
-    {
-      struct { uint32_t a; uint32_t b; uint32_t c; uint32_t d; uint32_t e; } hash;
-      const char *str = GIT_HASH;
-      hash.a = hash_chunk(str, 0);
-      hash.b = hash_chunk(str, 1);
-      hash.c = hash_chunk(str, 2);
-      hash.d = hash_chunk(str, 3);
-      hash.e = hash_chunk(str, 4);
-      // TODO, truncate the written reply to fit within packet->value_size
-      value32[0] = hash.a;
-      value32[1] = hash.b;
-      value32[2] = hash.c;
-      value32[3] = hash.d;
-      value32[4] = hash.e;
-      packet->req_resp = 0x80000000 | 20;
-      return false;
-    }
-    case 0x00010005: // get arm mem
-      value32[0] = 0;
-      value32[1] = 64 * 1024 * 1024;
-      packet->req_resp = 0x80000000 | 8;
-      return false;
-    case 0x00010007: // RPI_FIRMWARE_GET_CLOCKS
-      return true;
-    case 0x00030046: // RPI_FIRMWARE_GET_THROTTLED
-      return true;
-    case 0x00030048: //RPI_FIRMWARE_NOTIFY_REBOOT
-      return true;
-    case 0x00030066: // RPI_FIRMWARE_NOTIFY_DISPLAY_DONE
-      // used by kms driver, to tell firmware 2d to stop
-      return true;
+static void property_init(const struct app_descriptor *app) {
+  const char *str = GIT_HASH;
+  for (int i=0; i<5; i++) firmware_hash[i] = hash_chunk(str, i);
+  if (!property_table_init(&__start_property_tags, &__stop_property_tags)) {
+    puts("no memory for the property tag table");
+    return;
   }
-  printf("unsupported tag: 0x%x\n", packet->tag);
-  return true;
+  LTRACEF("%d property tags registered\n", property_tag_count());
+  mailbox_init();
 }
 
-void handle_property_message(uint32_t *message) {
-#if 0
-  printf("length: %d\n", message[0]);
-  printf("full message as uint32's\n");
-  for (uint i=0; i < (message[0]/4); i++) {
-    printf("%d: 0x%08x\n", i, message[i]);
-  }
-  printf("req/resp: 0x%08x\n", message[1]);
-#endif
-  bool error = false;
-  for (uint position = 2; position < (message[0] / 4);) {
-    int start = position;
-    struct tagged_packet *packet = (struct tagged_packet *)&message[position];
-    if (packet->tag == 0) break;
-    position += 3; // the header
-    position += (packet->value_size+3)/4;
-    //position += 4 - (packet->value_size % 4); // padding to align
-    bool ret = handle_property_tag(packet);
-    if (ret) {
-      printf("offset %d, tag 0x%x, size: %d, req/resp 0x%x\n", start, packet->tag, packet->value_size, packet->req_resp);
-      for (uint i=start; i < position; i++) {
-        printf("%d: 0x%08x\n", i, message[i]);
+static void property_entry(const struct app_descriptor *app, void *args) {
+  uint32_t batch[MAX_BATCH];
+  uint32_t replies[MAX_BATCH];
+  puts("waiting for property requests");
+  while (true) {
+    size_t count = mailbox_fifo_pop_all(batch, MAX_BATCH);
+    uint32_t start = *REG32(ST_CLO);
+    uint reply_count = 0;
+    for (size_t i=0; i<count; i++) {
+      uint32_t msg = batch[i];
+      //printf("got prop request 0x%x\n", msg);
+      switch (msg & 0xf) {
+      case 8: // property tags
+        handle_property_message((uint32_t*)(msg & ~0xf));
+        replies[reply_count++] = (msg & ~0xf) | 8;
+        stats.messages++;
+        break;
+      default:
+        printf("unsupported mailbox channel %d\n", msg & 0xf);
       }
     }
-    error |= ret;
-  }
-  if (error) message[1] = 0x80000001;
-  else message[1] = 0x80000000;
+    // all replies go out back to back, so the ARM sees one burst of irqs
+    for (uint i=0; i<reply_count; i++) mailbox_send(replies[i]);
 
-  mailbox_send((uint32_t)message | 8);
+    uint32_t spent = *REG32(ST_CLO) - start;
+    stats.wakeups++;
+    stats.total_usec += spent;
+    if (spent > stats.max_usec) stats.max_usec = spent;
+    if (count > stats.max_batch) stats.max_batch = count;
+  }
 }
 
-static void property_entry(const struct app_descriptor *app, void *args) {
-  puts("waiting for property requests");
-  while (true) {
-    uint32_t msg = mailbox_fifo_pop();
-    //printf("got prop request 0x%x\n", msg);
-    switch (msg & 0xf) {
-    case 8: // property tags
-      handle_property_message((uint32_t*)(msg & ~0xf));
-      break;
-    default:
-      printf("unsupported mailbox channel %d\n", msg & 0xf);
-    }
+static int cmd_property_stats(int argc, const console_cmd_args *argv) {
+  const property_tag_stats *tags = property_get_stats();
+  printf("%d tags registered\n", property_tag_count());
+  for (uint i=0; i<property_tag_count(); i++) {
+    const property_tag_t *entry = property_tag_at(i);
+    printf("  0x%08x %s\n", entry->tag, entry->name);
   }
+  printf("messages: %d, tags: %d, unsupported: %d (last 0x%x), malformed: %d\n", stats.messages, tags->tags, tags->unsupported, tags->last_unsupported, tags->malformed);
+  printf("wakeups: %d, largest batch: %d\n", stats.wakeups, stats.max_batch);
+  if (stats.wakeups) printf("latency: avg %duSec, max %duSec\n", stats.total_usec / stats.wakeups, stats.max_usec);
+  return 0;
+}
+
+// tags linux asks about that we dont implement yet, reply with an error but dont log them
+static bool tag_unimplemented(struct tagged_packet *packet) {
+  return true;
 }
 
+// 32bit unix timestamp of the build, not 2038 safe
+static const uint32_t firmware_revision[] = { 1691978865 };
+PROPERTY_TAG_START(firmware_revision) // RPI_FIRMWARE_GET_FIRMWARE_REVISION
+  .tag = 0x1,
+  .reply = firmware_revision,
+  .reply_len = sizeof(firmware_revision),
+PROPERTY_TAG_END
+
+// enum for unknown/start/start_x/start_db/start_cd
+static const uint32_t firmware_variant[] = { 0 };
+PROPERTY_TAG_START(firmware_variant) // RPI_FIRMWARE_GET_FIRMWARE_VARIANT
+  .tag = 0x2,
+  .reply = firmware_variant,
+  .reply_len = sizeof(firmware_variant),
+PROPERTY_TAG_END
+
+// filled in once by property_init
+PROPERTY_TAG_START(firmware_hash) // RPI_FIRMWARE_GET_FIRMWARE_HASH
+  .tag = 0x3,
+  .reply = firmware_hash,
+  .reply_len = sizeof(firmware_hash),
+PROPERTY_TAG_END
+
+static const uint32_t arm_memory[] = { 0, 64 * 1024 * 1024 };
+PROPERTY_TAG_START(arm_memory) // RPI_FIRMWARE_GET_ARM_MEMORY
+  .tag = 0x00010005,
+  .reply = arm_memory,
+  .reply_len = sizeof(arm_memory),
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_clocks) // RPI_FIRMWARE_GET_CLOCKS
+  .tag = 0x00010007,
+  .handler = tag_unimplemented,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_throttled) // RPI_FIRMWARE_GET_THROTTLED
+  .tag = 0x00030046,
+  .handler = tag_unimplemented,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(notify_reboot) // RPI_FIRMWARE_NOTIFY_REBOOT
+  .tag = 0x00030048,
+  .handler = tag_unimplemented,
+PROPERTY_TAG_END
+
+// used by kms driver, to tell firmware 2d to stop
+PROPERTY_TAG_START(notify_display_done) // RPI_FIRMWARE_NOTIFY_DISPLAY_DONE
+  .tag = 0x00030066,
+  .handler = tag_unimplemented,
+PROPERTY_TAG_END
+
 APP_START(properties)
   .init = property_init,
   .entry = property_entry,
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <lib/fs.h>
 #include <lib/elf.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/print_timestamp.h>
 #include <stdio.h>
 #include <arch.h>
@@ -37,6 +38,7 @@ void try_sd_boot(const char *device) {
   }
   void *entry = load_and_run_elf(stage2_elf);
   fs_close_file(stage2);
+  boot_trace_handoff();
   arch_chain_load(entry, 0, 0, 0, 0);
   return;
   closefile:
@@ -6,6 +6,7 @@
 #include <lwip/dhcp.h>
 #include <lwip/netif.h>
 #include <net-utils.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/time.h>
 
 #ifdef WITH_LIB_CKSUM_HELPER
@@ -136,6 +137,7 @@ void try_to_netboot(void) {
   void *entry = load_and_run_elf(stage2_elf);
   free(buffer);
   if (false) {
+    boot_trace_handoff();
     arch_chain_load(entry, 0, 0, 0, 0);
   }
   return;
@@ -4,6 +4,7 @@
 #include <lib/hexdump.h>
 #include <arch.h>
 #include <lib/heap.h>
+#include <platform/bcm28xx/boot_trace.h>
 
 #include "stage1.h"
 
@@ -28,6 +29,7 @@ void try_to_spi_boot(void) {
   void *entry = load_and_run_elf(stage2_elf);
   free(buffer);
   if (true) {
+    boot_trace_handoff();
     arch_chain_load(entry, 0, 0, 0, 0);
   }
 }
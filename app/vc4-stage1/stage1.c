@@ -10,6 +10,7 @@
 #include <lk/list.h>
 #include <lk/reg.h>
 #include <platform.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/pll_read.h>
 #include <platform/bcm28xx/power.h>
 #include <platform/bcm28xx/print_timestamp.h>
@@ -68,9 +69,14 @@ void *load_and_run_elf(elf_handle_t *stage2_elf) {
     printf("failed to load elf: %d\n", ret);
     return NULL;
   }
+  for (int i = 0; i < stage2_elf->eheader.e_phnum; i++) {
+    const struct Elf32_Phdr *ph = &stage2_elf->pheaders[i];
+    if (ph->p_type == PT_LOAD) boot_trace_handoff_check(ph->p_vaddr, ph->p_memsz);
+  }
   elf_close_handle(stage2_elf);
   void *entry = (void*)stage2_elf->entry;
   free(stage2_elf);
+  boot_trace(BT_STAGE1_ELF_LOADED, 0);
   return entry;
 }
 
@@ -175,6 +181,8 @@ static int chainload(lua_State *L) {
 #endif
 
 static void try_to_boot(const char *device) {
+  static uint16_t tried = 0;
+  boot_trace(BT_STAGE1_TRY_TARGET, tried++);
 
 #ifdef WITH_LIB_LWIP
   if (strcmp(device, "network") == 0) {
@@ -205,39 +213,73 @@ void add_boot_target(const char *device) {
   mutex_release(&pending_device_lock);
 }
 
-static void stage1_entry(const struct app_descriptor *app, void *args) {
-  int ret;
-  puts("stage1 entry\n");
-  // sdhost initializes in a blocking mode before threads are ran, so will be available immediately if detected
-  // usb initiailizes in a thread and wont show up until stage1_msd_probed() gets called
-  add_boot_target("sdhostp1");
-
-#ifdef WITH_DEV_SPI
-  add_boot_target("spi");
-#endif
-
 #ifdef WITH_LIB_LUA
-  lua_State *L = lua_newstate(&lua_allocator, NULL);
+static int script_targets = 0;
+
+static int lua_add_boot_target(lua_State *L) {
+  const char *device = lua_tostring(L, 1);
+  if (!device) return 0;
+  // the lua string is freed along with the state, long before the target is tried
+  add_boot_target(strdup(device));
+  script_targets++;
+  return 0;
+}
+
+// returns how many boot targets the script added
+static int run_boot_script(void) {
+  int ret;
+  lua_pool_t *pool = lua_pool_create();
+  lua_State *L = lua_newstate(&lua_pool_allocator, pool);
   register_globals(L);
+  lua_register(L, "add_boot_target", &lua_add_boot_target);
 
-  luaL_loadstring(L, "print(5+5)");
-  ret = lua_pcall(L, 0, LUA_MULTRET, 0);
-  printf("lua_pcall == %d\n", ret);
-  if (ret == LUA_ERRRUN) {
-    lua_prettyprint(L, -1);
+  lk_bigtime_t start = current_time_hires();
+  // the output of lib/lua's host luac skips the parser entirely
+  ret = luaL_loadfile(L, "/root/init.luac");
+  if (ret) {
+    lua_pop(L, 1);
+    ret = luaL_loadfile(L, "/root/init.lua");
   }
-
-  luaL_loadfile(L, "/root/init.lua");
-
-  ret = lua_pcall(L, 0, LUA_MULTRET, 0);
-  printf("lua_pcall == %d\n", ret);
-  if (ret == LUA_ERRRUN) {
+  lk_bigtime_t loaded = current_time_hires();
+  if (ret) {
     lua_prettyprint(L, -1);
+  } else {
+    ret = lua_pcall(L, 0, 0, 0);
+    printf("lua_pcall == %d\n", ret);
+    if (ret == LUA_ERRRUN) {
+      lua_prettyprint(L, -1);
+    }
+    logf("init script: load %d uSec, exec %d uSec\n", (uint32_t)(loaded - start), (uint32_t)(current_time_hires() - loaded));
   }
+  // what the script left live, before lua_close() frees it
+  lua_pool_dump(pool);
 
   lua_close(L); L=NULL;
+  lua_pool_destroy(pool);
+  boot_trace(BT_STAGE1_SCRIPT_DONE, script_targets);
+  return script_targets;
+}
 #endif
 
+static void stage1_entry(const struct app_descriptor *app, void *args) {
+  int ret;
+  puts("stage1 entry\n");
+  boot_trace(BT_STAGE1_START, 0);
+
+#ifdef WITH_LIB_LUA
+  // if the script picks the boot targets, it replaces the defaults below
+  if (run_boot_script() == 0)
+#endif
+  {
+    // sdhost initializes in a blocking mode before threads are ran, so will be available immediately if detected
+    // usb initiailizes in a thread and wont show up until stage1_msd_probed() gets called
+    add_boot_target("sdhostp1");
+
+#ifdef WITH_DEV_SPI
+    add_boot_target("spi");
+#endif
+  }
+
   while (true) {
     event_wait(&pending_devices_nonempty);
 
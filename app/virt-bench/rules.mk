@@ -0,0 +1,27 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_DEPS += \
+	lib/bio \
+	lib/cksum-helper \
+	lib/fs \
+	lib/fs/ext2 \
+	lib/mincrypt \
+
+MODULE_SRCS += $(LOCAL_DIR)/virt-bench.c
+
+# 1 runs all of them at boot, then shuts the emulator down
+VIRT_BENCH_AUTORUN ?= 0
+# how much each one moves, kept small since the emulator interprets every instruction
+VIRT_BENCH_SEQ_BYTES ?= 0x1000000
+VIRT_BENCH_RANDOM_OPS ?= 2000
+VIRT_BENCH_FS_BYTES ?= 0x1000000
+VIRT_BENCH_MAX_DEPTH ?= 8
+VIRT_BENCH_HASH_BYTES ?= 0x400000
+VIRT_BENCH_NET_PACKETS ?= 10000
+
+MODULE_DEFINES += VIRT_BENCH_AUTORUN=$(VIRT_BENCH_AUTORUN) VIRT_BENCH_SEQ_BYTES=$(VIRT_BENCH_SEQ_BYTES) VIRT_BENCH_RANDOM_OPS=$(VIRT_BENCH_RANDOM_OPS) VIRT_BENCH_FS_BYTES=$(VIRT_BENCH_FS_BYTES)
+MODULE_DEFINES += VIRT_BENCH_MAX_DEPTH=$(VIRT_BENCH_MAX_DEPTH) VIRT_BENCH_HASH_BYTES=$(VIRT_BENCH_HASH_BYTES) VIRT_BENCH_NET_PACKETS=$(VIRT_BENCH_NET_PACKETS)
+
+include make/module.mk
@@ -0,0 +1,272 @@
+#include <app.h>
+#include <cksum-helper/cksum-helper.h>
+#include <lib/bio.h>
+#include <lib/fs.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_LIB_MINIP
+#include <lib/minip.h>
+#endif
+
+// benchmarks for the virtio devices on the emulator targets
+// each result is one `bench <name>:` line, so a ci run can grep them out and compare them between commits
+// virt_bench runs them by hand, VIRT_BENCH_AUTORUN=1 runs all of them at boot and shuts down
+
+#define CHUNK (64 * 1024)
+// the block device the blk and fs benchmarks use by default, the first virtio-blk slot
+#define VIRT_BENCH_DEVICE "virtio0"
+#define MOUNT_POINT "/bench"
+
+static int cmd_virt_bench(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("virt_bench", "virtio benchmarks, `virt_bench [all|blk|fs|hash|net <a.b.c.d> [port]] [device]`", &cmd_virt_bench)
+STATIC_COMMAND_END(virt_bench);
+
+// MB/s to 2 places and ops/s, from integers
+static void report(const char *name, uint64_t bytes, uint64_t ops, lk_bigtime_t us) {
+  if (us == 0) us = 1;
+  const uint64_t centi_mbps = ((bytes * 100 * 1000000) / us) >> 20;
+  const uint64_t ops_per_sec = (ops * 1000000) / us;
+  printf("bench %s: %llu bytes, %llu ops in %llu uSec, %llu.%02llu MB/s, %llu ops/s\n", name,
+      bytes, ops, (uint64_t)us, centi_mbps / 100, centi_mbps % 100, ops_per_sec);
+}
+
+// an lcg, so every run reads the same blocks
+static uint32_t next_random(uint32_t *state) {
+  *state = (*state * 1103515245) + 12345;
+  return *state >> 8;
+}
+
+static int bench_blk(const char *device) {
+  bdev_t *dev = bio_open(device);
+  if (!dev) {
+    printf("cant open %s\n", device);
+    return ERR_NOT_FOUND;
+  }
+  uint8_t *buf = malloc(CHUNK);
+  if (!buf) {
+    bio_close(dev);
+    return ERR_NO_MEMORY;
+  }
+  int ret = 0;
+
+  const off_t seq_len = (dev->total_size < VIRT_BENCH_SEQ_BYTES) ? dev->total_size : VIRT_BENCH_SEQ_BYTES;
+  uint64_t ops = 0;
+  lk_bigtime_t start = current_time_hires();
+  for (off_t off = 0; off < seq_len; off += CHUNK) {
+    const size_t len = ((seq_len - off) < CHUNK) ? (seq_len - off) : CHUNK;
+    if (bio_read(dev, buf, off, len) < 0) {
+      printf("read at 0x%llx failed\n", (uint64_t)off);
+      ret = ERR_IO;
+      goto done;
+    }
+    ops++;
+  }
+  report("blk-seq-read", seq_len, ops, current_time_hires() - start);
+
+  // single block reads scattered over the whole device, what a filesystem walk looks like to the device
+  const uint32_t blocks = dev->block_count;
+  uint32_t state = 1;
+  start = current_time_hires();
+  for (ops = 0; ops < VIRT_BENCH_RANDOM_OPS; ops++) {
+    const uint32_t block = next_random(&state) % blocks;
+    if (bio_read_block(dev, buf, block, 1) < 0) {
+      printf("read of block %u failed\n", block);
+      ret = ERR_IO;
+      goto done;
+    }
+  }
+  report("blk-random-read", (uint64_t)ops * dev->block_size, ops, current_time_hires() - start);
+
+done:
+  free(buf);
+  bio_close(dev);
+  return ret;
+}
+
+typedef struct {
+  uint8_t *buf;
+  uint64_t bytes;
+  uint64_t files;
+  uint64_t dirs;
+  // every byte read also goes through this, if it is set
+  const hash_algo_implementation *algo;
+  void *ctx;
+} walk_state;
+
+static int walk_file(walk_state *w, filehandle *fh) {
+  int ret;
+  off_t offset = 0;
+  while ((ret = fs_read_file(fh, w->buf, offset, CHUNK)) > 0) {
+    if (w->algo) w->algo->update(w->ctx, w->buf, ret);
+    offset += ret;
+  }
+  w->bytes += offset;
+  w->files++;
+  return ret;
+}
+
+// every file under path read once, depth first
+static int walk(walk_state *w, const char *path, int depth) {
+  dirhandle *dh;
+  int ret = fs_open_dir(path, &dh);
+  if (ret) return ret;
+  w->dirs++;
+  struct dirent *ent = malloc(sizeof(*ent));
+  char *child = malloc(FS_MAX_PATH_LEN);
+  while (fs_read_dir(dh, ent) >= 0) {
+    if ((strcmp(ent->name, ".") == 0) || (strcmp(ent->name, "..") == 0)) continue;
+    snprintf(child, FS_MAX_PATH_LEN, "%s/%s", path, ent->name);
+    filehandle *fh;
+    if (fs_open_file(child, &fh)) continue;
+    struct file_stat stat;
+    ret = fs_stat_file(fh, &stat);
+    if ((ret == 0) && !stat.is_dir) walk_file(w, fh);
+    fs_close_file(fh);
+    if ((ret == 0) && stat.is_dir && (depth < VIRT_BENCH_MAX_DEPTH)) walk(w, child, depth + 1);
+    if (w->bytes >= VIRT_BENCH_FS_BYTES) break;
+  }
+  free(child);
+  free(ent);
+  fs_close_dir(dh);
+  return 0;
+}
+
+// algo is NULL for a plain read, else every byte is hashed the way verify_hashes() does it
+static int bench_fs(const char *device, const hash_algo_implementation *algo) {
+  int ret = fs_mount(MOUNT_POINT, "ext2", device);
+  if (ret) {
+    printf("cant mount %s as ext2: %d\n", device, ret);
+    return ret;
+  }
+  walk_state w = { .buf = malloc(CHUNK), .algo = algo };
+  if (algo) {
+    w.ctx = malloc(algo->context_size);
+    algo->init(w.ctx);
+  }
+  lk_bigtime_t start = current_time_hires();
+  walk(&w, MOUNT_POINT, 0);
+  if (algo) algo->finalize(w.ctx);
+  const lk_bigtime_t us = current_time_hires() - start;
+  // ops are files opened and read to the end, directories count as one each
+  report(algo ? "ext2-read-hash" : "ext2-read", w.bytes, w.files + w.dirs, us);
+  free(w.ctx);
+  free(w.buf);
+  fs_unmount(MOUNT_POINT);
+  return 0;
+}
+
+#ifdef WITH_LIB_MINCRYPT
+// just the hash over ram, to split the hash cost out of ext2-read-hash
+static int bench_hash(const hash_algo_implementation *algo) {
+  uint8_t *buf = malloc(CHUNK);
+  void *ctx = malloc(algo->context_size);
+  for (int i = 0; i < CHUNK; i++) buf[i] = i;
+  algo->init(ctx);
+  const uint32_t rounds = VIRT_BENCH_HASH_BYTES / CHUNK;
+  lk_bigtime_t start = current_time_hires();
+  for (uint32_t i = 0; i < rounds; i++) algo->update(ctx, buf, CHUNK);
+  algo->finalize(ctx);
+  report("sha256", (uint64_t)rounds * CHUNK, rounds, current_time_hires() - start);
+  free(ctx);
+  free(buf);
+  return 0;
+}
+#endif
+
+#if WITH_LIB_MINIP
+static bool parse_ip(const char *str, uint32_t *ip) {
+  unsigned int a, b, c, d;
+  if (sscanf(str, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) return false;
+  *ip = IPV4(a, b, c, d);
+  return true;
+}
+
+// udp to a sink on the host, like `nc -lu 5001 > /dev/null`
+static int bench_net(uint32_t host, uint16_t port) {
+  udp_socket_t *sock;
+  status_t ret = udp_open(host, port, port, &sock);
+  if (ret) {
+    printf("udp_open failed: %d\n", ret);
+    return ret;
+  }
+  const size_t len = 1024;
+  uint8_t *buf = calloc(1, len);
+  uint64_t ops;
+  lk_bigtime_t start = current_time_hires();
+  for (ops = 0; ops < VIRT_BENCH_NET_PACKETS; ops++) {
+    ret = udp_send(buf, len, sock);
+    if (ret < 0) {
+      printf("udp_send failed: %d\n", ret);
+      break;
+    }
+  }
+  report("udp-tx", ops * len, ops, current_time_hires() - start);
+  free(buf);
+  udp_close(sock);
+  return ret < 0 ? ret : 0;
+}
+#endif
+
+static void bench_all(const char *device) {
+  bench_blk(device);
+  bench_fs(device, NULL);
+#ifdef WITH_LIB_MINCRYPT
+  bench_fs(device, &sha256_implementation);
+  bench_hash(&sha256_implementation);
+#endif
+}
+
+static int cmd_virt_bench(int argc, const console_cmd_args *argv) {
+  const char *what = (argc >= 2) ? argv[1].str : "all";
+  if (strcmp(what, "net") == 0) {
+#if WITH_LIB_MINIP
+    uint32_t host;
+    if ((argc < 3) || !parse_ip(argv[2].str, &host)) {
+      printf("usage: %s net <a.b.c.d> [port]\n", argv[0].str);
+      return -1;
+    }
+    return bench_net(host, (argc >= 4) ? argv[3].u : 5001);
+#else
+    puts("built without minip");
+    return -1;
+#endif
+  }
+  const char *device = (argc >= 3) ? argv[2].str : VIRT_BENCH_DEVICE;
+  if (strcmp(what, "all") == 0) {
+    bench_all(device);
+    return 0;
+  } else if (strcmp(what, "blk") == 0) {
+    return bench_blk(device);
+  } else if (strcmp(what, "fs") == 0) {
+    return bench_fs(device, NULL);
+#ifdef WITH_LIB_MINCRYPT
+  } else if (strcmp(what, "hash") == 0) {
+    bench_hash(&sha256_implementation);
+    return bench_fs(device, &sha256_implementation);
+#endif
+  }
+  printf("usage: %s [all|blk|fs|hash|net <a.b.c.d> [port]] [device]\n", argv[0].str);
+  return -1;
+}
+
+#if VIRT_BENCH_AUTORUN
+static void virt_bench_entry(const struct app_descriptor *app, void *args) {
+  bench_all(VIRT_BENCH_DEVICE);
+  platform_halt(HALT_ACTION_SHUTDOWN, HALT_REASON_UNKNOWN);
+}
+#endif
+
+APP_START(virt_bench)
+#if VIRT_BENCH_AUTORUN
+  .entry = virt_bench_entry,
+  .flags = APP_FLAG_CUSTOM_STACK_SIZE,
+  .stack_size = 16 * 1024,
+#endif
+APP_END
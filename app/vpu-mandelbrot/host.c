@@ -0,0 +1,33 @@
+// renders one frame with the C reference on the host
+// usage: ./mandel-ref ustart vstart delta [out.ppm], with the numbers mandel_verify prints on the device
+
+#include "mandel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WIDTH 640
+#define HEIGHT 480
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s ustart vstart delta [out.ppm]\n", argv[0]);
+    return 1;
+  }
+  uint32_t ustart = strtoul(argv[1], NULL, 0);
+  uint32_t vstart = strtoul(argv[2], NULL, 0);
+  uint32_t delta = strtoul(argv[3], NULL, 0);
+  uint32_t *image = malloc(WIDTH * HEIGHT * 4);
+  mandel_ref(image, WIDTH, ustart, vstart, delta, WIDTH, HEIGHT);
+  printf("checksum 0x%08x\n", mandel_checksum(image, WIDTH, WIDTH, HEIGHT));
+  if (argc > 4) {
+    FILE *fp = fopen(argv[4], "wb");
+    fprintf(fp, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+      uint8_t rgb[3] = { (image[i] >> 16) & 0xff, (image[i] >> 8) & 0xff, image[i] & 0xff };
+      fwrite(rgb, 3, 1, fp);
+    }
+    fclose(fp);
+  }
+  free(image);
+  return 0;
+}
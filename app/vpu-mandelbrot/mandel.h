@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// fixed point format shared by core.S and the reference, 10.22
+#define SHIFT (22u)
+#define MUL (1 << SHIFT)
+#define MANDEL_ITERATIONS 64
+
+// plain C version of mandel_asm, for checking the vector kernel and for running on the host
+// writes width*height XRGB pixels, stride is in pixels, width must be a multiple of 16 like mandel_asm
+void mandel_ref(uint32_t *out, uint32_t stride, uint32_t ustart, uint32_t vstart, uint32_t delta, uint32_t width, uint32_t height);
+
+// fnv-1a over the pixels, so a device render can be compared to a host one without moving the image
+uint32_t mandel_checksum(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height);
@@ -1,19 +1,80 @@
 #include <app.h>
-#include <lib/font.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/semaphore.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lk/console_cmd.h>
 #include <lk/reg.h>
 #include <math.h>
 #include <platform/bcm28xx.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/cm.h>
 #include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/pll.h>
 #include <platform/bcm28xx/pll_read.h>
 #include <platform/time.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "mandel.h"
 
 uint32_t mandel_asm(void *buffer, uint32_t ustart, uint32_t vstart, uint32_t delta, uint32_t width, uint32_t height);
 
-static uint32_t vpu_clock;
+// the frame is cut into bands of full scanlines, mandel_asm writes rows back to back, so a band is the only tile shape it can do without a stride
+#define TILE_ROWS 16
+#define MAX_TILES 64
+// the vector register file isnt saved on a context switch, so workers on the same core take turns in vrf_lock
+// more workers only overlap the queue and bookkeeping, the queue is what lets another core join in
+#define WORKERS 2
+
+static int cmd_mandel_stats(int argc, const console_cmd_args *argv);
+static int cmd_mandel_verify(int argc, const console_cmd_args *argv);
+static int cmd_mandel_bench(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("mandel_stats", "per-tile timing of the last mandelbrot frame", &cmd_mandel_stats)
+STATIC_COMMAND("mandel_verify", "compare the vector kernel against the C reference", &cmd_mandel_verify)
+STATIC_COMMAND("mandel_bench", "mandelbrot frames/sec at several vpu clocks", &cmd_mandel_bench)
+STATIC_COMMAND_END(mandelbrot);
+
+typedef struct {
+  uint32_t row;
+  uint32_t rows;
+  uint32_t usec;  // as measured by mandel_asm
+  int worker;
+} mandel_tile;
+
+typedef struct {
+  uint32_t usec;
+  uint32_t sdram_idle;
+  uint32_t sdram_cycles;
+} frame_stats;
 
-#define SHIFT (22u)
-#define MUL (1 << SHIFT)
+static struct {
+  gfx_surface *target;
+  uint32_t ustart;
+  uint32_t vstart;
+  uint32_t delta;
+  mandel_tile tiles[MAX_TILES];
+  uint32_t tile_count;
+  uint32_t next_tile;
+  uint32_t tiles_done;
+  spin_lock_t lock;
+  semaphore_t work;
+  event_t done;
+} frame;
+
+static mutex_t vrf_lock = MUTEX_INITIAL_VALUE(vrf_lock);
+// held for a whole frame, so mandel_bench can borrow the workers from the display loop
+static mutex_t render_lock = MUTEX_INITIAL_VALUE(render_lock);
+static uint32_t vpu_mhz;
+static frame_stats last_frame;
+static gfx_surface *imagea, *imageb;
+
+static const int width = 640;
+static const int height = 480;
 
 void __attribute__(( optimize("-O0"))) dump_entire_matrix(void) {
   uint32_t matrix[64][16];
@@ -31,47 +92,82 @@ void __attribute__(( optimize("-O0"))) dump_entire_matrix(void) {
   }
 }
 
-void do_mandel_render(gfx_surface *image, uint32_t ustart, uint32_t vstart, uint32_t delta, uint32_t width, uint32_t height) {
-  volatile uint32_t *data = image->ptr;
+static void render_tile(mandel_tile *tile, int worker) {
+  uint32_t *data = (uint32_t*)frame.target->ptr + (tile->row * frame.target->stride);
+  mutex_acquire(&vrf_lock);
+  // mandel_asm loads the per-lane u offsets from the first 16 pixels of its output
+  for (int j = 0; j < 16; j++) { data[j] = j*frame.delta; }
+  tile->usec = mandel_asm(data, frame.ustart, frame.vstart + (tile->row * frame.delta), frame.delta, frame.target->width, tile->rows);
+  mutex_release(&vrf_lock);
+  tile->worker = worker;
+}
+
+static int mandel_worker(void *arg) {
+  int worker = (int)arg;
+  while (true) {
+    sem_wait(&frame.work);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&frame.lock, state);
+    mandel_tile *tile = &frame.tiles[frame.next_tile++];
+    spin_unlock_irqrestore(&frame.lock, state);
 
-  for (int j = 0; j < 16; j++) { data[j] = j*delta; }
+    render_tile(tile, worker);
+
+    spin_lock_irqsave(&frame.lock, state);
+    bool last = ++frame.tiles_done == frame.tile_count;
+    spin_unlock_irqrestore(&frame.lock, state);
+    if (last) event_signal(&frame.done, true);
+  }
+  return 0;
+}
+
+static void mandel_render(gfx_surface *image, uint32_t ustart, uint32_t vstart, uint32_t delta, frame_stats *stats) {
+  frame.target = image;
+  frame.ustart = ustart;
+  frame.vstart = vstart;
+  frame.delta = delta;
+  frame.next_tile = 0;
+  frame.tiles_done = 0;
 
   // zero DDR2 perf counters
   *REG32(SD_IDL) = 0;
+  uint32_t start = *REG32(ST_CLO);
+  for (uint32_t i = 0; i < frame.tile_count; i++) sem_post(&frame.work, false);
+  event_wait(&frame.done);
+  stats->usec = *REG32(ST_CLO) - start;
+  stats->sdram_idle = *REG32(SD_IDL);
+  stats->sdram_cycles = *REG32(SD_CYC);
+}
 
-  uint32_t internal_measured = mandel_asm(image->ptr, ustart, vstart, delta, width, height);
-  uint64_t idle = *REG32(SD_IDL);
-  uint64_t total = *REG32(SD_CYC);
-
-  if (true) {
-    //dump_entire_matrix();
-    char buffer[128];
-    double ms_spent = (double)internal_measured / 1000;
-    snprintf(buffer, 127, "mandelbrot took %f ms, %f fps, @ %d MHz\n", ms_spent, 1000 / ms_spent, vpu_clock);;
-    const char *c;
-    int x=0;
-    for (c = buffer; *c; c++) {
-      font_draw_char(image, *c, x, 0, 0xffffffff);
-      x += FONT_X;
-    }
-    snprintf(buffer, 127, "mandelbrot took %lldk cycles of the ddr2 clock, %lldk of which where idle, %lldk spent\n", total/1000, idle/1000, (total-idle)/1000);
-    x = 0;
-    for (c = buffer; *c; c++) {
-      font_draw_char(image, *c, x, FONT_Y, 0xffffffff);
-      x += FONT_X;
-    }
+static void mandel_init(const struct app_descriptor *app) {
+  spin_lock_init(&frame.lock);
+  sem_init(&frame.work, 0);
+  event_init(&frame.done, false, EVENT_FLAG_AUTOUNSIGNAL);
+  frame.tile_count = 0;
+  for (int row = 0; row < height; row += TILE_ROWS) {
+    mandel_tile *tile = &frame.tiles[frame.tile_count++];
+    tile->row = row;
+    tile->rows = ((row + TILE_ROWS) > height) ? (height - row) : TILE_ROWS;
   }
+  for (int i = 0; i < WORKERS; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "mandel%d", i);
+    thread_detach_and_resume(thread_create(name, mandel_worker, (void*)i, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE));
+  }
+}
+
+static void frame_params(double step, uint32_t *ustart, uint32_t *vstart, uint32_t *delta) {
+  double d = 3.*pow(0.1,1+cos(.2*step));
+  *ustart = (int)((-.745-.5*d)*MUL);
+  *vstart = (int)((.186-.5*d)*MUL);
+  *delta = (int)(d/480.0*MUL);
 }
 
 static void mandelbrot_entry(const struct app_descriptor *app, void *args) {
-  gfx_surface *imagea, *imageb;
   hvs_layer *layer;
   const int channel = PRIMARY_HVS_CHANNEL;
   int vpu = measure_clock(5);
-  vpu_clock = vpu / 1000 / 1000;
-
-  const int width = 640;
-  const int height = 480;
+  vpu_mhz = vpu / 1000 / 1000;
 
   imagea = gfx_create_surface(NULL, width, height, width, GFX_FORMAT_RGB_x888);
   imageb = gfx_create_surface(NULL, width, height, width, GFX_FORMAT_RGB_x888);
@@ -93,25 +189,114 @@ static void mandelbrot_entry(const struct app_descriptor *app, void *args) {
 
   while (true) {
     hvs_wait_vsync(channel);
-    double d = 3.*pow(0.1,1+cos(.2*step));
-    int ustart = (-.745-.5*d)*MUL;
-    int vstart = (.186-.5*d)*MUL;
-    int delta = d/480.0*MUL;
-    layer->fb = (whichframe == 0) ? imagea : imageb;
+    uint32_t ustart, vstart, delta;
+    frame_params(step, &ustart, &vstart, &delta);
+    gfx_surface *next = (whichframe == 0) ? imagea : imageb;
     whichframe = !whichframe;
 
-    do_mandel_render(layer->fb, ustart, vstart, delta, width, height);
+    mutex_acquire(&render_lock);
+    mandel_render(next, ustart, vstart, delta, &last_frame);
+    mutex_release(&render_lock);
 
     mutex_acquire(&channels[channel].lock);
+    layer->fb = next;
     hvs_update_dlist(channel);
     mutex_release(&channels[channel].lock);
 
     step += 0.1;
+  }
+}
+
+static int cmd_mandel_stats(int argc, const console_cmd_args *argv) {
+  uint32_t min = ~0, max = 0;
+  for (uint32_t i = 0; i < frame.tile_count; i++) {
+    mandel_tile *tile = &frame.tiles[i];
+    printf("tile %2d rows %3d-%3d: %6d uSec, %8dk cycles, worker %d\n", i, tile->row, tile->row + tile->rows - 1,
+        tile->usec, tile->usec * vpu_mhz / 1000, tile->worker);
+    if (tile->usec < min) min = tile->usec;
+    if (tile->usec > max) max = tile->usec;
+  }
+  printf("tiles: min %d uSec, max %d uSec\n", min, max);
+  printf("frame: %d uSec, %d fps @ %d MHz\n", last_frame.usec, last_frame.usec ? 1000000 / last_frame.usec : 0, vpu_mhz);
+  printf("sdram: %dk cycles, %dk idle, %d%% busy\n", last_frame.sdram_cycles / 1000, last_frame.sdram_idle / 1000,
+      last_frame.sdram_cycles ? 100 - (int)((uint64_t)last_frame.sdram_idle * 100 / last_frame.sdram_cycles) : 0);
+  return 0;
+}
+
+static int cmd_mandel_verify(int argc, const console_cmd_args *argv) {
+  if (!imageb) {
+    puts("mandelbrot app not running");
+    return -1;
+  }
+  uint32_t ustart, vstart, delta;
+  frame_stats stats;
+  frame_params(0, &ustart, &vstart, &delta);
+  uint32_t *reference = malloc(width * height * 4);
+  if (!reference) return -1;
+
+  mutex_acquire(&render_lock);
+  mandel_render(imageb, ustart, vstart, delta, &stats);
+  uint32_t t = *REG32(ST_CLO);
+  mandel_ref(reference, width, ustart, vstart, delta, width, height);
+  t = *REG32(ST_CLO) - t;
 
-    //thread_sleep(10 * 1000);
+  uint32_t *pixels = imageb->ptr;
+  int mismatches = 0;
+  for (int i = 0; i < (width * height); i++) {
+    if (pixels[i] != reference[i]) {
+      if (mismatches < 8) printf("pixel %d,%d: 0x%08x, reference 0x%08x\n", i % width, i / width, pixels[i], reference[i]);
+      mismatches++;
+    }
+  }
+  printf("ustart %d vstart %d delta %d\n", ustart, vstart, delta);
+  printf("vector checksum 0x%08x, reference checksum 0x%08x\n", mandel_checksum(pixels, width, width, height), mandel_checksum(reference, width, width, height));
+  printf("%d mismatching pixels, vector %d uSec, reference %d uSec\n", mismatches, stats.usec, t);
+  mutex_release(&render_lock);
+  free(reference);
+  return mismatches ? -1 : 0;
+}
+
+// only ever divides the vpu clock down from where the platform set it, the same source is kept
+// anything else on the core clock (hvs, mini-uart) slows down with it
+static void set_vpu_div(uint32_t div) {
+  uint32_t src = *REG32(CM_VPUCTL) & 0xf;
+  switch_vpu_to_src(CM_SRC_OSC);
+  *REG32(CM_VPUDIV) = CM_PASSWORD | div;
+  switch_vpu_to_src(src);
+}
+
+static int cmd_mandel_bench(int argc, const console_cmd_args *argv) {
+  const int frames = 10;
+  if (!imageb) {
+    puts("mandelbrot app not running");
+    return -1;
+  }
+  uint32_t original_div = *REG32(CM_VPUDIV) & 0xffffff;
+  uint32_t ustart, vstart, delta;
+  frame_params(0, &ustart, &vstart, &delta);
+
+  mutex_acquire(&render_lock);
+  for (int n = 1; n <= 4; n++) {
+    set_vpu_div(original_div * n);
+    uint32_t mhz = measure_clock(5) / 1000 / 1000;
+    uint32_t usec = 0, idle = 0, cycles = 0;
+    for (int i = 0; i < frames; i++) {
+      frame_stats stats;
+      mandel_render(imageb, ustart, vstart, delta, &stats);
+      usec += stats.usec;
+      idle += stats.sdram_idle / frames;
+      cycles += stats.sdram_cycles / frames;
+    }
+    printf("%4d MHz: %d.%02d fps, %d uSec/frame, sdram %d%% busy\n", mhz,
+        frames * 1000000 / usec, (frames * 100000000 / usec) % 100, usec / frames,
+        cycles ? 100 - (int)((uint64_t)idle * 100 / cycles) : 0);
   }
+  set_vpu_div(original_div);
+  mutex_release(&render_lock);
+  return 0;
 }
 
 APP_START(vpu_mandelbrot)
+  .init = mandel_init,
   .entry = mandelbrot_entry
 APP_END
@@ -0,0 +1,49 @@
+#include "mandel.h"
+
+// |a - b| the way v32dist does it, on signed 32bit lanes
+static inline uint32_t dist(int32_t a, int32_t b) {
+  int64_t d = (int64_t)a - b;
+  return (uint32_t)(d < 0 ? -d : d);
+}
+
+// x^2 >> SHIFT using only 16x16 multiplies, and dropping lo*lo, exactly like core.S
+static inline uint32_t square(uint32_t x) {
+  uint32_t hi = x >> 16;
+  uint32_t lo = x & 0xffff;
+  return ((hi * hi) << (32 - SHIFT)) + ((lo * hi) >> (SHIFT - 17));
+}
+
+void mandel_ref(uint32_t *out, uint32_t stride, uint32_t ustart, uint32_t vstart, uint32_t delta, uint32_t width, uint32_t height) {
+  uint32_t ci = vstart;
+  for (uint32_t y = 0; y < height; y++) {
+    uint32_t *row = out + (y * stride);
+    for (uint32_t x = 0; x < width; x++) {
+      const uint32_t cr = ustart + (x * delta);
+      uint32_t zr = 0, zi = 0;
+      uint32_t count = MANDEL_ITERATIONS;
+      for (uint32_t i = 0; i < MANDEL_ITERATIONS; i++) {
+        uint32_t zr2 = square(dist(zr, 0));
+        uint32_t zi2 = square(dist(zi, 0));
+        uint32_t diff2 = square(dist(zr, zi));
+        uint32_t mag2 = zr2 + zi2;
+        zr = zr2 - zi2 + cr;
+        // the asm uses the sign flag of mag2 - 4.0
+        if (((int32_t)(mag2 - (4u << SHIFT)) >= 0) && (i < count)) count = i;
+        zi = mag2 - diff2 + ci;
+      }
+      row[x] = count << (2+8+8);
+    }
+    ci += delta;
+  }
+}
+
+uint32_t mandel_checksum(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      hash ^= pixels[(y * stride) + x];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
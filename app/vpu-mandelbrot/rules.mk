@@ -2,9 +2,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
-MODULE_SRCS += $(LOCAL_DIR)/mandelbrot.c $(LOCAL_DIR)/core.S
-
-MODULES += lib/font
+MODULE_SRCS += $(LOCAL_DIR)/mandelbrot.c $(LOCAL_DIR)/reference.c $(LOCAL_DIR)/core.S
 
 include make/module.mk
 
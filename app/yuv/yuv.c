@@ -2,7 +2,10 @@
 #include <kernel/timer.h>
 #include <lib/hexdump.h>
 #include <lk/console_cmd.h>
+#include <lk/macros.h>
+#include <platform/bcm28xx/dma_blit.h>
 #include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/hvs_yuv.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -18,9 +21,12 @@ extern int substate;
 extern const animation_t animations[];
 
 hvs_layer sprite;
-yuv_image_2plane *img;
+hvs_yuv_image *img;
+// set by yuv_video while it presents on the channel, hvs_present() and hvs_update_dlist() cant share one
+// only changed and read with the channel lock held, so yuv_entry never rebuilds the dlist under a queued frame
+static bool video_playing;
 
-void yuv_putuv(yuv_image_2plane *i, int posx, int posy, uint8_t u, uint8_t v) {
+void yuv_putuv(hvs_yuv_image *i, int posx, int posy, uint8_t u, uint8_t v) {
   int xoff = posx * 2;
   int yoff = posy * i->chroma_stride;
   i->chroma[yoff + xoff + 0] = u;
@@ -28,7 +34,7 @@ void yuv_putuv(yuv_image_2plane *i, int posx, int posy, uint8_t u, uint8_t v) {
   //if ((posy < 2) && (posx < 10)) printf("%d,%d = %d %d\n", posx, posy, u, v);
 }
 
-void yuv_puty(yuv_image_2plane *i, int posx, int posy, uint8_t y) {
+void yuv_puty(hvs_yuv_image *i, int posx, int posy, uint8_t y) {
   i->luma[(posy * i->luma_stride) + posx] = y;
 }
 
@@ -93,11 +99,74 @@ static int cmd_yuv_peek(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
+// decodes a fake video, a bar sweeping across a 3 plane bt709 frame, through a pool without copying any frame
+static int cmd_yuv_video(int argc, const console_cmd_args *argv) {
+  int frames = (argc >= 2) ? (int)argv[1].u : 300;
+  const int w = 320;
+  const int h = 180;
+  hvs_yuv_pool pool;
+  if (hvs_yuv_pool_init(&pool, 3, HVS_YUV420_3PLANE, HVS_BT709, w, h) != NO_ERROR) return -1;
+  hvs_layer video;
+  mk_yuv_layer(&video, &pool.frames[0].image, 70, 400, 300);
+  video.w = w * 2;
+  video.h = h * 2;
+  video.name = "yuv video";
+
+  mutex_acquire(&channels[channel].lock);
+  if (video_playing) {
+    mutex_release(&channels[channel].lock);
+    hvs_yuv_pool_free(&pool);
+    puts("already playing");
+    return -1;
+  }
+  video_playing = true;
+  hvs_dlist_add(channel, &video);
+  mutex_release(&channels[channel].lock);
+
+  uint32_t target = hvs_frame_count(channel) + 1;
+  for (int i=0; i < frames; i++) {
+    hvs_yuv_frame *f = hvs_yuv_pool_get(&pool, 1000);
+    if (!f) {
+      puts("no free frame");
+      break;
+    }
+    hvs_yuv_image *img = &f->image;
+    const int bar = (i * 4) % w;
+    for (int y=0; y < h; y++) {
+      memset(img->luma + (y * img->luma_stride), 16, w);
+      memset(img->luma + (y * img->luma_stride) + bar, 235, MIN(16, w - bar));
+    }
+    memset(img->chroma, 128, (h / 2) * img->chroma_stride);
+    memset(img->chroma2, 128, (h / 2) * img->chroma_stride);
+    // the pool runs out before the presentation queue does, so this only fails if something else is queueing on the channel
+    status_t ret = hvs_yuv_pool_present(f, channel, &video, target++, 0);
+    if (ret != NO_ERROR) {
+      printf("present error %d\n", ret);
+      hvs_yuv_pool_put(f);
+      break;
+    }
+  }
+  hvs_present_wait(channel, target - 1);
+
+  mutex_acquire(&channels[channel].lock);
+  hvs_dlist_remove(channel, &video);
+  hvs_update_dlist(channel);
+  video_playing = false;
+  mutex_release(&channels[channel].lock);
+  // give the hvs a frame to stop reading it
+  hvs_wait_vsync(channel);
+  hvs_wait_vsync(channel);
+  printf("presented %d, missed %d, skipped %d\n", pool.presented, pool.missed, pool.skipped);
+  hvs_yuv_pool_free(&pool);
+  return 0;
+}
+
 STATIC_COMMAND_START
 STATIC_COMMAND("yuv_fill", "", &cmd_fill)
 STATIC_COMMAND("yuv_fill2", "", &cmd_fill2)
 STATIC_COMMAND("yuv_filly", "", &cmd_filly)
 STATIC_COMMAND("yuv_peek", "", &cmd_yuv_peek)
+STATIC_COMMAND("yuv_video", "play a test pattern through a yuv frame pool", &cmd_yuv_video)
 STATIC_COMMAND_END(yuv);
 
 bool state_advance(void) {
@@ -130,15 +199,6 @@ void animate_alpha(uint32_t stat) {
   }
 }
 
-#if 0
-void animate_chroma_hscale(uint32_t stat) {
-  img->chroma_hscale = (substate/10)+1;
-  if (state_advance()) {
-    img->chroma_hscale = 200;
-  }
-}
-#endif
-
 int state = 0;
 int substate = 0;
 
@@ -146,7 +206,6 @@ const animation_t animations[] = {
   { animate_x, 256 },
   { animate_y, 256 },
   { animate_alpha, 256 },
-  //{ animate_chroma_hscale, 2000 },
 };
 const int state_count = sizeof(animations) / sizeof(animations[0]);
 
@@ -162,8 +221,9 @@ static void draw_grid(void) {
   gfx_surface *gfx_grid = gfx_create_surface(NULL, width, height, width, GFX_FORMAT_ARGB_8888);
   hvs_layer *grid_layer = malloc(sizeof(hvs_layer));
 
+  // only the first band of grid rows is drawn by hand
   for (int x=0; x< width; x++) {
-    for (int y=0; y < height; y++) {
+    for (int y=0; y < grid; y++) {
       uint color = 0x00000000;
       if (true) {
         if ((y % grid == 0) || (y % grid == 1)) {
@@ -176,9 +236,15 @@ static void draw_grid(void) {
       gfx_putpixel(gfx_grid, x, y, color);
     }
   }
+  // then copied down the rest of the surface in one go
+  // each row reads the one a band above it, which has already been written, so the band repeats
+  const uint32_t pitch = gfx_grid->stride * gfx_grid->pixelsize;
+  dma_blit blit;
+  dma_blit_init(&blit, 1);
+  dma_blit_copy_stride(&blit, gfx_grid->ptr + (grid * pitch), pitch, gfx_grid->ptr, pitch, width * gfx_grid->pixelsize, height - grid);
+  dma_blit_run(&blit);
+  dma_blit_free(&blit);
   mk_unity_layer(grid_layer, gfx_grid, 60, 100, 100);
-  hvs_allocate_premade(grid_layer, 7);
-  hvs_regen_noscale_noviewport_noalpha(grid_layer);
   grid_layer->name = strdup("grid");
   mutex_acquire(&channels[channel].lock);
   hvs_dlist_add(channel, grid_layer);
@@ -186,112 +252,11 @@ static void draw_grid(void) {
   mutex_release(&channels[channel].lock);
 }
 
-void hvs_dlist_update_yuv(hvs_layer *s, yuv_image_2plane *i) {
-  // HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE:
-  // the hardware is aware that the luma plane is the size specified in POS2, and the chroma plane is half of POS2
-  // but the scale parameters for luma and chroma are user supplied, and can violate those assumptions
-  // when doing a chroma lookup, it will follow the user-specified chroma scale, but then clamp to half of POS2
-  // if the scale parameters lead to a lookup beyond the assumed chroma size, it will repeat whatever is at the edge of the chroma image
-  int fmt = HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE;
-
-  // UV scale
-  uint32_t scl0 = SCALER_CTL0_SCL_H_PPF_V_PPF;
-  // Y scale
-  uint32_t scl1 = SCALER_CTL0_SCL_H_PPF_V_PPF;
-
-  s->dlist_length = 25;
-  uint32_t *d = s->premade_dlist;
-  // CTL0
-  d[0] = CONTROL_VALID
-    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_XYCBCR)
-    | CONTROL_FORMAT(fmt)
-    | CONTROL_SCL0(scl0)
-    | CONTROL_SCL1(scl1)
-    | CONTROL_WORDS(s->dlist_length);
-  // POS0
-  d[1] = POS0_X(s->x) | POS0_Y(s->y) | POS0_ALPHA(s->alpha);
-  // POS1 optional scaled output size
-  d[2] = s->w | (s->h << 16);
-  // POS2, input size
-  d[3] = POS2_H(s->orig_h) | POS2_W(s->orig_w) | (s->alpha_mode << 30); // fixed alpha
-  // POS3, context
-  d[4] = 0xDEADBEEF;
-  // PTR0
-  d[5] = (uint32_t)i->luma | 0xc0000000;
-  // PTR1
-  d[6] = (uint32_t)i->chroma | 0xc0000000;
-  // context 0
-  d[7] = 0xDEADBEEF;
-  // context 1
-  d[8] = 0xDEADBEEF;
-  // pitch 0
-  d[9] = i->luma_stride;
-  // pitch 1
-  d[10] = i->chroma_stride;
-  // colorspace conversion
-  d[11] = 0x00f00000;
-  d[12] = 0xe73304a8;
-  d[13] = 0x00066604;
-  // LMB base addr
-  d[14] = 600;
-  // scaling parameters UV
-  //d[14] = gen_ppf(100, 100); // ???
-  d[15] = gen_ppf(100, 200); // chroma H scale
-  d[16] = gen_ppf(100, 200); // chroma V scale
-  d[17] = 0xDEADBEEF;
-  // scaling parameters Y
-  d[18] = gen_ppf(256, 256);
-  d[19] = gen_ppf(256, 256);
-  d[20] = 0xDEADBEEF;
-
-  // scaling kernels
-  d[21] = scaling_kernel;
-  d[22] = scaling_kernel;
-  d[23] = scaling_kernel;
-  d[24] = scaling_kernel;
-}
-
-yuv_image_2plane *yuv_allocate(unsigned int width, unsigned int height, int chroma_hscale, int chroma_vscale) {
-  yuv_image_2plane *i = malloc(sizeof(yuv_image_2plane));
-  i->luma_stride = width;
-  i->chroma_stride = (width / chroma_hscale) * 2;
-  i->luma = malloc(height * i->luma_stride);
-  i->chroma = malloc((height / chroma_vscale) * i->chroma_stride);
-  i->chroma_hscale = chroma_hscale * 100;
-  i->chroma_vscale = chroma_vscale * 100;
-  return i;
-}
-
-yuv_image_2plane *yuv420_allocate(unsigned int width, unsigned int height) {
-  return yuv_allocate(width, height, 2, 2);
-}
-
 void create_yuv_sweep(void) {
-  img = yuv420_allocate(256,256);
-
-  sprite.fb = NULL;
-  sprite.layer = 60;
-  sprite.x = 116;
-  sprite.y = 116;
-  sprite.w = 256;
-  sprite.h = 256;
-
-  sprite.orig_w = 256;
-  sprite.orig_h = 256;
-
-  sprite.viewport_w = 256;
-  sprite.viewport_h = 256;
-  sprite.viewport_x = 0;
-  sprite.viewport_y = 0;
-
-  sprite.visible = true;
-
-  sprite.palette_mode = palette_none;
+  img = hvs_yuv_alloc(HVS_YUV420_2PLANE, HVS_BT601, 256, 256);
 
-  sprite.premade_dlist = malloc(4*32);
-
-  sprite.alpha_mode = alpha_mode_fixed;
-  sprite.alpha = 0xff;
+  // hvs_update_dlist() compiles the entry, and rebuilds it when the alpha mode changes
+  mk_yuv_layer(&sprite, img, 60, 116, 116);
 
   sprite.name = strdup("YUV");
 
@@ -308,7 +273,7 @@ void create_yuv_sweep(void) {
   }
 }
 
-void fillrect(yuv_image_2plane *i, int x0, int y0, int w, int h, uint8_t luma, uint8_t u, uint8_t v) {
+void fillrect(hvs_yuv_image *i, int x0, int y0, int w, int h, uint8_t luma, uint8_t u, uint8_t v) {
   for (int y=y0/2; y<((y0/2)+(h/2)); y++) {
     for (int x=x0/2; x<((x0/2)+(w/2)); x++) {
       yuv_putuv(i, x, y, u, v);
@@ -324,35 +289,14 @@ void fillrect(yuv_image_2plane *i, int x0, int y0, int w, int h, uint8_t luma, u
 void create_yuv_colorbars(void) {
   int w = 620;
   int h = 400;
-  img = yuv420_allocate(w, h);
-
-  sprite.fb = NULL;
-  sprite.layer = 60;
-  sprite.x = 50;
-  sprite.y = 30;
-  sprite.w = w;
-  sprite.h = h;
-
-  sprite.orig_w = w;
-  sprite.orig_h = h;
-
-  sprite.viewport_w = 256;
-  sprite.viewport_h = 256;
-  sprite.viewport_x = 0;
-  sprite.viewport_y = 0;
-
-  sprite.visible = true;
+  img = hvs_yuv_alloc(HVS_YUV420_2PLANE, HVS_BT601, w, h);
 
-  sprite.palette_mode = palette_none;
-
-  sprite.premade_dlist = malloc(4*32);
-
-  sprite.alpha_mode = alpha_mode_fixed;
-  sprite.alpha = 0xff;
+  // hvs_update_dlist() compiles the entry, and rebuilds it when the alpha mode changes
+  mk_yuv_layer(&sprite, img, 60, 50, 30);
 
   sprite.name = strdup("YUV");
 
-  memset(img->chroma, 128, h * img->chroma_stride);
+  memset(img->chroma, 128, (h / 2) * img->chroma_stride);
   memset(img->luma, 0, h * img->luma_stride);
 
   int slice = w/7;
@@ -371,8 +315,6 @@ static void yuv_entry(const struct app_descriptor *app, void *args) {
   //create_yuv_colorbars();
   create_yuv_sweep();
 
-  hvs_dlist_update_yuv(&sprite, img);
-
   mutex_acquire(&channels[channel].lock);
   hvs_dlist_add(channel, &sprite);
   hvs_update_dlist(channel);
@@ -381,12 +323,13 @@ static void yuv_entry(const struct app_descriptor *app, void *args) {
 
   while (true) {
     uint32_t stat = hvs_wait_vsync(channel);
-    animations[state].update(stat);
-
-    hvs_dlist_update_yuv(&sprite, img);
 
     mutex_acquire(&channels[channel].lock);
-    hvs_update_dlist(channel);
+    // paused while yuv_video owns the channel
+    if (!video_playing) {
+      animations[state].update(stat);
+      hvs_update_dlist(channel);
+    }
     mutex_release(&channels[channel].lock);
   }
 }
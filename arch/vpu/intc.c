@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <dev/uart.h>
 #include <kernel/thread.h>
 #include <lk/debug.h>
 #include <lk/err.h>
@@ -205,6 +206,7 @@ void sleh_fatal(vc4_saved_state_t* pcb, uint32_t n) {
 
   printf("We are hanging here ...\n");
   //platform_halt(HALT_ACTION_REBOOT, HALT_REASON_SW_RESET);
+  uart_flush_tx(0);
 
   while(true) __asm__ volatile ("nop");
 }
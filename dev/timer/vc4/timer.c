@@ -61,8 +61,8 @@ void platform_stop_timer(void) {
 }
 
 static enum handler_return timer0_irq(void *arg) {
-  uint32_t cs = *REG32(ST_CS);
-  *REG32(ST_CS) = cs; // ack the event so the irq signal clears
+  // ack only our own match, the other channels belong to the hrtimer and the arm
+  *REG32(ST_CS) = 1 << VC4_TIMER_CHANNEL;
   assert(timer_cb);
   return timer_cb(timer_arg, current_time());
 }
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fixed-point/clock_plan.h>
+
+#include "fixed-point.h"
+#include "util.h"
+
+// host checks for the clock planner and the divisor math under it
+// the checkPll/checkPL011 cases are the ones fixed-point.cpp prints, here they are checked instead
+// usage: clock-plan-check [xtal vpu v3d pixel per pwm [tolerance_ppm]], rates in Hz, to print one plan
+
+#define MHz 1000000
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// the old kHz divisor is truncated to 14 fraction bits, the Hz one is rounded to 20
+static void checkPll(uint32_t xtal, uint32_t goal) {
+  const uint32_t old_div = computePllDivisor(xtal / 1000, goal / 1000);
+  const uint32_t div = computePllDivisorRounded(xtal, goal);
+  const uint32_t rate = clock_plan_pll_rate(xtal, div, false);
+  printf("%u Hz * 0x%08x == %u Hz, kHz divisor 0x%08x\n", xtal, div, rate, old_div);
+  CHECK((div >= old_div) && ((div - old_div) <= (1 << 6)));
+  // half an lsb of the divisor, plus one for rounding the rate
+  const uint32_t slop = (xtal >> 21) + 1;
+  CHECK((rate + slop >= goal) && (rate <= goal + slop));
+}
+
+// the pl011 can tolerate a few percent
+static void checkPL011(uint32_t refclk_in, uint32_t baud, bool reachable) {
+  Fixed<uint32_t,16,6> divisor = computePL011Divisor(refclk_in, baud);
+  const uint32_t ibrd = divisor.getIntger();
+  const uint32_t fbrd = divisor.getFraction();
+  if (!reachable) {
+    printf("IBRD = %u, baud %u is out of reach from %u Hz\n", ibrd, baud, refclk_in);
+    CHECK(ibrd == 0);
+    return;
+  }
+  const uint32_t actual = ((uint64_t)refclk_in * 64) / ((uint64_t)divisor.s * 16);
+  const uint32_t ppm = clock_plan_ppm(actual, baud);
+  printf("IBRD = %u, FBRD = %u, %u Hz -> %u baud, %u ppm\n", ibrd, fbrd, refclk_in, actual, ppm);
+  CHECK(ibrd >= 1);
+  CHECK(ppm < 20000);
+}
+
+// the cases clock_set_pwm/vec/hsm feed it, and the range limits they used to check by hand
+static void checkDividers(void) {
+  clock_plan_cm cm;
+  CHECK(clock_plan_cm_divider(250 * MHz, 125 * MHz, 2, true, &cm));
+  CHECK(cm.div == 0x2000 && cm.mash == 0 && cm.hz == 125 * MHz && cm.ppm == 0);
+
+  CHECK(clock_plan_cm_divider(500 * MHz, 108 * MHz, 2, false, &cm));
+  CHECK(cm.div == 0x5000 && cm.mash == 0 && cm.ppm != 0);
+
+  // 48khz audio at a range of 1024
+  CHECK(clock_plan_cm_divider(250 * MHz, 48000 * 1024, 2, true, &cm));
+  CHECK(cm.mash == 1 && (cm.div >> 12) == 5 && cm.ppm < 50);
+
+  CHECK(!clock_plan_cm_divider(250 * MHz, 200 * MHz, 2, true, &cm));
+  CHECK(!clock_plan_cm_divider(250 * MHz, 50000, 2, true, &cm));
+  CHECK(clock_plan_cm_divider(250 * MHz, 250 * MHz, 1, false, &cm));
+  CHECK(cm.div == 0x1000);
+}
+
+static bool plan(const char *name, const clock_plan_request *req, clock_plan *out) {
+  printf("%s:\n", name);
+  if (!clock_plan_solve(req, out)) {
+    printf("  no plan\n");
+    return false;
+  }
+  clock_plan_dump(out);
+  return true;
+}
+
+static void checkPlans(void) {
+  clock_plan p;
+
+  // what PLLC_FREQ_MHZ/PLLC_CORE0_DIV/PLLC_PER_DIV give now, found at a lower vco
+  clock_plan_request tree = { .xtal = 19200000, .vpu = 250 * MHz, .per = 250 * MHz };
+  CHECK(plan("rules.mk defaults", &tree, &p));
+  CHECK(p.worst_ppm == 0 && p.mash_count == 0);
+  CHECK(p.vco == 750 * MHz && p.core0_div == 3 && p.per_div == 3);
+  CHECK(p.ndiv == 0x2710000);
+
+  // pi4_pllc(), on a 54mhz crystal
+  clock_plan_request pi4 = { .xtal = 54000000, .vpu = 108 * 2 * 13 / 2 / 3 * MHz };
+  CHECK(plan("pi4", &pi4, &p));
+  CHECK(p.worst_ppm == 0 && p.vco < CLOCK_PLAN_PRESCALE_MIN);
+
+  // a 1080p hdmi mode, with 48khz audio
+  clock_plan_request hdmi = { .xtal = 19200000, .vpu = 500 * MHz, .v3d = 250 * MHz, .pixel = 148500000, .per = 250 * MHz, .pwm = 48000 * 1024 };
+  CHECK(plan("1080p60", &hdmi, &p));
+  // a 12 bit fraction at a divider of 5 is only good to about 50ppm
+  CHECK(p.worst_ppm < 50);
+  CHECK(p.vpu.mash == 0 && p.v3d.mash == 0);
+  CHECK(p.vpu.ppm == 0 && p.v3d.ppm == 0 && p.per_ppm == 0);
+
+  // only a 1.5ghz vco makes both exactly, a tolerance lets it trade error for a slower one
+  clock_plan_request exact = { .xtal = 19200000, .vpu = 250 * MHz, .v3d = 300 * MHz };
+  clock_plan exact_plan;
+  CHECK(plan("vpu 250 v3d 300 exact", &exact, &exact_plan));
+  CHECK(exact_plan.vco == 1500 * MHz && exact_plan.worst_ppm == 0);
+  clock_plan_request loose = exact;
+  loose.tolerance_ppm = 50000;
+  CHECK(plan("vpu 250 v3d 300 within 5%", &loose, &p));
+  CHECK(p.worst_ppm != 0 && p.worst_ppm <= 50000);
+  CHECK(p.vco < exact_plan.vco);
+
+  // above 1.75ghz the divisor is halved and the prescaler does the rest
+  clock_plan_request fast = { .xtal = 19200000, .vpu = 600 * MHz, .per = 1000 * MHz, .vco_max = 3000u * MHz };
+  CHECK(plan("prescaled", &fast, &p));
+  CHECK(p.prescale && p.vco == 3000u * MHz && p.worst_ppm == 0);
+  CHECK(clock_plan_pll_rate(19200000, p.ndiv, true) == p.vco);
+
+  // nothing can make these
+  clock_plan_request impossible = { .xtal = 19200000, .vpu = 3000u * MHz };
+  CHECK(!plan("too fast", &impossible, &p));
+  clock_plan_request no_xtal = { .vpu = 250 * MHz };
+  CHECK(!clock_plan_solve(&no_xtal, &p));
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 7) {
+    clock_plan_request req = {
+      .xtal = (uint32_t)strtoul(argv[1], NULL, 0),
+      .vpu = (uint32_t)strtoul(argv[2], NULL, 0),
+      .v3d = (uint32_t)strtoul(argv[3], NULL, 0),
+      .pixel = (uint32_t)strtoul(argv[4], NULL, 0),
+      .per = (uint32_t)strtoul(argv[5], NULL, 0),
+      .pwm = (uint32_t)strtoul(argv[6], NULL, 0),
+      .tolerance_ppm = (argc >= 8) ? (uint32_t)strtoul(argv[7], NULL, 0) : 0,
+    };
+    clock_plan p;
+    return plan("plan", &req, &p) ? 0 : 1;
+  }
+
+  checkPll(19200000, 500000000);
+  checkPll(19200000, 108 * 1000 * 1000 * 5);
+  checkPll(54000000, 500000000);
+  checkPll(54000000, 108 * 1000 * 1000 * 1);
+  checkPll(54000000, 108 * 1000 * 1000 * 2);
+  checkPll(54000000, 108 * 1000 * 1000 * 3);
+  checkPll(54000000, 108 * 1000 * 1000 * 4);
+  checkPll(54000000, 108 * 1000 * 1000 * 5);
+
+  // the pll-less clock start.S uses
+  uint32_t ref = 54 * MHz / (0xa050 / 0x1000);
+  checkPL011(ref, 9600, true);
+  checkPL011(ref, 115200, true);
+  checkPL011(50 * MHz, 9600, true);
+  checkPL011(50 * MHz, 115200, true);
+  checkPL011(19200000, 115200, true);
+  checkPL011(50 * MHz, 3750 * 1000, false);
+  checkPL011(50 * MHz, 1870 * 1000, true);
+  checkPL011(ref, 300 * 1000, true);
+
+  checkDividers();
+  checkPlans();
+
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <fixed-point/clock_plan.h>
+
+#include "fixed-point.h"
+#include "util.h"
+
+// the A2W channel dividers are 8 bits
+#define CHANNEL_DIV_MAX 255
+// each wanted rate adds at most this many multiples of itself as vco candidates
+#define MULTIPLES_MAX 512
+
+uint32_t clock_plan_ppm(uint32_t actual, uint32_t goal) {
+  if (goal == 0) return 0;
+  uint64_t diff = (actual > goal) ? (actual - goal) : (goal - actual);
+  return ((diff * 1000000) + (goal / 2)) / goal;
+}
+
+uint32_t clock_plan_pll_rate(uint32_t xtal, uint32_t ndiv, bool prescale) {
+  Fixed<uint64_t,32,0> crystal = xtal;
+  Fixed<uint64_t,12,20> divisor(ndiv, true);
+  Fixed<uint64_t,44,20> rate = crystal * divisor;
+  uint64_t hz = (rate.s + (1 << 19)) >> 20;
+  if (prescale) hz *= 2;
+  return hz;
+}
+
+static uint32_t channel_rate(uint32_t vco, uint32_t div) {
+  return (vco + (div / 2)) / div;
+}
+
+bool clock_plan_cm_divider(uint32_t parent, uint32_t goal, unsigned int min_div, bool mash, clock_plan_cm *out) {
+  out->div = 0;
+  out->mash = 0;
+  out->hz = 0;
+  out->ppm = 0;
+  if ((parent == 0) || (goal == 0)) return false;
+
+  Fixed<uint32_t,12,12> div(0, true);
+  if (mash) {
+    div = computeClockDivisorInternal(parent, goal);
+  } else {
+    Fixed<uint64_t,32,0> parent_freq = parent;
+    Fixed<uint64_t,32,0> goal_freq = goal;
+    Fixed<uint64_t,32,0> whole = parent_freq.divRound(goal_freq);
+    if (whole.s < (1 << 12)) div = Fixed<uint32_t,12,12>((uint32_t)whole.s);
+  }
+  if ((div.s == 0) || (div.getIntger() < min_div)) return false;
+
+  Fixed<uint64_t,52,12> parent_freq = parent;
+  Fixed<uint64_t,12,12> divisor(div.s, true);
+  Fixed<uint64_t,64,0> rate = parent_freq.divRound(divisor);
+
+  out->div = div.s;
+  out->mash = div.getFraction() ? 1 : 0;
+  out->hz = rate.s;
+  out->ppm = clock_plan_ppm(out->hz, goal);
+  return true;
+}
+
+// ppm is clamped to the tolerance and used for ranking, worst is what gets reported
+typedef struct {
+  uint32_t ppm;
+  uint32_t worst;
+  uint32_t mash;
+} score;
+
+static uint32_t clamp_ppm(const clock_plan_request *req, uint32_t ppm) {
+  return (ppm < req->tolerance_ppm) ? req->tolerance_ppm : ppm;
+}
+
+// a wanted clock that cant be made at all fails the whole branch, an unwanted one adds nothing
+static bool add_cm(const clock_plan_request *req, score *s, uint32_t parent, uint32_t goal, unsigned int min_div, bool mash, clock_plan_cm *out) {
+  if (goal == 0) {
+    clock_plan_cm_divider(0, 0, 0, false, out);
+    return true;
+  }
+  if (!clock_plan_cm_divider(parent, goal, min_div, mash, out)) return false;
+  uint32_t ppm = clamp_ppm(req, out->ppm);
+  if (ppm > s->ppm) s->ppm = ppm;
+  if (out->ppm > s->worst) s->worst = out->ppm;
+  s->mash += out->mash;
+  return true;
+}
+
+// ties go to the later, larger channel divider, a slower channel burns less
+static bool better(const score *a, const score *b) {
+  if (a->ppm != b->ppm) return a->ppm < b->ppm;
+  return a->mash <= b->mash;
+}
+
+static bool plan_core0(const clock_plan_request *req, clock_plan *plan, score *out) {
+  plan->core0_div = 0;
+  plan->core0 = 0;
+  clock_plan_cm_divider(0, 0, 0, false, &plan->vpu);
+  clock_plan_cm_divider(0, 0, 0, false, &plan->v3d);
+  clock_plan_cm_divider(0, 0, 0, false, &plan->pixel);
+  *out = { 0, 0, 0 };
+  if (!req->vpu && !req->v3d && !req->pixel) return true;
+
+  // the channel has to be at least as fast as the fastest clock under it
+  uint32_t fastest = req->vpu;
+  if (req->v3d > fastest) fastest = req->v3d;
+  if ((req->pixel * 2) > fastest) fastest = req->pixel * 2;
+  uint32_t last = plan->vco / fastest;
+  if (last > CHANNEL_DIV_MAX) last = CHANNEL_DIV_MAX;
+
+  bool found = false;
+  for (uint32_t d = 1; d <= last; d++) {
+    const uint32_t core0 = channel_rate(plan->vco, d);
+    score s = { 0, 0, 0 };
+    clock_plan_cm vpu, v3d, pixel;
+    if (!add_cm(req, &s, core0, req->vpu, 1, false, &vpu)) continue;
+    if (!add_cm(req, &s, core0, req->v3d, 1, false, &v3d)) continue;
+    if (!add_cm(req, &s, core0, req->pixel, 2, true, &pixel)) continue;
+    if (found && !better(&s, out)) continue;
+    found = true;
+    *out = s;
+    plan->core0_div = d;
+    plan->core0 = core0;
+    plan->vpu = vpu;
+    plan->v3d = v3d;
+    plan->pixel = pixel;
+  }
+  return found;
+}
+
+static bool plan_per(const clock_plan_request *req, clock_plan *plan, score *out) {
+  plan->per_div = 0;
+  plan->per = 0;
+  plan->per_ppm = 0;
+  clock_plan_cm_divider(0, 0, 0, false, &plan->pwm);
+  *out = { 0, 0, 0 };
+  if (!req->per && !req->pwm) return true;
+
+  uint32_t first = 1;
+  uint32_t last = CHANNEL_DIV_MAX;
+  if (req->per) {
+    // only the dividers either side of the ideal one can win
+    const uint32_t ideal = channel_rate(plan->vco, req->per);
+    first = (ideal > 1) ? (ideal - 1) : 1;
+    if ((ideal + 1) < last) last = ideal + 1;
+  } else if ((plan->vco / (req->pwm * 2)) < last) {
+    last = plan->vco / (req->pwm * 2);
+  }
+
+  bool found = false;
+  for (uint32_t d = first; d <= last; d++) {
+    const uint32_t per = channel_rate(plan->vco, d);
+    score s = { 0, 0, 0 };
+    uint32_t per_ppm = 0;
+    if (req->per) {
+      per_ppm = clock_plan_ppm(per, req->per);
+      s.ppm = clamp_ppm(req, per_ppm);
+      s.worst = per_ppm;
+    }
+    clock_plan_cm pwm;
+    if (!add_cm(req, &s, per, req->pwm, 2, true, &pwm)) continue;
+    if (found && !better(&s, out)) continue;
+    found = true;
+    *out = s;
+    plan->per_div = d;
+    plan->per = per;
+    plan->per_ppm = per_ppm;
+    plan->pwm = pwm;
+  }
+  return found;
+}
+
+static bool plan_vco(const clock_plan_request *req, uint32_t goal, clock_plan *plan) {
+  plan->xtal = req->xtal;
+  plan->prescale = goal > CLOCK_PLAN_PRESCALE_MIN;
+  plan->ndiv = computePllDivisorHz(req->xtal, goal).s;
+  if (plan->prescale) plan->ndiv = (plan->ndiv + 1) >> 1;
+  plan->vco = clock_plan_pll_rate(req->xtal, plan->ndiv, plan->prescale);
+
+  score core0, per;
+  if (!plan_core0(req, plan, &core0)) return false;
+  if (!plan_per(req, plan, &per)) return false;
+  plan->worst_ppm = (core0.worst > per.worst) ? core0.worst : per.worst;
+  plan->mash_count = core0.mash + per.mash;
+  return true;
+}
+
+// worst error, then jitter, then power
+static bool better_plan(const clock_plan_request *req, const clock_plan *a, const clock_plan *b) {
+  const uint32_t ea = clamp_ppm(req, a->worst_ppm);
+  const uint32_t eb = clamp_ppm(req, b->worst_ppm);
+  if (ea != eb) return ea < eb;
+  if (a->mash_count != b->mash_count) return a->mash_count < b->mash_count;
+  return a->vco < b->vco;
+}
+
+bool clock_plan_solve(const clock_plan_request *req, clock_plan *plan) {
+  const uint32_t vco_max = req->vco_max ? req->vco_max : CLOCK_PLAN_VCO_MAX;
+  const uint32_t wanted[] = { req->vpu, req->v3d, req->pixel, req->per, req->pwm };
+  if (req->xtal == 0) return false;
+
+  // every multiple of a wanted rate is a vco that makes that rate exactly, with the right dividers
+  bool found = false;
+  for (unsigned int i = 0; i < (sizeof(wanted) / sizeof(wanted[0])); i++) {
+    const uint32_t rate = wanted[i];
+    if (rate == 0) continue;
+    uint32_t first = (CLOCK_PLAN_VCO_MIN + rate - 1) / rate;
+    uint32_t last = vco_max / rate;
+    if (last < first) continue;
+    if ((last - first) >= MULTIPLES_MAX) last = first + MULTIPLES_MAX - 1;
+    for (uint32_t m = first; m <= last; m++) {
+      clock_plan candidate;
+      if (!plan_vco(req, rate * m, &candidate)) continue;
+      if (found && !better_plan(req, &candidate, plan)) continue;
+      found = true;
+      *plan = candidate;
+    }
+  }
+  return found;
+}
+
+static void dump_cm(const char *name, const clock_plan_cm *cm) {
+  if (!cm->div) return;
+  printf("  %-5s div 0x%06x (%u + %u/4096) mash %d -> %u Hz, %u ppm\n", name, cm->div, cm->div >> 12, cm->div & 0xfff, cm->mash, cm->hz, cm->ppm);
+}
+
+void clock_plan_dump(const clock_plan *plan) {
+  printf("PLLC vco %u Hz, ndiv 0x%x (%u + %u/2^20)%s\n", plan->vco, plan->ndiv, plan->ndiv >> 20, plan->ndiv & 0xfffff, plan->prescale ? ", prescaled" : "");
+  if (plan->core0_div) printf("  CORE0 /%u -> %u Hz\n", plan->core0_div, plan->core0);
+  dump_cm("vpu", &plan->vpu);
+  dump_cm("v3d", &plan->v3d);
+  dump_cm("pixel", &plan->pixel);
+  if (plan->per_div) printf("  PER   /%u -> %u Hz, %u ppm\n", plan->per_div, plan->per, plan->per_ppm);
+  dump_cm("pwm", &plan->pwm);
+  printf("  worst %u ppm, %u clocks on mash\n", plan->worst_ppm, plan->mash_count);
+}
@@ -58,6 +58,11 @@ public:
     return Fixed<storage,integer + b,fraction - b>(s / num.s, true);
   }
 
+  // same as operator/, but rounds to the nearest lsb instead of truncating
+  template<int a, int b> Fixed<storage,integer + b,fraction - b> divRound(Fixed<storage,a,b> num) {
+    return Fixed<storage,integer + b,fraction - b>((s + (num.s / 2)) / num.s, true);
+  }
+
   // TODO, auto-compute storage, based on sum of bits
   template<int a, int b> Fixed<storage,integer + a,fraction + b> operator* (Fixed<storage,a,b> num) {
     return Fixed<storage,integer + a, fraction+b>(s * num.s, true);
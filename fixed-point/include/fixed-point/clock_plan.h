@@ -0,0 +1,79 @@
+#pragma once
+
+// picks a PLLC frequency, its channel dividers and the CM dividers hanging off them, for a set of wanted rates
+// integer math only, so the firmware and clock-plan-check on the host get the same answer
+//
+// the clock tree it models is the one this tree drives:
+//   xtal -> PLLC vco -> CORE0 channel -> CM_VPU, CM_V3D, CM_DPI (pixel)
+//                    -> PER channel   -> CM_PWM
+// vpu and v3d only get integer dividers, pixel and pwm may use MASH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// linux says PLLC runs from 600mhz to 3ghz, above 1.75ghz the feedback prescaler has to be on
+#define CLOCK_PLAN_VCO_MIN      600000000
+#define CLOCK_PLAN_VCO_MAX      2400000000u
+#define CLOCK_PLAN_PRESCALE_MIN 1750000000
+
+// all rates in Hz, 0 means that output isnt needed
+typedef struct {
+  uint32_t xtal;
+  uint32_t vpu;
+  uint32_t v3d;
+  uint32_t pixel;
+  // the PLLC_PER channel itself, what the uart/emmc/hsm dividers are computed against
+  uint32_t per;
+  uint32_t pwm;
+  // errors up to this are treated as exact, so the lower power plan wins, in ppm
+  uint32_t tolerance_ppm;
+  // highest vco to consider, 0 for CLOCK_PLAN_VCO_MAX
+  uint32_t vco_max;
+} clock_plan_request;
+
+typedef struct {
+  // 12.12, as written to CM_*DIV, 0 if the clock isnt used
+  uint32_t div;
+  // 0 for an integer divider, else 1
+  uint8_t mash;
+  // the average rate it really runs at
+  uint32_t hz;
+  uint32_t ppm;
+} clock_plan_cm;
+
+typedef struct {
+  uint32_t xtal;
+  // 12.20, what goes into A2W_PLLC_CTRL and A2W_PLLC_FRAC, already halved if prescale is set
+  uint32_t ndiv;
+  bool prescale;
+  uint32_t vco;
+  // A2W channel dividers, 0 if the channel isnt needed
+  uint32_t core0_div;
+  uint32_t per_div;
+  uint32_t core0;
+  uint32_t per;
+  uint32_t per_ppm;
+  clock_plan_cm vpu, v3d, pixel, pwm;
+  // the worst error of any wanted rate, and how many clocks need MASH
+  uint32_t worst_ppm;
+  uint32_t mash_count;
+} clock_plan;
+
+// false if no plan gets every wanted clock in range
+// ranking is the worst error, clamped to tolerance_ppm, then fewer MASH clocks, then the lowest vco
+bool clock_plan_solve(const clock_plan_request *req, clock_plan *plan);
+// one CM divider of at least min_div, false if goal cant be reached from parent
+// with mash false the divider is rounded to an integer, and the error lands in out->ppm
+bool clock_plan_cm_divider(uint32_t parent, uint32_t goal, unsigned int min_div, bool mash, clock_plan_cm *out);
+// what a 12.20 pll divisor really makes from xtal
+uint32_t clock_plan_pll_rate(uint32_t xtal, uint32_t ndiv, bool prescale);
+uint32_t clock_plan_ppm(uint32_t actual, uint32_t goal);
+void clock_plan_dump(const clock_plan *plan);
+
+#ifdef __cplusplus
+}
+#endif
@@ -9,7 +9,12 @@
 
 extern "C" {
 #endif
+  // 12.20 pll divisor, xtal and goal in kHz, truncated to 14 fraction bits
   uint32_t computePllDivisor(uint32_t xtal, uint32_t goal);
+  // 12.20 pll divisor, xtal and goal in Hz, rounded
+  uint32_t computePllDivisorRounded(uint32_t xtal, uint32_t goal);
+  // 12.12 CM_*DIV divisor, rounded, 0 if it doesnt fit
+  uint32_t computeClockDivisor(uint32_t parent, uint32_t goal);
 #ifdef __cplusplus
 }
 #endif
@@ -2,7 +2,9 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
-MODULE_SRCS += $(LOCAL_DIR)/util.cpp
+MODULE_SRCS += \
+	$(LOCAL_DIR)/util.cpp \
+	$(LOCAL_DIR)/clock_plan.cpp \
 
 MODULE_CPPFLAGS += -O3
 
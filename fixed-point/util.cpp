@@ -24,10 +24,37 @@ Fixed<uint32_t,12,20> computePllDivisorInternal(uint32_t xtal, uint32_t goal) {
   return shifted_divisor;
 }
 
+// the same 12.20 divisor, but from Hz and rounded to the full 20 fraction bits
+Fixed<uint32_t,12,20> computePllDivisorHz(uint32_t xtal, uint32_t goal) {
+  Fixed<uint64_t,44,20> goal_freq = goal;
+  Fixed<uint64_t,32,0> crystal = xtal;
+  Fixed<uint64_t,44,20> divisor = goal_freq.divRound(crystal);
+  return Fixed<uint32_t,12,20>(divisor.s, true);
+}
+
+// the 12.12 divisor the CM_*DIV registers take, 0 if it doesnt fit in 12 integer bits
+Fixed<uint32_t,12,12> computeClockDivisorInternal(uint32_t parent, uint32_t goal) {
+  Fixed<uint64_t,52,12> parent_freq = parent;
+  Fixed<uint64_t,32,0> goal_freq = goal;
+  Fixed<uint64_t,52,12> divisor = parent_freq.divRound(goal_freq);
+  if (divisor.getIntger() >= (1 << 12)) return Fixed<uint32_t,12,12>(0, true);
+  return Fixed<uint32_t,12,12>(divisor.s, true);
+}
+
 extern "C" {
   uint32_t computePllDivisor(uint32_t xtal, uint32_t goal) {
     return computePllDivisorInternal(xtal, goal).s;
   }
+
+  uint32_t computePllDivisorRounded(uint32_t xtal, uint32_t goal) {
+    if (xtal == 0) return 0;
+    return computePllDivisorHz(xtal, goal).s;
+  }
+
+  uint32_t computeClockDivisor(uint32_t parent, uint32_t goal) {
+    if (goal == 0) return 0;
+    return computeClockDivisorInternal(parent, goal).s;
+  }
 }
 
 
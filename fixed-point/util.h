@@ -4,7 +4,11 @@
 
 Fixed<uint32_t,12,20> computePllDivisorInternal(uint32_t xtal, uint32_t goal);
 Fixed<uint32_t,16,6> computePL011Divisor(uint32_t refclk_in, uint32_t baud);
+Fixed<uint32_t,12,20> computePllDivisorHz(uint32_t xtal, uint32_t goal);
+Fixed<uint32_t,12,12> computeClockDivisorInternal(uint32_t parent, uint32_t goal);
 
 extern "C" {
   uint32_t computePllDivisor(uint32_t xtal, uint32_t goal);
+  uint32_t computePllDivisorRounded(uint32_t xtal, uint32_t goal);
+  uint32_t computeClockDivisor(uint32_t parent, uint32_t goal);
 }
@@ -5,6 +5,7 @@
 #include <lib/io.h>
 #include <lk/debug.h>
 #include <lk/init.h>
+#include <platform/bcm28xx/dma_blit.h>
 #include <platform/bcm28xx/hvs.h>
 #include <string.h>
 #include <lk/console_cmd.h>
@@ -47,6 +48,8 @@ static struct {
 
     hvs_layer layer0;
     hvs_layer layer1;
+
+    dma_blit blit;
 } gfxconsole;
 
 static const int channel = PRIMARY_HVS_CHANNEL;
@@ -65,7 +68,11 @@ void gfxconsole_print_callback(print_callback_t *callback, const char *str, size
 
 static void clear_line(uint line) {
   const uint real_y = (line + gfxconsole.viewport_top) % gfxconsole.rows;
-  gfx_fillrect(gfxconsole.surface, 0, real_y * FONT_Y, gfxconsole.surface->width, FONT_Y, gfxconsole.back_color);
+  dma_blit_reset(&gfxconsole.blit);
+  dma_blit_fill(&gfxconsole.blit, gfxconsole.surface, 0, real_y * FONT_Y, gfxconsole.surface->width, FONT_Y, gfxconsole.back_color);
+  // font_draw_char() is about to draw into it, so this cant be left running
+  // prints come in under the print spinlock with irqs off, dma_blit_submit() then does it on the cpu instead of waiting on the dma irq
+  dma_blit_run(&gfxconsole.blit);
 }
 
 static void adjust_sprites(void) {
@@ -184,8 +191,9 @@ void gfxconsole_start(void) {
     const gfx_format fmt = GFX_FORMAT_ARGB_8888;
     gfxconsole.surface = gfx_create_surface(NULL, gfxconsole.columns * FONT_X, gfxconsole.rows * FONT_Y, gfxconsole.columns * FONT_X, fmt);
 
-    //bzero(gfxconsole.surface->ptr, gfxconsole.surface->len);
-    gfx_fillrect(gfxconsole.surface, 0, 0, gfxconsole.columns * FONT_X, gfxconsole.rows * FONT_Y, 0xff0000AA);
+    dma_blit_init(&gfxconsole.blit, 2);
+    dma_blit_fill(&gfxconsole.blit, gfxconsole.surface, 0, 0, gfxconsole.columns * FONT_X, gfxconsole.rows * FONT_Y, 0xff0000AA);
+    dma_blit_run(&gfxconsole.blit);
 
     dprintf(SPEW, "gfxconsole: rows %d, columns %d, extray %d\n", gfxconsole.rows, gfxconsole.columns, gfxconsole.extray);
 
@@ -4,7 +4,8 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS += \
 	lib/gfx \
-	lib/font
+	lib/font \
+	platform/bcm28xx/blit \
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/fasterconsole.c
@@ -0,0 +1,6 @@
+#include <time.h>
+
+// luaconf.h is patched to call this for the hash seed, on the host any value works
+unsigned int lk_luai_makeseed(void) {
+  return time(NULL);
+}
@@ -1,7 +1,16 @@
 #pragma once
 
+typedef struct lua_pool lua_pool_t;
+
 void lua_prettyprint(lua_State *L, int index);
 void register_globals(lua_State *L);
 int luaL_loadstring(lua_State *L, const char *s);
+int luaL_loadbuffer(lua_State *L, const void *buffer, size_t size, const char *name);
 void* lua_allocator(void *ud, void *ptr, size_t osize, size_t nsize);
 int luaL_loadfile(lua_State *L, const char *filename);
+
+// small-object allocator, pass the pool as the ud of lua_newstate
+lua_pool_t *lua_pool_create(void);
+void lua_pool_destroy(lua_pool_t *pool);
+void lua_pool_dump(lua_pool_t *pool);
+void *lua_pool_allocator(void *ud, void *ptr, size_t osize, size_t nsize);
@@ -1,15 +1,11 @@
 #include <lib/fs.h>
 #include <lua.h>
+#include <lib/lua/lua-utils.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct {
-  int pos; // offset into file
-  filehandle *fd;
-  char buff[512];
-} lua_filehandle;
-
 void lua_prettyprint(lua_State *L, int index) {
   const char *str;
   int type = lua_type(L, index);
@@ -64,6 +60,14 @@ int luaL_loadstring(lua_State *L, const char *s) {
   return lua_load(L, &memfs_read, &fd, "loadstring", NULL);
 }
 
+int luaL_loadbuffer(lua_State *L, const void *buffer, size_t size, const char *name) {
+  mem_handle fd;
+  fd.buffer = buffer;
+  fd.size = size;
+  // lua_load checks the first byte for LUA_SIGNATURE, so this takes both source and luac output
+  return lua_load(L, &memfs_read, &fd, name, NULL);
+}
+
 void* lua_allocator(void *ud, void *ptr, size_t osize, size_t nsize) {
   if (nsize == 0) {
     free(ptr);
@@ -73,23 +77,205 @@ void* lua_allocator(void *ud, void *ptr, size_t osize, size_t nsize) {
   }
 }
 
-const char *lk_fs_read(lua_State *L, void *data, size_t *size) {
-  lua_filehandle *fd = data;
-  *size = fs_read_file(fd->fd, fd->buff, fd->pos, 512);
-  fd->pos += *size;
-  return fd->buff;
+// lua makes a lot of small short-lived objects (strings, closures, table nodes)
+// so everything up to POOL_MAX_SIZE comes out of per-size free lists carved from big slabs
+// lua passes the old size on every free/realloc, so blocks need no header
+#define POOL_CLASSES 5 // 16, 32, 64, 128, 256
+#define POOL_MAX_SIZE (16 << (POOL_CLASSES - 1))
+#define POOL_SLAB_SIZE (16 * 1024)
+#define POOL_SLAB_HEADER 16
+
+struct pool_block {
+  struct pool_block *next;
+};
+
+struct lua_pool {
+  struct pool_block *free[POOL_CLASSES];
+  struct pool_block *slabs;
+  uint8_t *cursor;
+  size_t remaining;
+  uint32_t slab_count;
+  uint32_t pooled[POOL_CLASSES];
+  size_t large_bytes;
+  // large blocks kept by a shrink that couldnt get a pooled block, they end up on the free lists and not in any slab
+  uint32_t adopted;
+};
+
+static int pool_class(size_t size) {
+  int class = 0;
+  size_t class_size = 16;
+  if (size > POOL_MAX_SIZE) return -1;
+  while (class_size < size) {
+    class_size <<= 1;
+    class++;
+  }
+  return class;
+}
+
+static void *pool_carve(lua_pool_t *pool, int class) {
+  size_t size = 16 << class;
+  if (pool->remaining < size) {
+    // whatever is left in the old slab is too small for this class, it gets wasted
+    struct pool_block *slab = malloc(POOL_SLAB_SIZE);
+    if (!slab) return NULL;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->cursor = ((uint8_t*)slab) + POOL_SLAB_HEADER;
+    pool->remaining = POOL_SLAB_SIZE - POOL_SLAB_HEADER;
+    pool->slab_count++;
+  }
+  void *block = pool->cursor;
+  pool->cursor += size;
+  pool->remaining -= size;
+  return block;
+}
+
+static void *pool_alloc(lua_pool_t *pool, size_t size) {
+  int class = pool_class(size);
+  if (class < 0) {
+    void *ret = malloc(size);
+    if (ret) pool->large_bytes += size;
+    return ret;
+  }
+  struct pool_block *block = pool->free[class];
+  if (block) {
+    pool->free[class] = block->next;
+  } else {
+    block = pool_carve(pool, class);
+    if (!block) return NULL;
+  }
+  pool->pooled[class]++;
+  return block;
+}
+
+static bool in_slab(lua_pool_t *pool, const void *ptr) {
+  for (struct pool_block *slab = pool->slabs; slab; slab = slab->next) {
+    if (((const uint8_t*)ptr >= (const uint8_t*)slab) && ((const uint8_t*)ptr < ((const uint8_t*)slab + POOL_SLAB_SIZE))) return true;
+  }
+  return false;
+}
+
+static void pool_free(lua_pool_t *pool, void *ptr, size_t size) {
+  int class = pool_class(size);
+  if (class < 0) {
+    pool->large_bytes -= size;
+    free(ptr);
+    return;
+  }
+  pool->pooled[class]--;
+  struct pool_block *block = ptr;
+  block->next = pool->free[class];
+  pool->free[class] = block;
+}
+
+lua_pool_t *lua_pool_create(void) {
+  lua_pool_t *pool = calloc(1, sizeof(lua_pool_t));
+  return pool;
 }
 
+// only valid after lua_close(), frees every slab at once
+void lua_pool_destroy(lua_pool_t *pool) {
+  // adopted blocks came from malloc, so they are freed on their own, everything is on a free list by now
+  if (pool->adopted) {
+    for (int i=0; i<POOL_CLASSES; i++) {
+      struct pool_block *block = pool->free[i];
+      while (block) {
+        struct pool_block *next = block->next;
+        if (!in_slab(pool, block)) free(block);
+        block = next;
+      }
+    }
+  }
+  struct pool_block *slab = pool->slabs;
+  while (slab) {
+    struct pool_block *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  free(pool);
+}
+
+void lua_pool_dump(lua_pool_t *pool) {
+  printf("lua pool: %d slabs of %d bytes, %zu bytes in large allocations, %d adopted\n", pool->slab_count, POOL_SLAB_SIZE, pool->large_bytes, pool->adopted);
+  for (int i=0; i<POOL_CLASSES; i++) {
+    printf("  %3d byte blocks: %d live\n", 16 << i, pool->pooled[i]);
+  }
+}
+
+void *lua_pool_allocator(void *ud, void *ptr, size_t osize, size_t nsize) {
+  lua_pool_t *pool = ud;
+  if (ptr == NULL) {
+    // osize is the object type, not a size
+    if (nsize == 0) return NULL;
+    return pool_alloc(pool, nsize);
+  }
+  if (nsize == 0) {
+    pool_free(pool, ptr, osize);
+    return NULL;
+  }
+  int oclass = pool_class(osize);
+  int nclass = pool_class(nsize);
+  if ((oclass >= 0) && (oclass == nclass)) return ptr;
+  if ((oclass < 0) && (nclass < 0)) {
+    void *ret = realloc(ptr, nsize);
+    if (ret) {
+      pool->large_bytes += nsize - osize;
+      return ret;
+    }
+    // lua doesnt allow a shrink to fail, the block is already big enough
+    if (nsize > osize) return NULL;
+    pool->large_bytes -= osize - nsize;
+    return ptr;
+  }
+  void *ret = pool_alloc(pool, nsize);
+  if (ret) {
+    memcpy(ret, ptr, osize < nsize ? osize : nsize);
+    pool_free(pool, ptr, osize);
+    return ret;
+  }
+  if (nsize > osize) return NULL;
+  // a failed shrink keeps the block, and from here on it counts as the class lua now thinks it is
+  // it is at least that big, so it can go on that free list when lua frees it
+  if (oclass < 0) {
+    pool->large_bytes -= osize;
+    pool->adopted++;
+  } else {
+    pool->pooled[oclass]--;
+  }
+  pool->pooled[nclass]++;
+  return ptr;
+}
+
+// reads the whole file in one go, then hands lua the buffer, rather than feeding the parser 512 bytes at a time
 int luaL_loadfile(lua_State *L, const char *filename) {
-  lua_filehandle fh;
-  fh.pos = 0;
-  int ret = fs_open_file(filename, &fh.fd);
+  filehandle *fh;
+  int ret = fs_open_file(filename, &fh);
   if (ret) {
-    lua_pushfstring(L, "cannot open %s: %s", filename, ret);
-    printf("failed to open %s: %d\n", filename, ret);
+    lua_pushfstring(L, "cannot open %s: %d", filename, ret);
+    return LUA_ERRERR;
+  }
+  struct file_stat stat;
+  ret = fs_stat_file(fh, &stat);
+  if (ret) {
+    fs_close_file(fh);
+    lua_pushfstring(L, "cannot stat %s: %d", filename, ret);
+    return LUA_ERRERR;
+  }
+  size_t size = stat.size;
+  void *buffer = malloc(size);
+  if (!buffer) {
+    fs_close_file(fh);
+    lua_pushfstring(L, "cannot allocate %d bytes for %s", (int)size, filename);
+    return LUA_ERRMEM;
+  }
+  ssize_t got = fs_read_file(fh, buffer, 0, size);
+  fs_close_file(fh);
+  if (got != (ssize_t)size) {
+    free(buffer);
+    lua_pushfstring(L, "short read on %s: %d", filename, (int)got);
     return LUA_ERRERR;
   }
-  ret = lua_load(L, &lk_fs_read, &fh, filename, NULL);
-  fs_close_file(fh.fd);
+  ret = luaL_loadbuffer(L, buffer, size, filename);
+  free(buffer);
   return ret;
 }
@@ -1,4 +1,5 @@
 #include <app.h>
+#include <arch/ops.h>
 #include <assert.h>
 #include <dev/gpio.h>
 #include <kernel/timer.h>
@@ -8,8 +9,10 @@
 #include <lk/reg.h>
 #include <platform/bcm28xx/a2w.h>
 #include <platform/bcm28xx/arm.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/cm.h>
+#include <platform/bcm28xx/dma.h>
 #include <platform/bcm28xx/gpio.h>
 #include <platform/bcm28xx/hvs.h>
 #include <platform/bcm28xx/inter-arch.h>
@@ -26,11 +29,35 @@
   #define MB (1024*1024)
 #endif
 
+// arm_init() maps the lower 64mb as plain ram, the payload and its dtb have to fit in it
+#define ARM_LOW_RAM (64 * MB)
+
 typedef struct {
   uint8_t *payload_addr;
   uint32_t payload_size;
+  // both recorded by payload-info.py, header_offset is 0xffffffff if it found no header
+  uint32_t header_offset;
+  uint32_t crc32;
 } arm_payload;
 
+// the payload is copied by a chain of control blocks, one per chunk, while arm_init() gets the rest ready
+// the crc trails the dma, a chunk at a time, so the check is done about when the copy is
+// 5 is the blitter
+#define ARM_PAYLOAD_DMA_CHANNEL 4
+#define ARM_PAYLOAD_CHUNK (64 * 1024)
+// a chunk takes around 1ms, if the channel sits on one this long it is stuck, and the cpu does the copy
+#define ARM_PAYLOAD_CHUNK_TIMEOUT_US 20000
+
+typedef struct {
+  dma_cb *cbs;
+  uint32_t chunks;
+  uint8_t *dest;
+  uint32_t size;
+  uint32_t start;
+} payload_copy_t;
+
+static payload_copy_t payload_copy;
+
 typedef struct {
   uint8_t *stub_addr;
   uint32_t stub_size;
@@ -109,28 +136,29 @@ static void setup_framebuffer(void) {
 
 #define checkerr if (ret < 0) { printf("%s():%d error %d %s\n", __FUNCTION__, __LINE__, ret, fdt_strerror(ret)); return NULL; }
 
-static void *setupInterArchDtb(void) {
-  size_t buffer_size = 1 * 1024 * 1024;
-  void *v_fdt = memalign(8, buffer_size);
+// built in place, v_fdt is where the arm will find it, and fdt_finish() leaves it packed
+static void *setupInterArchDtb(void *v_fdt, size_t budget) {
+  // the offset of each well known node, a node starts where the struct block ends when it is begun
+  fdt32_t index[INTER_ARCH_NODES] = { 0 };
   int ret;
 
-  ret = fdt_create(v_fdt, buffer_size);
+  ret = fdt_create(v_fdt, budget);
   checkerr;
-  //puts("a");
 
   ret = fdt_finish_reservemap(v_fdt);
   checkerr;
-  //printf("b %d\n", fdt_size_dt_struct(v_fdt));
 
   ret = fdt_begin_node(v_fdt, "root");
   checkerr;
-  //printf("c %d\n", fdt_size_dt_struct(v_fdt));
 
+  // properties go before the subnodes, so this is filled in after fdt_finish()
+  ret = fdt_property(v_fdt, "index", index, sizeof(index));
+  checkerr;
 
   {
+    index[INTER_ARCH_FRAMEBUFFER] = cpu_to_fdt32(fdt_size_dt_struct(v_fdt));
     ret = fdt_begin_node(v_fdt, "framebuffer");
     checkerr;
-    //printf("c2 %d\n", fdt_size_dt_struct(v_fdt));
 
     fdt_property_u32(v_fdt, "width", w);
     fdt_property_u32(v_fdt, "height", h);
@@ -141,17 +169,35 @@ static void *setupInterArchDtb(void) {
   }
 
   {
+    index[INTER_ARCH_TIMESTAMPS] = cpu_to_fdt32(fdt_size_dt_struct(v_fdt));
     ret = fdt_begin_node(v_fdt, "timestamps");
     checkerr;
 
+    const uint32_t arm_start = *REG32(ST_CLO);
     fdt_property_u32(v_fdt, "3stage2_arch_init", arch_init_timestamp);
-    fdt_property_u32(v_fdt, "4stage2_arm_start", *REG32(ST_CLO));
+    fdt_property_u32(v_fdt, "4stage2_arm_start", arm_start);
+    boot_trace_at(arm_start, BT_STAGE2_ARM_START, 0);
+
+    ret = fdt_end_node(v_fdt);
+    checkerr;
+  }
+
+  {
+    // the whole vpu side of the boot, inter-arch.c puts it in front of the arm events
+    index[INTER_ARCH_BOOT_TRACE] = cpu_to_fdt32(fdt_size_dt_struct(v_fdt));
+    ret = fdt_begin_node(v_fdt, "boot-trace");
+    checkerr;
+
+    const boot_trace_ring *ring = boot_trace_get();
+    ret = fdt_property(v_fdt, "ring", ring, sizeof(*ring));
+    checkerr;
 
     ret = fdt_end_node(v_fdt);
     checkerr;
   }
 
   {
+    index[INTER_ARCH_OTP] = cpu_to_fdt32(fdt_size_dt_struct(v_fdt));
     ret = fdt_begin_node(v_fdt, "otp");
     checkerr;
 
@@ -164,11 +210,13 @@ static void *setupInterArchDtb(void) {
 
   ret = fdt_end_node(v_fdt);
   checkerr;
-  //puts("d");
 
   ret = fdt_finish(v_fdt);
   checkerr;
-  //puts("e");
+
+  // the struct block doesnt move in fdt_finish(), only the strings do, so the offsets still hold
+  ret = fdt_setprop_inplace(v_fdt, 0, "index", index, sizeof(index));
+  checkerr;
 
   return v_fdt;
 }
@@ -246,19 +294,98 @@ static void choose_armstub(uint32_t bits) {
 
 //static uint32_t orig_checksum;
 
-static void copy_arm_payload_to(uint32_t offset) {
-  void *original_start = chosenPayload->payload_addr;
-  uint32_t size = chosenPayload->payload_size;
+static void start_arm_payload_copy(uint32_t offset) {
+  payload_copy_t *c = &payload_copy;
+  uint8_t *src = chosenPayload->payload_addr;
+  c->dest = (uint8_t*)(0xc0000000 + offset);
+  c->size = chosenPayload->payload_size;
+  c->chunks = (c->size + ARM_PAYLOAD_CHUNK - 1) / ARM_PAYLOAD_CHUNK;
+  c->start = *REG32(ST_CLO);
+  boot_trace_at(c->start, BT_STAGE2_PAYLOAD_COPY_START, c->size / 1024);
+  c->cbs = memalign(32, c->chunks * sizeof(dma_cb));
+  logf("MEMORY: 0x%x + 0x%x: arm payload\n", offset, c->size);
+  if (!c->cbs) {
+    memcpy(c->dest, src, c->size);
+    return;
+  }
 
-  void *dest = (void*)(0xc0000000 + offset);
+  for (uint32_t i=0; i < c->chunks; i++) {
+    const uint32_t pos = i * ARM_PAYLOAD_CHUNK;
+    dma_cb *cb = &c->cbs[i];
+    // WAIT_RESP keeps the channel on this block until its writes land, so moving on means the chunk is readable
+    cb->ti = DMA_TI_SRC_INC | DMA_TI_DEST_INC | DMA_TI_SRC_WIDE | DMA_TI_DEST_WIDE | DMA_TI_BURST(16) | DMA_TI_WAIT_RESP;
+    cb->source = dma_bus_addr(src + pos);
+    cb->dest = dma_bus_addr(c->dest + pos);
+    cb->length = MIN(ARM_PAYLOAD_CHUNK, c->size - pos);
+    cb->stride = 0;
+    cb->next_block = (i + 1) < c->chunks ? dma_bus_addr(&c->cbs[i + 1]) : 0;
+    cb->pad1 = 0;
+    cb->pad2 = 0;
+  }
+  arch_clean_cache_range((addr_t)src, c->size);
+  arch_clean_cache_range((addr_t)c->cbs, c->chunks * sizeof(dma_cb));
 
-  memcpy(dest, original_start, size);
-  //uint32_t crc = crc32(0, original_start, size);
-  //uint32_t crc2 = crc32(0, dest, size);
-  //logf("checksums 0x%08x 0x%08x, size: %d\n", crc, crc2, size);
+  dma_controller *chan = get_dma(ARM_PAYLOAD_DMA_CHANNEL);
+  chan->cs = DMA_CS_RESET;
+  chan->conblk_ad = dma_bus_addr(c->cbs);
+  chan->cs = DMA_CS_ACTIVE | DMA_CS_PRIORITY(8) | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_WAIT_WRITES;
+}
 
-  logf("MEMORY: 0x0 + 0x%x: arm payload\n", chosenPayload->payload_size);
-  //orig_checksum = crc;
+static bool chunk_landed(dma_controller *chan, const payload_copy_t *c, uint32_t i) {
+  if (!(chan->cs & DMA_CS_ACTIVE)) return true;
+  // the channel holds the block it is working on, or 0 once it ran off the end of the chain
+  const uint32_t current = chan->conblk_ad;
+  return (current == 0) || (current > dma_bus_addr(&c->cbs[i]));
+}
+
+// waits for the copy while checksumming it, false if the payload in arm ram doesnt match what was built
+static bool finish_arm_payload_copy(void) {
+  payload_copy_t *c = &payload_copy;
+  uint8_t *src = chosenPayload->payload_addr;
+  uint32_t crc = 0;
+  bool dma_ok = c->cbs != NULL;
+
+  if (c->cbs) {
+    dma_controller *chan = get_dma(ARM_PAYLOAD_DMA_CHANNEL);
+    for (uint32_t i=0; i < c->chunks; i++) {
+      const uint32_t wait_start = *REG32(ST_CLO);
+      bool stuck = false;
+      while (!chunk_landed(chan, c, i)) {
+        if (chan->cs & DMA_CS_ERROR) break;
+        if ((*REG32(ST_CLO) - wait_start) > ARM_PAYLOAD_CHUNK_TIMEOUT_US) {
+          stuck = true;
+          break;
+        }
+      }
+      if (stuck || (chan->cs & DMA_CS_ERROR)) {
+        logf("dma %s, CS 0x%x, at chunk %d of %d\n", stuck ? "timed out" : "error", chan->cs, i, c->chunks);
+        chan->cs = DMA_CS_RESET;
+        dma_ok = false;
+        break;
+      }
+      const uint32_t pos = i * ARM_PAYLOAD_CHUNK;
+      crc = crc32(crc, c->dest + pos, MIN(ARM_PAYLOAD_CHUNK, c->size - pos));
+    }
+    free(c->cbs);
+    c->cbs = NULL;
+  }
+
+  if (!dma_ok) {
+    memcpy(c->dest, src, c->size);
+    crc = crc32(0, c->dest, c->size);
+  } else if (crc != chosenPayload->crc32) {
+    // one more go with the cpu, in case it was the copy and not the payload
+    logf("checksum 0x%08x, wanted 0x%08x, copying again\n", crc, chosenPayload->crc32);
+    memcpy(c->dest, src, c->size);
+    crc = crc32(0, c->dest, c->size);
+  }
+  boot_trace(BT_STAGE2_PAYLOAD_COPIED, crc == chosenPayload->crc32);
+  logf("payload copied and checked in %d uSec, crc 0x%08x\n", *REG32(ST_CLO) - c->start, crc);
+  if (crc != chosenPayload->crc32) {
+    logf("arm payload is corrupt, 0x%08x != 0x%08x\n", crc, chosenPayload->crc32);
+    return false;
+  }
+  return true;
 }
 
 #if 0
@@ -279,35 +406,36 @@ static void rechecksum_arm(void) {
 #endif
 
 static inter_core_header *find_header(uint32_t *start, uint32_t size) {
-  for (uint32_t *i = start; i < (start + size); i += 4) { // increment by 16 bytes
+  const uint32_t offset = chosenPayload->header_offset;
+  if ((offset < size) && (start[offset / 4] == INTER_ARCH_MAGIC)) return (inter_core_header*)(start + (offset / 4));
+  // only payloads built without the header get here
+  logf("no header recorded at build time, scanning\n");
+  for (uint32_t *i = start; i < (start + (size / 4)); i += 4) { // increment by 16 bytes
     if (*i == INTER_ARCH_MAGIC) return (inter_core_header*)i;
   }
   return NULL;
 }
 
 static bool patch_arm_payload(void) {
-  void *dtb_src = setupInterArchDtb();
-  if (!dtb_src) return false;
-  void *dtb_dst = (void*) ROUNDUP(chosenPayload->payload_size, 8);
+  const uint32_t start = *REG32(ST_CLO);
+  uint32_t dtb_base = ROUNDUP(chosenPayload->payload_size, 8);
 
-  uint32_t t0 = *REG32(ST_CLO);
-  inter_core_header *hdr = find_header((uint32_t*)0xc0000000, chosenPayload->payload_size);
-  uint32_t t1 = *REG32(ST_CLO);
+  // end_of_ram is read from the payload as built, the copy in arm ram only gets dtb_base written into it
+  inter_core_header *hdr = find_header((uint32_t*)chosenPayload->payload_addr, chosenPayload->payload_size);
   if (hdr) {
-    printf("header found at %p in %d uSec\n", hdr, t1-t0);
     logf("MEMORY: 0x0 + 0x%x: payload ram\n", hdr->end_of_ram);
-    dtb_dst = (void*)(ROUNDUP(hdr->end_of_ram, 8));
+    dtb_base = ROUNDUP(hdr->end_of_ram, 8);
+    hdr = (inter_core_header*)(payload_copy.dest + ((uint8_t*)hdr - chosenPayload->payload_addr));
+  }
+  if ((dtb_base + INTER_ARCH_DTB_MAX) > ARM_LOW_RAM) {
+    logf("no room for the dtb at 0x%x, the arm only has %d MB of plain ram\n", dtb_base, ARM_LOW_RAM / MB);
+    return false;
   }
 
-  int ret;
-  size_t size = fdt_totalsize(dtb_src);
-
-  printf("fdt move %p -> %p, size: %d\n", dtb_src, dtb_dst, size);
-  ret = fdt_move(dtb_src, (void*)(0xc0000000 | (uint32_t)dtb_dst), size);
-  checkerr;
-  free(dtb_src);
-  hdr->dtb_base = (uint32_t)dtb_dst;
-  logf("MEMORY: %p + 0x%x: inter arch dtb\n", dtb_dst, size);
+  void *dtb = setupInterArchDtb((void*)(0xc0000000 | dtb_base), INTER_ARCH_DTB_MAX);
+  if (!dtb) return false;
+  if (hdr) hdr->dtb_base = dtb_base;
+  logf("MEMORY: 0x%x + 0x%x: inter arch dtb, built in place in %d uSec\n", dtb_base, fdt_totalsize(dtb), *REG32(ST_CLO) - start);
   return true;
 }
 
@@ -321,6 +449,7 @@ static void cam1_enable(void) {
 
 static void __attribute__(( optimize("-O1"))) arm_init(uint level) {
   bool jtag = false;
+  boot_trace(BT_STAGE2_ARM_INIT, 0);
 
 #if ARMSTUB == 1
   choose_armstub(32);
@@ -345,12 +474,11 @@ static void __attribute__(( optimize("-O1"))) arm_init(uint level) {
 
   //cam1_enable();
 
+  // runs in the background until finish_arm_payload_copy(), right before the arm is let go
 #if ARMSTUB == 1
-  copy_arm_payload_to(0x8000);
-  patch_arm_payload();
+  start_arm_payload_copy(0x8000);
 #else
-  copy_arm_payload_to(0);
-  patch_arm_payload();
+  start_arm_payload_copy(0);
 #endif
 
   // first pass, map everything to the framebuffer, to act as a default
@@ -412,9 +540,19 @@ static void __attribute__(( optimize("-O1"))) arm_init(uint level) {
 
   setupClock();
   //printregs();
+  if (!finish_arm_payload_copy()) {
+    logf("not starting the arm\n");
+    return;
+  }
+  // without the dtb, or with dtb_base left unpatched, the payload would read whatever is past its ram
+  if (!patch_arm_payload()) {
+    logf("not starting the arm\n");
+    return;
+  }
   power_arm_start();
   //printregs();
   bridgeStart(true);
+  boot_trace(BT_STAGE2_ARM_RELEASED, 0);
   printregs();
 }
 
@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+# generates payload_info.h for payload.S, from the arm lk.bin files it incbins
+# for each payload it records where the inter-arch header is, so arm.c doesnt have to scan for it at boot,
+# and the crc32 of the whole image, that the copy into arm ram is checked against
+# usage: payload-info.py NAME=path/to/lk.bin ...
+
+import struct
+import sys
+import zlib
+
+INTER_ARCH_MAGIC = 0xa8ca6706
+# magic, header_size, dtb_base, mmio_base, end_of_ram
+HEADER_SIZE = 5 * 4
+# what arm.c treats as not recorded
+NO_OFFSET = 0xffffffff
+
+def find_header(data):
+  magic = struct.pack('<I', INTER_ARCH_MAGIC)
+  i = data.find(magic)
+  while i >= 0:
+    # the header is 16 byte aligned, and the word after the magic is its own size
+    if (i % 16) == 0 and struct.unpack('<I', data[i + 4:i + 8])[0] == HEADER_SIZE:
+      return i
+    i = data.find(magic, i + 1)
+  return NO_OFFSET
+
+def main(args):
+  print('#pragma once')
+  print('// generated by payload-info.py, dont edit')
+  for arg in args:
+    name, path = arg.split('=', 1)
+    with open(path, 'rb') as f:
+      data = f.read()
+    offset = find_header(data)
+    if offset == NO_OFFSET:
+      sys.stderr.write('%s: no inter-arch header, arm.c will have to scan for it\n' % path)
+    print('#define %s_HEADER_OFFSET 0x%x' % (name, offset))
+    print('#define %s_CRC32 0x%08x' % (name, zlib.crc32(data) & 0xffffffff))
+
+if __name__ == '__main__':
+  main(sys.argv[1:])
@@ -2,11 +2,22 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 MODULE_SRCS += $(LOCAL_DIR)/arm.c $(LOCAL_DIR)/payload.S
 
-MODULES += platform/bcm28xx/power lib/cksum lib/fdt app/inter-arch
+MODULES += platform/bcm28xx/power platform/bcm28xx/dma lib/cksum lib/fdt app/inter-arch
 
-$(BUILDDIR)/platform/bcm28xx/arm/payload.S.o: build-rpi1-test/lk.bin build-rpi2-test/lk.bin build-rpi3-test/lk.bin
+ARM_PAYLOADS := build-rpi1-test/lk.bin build-rpi2-test/lk.bin build-rpi3-test/lk.bin
+ARM_PAYLOAD_INFO := $(BUILDDIR)/platform/bcm28xx/arm/payload_info.h
 
-MODULE_INCLUDES += $(ARMSTUBS)
+# header offsets and crc32 of each payload, so arm.c can skip the header scan and check the copy
+$(ARM_PAYLOAD_INFO): $(LOCAL_DIR)/payload-info.py $(ARM_PAYLOADS)
+	@echo generating $@
+	@$(MKDIR)
+	python $< BCM2835=build-rpi1-test/lk.bin BCM2836=build-rpi2-test/lk.bin BCM2837=build-rpi3-test/lk.bin > $@
+
+GENERATED += $(ARM_PAYLOAD_INFO)
+
+$(BUILDDIR)/platform/bcm28xx/arm/payload.S.o: $(ARM_PAYLOADS) $(ARM_PAYLOAD_INFO)
+
+MODULE_INCLUDES += $(ARMSTUBS) $(BUILDDIR)/platform/bcm28xx/arm
 
 MODULE_DEFINES += ARM_FREQ_MHZ=$(ARM_FREQ_MHZ)
 
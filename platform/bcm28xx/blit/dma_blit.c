@@ -0,0 +1,481 @@
+#include <arch/ops.h>
+#include <assert.h>
+#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <lib/gfx.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <lk/init.h>
+#include <lk/macros.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/dma.h>
+#include <platform/bcm28xx/dma_blit.h>
+#include <platform/interrupts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum dma_blit_mode dma_blit_mode = DMA_BLIT_AUTO;
+
+static bool blit_ready = false;
+static spin_lock_t blit_lock = SPIN_LOCK_INITIAL_VALUE;
+// batches waiting for the channel, and the one on it
+static struct list_node blit_queue = LIST_INITIAL_VALUE(blit_queue);
+static dma_blit *blit_active = NULL;
+// signaled whenever nothing is queued, so a cpu batch can wait its turn
+static event_t blit_idle;
+
+static uint32_t dma_batches, cpu_batches, dma_errors;
+
+static int cmd_blit_bench(int argc, const console_cmd_args *argv);
+static int cmd_blit_mode(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("blit_bench", "compare dma and cpu fill/copy speed", &cmd_blit_bench)
+STATIC_COMMAND("blit_mode", "show or set the blitter mode, auto|cpu|dma", &cmd_blit_mode)
+STATIC_COMMAND_END(dma_blit);
+
+status_t dma_blit_init(dma_blit *b, uint32_t capacity) {
+  memset(b, 0, sizeof(*b));
+  b->ops = malloc(capacity * sizeof(dma_blit_op));
+  // most ops are a single 2d control block
+  b->cb_capacity = capacity * 2;
+  b->cbs = memalign(32, b->cb_capacity * sizeof(dma_cb));
+  if (!b->ops || !b->cbs) {
+    dma_blit_free(b);
+    return ERR_NO_MEMORY;
+  }
+  b->capacity = capacity;
+  // signaled, so waiting on a batch that was never submitted returns right away
+  event_init(&b->done, true, 0);
+  return NO_ERROR;
+}
+
+void dma_blit_free(dma_blit *b) {
+  // also called on a failed or never ran dma_blit_init(), where done was never set up
+  if (b->busy) dma_blit_wait(b);
+  free(b->ops);
+  free(b->cbs);
+  b->ops = NULL;
+  b->cbs = NULL;
+  b->capacity = 0;
+  b->cb_capacity = 0;
+}
+
+void dma_blit_reset(dma_blit *b) {
+  b->count = 0;
+  b->bytes = 0;
+}
+
+static status_t add_op(dma_blit *b, const dma_blit_op *op) {
+  if (b->busy) return ERR_BUSY;
+  if (b->count >= b->capacity) return ERR_NO_MEMORY;
+  if ((op->rows == 0) || (op->row_bytes == 0)) return NO_ERROR;
+  b->ops[b->count++] = *op;
+  b->bytes += op->row_bytes * op->rows;
+  return NO_ERROR;
+}
+
+// ARGB8888 to the surface format, repeated to fill 32bits
+static uint32_t fill_pattern(const gfx_surface *s, uint32_t color) {
+  uint32_t r = (color >> 16) & 0xff;
+  uint32_t g = (color >> 8) & 0xff;
+  uint32_t b = color & 0xff;
+  switch (s->format) {
+  case GFX_FORMAT_RGB_565: {
+    uint32_t c = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    return c | (c << 16);
+  }
+  case GFX_FORMAT_RGB_332: {
+    uint32_t c = ((r >> 5) << 5) | ((g >> 5) << 2) | (b >> 6);
+    return c * 0x01010101;
+  }
+  default:
+    return color;
+  }
+}
+
+static bool clip(const gfx_surface *s, uint *x, uint *y, uint *w, uint *h) {
+  if ((*x >= s->width) || (*y >= s->height)) return false;
+  if ((*x + *w) > s->width) *w = s->width - *x;
+  if ((*y + *h) > s->height) *h = s->height - *y;
+  return (*w > 0) && (*h > 0);
+}
+
+static inline uint32_t surface_pitch(const gfx_surface *s) {
+  return s->stride * s->pixelsize;
+}
+
+static inline uint8_t *surface_pixel(const gfx_surface *s, uint x, uint y) {
+  return (uint8_t*)s->ptr + (y * surface_pitch(s)) + (x * s->pixelsize);
+}
+
+status_t dma_blit_fill(dma_blit *b, gfx_surface *s, uint x, uint y, uint w, uint h, uint32_t color) {
+  if (!clip(s, &x, &y, &w, &h)) return NO_ERROR;
+  dma_blit_op op = {
+    .dst = surface_pixel(s, x, y),
+    .dst_pitch = surface_pitch(s),
+    .row_bytes = w * s->pixelsize,
+    .rows = h,
+    .pattern = fill_pattern(s, color),
+  };
+  return add_op(b, &op);
+}
+
+status_t dma_blit_copy(dma_blit *b, gfx_surface *dst, uint dx, uint dy, const gfx_surface *src, uint sx, uint sy, uint w, uint h) {
+  if (dst->format != src->format) return ERR_NOT_SUPPORTED;
+  if (!clip(src, &sx, &sy, &w, &h)) return NO_ERROR;
+  if (!clip(dst, &dx, &dy, &w, &h)) return NO_ERROR;
+  dma_blit_op op = {
+    .dst = surface_pixel(dst, dx, dy),
+    .src = surface_pixel(src, sx, sy),
+    .dst_pitch = surface_pitch(dst),
+    .src_pitch = surface_pitch(src),
+    .row_bytes = w * dst->pixelsize,
+    .rows = h,
+    // within one surface, moving down has to start at the bottom
+    .reverse = (dst->ptr == src->ptr) && (dy > sy),
+  };
+  return add_op(b, &op);
+}
+
+status_t dma_blit_copy_stride(dma_blit *b, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t row_bytes, uint32_t rows) {
+  dma_blit_op op = {
+    .dst = dst,
+    .src = src,
+    .dst_pitch = dst_pitch,
+    .src_pitch = src_pitch,
+    .row_bytes = row_bytes,
+    .rows = rows,
+  };
+  return add_op(b, &op);
+}
+
+status_t dma_blit_scroll(dma_blit *b, gfx_surface *s, int lines, uint32_t color) {
+  uint distance = (lines < 0) ? -lines : lines;
+  if (distance == 0) return NO_ERROR;
+  if (distance >= s->height) return dma_blit_fill(b, s, 0, 0, s->width, s->height, color);
+  if ((b->capacity - b->count) < 2) return ERR_NO_MEMORY;
+  status_t ret;
+  if (lines > 0) {
+    ret = dma_blit_copy(b, s, 0, 0, s, 0, distance, s->width, s->height - distance);
+    if (ret == NO_ERROR) ret = dma_blit_fill(b, s, 0, s->height - distance, s->width, distance, color);
+  } else {
+    ret = dma_blit_copy(b, s, 0, distance, s, 0, 0, s->width, s->height - distance);
+    if (ret == NO_ERROR) ret = dma_blit_fill(b, s, 0, 0, s->width, distance, color);
+  }
+  return ret;
+}
+
+static void cpu_fill_row(uint8_t *d, uint32_t bytes, uint32_t pattern) {
+  // byte n of the pattern belongs at addresses that are n mod 4, same as the dma does it
+  while (bytes && ((uintptr_t)d & 3)) {
+    *d = pattern >> (((uintptr_t)d & 3) * 8);
+    d++;
+    bytes--;
+  }
+  uint32_t *w = (uint32_t*)d;
+  for (; bytes >= 4; bytes -= 4) *w++ = pattern;
+  d = (uint8_t*)w;
+  for (uint32_t i=0; i < bytes; i++) d[i] = pattern >> (i * 8);
+}
+
+static void cpu_run_op(const dma_blit_op *op) {
+  for (uint32_t i=0; i < op->rows; i++) {
+    uint32_t row = op->reverse ? (op->rows - 1 - i) : i;
+    uint8_t *d = op->dst + (row * op->dst_pitch);
+    if (op->src) memmove(d, op->src + (row * op->src_pitch), op->row_bytes);
+    else cpu_fill_row(d, op->row_bytes, op->pattern);
+  }
+}
+
+static dma_cb *next_cb(dma_blit *b, uint32_t *used) {
+  if (*used >= b->cb_capacity) return NULL;
+  dma_cb *cb = &b->cbs[(*used)++];
+  memset(cb, 0, sizeof(*cb));
+  return cb;
+}
+
+static void cb_source(dma_cb *cb, const dma_blit_op *op, uint32_t row) {
+  if (op->src) {
+    cb->source = dma_bus_addr(op->src + (row * op->src_pitch));
+  } else {
+    // a fill reads the same word over and over, it lives in the padding of its own control block
+    cb->pad1 = op->pattern;
+    cb->source = dma_bus_addr(&cb->pad1);
+  }
+}
+
+static bool fits_stride(int32_t stride) {
+  return (stride >= -32768) && (stride <= 32767);
+}
+
+// returns false if the batch ran out of control blocks
+static bool build_op(dma_blit *b, const dma_blit_op *op, uint32_t *used) {
+  const bool fill = op->src == NULL;
+  dma_cb *cb;
+  // fills stay at 32bit, the source is a single word
+  uint32_t ti = fill ? (DMA_TI_DEST_INC | DMA_TI_BURST(8))
+    : (DMA_TI_SRC_INC | DMA_TI_DEST_INC | DMA_TI_SRC_WIDE | DMA_TI_DEST_WIDE | DMA_TI_BURST(16));
+
+  // back to back rows are one long 1d transfer
+  if (!op->reverse && (op->dst_pitch == op->row_bytes) && (fill || (op->src_pitch == op->row_bytes))) {
+    if (!(cb = next_cb(b, used))) return false;
+    cb->ti = ti;
+    cb->dest = dma_bus_addr(op->dst);
+    cb->length = op->row_bytes * op->rows;
+    cb_source(cb, op, 0);
+    return true;
+  }
+
+  // the strides are what gets added after each row, on top of the row itself
+  const int32_t dir = op->reverse ? -1 : 1;
+  const int32_t dst_stride = (dir * (int32_t)op->dst_pitch) - (int32_t)op->row_bytes;
+  const int32_t src_stride = fill ? 0 : ((dir * (int32_t)op->src_pitch) - (int32_t)op->row_bytes);
+  const bool use_2d = (op->row_bytes <= DMA_2D_MAX_ROW_BYTES) && fits_stride(dst_stride) && fits_stride(src_stride);
+  const uint32_t chunk = use_2d ? DMA_2D_MAX_ROWS : 1;
+
+  for (uint32_t i=0; i < op->rows; i += chunk) {
+    const uint32_t n = MIN(chunk, op->rows - i);
+    const uint32_t row = op->reverse ? (op->rows - 1 - i) : i;
+    if (!(cb = next_cb(b, used))) return false;
+    cb->dest = dma_bus_addr(op->dst + (row * op->dst_pitch));
+    cb_source(cb, op, row);
+    if (use_2d) {
+      cb->ti = ti | DMA_TI_TDMODE;
+      cb->length = DMA_2D_LENGTH(op->row_bytes, n);
+      cb->stride = DMA_2D_STRIDE(src_stride, dst_stride);
+    } else {
+      cb->ti = ti;
+      cb->length = op->row_bytes;
+    }
+  }
+  return true;
+}
+
+static bool build_cbs(dma_blit *b) {
+  uint32_t used = 0;
+  for (uint32_t i=0; i < b->count; i++) {
+    if (!build_op(b, &b->ops[i], &used)) return false;
+  }
+  for (uint32_t i=0; i < used; i++) {
+    b->cbs[i].next_block = (i + 1) < used ? dma_bus_addr(&b->cbs[i + 1]) : 0;
+  }
+  b->cbs[used - 1].ti |= DMA_TI_INT_EN;
+  arch_clean_cache_range((addr_t)b->cbs, used * sizeof(dma_cb));
+  return true;
+}
+
+static void op_span(const uint8_t *base, uint32_t pitch, const dma_blit_op *op, addr_t *start, size_t *len) {
+  *start = (addr_t)base;
+  *len = ((op->rows - 1) * pitch) + op->row_bytes;
+}
+
+// before the dma reads, the sources must be in ram, and the destinations must not have dirty lines to evict on top of it
+static void clean_ops(const dma_blit *b) {
+  addr_t start;
+  size_t len;
+  for (uint32_t i=0; i < b->count; i++) {
+    const dma_blit_op *op = &b->ops[i];
+    op_span(op->dst, op->dst_pitch, op, &start, &len);
+    arch_clean_invalidate_cache_range(start, len);
+    if (op->src) {
+      op_span(op->src, op->src_pitch, op, &start, &len);
+      arch_clean_cache_range(start, len);
+    }
+  }
+}
+
+static void invalidate_dsts(const dma_blit *b) {
+  addr_t start;
+  size_t len;
+  for (uint32_t i=0; i < b->count; i++) {
+    const dma_blit_op *op = &b->ops[i];
+    op_span(op->dst, op->dst_pitch, op, &start, &len);
+    arch_invalidate_cache_range(start, len);
+  }
+}
+
+// with blit_lock held
+static void start_batch(dma_blit *b) {
+  dma_controller *chan = get_dma(DMA_BLIT_CHANNEL);
+  blit_active = b;
+  chan->conblk_ad = dma_bus_addr(b->cbs);
+  chan->cs = DMA_CS_ACTIVE | DMA_CS_PRIORITY(8) | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_WAIT_WRITES;
+}
+
+static enum handler_return dma_blit_irq(void *arg) {
+  dma_controller *chan = get_dma(DMA_BLIT_CHANNEL);
+  uint32_t cs = chan->cs;
+  if (!(cs & DMA_CS_INT)) return INT_NO_RESCHEDULE;
+  chan->cs = DMA_CS_INT | DMA_CS_END;
+  if (cs & DMA_CS_ERROR) dma_errors++;
+
+  spin_lock(&blit_lock);
+  dma_blit *b = blit_active;
+  blit_active = NULL;
+  if (!list_is_empty(&blit_queue)) {
+    start_batch(list_remove_head_type(&blit_queue, dma_blit, node));
+  } else {
+    event_signal(&blit_idle, false);
+  }
+  spin_unlock(&blit_lock);
+
+  if (!b) return INT_NO_RESCHEDULE;
+  invalidate_dsts(b);
+  b->busy = false;
+  event_signal(&b->done, false);
+  if (b->callback) b->callback(b->arg);
+  return INT_RESCHEDULE;
+}
+
+static bool want_dma(const dma_blit *b) {
+  if (!blit_ready) return false;
+  switch (dma_blit_mode) {
+  case DMA_BLIT_CPU:
+    return false;
+  case DMA_BLIT_DMA:
+    return true;
+  default:
+    return b->bytes >= DMA_BLIT_MIN_BYTES;
+  }
+}
+
+// with irqs off, which includes every irq handler, nothing can wait for the dma irq
+// so the batch is done on the cpu, like print callbacks running under the print spinlock need
+static bool can_wait(void) {
+  return !arch_ints_disabled();
+}
+
+void dma_blit_submit(dma_blit *b, dma_blit_callback callback, void *arg) {
+  const bool atomic = !can_wait();
+  // a batch is only left busy by a caller that could wait for it, so this one cant be
+  if (b->busy) {
+    assert(!atomic);
+    dma_blit_wait(b);
+  }
+  b->callback = callback;
+  b->arg = arg;
+  b->used_dma = false;
+  if (b->count == 0) {
+    if (callback) callback(arg);
+    return;
+  }
+
+  if (!atomic && want_dma(b) && build_cbs(b)) {
+    clean_ops(b);
+    b->used_dma = true;
+    b->busy = true;
+    event_unsignal(&b->done);
+    dma_batches++;
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&blit_lock, state);
+    event_unsignal(&blit_idle);
+    if (blit_active) list_add_tail(&blit_queue, &b->node);
+    else start_batch(b);
+    spin_unlock_irqrestore(&blit_lock, state);
+    return;
+  }
+
+  // anything still on the dma could be drawing under this, let it finish first
+  // that cant be waited for with irqs off, the print paths only draw into the console surface, which only they use
+  if (blit_ready && !atomic) event_wait(&blit_idle);
+  for (uint32_t i=0; i < b->count; i++) cpu_run_op(&b->ops[i]);
+  cpu_batches++;
+  if (callback) callback(arg);
+}
+
+void dma_blit_wait(dma_blit *b) {
+  event_wait(&b->done);
+}
+
+void dma_blit_run(dma_blit *b) {
+  dma_blit_submit(b, NULL, NULL);
+  if (b->busy) dma_blit_wait(b);
+}
+
+static void dma_blit_init_hook(uint level) {
+  dma_controller *chan = get_dma(DMA_BLIT_CHANNEL);
+  chan->cs = DMA_CS_RESET;
+  event_init(&blit_idle, true, 0);
+  register_int_handler(INTERRUPT_DMA0 + DMA_BLIT_CHANNEL, dma_blit_irq, NULL);
+  unmask_interrupt(INTERRUPT_DMA0 + DMA_BLIT_CHANNEL);
+  blit_ready = true;
+}
+
+LK_INIT_HOOK(dma_blit, &dma_blit_init_hook, LK_INIT_LEVEL_PLATFORM - 3);
+
+static int cmd_blit_mode(int argc, const console_cmd_args *argv) {
+  if (argc >= 2) {
+    if (strcmp(argv[1].str, "auto") == 0) dma_blit_mode = DMA_BLIT_AUTO;
+    else if (strcmp(argv[1].str, "cpu") == 0) dma_blit_mode = DMA_BLIT_CPU;
+    else if (strcmp(argv[1].str, "dma") == 0) dma_blit_mode = DMA_BLIT_DMA;
+    else printf("usage: %s [auto|cpu|dma]\n", argv[0].str);
+  }
+  const char *names[] = { "auto", "cpu", "dma" };
+  printf("mode %s, dma channel %d, %d batches on the dma, %d on the cpu, %d dma errors\n",
+      names[dma_blit_mode], DMA_BLIT_CHANNEL, dma_batches, cpu_batches, dma_errors);
+  return 0;
+}
+
+// MB/s is bytes per uSec
+static uint32_t mbps(uint32_t bytes, uint32_t usec) {
+  return usec ? (bytes / usec) : 0;
+}
+
+static uint32_t time_gfx_fill(gfx_surface *s, uint w, uint h, int iterations) {
+  uint32_t start = *REG32(ST_CLO);
+  for (int i=0; i < iterations; i++) gfx_fillrect(s, 0, 0, w, h, 0xff0000aa + i);
+  return *REG32(ST_CLO) - start;
+}
+
+static uint32_t time_blit(dma_blit *b, enum dma_blit_mode mode, gfx_surface *dst, gfx_surface *src, uint w, uint h, int iterations) {
+  enum dma_blit_mode old = dma_blit_mode;
+  dma_blit_mode = mode;
+  uint32_t start = *REG32(ST_CLO);
+  for (int i=0; i < iterations; i++) {
+    dma_blit_reset(b);
+    if (src) dma_blit_copy(b, dst, 0, 0, src, 0, 0, w, h);
+    else dma_blit_fill(b, dst, 0, 0, w, h, 0xff0000aa + i);
+    dma_blit_run(b);
+  }
+  uint32_t delta = *REG32(ST_CLO) - start;
+  dma_blit_mode = old;
+  return delta;
+}
+
+static int cmd_blit_bench(int argc, const console_cmd_args *argv) {
+  static const struct { uint w, h; } sizes[] = {
+    { 8, 8 }, { 16, 16 }, { 34, 34 }, { 64, 64 }, { 128, 128 }, { 256, 256 }, { 720, 16 }, { 720, 480 },
+  };
+  const int iterations = (argc >= 2) ? argv[1].u : 20;
+  gfx_surface *a = gfx_create_surface(NULL, 720, 480, 720, GFX_FORMAT_ARGB_8888);
+  gfx_surface *c = gfx_create_surface(NULL, 720, 480, 720, GFX_FORMAT_ARGB_8888);
+  dma_blit b;
+  if (!a || !c || (dma_blit_init(&b, 4) != NO_ERROR)) {
+    puts("out of memory");
+    if (a) gfx_surface_destroy(a);
+    if (c) gfx_surface_destroy(c);
+    return -1;
+  }
+
+  printf("ARGB8888, %d iterations, MB/s\n", iterations);
+  printf("   size    bytes  gfx_fillrect  cpu fill  dma fill  cpu copy  dma copy\n");
+  for (unsigned int i=0; i < countof(sizes); i++) {
+    const uint w = sizes[i].w, h = sizes[i].h;
+    const uint32_t bytes = w * h * 4 * iterations;
+    printf("%3dx%-3d %8d  %12d  %8d  %8d  %8d  %8d\n", w, h, w * h * 4,
+        mbps(bytes, time_gfx_fill(a, w, h, iterations)),
+        mbps(bytes, time_blit(&b, DMA_BLIT_CPU, a, NULL, w, h, iterations)),
+        mbps(bytes, time_blit(&b, DMA_BLIT_DMA, a, NULL, w, h, iterations)),
+        mbps(bytes, time_blit(&b, DMA_BLIT_CPU, a, c, w, h, iterations)),
+        mbps(bytes, time_blit(&b, DMA_BLIT_DMA, a, c, w, h, iterations)));
+  }
+  printf("auto mode uses the dma from %d bytes per batch\n", DMA_BLIT_MIN_BYTES);
+
+  dma_blit_free(&b);
+  gfx_surface_destroy(a);
+  gfx_surface_destroy(c);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// 2d blits into gfx surfaces, done by a dma channel in the background, or by the cpu when that is faster
+//
+//   dma_blit b;
+//   dma_blit_init(&b, 8);
+//   dma_blit_fill(&b, surface, 0, 0, 100, 16, 0xff0000aa);
+//   dma_blit_scroll(&b, surface, 16, 0xff0000aa);
+//   dma_blit_submit(&b, NULL, NULL);
+//   ... other work ...
+//   dma_blit_wait(&b);
+//   dma_blit_reset(&b);
+//
+// the ops in a batch run in the order they were added
+
+#include <kernel/event.h>
+#include <lib/gfx.h>
+#include <lk/list.h>
+#include <platform/bcm28xx/dma.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// must be one of the full channels, the lite ones (7-14) have no 2d mode
+#ifndef DMA_BLIT_CHANNEL
+#define DMA_BLIT_CHANNEL 5
+#endif
+
+// batches that move less than this are done by the cpu, starting the dma costs more than it saves
+// see blit_bench for where the crossover is
+#ifndef DMA_BLIT_MIN_BYTES
+#define DMA_BLIT_MIN_BYTES 4096
+#endif
+
+enum dma_blit_mode {
+  DMA_BLIT_AUTO,
+  DMA_BLIT_CPU,
+  DMA_BLIT_DMA,
+};
+
+// one rectangle, rows of row_bytes, pitch apart
+typedef struct {
+  uint8_t *dst;
+  const uint8_t *src;   // NULL for a fill
+  uint32_t dst_pitch;
+  uint32_t src_pitch;   // 0 repeats the same source row
+  uint32_t row_bytes;
+  uint32_t rows;
+  uint32_t pattern;     // a fill, already in the pixel format and repeated to 32bits
+  bool reverse;         // last row first, for copies that move down within one buffer
+} dma_blit_op;
+
+// called when the whole batch is done, from the dma irq, or from dma_blit_submit() if the cpu did it
+typedef void (*dma_blit_callback)(void *arg);
+
+typedef struct {
+  struct list_node node;
+  dma_blit_op *ops;
+  uint32_t count;
+  uint32_t capacity;
+  // the control blocks, built by dma_blit_submit(), 2 per op before they have to be split further
+  dma_cb *cbs;
+  uint32_t cb_capacity;
+  uint32_t bytes;
+  bool busy;
+  // how the last submit ran
+  bool used_dma;
+  event_t done;
+  dma_blit_callback callback;
+  void *arg;
+} dma_blit;
+
+extern enum dma_blit_mode dma_blit_mode;
+
+status_t dma_blit_init(dma_blit *b, uint32_t capacity);
+void dma_blit_free(dma_blit *b);
+// empties a batch that is not busy, so it can be filled again
+void dma_blit_reset(dma_blit *b);
+
+// these only record the op, nothing is drawn until dma_blit_submit()
+// rectangles are clipped to the surface, colors are ARGB8888 like gfx_fillrect()
+// ERR_NO_MEMORY means the batch is full, submit it and start another
+status_t dma_blit_fill(dma_blit *b, gfx_surface *s, uint x, uint y, uint w, uint h, uint32_t color);
+// both surfaces must have the same format
+status_t dma_blit_copy(dma_blit *b, gfx_surface *dst, uint dx, uint dy, const gfx_surface *src, uint sx, uint sy, uint w, uint h);
+// raw rows, for buffers that are not surfaces, overlapping copies are done row by row from the top
+status_t dma_blit_copy_stride(dma_blit *b, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t row_bytes, uint32_t rows);
+// moves the whole surface up by lines (down if negative), and fills the rows that were uncovered
+status_t dma_blit_scroll(dma_blit *b, gfx_surface *s, int lines, uint32_t color);
+
+// starts the batch, or queues it behind the running one
+// small batches, any that dont fit the control blocks, and any submitted with irqs off, run on the cpu right here and are done on return
+void dma_blit_submit(dma_blit *b, dma_blit_callback callback, void *arg);
+// blocks until the batch is done, thread context only
+void dma_blit_wait(dma_blit *b);
+// submit and wait
+void dma_blit_run(dma_blit *b);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_DEPS += \
+	lib/gfx \
+	platform/bcm28xx/dma \
+
+MODULE_SRCS += \
+	$(LOCAL_DIR)/dma_blit.c \
+
+MODULE_CFLAGS := -O2
+
+include make/module.mk
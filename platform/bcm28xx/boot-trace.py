@@ -0,0 +1,123 @@
+#!/usr/bin/env python
+# decodes a boot_trace ring into a timeline, see platform/bcm28xx/include/platform/bcm28xx/boot_trace.h
+# the input is either a serial log with the output of `boot_trace dump` in it,
+# or the raw ring, like /proc/device-tree/timestamps/boot-trace under linux
+# usage: boot-trace.py [file], stdin if no file is given
+
+import re
+import struct
+import sys
+
+BOOT_TRACE_MAGIC = 0x54427462
+BOOT_TRACE_VERSION = 1
+# magic, version, capacity, count, dropped
+HEADER = '<IHHII'
+EVENT = '<IHH'
+
+STAGES = { 1: 'bootcode', 2: 'stage1', 3: 'stage2', 4: 'arm' }
+
+NAMES = {
+  0x100: 'arch-init',
+  0x101: 'sdram-start',
+  0x102: 'sdram-done',
+  0x200: 'start',
+  0x201: 'script-done',
+  0x202: 'try-target',
+  0x203: 'elf-loaded',
+  0x204: 'chainload',
+  0x300: 'arch-init',
+  0x301: 'handoff',
+  0x302: 'arm-init',
+  0x303: 'payload-copy-start',
+  0x304: 'payload-copied',
+  0x305: 'arm-start',
+  0x306: 'arm-released',
+  0x400: 'platform-init',
+  0x401: 'inter-arch',
+  0x402: 'linux-loaded',
+  0x403: 'linux-soon',
+}
+
+BAR_WIDTH = 40
+
+# the lines hexdump_ram() prints, `0x00000010 xx xx .. xx  |ascii|`
+HEXDUMP_LINE = re.compile(r'0x[0-9a-f]{8} ((?:[0-9a-f]{2} +){16})')
+
+def from_hexdump(text):
+  data = bytearray()
+  for line in text.splitlines():
+    m = HEXDUMP_LINE.search(line)
+    if m:
+      data += bytearray(int(b, 16) for b in m.group(1).split())
+  return bytes(data)
+
+def parse(data):
+  start = data.find(struct.pack('<I', BOOT_TRACE_MAGIC))
+  if start < 0:
+    raise ValueError('no boot trace ring found')
+  data = data[start:]
+  magic, version, capacity, count, dropped = struct.unpack_from(HEADER, data)
+  if version != BOOT_TRACE_VERSION:
+    raise ValueError('ring version %d, this only knows %d' % (version, BOOT_TRACE_VERSION))
+  base = struct.calcsize(HEADER)
+  size = struct.calcsize(EVENT)
+  n = min(count, capacity)
+  if len(data) < base + (capacity * size):
+    raise ValueError('ring is cut short, %d bytes for %d events' % (len(data), capacity))
+  events = []
+  for i in range(count - n, count):
+    events.append(struct.unpack_from(EVENT, data, base + ((i % capacity) * size)))
+  return events, dropped + (count - n)
+
+def fmt_time(us):
+  return '%3d.%06d' % (us // 1000000, us % 1000000)
+
+def render(events, dropped):
+  if dropped:
+    print('%d older events were overwritten' % dropped)
+  if not events:
+    print('no events')
+    return
+  first = events[0][0]
+  # ST_CLO is 32 bits of uSec, the boot is well inside one wrap
+  total = max(((events[-1][0] - first) & 0xffffffff), 1)
+  prev = first
+  for stamp, ident, arg in events:
+    offset = (stamp - first) & 0xffffffff
+    delta = (stamp - prev) & 0xffffffff
+    pos = (offset * BAR_WIDTH) // total
+    bar = ' ' * pos + '|' + ' ' * (BAR_WIDTH - pos)
+    stage = STAGES.get(ident >> 8, '?')
+    name = NAMES.get(ident, '0x%x' % ident)
+    print('%s +%8d uSec %s %-8s %-18s %d' % (fmt_time(stamp), delta, bar, stage, name, arg))
+    prev = stamp
+
+  # how long each stage ran, from its first event to the first event of the next one
+  print('')
+  spans = []
+  for stamp, ident, arg in events:
+    stage = ident >> 8
+    if not spans or spans[-1][0] != stage:
+      spans.append([stage, stamp, stamp])
+    spans[-1][2] = stamp
+  for i, (stage, begin, end) in enumerate(spans):
+    if i + 1 < len(spans):
+      end = spans[i + 1][1]
+    print('%-8s %s -> %s %8d uSec' % (STAGES.get(stage, '?'), fmt_time(begin), fmt_time(end), (end - begin) & 0xffffffff))
+  print('%-8s %s -> %s %8d uSec' % ('total', fmt_time(first), fmt_time(events[-1][0]), total))
+
+def main(args):
+  if args:
+    with open(args[0], 'rb') as f:
+      data = f.read()
+  else:
+    data = sys.stdin.buffer.read() if hasattr(sys.stdin, 'buffer') else sys.stdin.read()
+  # a log is text, so the ring is in hexdump lines, else it is the raw ring
+  hexed = from_hexdump(data.decode('latin-1'))
+  if hexed:
+    data = hexed
+  events, dropped = parse(data)
+  render(events, dropped)
+
+if __name__ == '__main__':
+  main(sys.argv[1:])
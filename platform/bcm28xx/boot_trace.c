@@ -0,0 +1,213 @@
+#include <kernel/spinlock.h>
+#include <lib/hexdump.h>
+#include <lk/console_cmd.h>
+#include <lk/macros.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx/boot_trace.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/platform.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARCH_VPU
+#include <arch/arch_ops.h>
+#define UNCACHED_RAM 0xc0000000
+#endif
+
+static int cmd_boot_trace(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("boot_trace", "boot timeline, `boot_trace dump` for boot-trace.py", &cmd_boot_trace)
+STATIC_COMMAND_END(boot_trace);
+
+// aligned for hexdump_ram()
+static boot_trace_ring ring __attribute__((aligned(16)));
+static spin_lock_t ring_lock = SPIN_LOCK_INITIAL_VALUE;
+
+#ifndef BOOTCODE
+// the events already recorded, while the imported ones go in front of them
+static boot_trace_event scratch[BOOT_TRACE_ENTRIES];
+#endif
+
+static const struct {
+  uint16_t id;
+  const char *name;
+} names[] = {
+  { BT_BOOTCODE_ARCH_INIT, "arch-init" },
+  { BT_BOOTCODE_SDRAM_START, "sdram-start" },
+  { BT_BOOTCODE_SDRAM_DONE, "sdram-done" },
+  { BT_STAGE1_START, "start" },
+  { BT_STAGE1_SCRIPT_DONE, "script-done" },
+  { BT_STAGE1_TRY_TARGET, "try-target" },
+  { BT_STAGE1_ELF_LOADED, "elf-loaded" },
+  { BT_STAGE1_CHAINLOAD, "chainload" },
+  { BT_STAGE2_ARCH_INIT, "arch-init" },
+  { BT_STAGE2_HANDOFF, "handoff" },
+  { BT_STAGE2_ARM_INIT, "arm-init" },
+  { BT_STAGE2_PAYLOAD_COPY_START, "payload-copy-start" },
+  { BT_STAGE2_PAYLOAD_COPIED, "payload-copied" },
+  { BT_STAGE2_ARM_START, "arm-start" },
+  { BT_STAGE2_ARM_RELEASED, "arm-released" },
+  { BT_ARM_PLATFORM_INIT, "platform-init" },
+  { BT_ARM_INTER_ARCH, "inter-arch" },
+  { BT_ARM_LINUX_LOADED, "linux-loaded" },
+  { BT_ARM_LINUX_SOON, "linux-soon" },
+};
+
+static const char *stage_names[] = { "?", "bootcode", "stage1", "stage2", "arm" };
+
+static const char *event_name(uint16_t id) {
+  for (unsigned int i = 0; i < (sizeof(names) / sizeof(names[0])); i++) {
+    if (names[i].id == id) return names[i].name;
+  }
+  return "?";
+}
+
+// set up on first use, so it works before any init hook has ran, the caller holds ring_lock
+static void setup(void) {
+  if (ring.magic == BOOT_TRACE_MAGIC) return;
+  ring.magic = BOOT_TRACE_MAGIC;
+  ring.version = BOOT_TRACE_VERSION;
+  ring.capacity = BOOT_TRACE_ENTRIES;
+  ring.count = 0;
+  ring.dropped = 0;
+}
+
+static void append(uint32_t stamp, uint16_t id, uint16_t arg) {
+  setup();
+  boot_trace_event *e = &ring.events[ring.count % BOOT_TRACE_ENTRIES];
+  e->stamp = stamp;
+  e->id = id;
+  e->arg = arg;
+  ring.count++;
+}
+
+void boot_trace_at(uint32_t stamp, uint16_t id, uint16_t arg) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&ring_lock, state);
+  append(stamp, id, arg);
+  spin_unlock_irqrestore(&ring_lock, state);
+}
+
+void boot_trace(uint16_t id, uint16_t arg) {
+  boot_trace_at(*REG32(ST_CLO), id, arg);
+}
+
+const boot_trace_ring *boot_trace_get(void) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&ring_lock, state);
+  setup();
+  spin_unlock_irqrestore(&ring_lock, state);
+  return &ring;
+}
+
+#ifndef BOOTCODE
+int boot_trace_import(const void *buf, size_t len) {
+  const boot_trace_ring *src = buf;
+  if (len < offsetof(boot_trace_ring, events)) return -1;
+  if ((src->magic != BOOT_TRACE_MAGIC) || (src->version != BOOT_TRACE_VERSION)) return -1;
+  const uint32_t cap = src->capacity;
+  if ((cap == 0) || (len < (offsetof(boot_trace_ring, events) + (cap * sizeof(boot_trace_event))))) return -1;
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&ring_lock, state);
+  setup();
+  const uint32_t local = MIN(ring.count, BOOT_TRACE_ENTRIES);
+  for (uint32_t i = 0, j = ring.count - local; i < local; i++, j++) scratch[i] = ring.events[j % BOOT_TRACE_ENTRIES];
+  const uint32_t dropped = ring.dropped + (ring.count - local);
+  ring.magic = 0;
+  setup();
+  // what the older stage lost is still counted, so the decoder can say how much is missing
+  const uint32_t lost = (src->count > cap) ? src->count - cap : 0;
+  ring.dropped = dropped + src->dropped + lost;
+  for (uint32_t i = lost; i < src->count; i++) {
+    const boot_trace_event *e = &src->events[i % cap];
+    append(e->stamp, e->id, e->arg);
+  }
+  for (uint32_t i = 0; i < local; i++) append(scratch[i].stamp, scratch[i].id, scratch[i].arg);
+  spin_unlock_irqrestore(&ring_lock, state);
+  return src->count - lost;
+}
+#else
+int boot_trace_import(const void *buf, size_t len) {
+  return -1;
+}
+#endif
+
+#ifdef ARCH_VPU
+// set when the stage2 just loaded covers the mailbox, writing it then would corrupt stage2
+static bool handoff_blocked;
+
+void boot_trace_handoff_check(uint32_t addr, uint32_t len) {
+  // drop the cache alias, to compare physical addresses
+  const uint32_t start = addr & 0x3fffffff;
+  // start + len isnt computed, it can wrap
+  if ((len == 0) || (start >= (BOOT_TRACE_HANDOFF_ADDR + sizeof(ring)))) return;
+  if ((start < BOOT_TRACE_HANDOFF_ADDR) && ((BOOT_TRACE_HANDOFF_ADDR - start) >= len)) return;
+  printf("boot_trace: segment 0x%x+0x%x covers the mailbox at 0x%x, not handing off\n", addr, len, BOOT_TRACE_HANDOFF_ADDR);
+  handoff_blocked = true;
+}
+
+void boot_trace_handoff(void) {
+  boot_trace(BT_STAGE1_CHAINLOAD, 0);
+  if (handoff_blocked) return;
+  memcpy((void*)(UNCACHED_RAM | BOOT_TRACE_HANDOFF_ADDR), &ring, sizeof(ring));
+}
+
+#ifndef BOOTCODE
+// only a mailbox stage1 left right before the chainload, anything else is from an older boot, or never written
+static int take_handoff(void) {
+  boot_trace_ring *mailbox = (boot_trace_ring*)(UNCACHED_RAM | BOOT_TRACE_HANDOFF_ADDR);
+  if ((mailbox->magic != BOOT_TRACE_MAGIC) || (mailbox->version != BOOT_TRACE_VERSION)) return 0;
+  if ((mailbox->count == 0) || (mailbox->capacity != BOOT_TRACE_ENTRIES)) return 0;
+  const boot_trace_event *last = &mailbox->events[(mailbox->count - 1) % BOOT_TRACE_ENTRIES];
+  if ((last->id != BT_STAGE1_CHAINLOAD) || ((arch_init_timestamp - last->stamp) > BOOT_TRACE_HANDOFF_MAX_US)) return 0;
+  const int taken = boot_trace_import(mailbox, sizeof(*mailbox));
+  // used up, a later stage2 started some other way shouldnt take it again
+  mailbox->magic = 0;
+  return (taken < 0) ? 0 : taken;
+}
+#endif
+#endif
+
+void boot_trace_early_init(void) {
+#ifdef ARCH_VPU
+#ifdef BOOTCODE
+  boot_trace_at(arch_init_timestamp, BT_BOOTCODE_ARCH_INIT, 0);
+#else
+  const int taken = take_handoff();
+  boot_trace_at(arch_init_timestamp, BT_STAGE2_ARCH_INIT, 0);
+  boot_trace(BT_STAGE2_HANDOFF, taken);
+#endif
+#else
+  boot_trace_at(platform_init_timestamp, BT_ARM_PLATFORM_INIT, 0);
+#endif
+}
+
+static void print_timeline(void) {
+  const uint32_t n = MIN(ring.count, BOOT_TRACE_ENTRIES);
+  const uint32_t first = ring.count - n;
+  if (first + ring.dropped) printf("%u older events were overwritten\n", first + ring.dropped);
+  uint32_t prev = 0;
+  for (uint32_t i = first; i < ring.count; i++) {
+    const boot_trace_event *e = &ring.events[i % BOOT_TRACE_ENTRIES];
+    const uint32_t stage = BOOT_TRACE_STAGE(e->id);
+    const uint32_t delta = (i == first) ? 0 : e->stamp - prev;
+    printf("%3d.%06d +%8u uSec %-8s %-18s %u\n", e->stamp / 1000000, e->stamp % 1000000, delta,
+        stage_names[(stage < (sizeof(stage_names) / sizeof(stage_names[0]))) ? stage : 0], event_name(e->id), e->arg);
+    prev = e->stamp;
+  }
+}
+
+static int cmd_boot_trace(int argc, const console_cmd_args *argv) {
+  const boot_trace_ring *r = boot_trace_get();
+  if ((argc == 2) && (strcmp(argv[1].str, "dump") == 0)) {
+    hexdump_ram(r, 0, sizeof(*r));
+    return 0;
+  } else if (argc != 1) {
+    printf("usage: %s [dump]\n", argv[0].str);
+    return -1;
+  }
+  print_timeline();
+  return 0;
+}
@@ -6,7 +6,20 @@
 
 #define BIT(b) (1LL << b)
 
+#define DMA_CS_ACTIVE       BIT(0)
+#define DMA_CS_END          BIT(1)
+#define DMA_CS_INT          BIT(2)
+#define DMA_CS_ERROR        BIT(8)
+#define DMA_CS_PRIORITY(n)  ((n & 0xf) << 16)
+#define DMA_CS_PANIC_PRIORITY(n) ((n & 0xf) << 20)
+// the END/INT only fire once the writes have landed
+#define DMA_CS_WAIT_WRITES  BIT(28)
+#define DMA_CS_ABORT        BIT(30)
+#define DMA_CS_RESET        BIT(31)
+
 #define DMA_TI_INT_EN       BIT(0)
+// 2d mode, length is YLENGTH<<16 | XLENGTH and stride is added after every row, only channels 0-6 have it
+#define DMA_TI_TDMODE       BIT(1)
 #define DMA_TI_WAIT_RESP    BIT(3)
 #define DMA_TI_DEST_INC     BIT(4)
 // 32bit when false, 128bit when true
@@ -22,6 +35,12 @@
 #define DMA_TI_DREQ(n)      ((n & 0x1f) << 16)
 #define DMA_TI_WAITS(n)     ((n & 0x1f) << 21)
 
+#define DMA_2D_LENGTH(x, y) ((((y) & 0x3fff) << 16) | ((x) & 0xffff))
+// signed byte offsets, added after every row
+#define DMA_2D_STRIDE(src, dest) ((((dest) & 0xffff) << 16) | ((src) & 0xffff))
+#define DMA_2D_MAX_ROWS     0x3fff
+#define DMA_2D_MAX_ROW_BYTES 0xffff
+
 typedef struct {
   uint32_t ti;
   uint32_t source;
@@ -40,6 +59,11 @@ typedef struct {
   volatile uint32_t source_ad;
 } dma_controller;
 
+// the uncached bus alias of a pointer, for control blocks and buffers
+static inline uint32_t dma_bus_addr(const void *p) {
+  return (uint32_t)p | 0xc0000000;
+}
+
 static dma_controller *get_dma(int channel) {
   uint32_t base = 0;
   switch (channel) {
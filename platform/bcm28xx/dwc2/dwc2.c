@@ -254,7 +254,7 @@ static int dwc_addr0_get_desc(int argc, const console_cmd_args *argv) {
     printf("  bNumberConfigurations: %d\n", devDesc2->bNumberConfigurations);
   }
 
-  udelay(100 * 1000);
+  usleep(100 * 1000);
   logf("100ms later\n");
   dump_channel(0, __FUNCTION__);
   return 0;
@@ -357,7 +357,7 @@ static int dwc_root_disable(int argc, const console_cmd_args *argv) {
 
 static int dwc_root_reset(int argc, const console_cmd_args *argv) {
   *REG32(USB_HPRT) = BIT(8) | BIT(12);
-  udelay(50 * 1000);
+  usleep(50 * 1000);
   *REG32(USB_HPRT) = BIT(12);
   return 0;
 }
@@ -857,7 +857,7 @@ static enum handler_return dwc_irq(dwc_host_state_t *state) {
 
 void dwc_root_port_reset(void) {
   *REG32(USB_HPRT) = BIT(8) | BIT(12);
-  udelay(50 * 1000);
+  usleep(50 * 1000);
   *REG32(USB_HPRT) = BIT(12);
 }
 
@@ -1250,7 +1250,7 @@ static void dwc2_init_hook(uint level) {
     printf("  protocol: %d\n", devDesc.bDeviceProtocol);
     printf("  max-packet-size: %d\n", devDesc.bMaxPacketSize0);
 
-    udelay(100 * 1000);
+    usleep(100 * 1000);
     logf("100ms later\n");
     dump_channel(0, "unused");
   }
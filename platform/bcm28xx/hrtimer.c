@@ -0,0 +1,155 @@
+#include <arch/ops.h>
+#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lk/console_cmd.h>
+#include <lk/init.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/hrtimer.h>
+#include <platform/bcm28xx/udelay.h>
+#include <stdio.h>
+
+#define HRTIMER_COMPARE (ST_C0 + (HRTIMER_CHANNEL * 4))
+#define HRTIMER_MATCH (1 << HRTIMER_CHANNEL)
+
+static int cmd_usleep_test(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("usleep_test", "time usleep() against ST_CLO", &cmd_usleep_test)
+STATIC_COMMAND_END(hrtimer);
+
+static spin_lock_t hrtimer_lock = SPIN_LOCK_INITIAL_VALUE;
+// sorted by deadline, soonest first
+static struct list_node hrtimer_queue = LIST_INITIAL_VALUE(hrtimer_queue);
+static bool hrtimer_ready;
+
+static inline bool before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+// lock held
+static void program_compare(void) {
+  hrtimer_t *first = list_peek_head_type(&hrtimer_queue, hrtimer_t, node);
+  if (!first) return;
+  const uint32_t soonest = *REG32(ST_CLO) + HRTIMER_MIN_US;
+  // the match is on equality, a compare already in the past wont fire for another 71 minutes
+  *REG32(HRTIMER_COMPARE) = before(first->deadline, soonest) ? soonest : first->deadline;
+}
+
+// lock held
+static void insert(hrtimer_t *t) {
+  hrtimer_t *entry;
+  list_for_every_entry(&hrtimer_queue, entry, hrtimer_t, node) {
+    if (before(t->deadline, entry->deadline)) {
+      list_add_before(&entry->node, &t->node);
+      return;
+    }
+  }
+  list_add_tail(&hrtimer_queue, &t->node);
+}
+
+void hrtimer_init(hrtimer_t *t) {
+  list_clear_node(&t->node);
+  t->deadline = 0;
+  t->callback = NULL;
+  t->arg = NULL;
+}
+
+bool hrtimer_pending(hrtimer_t *t) {
+  return list_in_list(&t->node);
+}
+
+void hrtimer_set_deadline(hrtimer_t *t, uint32_t deadline, hrtimer_callback callback, void *arg) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hrtimer_lock, state);
+  if (list_in_list(&t->node)) list_delete(&t->node);
+  t->deadline = deadline;
+  t->callback = callback;
+  t->arg = arg;
+  insert(t);
+  if (list_peek_head_type(&hrtimer_queue, hrtimer_t, node) == t) program_compare();
+  spin_unlock_irqrestore(&hrtimer_lock, state);
+}
+
+void hrtimer_set_oneshot(hrtimer_t *t, uint32_t delay_us, hrtimer_callback callback, void *arg) {
+  hrtimer_set_deadline(t, *REG32(ST_CLO) + delay_us, callback, arg);
+}
+
+void hrtimer_cancel(hrtimer_t *t) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hrtimer_lock, state);
+  // a stale compare just fires into an empty or later queue, and gets reprogrammed there
+  if (list_in_list(&t->node)) list_delete(&t->node);
+  spin_unlock_irqrestore(&hrtimer_lock, state);
+}
+
+static enum handler_return hrtimer_irq(void *arg) {
+  bool resched = false;
+  // only our bit, the LK timer acks its own
+  *REG32(ST_CS) = HRTIMER_MATCH;
+
+  spin_lock(&hrtimer_lock);
+  for (;;) {
+    hrtimer_t *t = list_peek_head_type(&hrtimer_queue, hrtimer_t, node);
+    const uint32_t now = *REG32(ST_CLO);
+    if (!t || before(now, t->deadline)) break;
+    list_delete(&t->node);
+    // dropped around the callback, so it can re-arm itself
+    spin_unlock(&hrtimer_lock);
+    if (t->callback(t, now, t->arg) == INT_RESCHEDULE) resched = true;
+    spin_lock(&hrtimer_lock);
+  }
+  program_compare();
+  spin_unlock(&hrtimer_lock);
+  return resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+static void hrtimer_init_hook(uint level) {
+  *REG32(ST_CS) = HRTIMER_MATCH;
+  register_int_handler(INTERRUPT_TIMER0 + HRTIMER_CHANNEL, &hrtimer_irq, NULL);
+  unmask_interrupt(INTERRUPT_TIMER0 + HRTIMER_CHANNEL);
+  hrtimer_ready = true;
+}
+
+LK_INIT_HOOK(hrtimer, &hrtimer_init_hook, LK_INIT_LEVEL_PLATFORM_EARLY);
+
+static enum handler_return usleep_wake(hrtimer_t *t, uint32_t now, void *arg) {
+  event_signal((event_t*)arg, false);
+  return INT_RESCHEDULE;
+}
+
+void usleep(uint32_t usec) {
+  thread_t *current = get_current_thread();
+  // blocking needs a thread that may block, and the irq to wake it
+  if ((usec <= USLEEP_SPIN_MAX_US) || !hrtimer_ready || arch_ints_disabled() || !current || (current->priority == IDLE_PRIORITY)) {
+    udelay(usec);
+    return;
+  }
+  event_t done;
+  hrtimer_t t;
+  event_init(&done, false, 0);
+  hrtimer_init(&t);
+  hrtimer_set_oneshot(&t, usec, usleep_wake, &done);
+  event_wait(&done);
+  event_destroy(&done);
+}
+
+static int cmd_usleep_test(int argc, const console_cmd_args *argv) {
+  const uint32_t usec = (argc >= 2) ? argv[1].u : 1000;
+  const uint32_t count = (argc >= 3) ? argv[2].u : 10;
+  uint32_t min = UINT32_MAX, max = 0;
+  uint64_t total = 0;
+  for (uint32_t i=0; i < count; i++) {
+    const uint32_t start = *REG32(ST_CLO);
+    usleep(usec);
+    const uint32_t took = *REG32(ST_CLO) - start;
+    if (took < min) min = took;
+    if (took > max) max = took;
+    total += took;
+  }
+  printf("usleep(%u) %s, %u times: min %u, avg %u, max %u uSec\n", usec, (usec <= USLEEP_SPIN_MAX_US) ? "spins" : "sleeps",
+         count, min, count ? (uint32_t)(total / count) : 0, max);
+  return 0;
+}
@@ -19,6 +19,7 @@ static int cmd_hvs_limit(int argc, const console_cmd_args *argv);
 static int cmd_hvs_delay(int argc, const console_cmd_args *argv);
 static int cmd_dance_update(int argc, const console_cmd_args *argv);
 static int cmd_dance_list(int argc, const console_cmd_args *argv);
+static int cmd_dance_bench(int argc, const console_cmd_args *argv);
 static void update_visibility(int channel);
 
 STATIC_COMMAND_START
@@ -27,6 +28,7 @@ STATIC_COMMAND("l", "limit sprites", &cmd_hvs_limit)
 STATIC_COMMAND("d", "delay updates", &cmd_hvs_delay)
 STATIC_COMMAND("u", "update", &cmd_dance_update)
 STATIC_COMMAND("dance_list", "list", &cmd_dance_list)
+STATIC_COMMAND("dance_bench", "find how many sprites fit in a frame", &cmd_dance_bench)
 STATIC_COMMAND_END(hvs_dance);
 
 gfx_surface *fb;
@@ -41,20 +43,14 @@ struct item {
 struct item items[ITEMS];
 uint32_t sprite_limit = 1;
 int delay = 1;
+// set while dance_bench owns the sprites, so dance_entry keeps its hands off
+static volatile bool benchmarking = false;
 
 int32_t screen_width, screen_height;
 
 #define SCALED
 
-void do_frame_update(int frame) {
-  if (delay != 0) {
-    if ((frame % delay) != 0) return;
-  }
-  //if ((display_slot + (sprite_limit * 14) + 1) > 4096) {
-  //  printf("early dlist loop %d\n", display_slot);
-  //  display_slot = 0;
-  //}
-
+static void move_sprites(void) {
   for (unsigned int i=0; i < sprite_limit; i++) {
     struct item *it = &items[i];
     int w = it->layer.w;
@@ -82,6 +78,14 @@ void do_frame_update(int frame) {
       it->layer.y += it->yd;
     }
   }
+}
+
+void do_frame_update(int frame) {
+  if (delay != 0) {
+    if ((frame % delay) != 0) return;
+  }
+
+  move_sprites();
 
   int hvs_channel = 1;
   mutex_acquire(&channels[hvs_channel].lock);
@@ -102,6 +106,81 @@ static int cmd_dance_update(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
+struct bench_result {
+  uint32_t avg;
+  uint32_t worst;
+  uint32_t compiles;
+  uint32_t dropped;
+};
+
+// times move_sprites() + hvs_update_dlist() over a number of frames
+// with rebuild set, every sprite is thrown out of the cache first, which is about what the old uncached path cost
+static void bench_frames(int frames, bool rebuild, struct bench_result *r) {
+  const int hvs_channel = 1;
+  uint32_t total = 0;
+  uint32_t compiles = hvs_layer_compiles;
+  r->worst = 0;
+  for (int f=0; f<frames; f++) {
+    hvs_wait_vsync(hvs_channel);
+    uint32_t start = *REG32(ST_CLO);
+    move_sprites();
+    mutex_acquire(&channels[hvs_channel].lock);
+    if (rebuild) {
+      for (unsigned int i=0; i < sprite_limit; i++) hvs_layer_invalidate(&items[i].layer);
+    }
+    hvs_update_dlist(hvs_channel);
+    mutex_release(&channels[hvs_channel].lock);
+    uint32_t spent = *REG32(ST_CLO) - start;
+    total += spent;
+    if (spent > r->worst) r->worst = spent;
+  }
+  r->avg = total / frames;
+  r->compiles = hvs_layer_compiles - compiles;
+  // a sprite that didnt fit in the dlist memory has no slot
+  r->dropped = 0;
+  for (unsigned int i=0; i < sprite_limit; i++) {
+    if (items[i].layer.dlist_slot < 0) r->dropped++;
+  }
+}
+
+static int cmd_dance_bench(int argc, const console_cmd_args *argv) {
+  const int hvs_channel = 1;
+  int frames = 60;
+  if (argc >= 2) frames = argv[1].u;
+  if (frames < 1) frames = 1;
+
+  uint32_t old_limit = sprite_limit;
+  benchmarking = true;
+
+  hvs_wait_vsync(hvs_channel);
+  uint32_t t0 = *REG32(ST_CLO);
+  hvs_wait_vsync(hvs_channel);
+  uint32_t period = *REG32(ST_CLO) - t0;
+  printf("frame period %d us, %d frames per step\n", period, frames);
+  puts("sprites   cached avg/worst us   rebuilt avg/worst us   compiles   dropped");
+
+  uint32_t capacity = 0;
+  for (uint32_t count = 1; ; count *= 2) {
+    if (count > ITEMS) count = ITEMS;
+    sprite_limit = count;
+    update_visibility(hvs_channel);
+    struct bench_result cached, rebuilt;
+    // one untimed pass to compile anything new
+    bench_frames(1, false, &cached);
+    bench_frames(frames, false, &cached);
+    bench_frames(frames, true, &rebuilt);
+    printf("%7d   %8d / %-8d   %8d / %-8d    %7d   %7d\n", count, cached.avg, cached.worst, rebuilt.avg, rebuilt.worst, cached.compiles, cached.dropped);
+    if ((cached.worst < period) && (cached.dropped == 0)) capacity = count;
+    if (count == ITEMS) break;
+  }
+  printf("capacity: %d sprites per frame\n", capacity);
+
+  sprite_limit = old_limit;
+  update_visibility(hvs_channel);
+  benchmarking = false;
+  return 0;
+}
+
 static void dance_scramble(void) {
   int w,h;
 #ifdef SCALED
@@ -157,7 +236,7 @@ static void update_visibility(int channel) {
       hvs_dlist_add(channel, &it->layer);
       it->visible = true;
     } else if (it->visible && (i >= sprite_limit)) {
-      list_delete(&it->layer.node);
+      hvs_dlist_remove(channel, &it->layer);
       it->visible = false;
     }
   }
@@ -219,7 +298,7 @@ static void dance_entry(const struct app_descriptor *app, void *args) {
     //uint32_t line = SCALER_STAT_LINE(stat);
     uint32_t frame = (stat >> 12) & 0x3f;
     //printf("frame %d\n", frame);
-    do_frame_update(frame);
+    if (!benchmarking) do_frame_update(frame);
   }
 }
 
@@ -0,0 +1,558 @@
+// host reference compositor for hvs display lists, run with `make hvs-ref && ./hvs-ref`
+// without arguments it builds the built-in scenes with the same encoders hvs.c uses, renders them with hvs_ref.c,
+// checks known pixels, and compares every frame against the crcs in hvs-ref.golden
+//   ./hvs-ref update                 rewrites hvs-ref.golden, after a change that is meant to alter the output
+//   ./hvs-ref bench [layers]         times building and emitting a list of that many layers, 4000 by default
+//   ./hvs-ref render <dlist> <start> <sdram> <sdram_base> <width> <height> <out.ppm> [<golden.ppm> [tolerance]]
+//                                    composes a list captured from a board, dlist is all 4096 words of dlist memory
+//                                    and sdram a copy of memory starting at bus address sdram_base, both raw little endian
+//                                    with a golden image, exits 1 if any channel is off by more than tolerance (default 8)
+
+#include <platform/bcm28xx/hvs_dlist.h>
+#include <platform/bcm28xx/hvs_entry.h>
+#include <platform/bcm28xx/hvs_ref.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GOLDEN_FILE "hvs-ref.golden"
+#define SDRAM_BASE 0x10000000
+#define SDRAM_SIZE (4 * 1024 * 1024)
+// where the scenes put things in dlist memory, the same as hvs.c
+#define KERNEL 4080
+#define PALETTE_BASE (KERNEL - 256)
+#define MAX_SCENES 32
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static uint32_t dlist[HVS_REF_DLIST_WORDS];
+static uint8_t *sdram;
+static uint32_t sdram_used;
+static uint32_t fb[320 * 240];
+static uint32_t dlist_pos;
+
+static struct {
+  char name[32];
+  uint32_t crc;
+} golden[MAX_SCENES], seen[MAX_SCENES];
+static int golden_count, seen_count;
+
+static hvs_ref ref = {
+  .dlist = dlist,
+  .sdram_base = SDRAM_BASE,
+  .sdram_size = SDRAM_SIZE,
+  .out = fb,
+  .width = 320,
+  .height = 240,
+  .background = 0x202020,
+};
+
+// a bus address in the uncached alias, like the driver hands the hvs
+static uint32_t sdram_alloc(uint32_t bytes, uint8_t **host) {
+  sdram_used = (sdram_used + 63) & ~63;
+  *host = sdram + sdram_used;
+  const uint32_t bus = (SDRAM_BASE + sdram_used) | 0xc0000000;
+  sdram_used += bytes;
+  if (sdram_used > SDRAM_SIZE) {
+    puts("scene sdram exhausted");
+    exit(2);
+  }
+  return bus;
+}
+
+static void scene_begin(void) {
+  memset(dlist, 0, sizeof(dlist));
+  memset(sdram, 0, SDRAM_SIZE);
+  sdram_used = 0;
+  dlist_pos = 0;
+  // the same kernel upload_scaling_kernel() makes, only its location is checked
+  for (int i=0; i<11; i++) dlist[KERNEL + i] = 0x1234;
+}
+
+static void emit(const uint32_t *entry, int words) {
+  CHECK(words > 0);
+  memcpy(&dlist[dlist_pos], entry, words * 4);
+  dlist_pos += words;
+}
+
+static uint32_t pos0(int x, int y, uint8_t alpha) {
+  return POS0_X(x) | POS0_Y(y) | POS0_ALPHA(alpha);
+}
+
+static uint32_t pixel(int x, int y) {
+  return fb[(y * ref.width) + x];
+}
+
+// renders the scene and records its crc under name
+static void scene_render(const char *name, bool expect_ok) {
+  dlist[dlist_pos] = CONTROL_END;
+  hvs_ref_stats stats;
+  const bool ok = hvs_ref_render(&ref, 0, &stats);
+  if (ok != expect_ok) {
+    printf("%s: render %s, %d entries, %d errors, last: %s at %d\n", name, ok ? "passed" : "failed",
+        stats.entries, stats.errors, stats.last_error ? stats.last_error : "none", stats.last_error_offset);
+    failures++;
+  }
+  if (seen_count < MAX_SCENES) {
+    snprintf(seen[seen_count].name, sizeof(seen[0].name), "%s", name);
+    seen[seen_count].crc = hvs_ref_crc(&ref);
+    seen_count++;
+  }
+}
+
+// an argb8888 surface, in the lib/gfx layout
+static uint32_t mk_argb(unsigned int w, unsigned int h, uint32_t (*color)(unsigned int x, unsigned int y), uint32_t *pitch) {
+  uint8_t *p;
+  const uint32_t bus = sdram_alloc(w * h * 4, &p);
+  for (unsigned int y=0; y<h; y++) {
+    for (unsigned int x=0; x<w; x++) {
+      const uint32_t c = color(x, y);
+      memcpy(p + (((y * w) + x) * 4), &c, 4);
+    }
+  }
+  *pitch = w * 4;
+  return bus;
+}
+
+static uint32_t solid_red(unsigned int x, unsigned int y) {
+  return 0xffff0000;
+}
+
+static uint32_t half_green(unsigned int x, unsigned int y) {
+  return 0x8000ff00;
+}
+
+static uint32_t checker(unsigned int x, unsigned int y) {
+  return ((x + y) & 1) ? 0xffffffff : 0xff000000;
+}
+
+static uint32_t stripes(unsigned int x, unsigned int y) {
+  return (x < 2) ? 0xff0000ff : 0xffffff00;
+}
+
+static void test_unity_rgb(void) {
+  uint32_t d[32], pitch;
+  scene_begin();
+  // opaque red, then 50% green over part of it with per pixel alpha
+  const uint32_t red = mk_argb(16, 16, solid_red, &pitch);
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_pipeline, pos0(10, 10, 0xff), 16, 16, red, pitch, 0));
+  const uint32_t green = mk_argb(16, 16, half_green, &pitch);
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_pipeline, pos0(18, 18, 0xff), 16, 16, green, pitch, 0));
+
+  // rgb565 and rgb332, the formats gfx_to_hvs_pixel_format() maps to
+  uint8_t *p;
+  const uint32_t c565 = sdram_alloc(8 * 4 * 2, &p);
+  for (int i=0; i < (8 * 4); i++) {
+    p[i * 2] = 0x1f;        // blue
+    p[(i * 2) + 1] = 0x00;
+  }
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGB565, alpha_mode_fixed, pos0(100, 0, 0xff), 8, 4, c565, 16, 0));
+  const uint32_t c332 = sdram_alloc(8 * 4, &p);
+  memset(p, 0xe0, 8 * 4);   // red
+  // a fixed 25% alpha, the background shows through
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGB332, alpha_mode_fixed, pos0(100, 10, 0x40), 8, 4, c332, 8, 0));
+  scene_render("unity-rgb", true);
+
+  CHECK(pixel(0, 0) == 0xff202020);
+  CHECK(pixel(10, 10) == 0xffff0000);
+  CHECK(pixel(12, 12) == 0xffff0000);
+  // 0x80 green over red
+  CHECK(pixel(20, 20) == 0xff7f8000);
+  // green over the background only
+  CHECK(pixel(30, 30) == 0xff109010);
+  CHECK(pixel(100, 0) == 0xff0000ff);
+  CHECK(pixel(107, 3) == 0xff0000ff);
+  CHECK(pixel(108, 3) == 0xff202020);
+  CHECK(pixel(100, 10) == 0xff581818);
+}
+
+static void test_palette(void) {
+  uint32_t d[32];
+  uint8_t *p;
+  scene_begin();
+  // 1bpp, like bad-apple, msb is the leftmost pixel
+  dlist[PALETTE_BASE] = 0xff000000;
+  dlist[PALETTE_BASE + 1] = 0xffffffff;
+  const uint32_t mono = sdram_alloc(2 * 4, &p);
+  for (int y=0; y<4; y++) {
+    p[y * 2] = 0xaa;
+    p[(y * 2) + 1] = 0x0f;
+  }
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_PALETTE, alpha_mode_pipeline, pos0(0, 0, 0xff), 16, 4, mono, 2,
+                          hvs_entry_palette_word(palette_1bpp, PALETTE_BASE)));
+  // 8bpp, its own table further down
+  for (int i=0; i<256; i++) dlist[PALETTE_BASE - 256 + i] = 0xff000000 | (i << 8);
+  const uint32_t ramp = sdram_alloc(16 * 4, &p);
+  for (int i=0; i < (16 * 4); i++) p[i] = (i % 16) * 16;
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_PALETTE, alpha_mode_pipeline, pos0(0, 10, 0xff), 16, 4, ramp, 16,
+                          hvs_entry_palette_word(palette_8bpp, PALETTE_BASE - 256)));
+  scene_render("palette", true);
+
+  CHECK(pixel(0, 0) == 0xffffffff);
+  CHECK(pixel(1, 0) == 0xff000000);
+  CHECK(pixel(8, 3) == 0xff000000);
+  CHECK(pixel(12, 3) == 0xffffffff);
+  CHECK(pixel(16, 0) == 0xff202020);
+  CHECK(pixel(0, 10) == 0xff000000);
+  CHECK(pixel(15, 13) == 0xff00f000);
+}
+
+static void test_scaled(void) {
+  uint32_t d[32], pitch;
+  scene_begin();
+  // 2x2 checker up to 8x8, PPF both ways
+  const uint32_t small = mk_argb(2, 2, checker, &pitch);
+  int words = hvs_entry_scaled(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(0, 0, 0xff), 2, 2, 8, 8, small, pitch, 0, KERNEL);
+  CHECK(words == 16);
+  emit(d, words);
+  // 8x8 checker down to 4x4, TPZ both ways, every box is half black half white
+  const uint32_t big = mk_argb(8, 8, checker, &pitch);
+  words = hvs_entry_scaled(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(20, 0, 0xff), 8, 8, 4, 4, big, pitch, 0, KERNEL);
+  CHECK(words == 14);
+  emit(d, words);
+  // stretched in x, shrunk in y, the TPZ/PPF mixes
+  const uint32_t s = mk_argb(4, 8, stripes, &pitch);
+  emit(d, hvs_entry_scaled(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(40, 0, 0xff), 4, 8, 16, 4, s, pitch, 0, KERNEL));
+  emit(d, hvs_entry_scaled(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(60, 0, 0xff), 4, 8, 2, 16, s, pitch, 0, KERNEL));
+  scene_render("scaled", true);
+
+  // the corners stay at the source colors, the middle is blended
+  CHECK(pixel(0, 0) == 0xff000000);
+  CHECK(pixel(7, 0) == 0xffffffff);
+  const uint32_t mid = pixel(3, 3) & 0xff;
+  CHECK((mid > 0x40) && (mid < 0xc0));
+  for (int y=0; y<4; y++) {
+    for (int x=0; x<4; x++) CHECK(pixel(20 + x, y) == 0xff808080);
+  }
+  CHECK(pixel(40, 0) == 0xff0000ff);
+  CHECK(pixel(55, 3) == 0xffffff00);
+  CHECK(pixel(60, 0) == 0xff0000ff);
+  CHECK(pixel(61, 15) == 0xffffff00);
+}
+
+static void test_flip(void) {
+  uint32_t d[32], pitch;
+  scene_begin();
+  const uint32_t s = mk_argb(4, 1, stripes, &pitch);
+  hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(0, 0, 0xff), 4, 1, s, pitch, 0);
+  d[0] |= CONTROL0_HFLIP;
+  emit(d, 7);
+  // ARGB order swaps red and blue
+  hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(0, 2, 0xff), 4, 1, s, pitch, 0);
+  d[0] = (d[0] & ~CONTROL_PIXEL_ORDER(3)) | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_ARGB);
+  emit(d, 7);
+  scene_render("flip", true);
+  CHECK(pixel(0, 0) == 0xffffff00);
+  CHECK(pixel(3, 0) == 0xff0000ff);
+  CHECK(pixel(0, 2) == 0xffff0000);
+  CHECK(pixel(3, 2) == 0xff00ffff);
+}
+
+static void fill_yuv(uint8_t *luma, uint8_t *cb, uint8_t *cr, unsigned int cstep, unsigned int w, unsigned int h,
+                     unsigned int hsub, unsigned int vsub, unsigned int lpitch, unsigned int cpitch) {
+  // left half red, right half mid grey, bt601 limited
+  for (unsigned int y=0; y<h; y++) {
+    for (unsigned int x=0; x<w; x++) luma[(y * lpitch) + x] = (x < (w / 2)) ? 81 : 126;
+  }
+  for (unsigned int y=0; y < (h / vsub); y++) {
+    for (unsigned int x=0; x < (w / hsub); x++) {
+      const bool red = (x * hsub) < (w / 2);
+      cb[(y * cpitch) + (x * cstep)] = red ? 90 : 128;
+      cr[(y * cpitch) + (x * cstep)] = red ? 240 : 128;
+    }
+  }
+}
+
+static void yuv_layer(enum hvs_yuv_format f, int x, int y, unsigned int w, unsigned int h, unsigned int dw, unsigned int dh) {
+  uint32_t d[32];
+  unsigned int hsub, vsub;
+  hvs_yuv_subsampling(f, &hsub, &vsub);
+  const unsigned int planes = hvs_yuv_planes(f);
+  const unsigned int cpitch = (w / hsub) * ((planes == 2) ? 2 : 1);
+  uint8_t *luma, *c1, *c2 = NULL;
+  hvs_entry_yuv_params p = {
+    .format = f,
+    .colorspace = HVS_BT601,
+    .alpha_mode = alpha_mode_fixed,
+    .pos0 = pos0(x, y, 0xff),
+    .src_w = w, .src_h = h,
+    .w = dw, .h = dh,
+    .luma_pitch = w,
+    .chroma_pitch = cpitch,
+    .kernel = KERNEL,
+  };
+  p.ptr[0] = sdram_alloc(w * h, &luma);
+  p.ptr[1] = sdram_alloc(cpitch * (h / vsub), &c1);
+  if (planes == 3) p.ptr[2] = sdram_alloc(cpitch * (h / vsub), &c2);
+  if (planes == 2) fill_yuv(luma, c1, c1 + 1, 2, w, h, hsub, vsub, w, cpitch);
+  else fill_yuv(luma, c1, c2, 1, w, h, hsub, vsub, w, cpitch);
+  const int words = hvs_entry_yuv(d, &p);
+  CHECK(words == (int)((planes == 3) ? 28 : 25));
+  emit(d, words);
+}
+
+static bool near(uint32_t a, uint32_t b, int tolerance) {
+  unsigned int worst;
+  return hvs_ref_diff(&a, &b, 1, &worst) <= (unsigned int)tolerance;
+}
+
+static void test_yuv(void) {
+  scene_begin();
+  yuv_layer(HVS_YUV420_2PLANE, 0, 0, 32, 16, 32, 16);
+  yuv_layer(HVS_YUV420_3PLANE, 40, 0, 32, 16, 32, 16);
+  yuv_layer(HVS_YUV422_2PLANE, 80, 0, 32, 16, 32, 16);
+  yuv_layer(HVS_YUV422_3PLANE, 120, 0, 32, 16, 32, 16);
+  // scaled up 2x, the chroma planes have to follow
+  yuv_layer(HVS_YUV420_2PLANE, 0, 20, 32, 16, 64, 32);
+  scene_render("yuv", true);
+  for (int i=0; i<4; i++) {
+    CHECK(near(pixel((i * 40) + 2, 4), 0xffff0000, 8));
+    CHECK(near(pixel((i * 40) + 28, 12), 0xff828282, 2));
+  }
+  CHECK(near(pixel(4, 40), 0xffff0000, 8));
+  CHECK(near(pixel(60, 50), 0xff828282, 2));
+}
+
+static void test_errors(void) {
+  uint32_t d[32], pitch;
+  scene_begin();
+  const uint32_t s = mk_argb(4, 4, solid_red, &pitch);
+  // claims one word more than it has, the next entry is then read from the wrong place
+  int words = hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(0, 0, 0xff), 4, 4, s, pitch, 0);
+  d[0] = (d[0] & ~CONTROL_WORDS(0x3f)) | CONTROL_WORDS(words + 1);
+  d[words] = 0;
+  emit(d, words + 1);
+  // points past the end of sdram
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(10, 0, 0xff), 4, 4,
+                          (SDRAM_BASE + SDRAM_SIZE - 8) | 0xc0000000, pitch, 0));
+  // a good one after them still draws
+  emit(d, hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, pos0(20, 0, 0xff), 4, 4, s, pitch, 0));
+  dlist[dlist_pos] = CONTROL_END;
+  hvs_ref_stats stats;
+  CHECK(!hvs_ref_render(&ref, 0, &stats));
+  CHECK(stats.entries == 3);
+  CHECK(stats.errors == 2);
+  CHECK(pixel(0, 0) == 0xff202020);
+  CHECK(pixel(10, 0) == 0xff202020);
+  CHECK(pixel(20, 0) == 0xffff0000);
+
+  // an entry without CONTROL_VALID ends the walk
+  dlist[0] &= ~CONTROL_VALID;
+  CHECK(!hvs_ref_render(&ref, 0, &stats));
+  CHECK(stats.entries == 0);
+}
+
+static void load_golden(void) {
+  FILE *f = fopen(GOLDEN_FILE, "r");
+  if (!f) return;
+  while ((golden_count < MAX_SCENES) && (fscanf(f, "%31s %x", golden[golden_count].name, &golden[golden_count].crc) == 2)) golden_count++;
+  fclose(f);
+}
+
+static void check_golden(void) {
+  load_golden();
+  for (int i=0; i < seen_count; i++) {
+    bool found = false;
+    for (int j=0; j < golden_count; j++) {
+      if (strcmp(seen[i].name, golden[j].name)) continue;
+      found = true;
+      if (seen[i].crc != golden[j].crc) {
+        printf("%s: crc 0x%08x, golden 0x%08x\n", seen[i].name, seen[i].crc, golden[j].crc);
+        failures++;
+      }
+    }
+    if (!found) {
+      printf("%s: no golden crc, run ./hvs-ref update\n", seen[i].name);
+      failures++;
+    }
+  }
+}
+
+static int write_golden(void) {
+  FILE *f = fopen(GOLDEN_FILE, "w");
+  if (!f) {
+    perror(GOLDEN_FILE);
+    return 1;
+  }
+  for (int i=0; i < seen_count; i++) fprintf(f, "%s %08x\n", seen[i].name, seen[i].crc);
+  fclose(f);
+  printf("wrote %d crcs to %s\n", seen_count, GOLDEN_FILE);
+  return 0;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// the two paths of hvs_update_dlist(), every entry rebuilt, or only POS0 patched into the cached ones
+static int bench(unsigned int layers) {
+  uint32_t *entries = malloc(layers * 32 * 4);
+  uint32_t *lengths = malloc(layers * 4);
+  uint32_t *ring = malloc(layers * 32 * 4);
+  if (!entries || !lengths || !ring) return 1;
+  const int rounds = 20;
+  uint64_t build = 0, patch = 0;
+  uint32_t words = 0, sink = 0;
+  for (int r=0; r < rounds; r++) {
+    uint64_t t = now_ns();
+    for (unsigned int i=0; i < layers; i++) {
+      uint32_t *d = &entries[i * 32];
+      // a mix like a tile scene, mostly unity sprites with some scaled ones
+      if (i % 8) {
+        lengths[i] = hvs_entry_unity(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, 0, 34, 34, 0xc0000000 + (i * 4624), 136, 0);
+      } else {
+        lengths[i] = hvs_entry_scaled(d, HVS_PIXEL_FORMAT_RGBA8888, alpha_mode_fixed, 0, 34, 34, 68 + (r & 1), 17, 0xc0000000 + (i * 4624), 136, i * 32, KERNEL);
+      }
+    }
+    build += now_ns() - t;
+
+    t = now_ns();
+    words = 0;
+    for (unsigned int i=0; i < layers; i++) {
+      uint32_t *d = &entries[i * 32];
+      d[1] = pos0((i * 7) + r, i / 9, 0xff);
+      memcpy(&ring[words], d, lengths[i] * 4);
+      words += lengths[i];
+    }
+    patch += now_ns() - t;
+    sink += ring[words - 1];
+  }
+  printf("%d layers, %d words\n", layers, words);
+  printf("  build every entry: %llu ns per list, %llu ns per layer\n",
+      (unsigned long long)(build / rounds), (unsigned long long)(build / rounds / layers));
+  printf("  patch POS0 and copy: %llu ns per list, %llu ns per layer\n",
+      (unsigned long long)(patch / rounds), (unsigned long long)(patch / rounds / layers));
+  if (words > (HVS_REF_DLIST_WORDS - 256)) printf("  note: more than the dlist memory of one channel holds\n");
+  free(entries);
+  free(lengths);
+  free(ring);
+  return sink == 0x12345678;
+}
+
+static void *read_file(const char *path, uint32_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  void *buf = malloc(*size ? *size : 1);
+  if (buf && (fread(buf, 1, *size, f) != *size)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  return buf;
+}
+
+static bool write_ppm(const char *path, const uint32_t *px, unsigned int w, unsigned int h) {
+  FILE *f = fopen(path, "wb");
+  if (!f) return false;
+  fprintf(f, "P6\n%d %d\n255\n", w, h);
+  for (unsigned int i=0; i < (w * h); i++) {
+    const uint8_t rgb[3] = { px[i] >> 16, px[i] >> 8, px[i] };
+    fwrite(rgb, 1, 3, f);
+  }
+  fclose(f);
+  return true;
+}
+
+static uint32_t *read_ppm(const char *path, unsigned int w, unsigned int h) {
+  FILE *f = fopen(path, "rb");
+  unsigned int pw, ph, max;
+  if (!f) return NULL;
+  uint32_t *px = NULL;
+  if ((fscanf(f, "P6 %u %u %u", &pw, &ph, &max) == 3) && (pw == w) && (ph == h) && (max == 255) && (fgetc(f) != EOF)) {
+    px = malloc(w * h * 4);
+    for (unsigned int i=0; px && (i < (w * h)); i++) {
+      uint8_t rgb[3] = { 0, 0, 0 };
+      if (fread(rgb, 1, 3, f) != 3) break;
+      px[i] = 0xff000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+    }
+  }
+  fclose(f);
+  return px;
+}
+
+static int render(int argc, char **argv) {
+  if (argc < 9) {
+    printf("usage: %s render <dlist> <start> <sdram> <sdram_base> <width> <height> <out.ppm> [<golden.ppm> [tolerance]]\n", argv[0]);
+    return 2;
+  }
+  uint32_t dlist_size, sdram_size;
+  uint32_t *words = read_file(argv[2], &dlist_size);
+  uint8_t *mem = read_file(argv[4], &sdram_size);
+  if (!words || !mem) return 2;
+  if (dlist_size < (HVS_REF_DLIST_WORDS * 4)) {
+    printf("%s: %d bytes, dlist memory is %d\n", argv[2], dlist_size, HVS_REF_DLIST_WORDS * 4);
+    return 2;
+  }
+  hvs_ref r = {
+    .dlist = words,
+    .sdram = mem,
+    .sdram_base = strtoul(argv[5], NULL, 0) & 0x3fffffff,
+    .sdram_size = sdram_size,
+    .width = strtoul(argv[6], NULL, 0),
+    .height = strtoul(argv[7], NULL, 0),
+  };
+  r.out = malloc(r.width * r.height * 4);
+  if (!r.out) return 2;
+  hvs_ref_stats stats;
+  hvs_ref_render(&r, strtoul(argv[3], NULL, 0), &stats);
+  printf("%d entries, %d words, %d errors", stats.entries, stats.words, stats.errors);
+  if (stats.errors) printf(", last: %s at %d", stats.last_error, stats.last_error_offset);
+  printf("\n");
+  if (!write_ppm(argv[8], r.out, r.width, r.height)) {
+    perror(argv[8]);
+    return 2;
+  }
+  if (argc < 10) return stats.errors ? 1 : 0;
+
+  uint32_t *want = read_ppm(argv[9], r.width, r.height);
+  if (!want) {
+    printf("%s: not a %dx%d binary ppm\n", argv[9], r.width, r.height);
+    return 2;
+  }
+  const unsigned int tolerance = (argc >= 11) ? strtoul(argv[10], NULL, 0) : 8;
+  unsigned int worst;
+  const unsigned int diff = hvs_ref_diff(r.out, want, r.width * r.height, &worst);
+  printf("largest difference %d at %d,%d, tolerance %d\n", diff, worst % r.width, worst / r.width, tolerance);
+  return (diff > tolerance) || stats.errors;
+}
+
+int main(int argc, char **argv) {
+  if ((argc >= 2) && (strcmp(argv[1], "render") == 0)) return render(argc, argv);
+  if ((argc >= 2) && (strcmp(argv[1], "bench") == 0)) return bench((argc >= 3) ? strtoul(argv[2], NULL, 0) : 4000);
+
+  sdram = calloc(1, SDRAM_SIZE);
+  if (!sdram) return 2;
+  ref.sdram = sdram;
+  test_unity_rgb();
+  test_palette();
+  test_scaled();
+  test_flip();
+  test_yuv();
+  test_errors();
+
+  if ((argc >= 2) && (strcmp(argv[1], "update") == 0)) {
+    if (failures) {
+      printf("%d checks failed, not updating %s\n", failures, GOLDEN_FILE);
+      return 1;
+    }
+    return write_golden();
+  }
+  check_golden();
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("all %d scenes match\n", seen_count);
+  return 0;
+}
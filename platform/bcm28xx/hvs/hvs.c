@@ -16,6 +16,11 @@
 #include <lk/reg.h>
 #include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/hvs_entry.h>
+#include <platform/bcm28xx/hvs_plan.h>
+#include <platform/bcm28xx/hvs_telemetry.h>
+#include <platform/bcm28xx/hvs_yuv.h>
+#include <platform/bcm28xx/lbm.h>
 #include <platform/bcm28xx/pv.h>
 #include <platform/interrupts.h>
 #include <stdio.h>
@@ -31,17 +36,39 @@ volatile uint32_t* dlist_memory = REG32(SCALER_LIST_MEMORY);
 #endif
 volatile struct hvs_channel *hvs_channels = (volatile struct hvs_channel*)REG32(SCALER_DISPCTRL0);
 int display_slot = 11;
-int scaled_layer_count = 0;
-timer_t ddr2_monitor;
 const int scaling_kernel = 4080;
+uint32_t hvs_layer_compiles = 0;
+
+// each distinct palette_table gets a 256 entry slot, just below the scaling kernel, layers using the same table share it
+#ifndef HVS_PALETTE_SLOTS
+#define HVS_PALETTE_SLOTS 2
+#endif
+#define PALETTE_BASE (scaling_kernel - (256 * HVS_PALETTE_SLOTS))
+#define PALETTE_SLOT_BASE(n) (PALETTE_BASE + (256 * (n)))
+// display lists must end before the palette
+#define DLIST_LIMIT PALETTE_BASE
+// the largest entry hvs_layer_compile() can make, a 3 plane yuv entry is 28 words
+#define COMPILED_WORDS 32
+
+// the hvs runs on the core clock, which is not always known here, so this is a guess to be overridden with hvs_plan budget
+#ifndef HVS_PLAN_CLOCK_MHZ
+#define HVS_PLAN_CLOCK_MHZ 250
+#endif
+// the share of sdram bandwidth the hvs can count on, per hvs cycle
+#ifndef HVS_PLAN_BYTES_PER_CYCLE
+#define HVS_PLAN_BYTES_PER_CYCLE 4
+#endif
 
 #define DSP3_MUX(n) ((n & 0x3) << 18)
 
-enum scaling_mode {
-  scaling_none,
-  PPF, // upscaling?
-  TPZ // downscaling?
-};
+// the LBM is shared by all 3 channels, lbm_lock also serializes hvs_update_dlist() between channels
+static lbm_pool lbm;
+static mutex_t lbm_lock = MUTEX_INITIAL_VALUE(lbm_lock);
+// users counts the layers whose compiled entry points at the slot, also under lbm_lock
+static struct {
+  const palette_table *colors;
+  int users;
+} palette_slots[HVS_PALETTE_SLOTS];
 
 struct hvs_channel_config channels[3];
 
@@ -50,6 +77,10 @@ bool hvs_debug = false;
 
 static int cmd_hvs_dump(int argc, const console_cmd_args *argv);
 static int cmd_hvs_update(int argc, const console_cmd_args *argv);
+static int cmd_hvs_lbm(int argc, const console_cmd_args *argv);
+static int cmd_hvs_plan(int argc, const console_cmd_args *argv);
+static int cmd_hvs_plan_dump(int argc, const console_cmd_args *argv);
+static int cmd_hvs_present(int argc, const console_cmd_args *argv);
 static int cmd_hvs_debug(int argc, const console_cmd_args *argv) {
   hvs_debug = true;
   return 0;
@@ -60,8 +91,80 @@ STATIC_COMMAND("hvs_dump", "dump hvs state", &cmd_hvs_dump)
 STATIC_COMMAND("hvs_dump_dlist", "dump the software dlist", &cmd_hvs_dump_dlist)
 STATIC_COMMAND("hvs_update", "update the display list, without waiting for irq", &cmd_hvs_update)
 STATIC_COMMAND("hvs_debug", "print debug info for the next frame", &cmd_hvs_debug)
+STATIC_COMMAND("hvs_lbm", "dump the line buffer memory allocations", &cmd_hvs_lbm)
+STATIC_COMMAND("hvs_plan", "show or set the scanline budget and policy", &cmd_hvs_plan)
+STATIC_COMMAND("hvs_plan_dump", "print the layer set in the plan-sim format", &cmd_hvs_plan_dump)
+STATIC_COMMAND("hvs_present", "show or reset the presentation queue stats", &cmd_hvs_present)
 STATIC_COMMAND_END(hvs);
 
+// gives l an LBM region of words, keeping the one it has if the size didnt change
+// 0 words releases it, returns false if the LBM is full, must hold lbm_lock
+static bool hvs_layer_lbm(hvs_layer *l, uint32_t words) {
+  assert(is_mutex_held(&lbm_lock));
+  if (words == l->lbm_size) return true;
+  if (l->lbm_size) {
+    // the entry using it may still be on screen, so it is quarantined rather than reused right away
+    lbm_free(&lbm, l->lbm_offset, *REG32(ST_CLO));
+    l->lbm_size = 0;
+  }
+  if (words == 0) return true;
+  int offset = lbm_alloc(&lbm, words, l);
+  if (offset < 0) {
+    if (!l->lbm_starved) {
+      printf("LBM full, %d words for %s dont fit, largest gap is %d\n", words, l->name ? l->name : "layer", lbm_largest_free(&lbm));
+    }
+    l->lbm_starved = true;
+    return false;
+  }
+  l->lbm_starved = false;
+  l->lbm_offset = offset;
+  l->lbm_size = words;
+  return true;
+}
+
+// points l at the palette slot holding colors, loading it into a free slot if no other layer uses that table
+// NULL releases it, returns false if every slot is held by other tables, must hold lbm_lock
+static bool hvs_layer_palette(hvs_layer *l, const palette_table *colors) {
+  assert(is_mutex_held(&lbm_lock));
+  if (l->palette_slot && (palette_slots[l->palette_slot - 1].colors == colors)) return true;
+  if (l->palette_slot) {
+    palette_slots[l->palette_slot - 1].users--;
+    l->palette_slot = 0;
+  }
+  if (!colors) return true;
+  int slot = -1;
+  for (int i=0; i < HVS_PALETTE_SLOTS; i++) {
+    // already holding this table, either in use or released but not yet overwritten
+    if (palette_slots[i].colors == colors) {
+      slot = i;
+      break;
+    }
+    if (palette_slots[i].users) continue;
+    // a slot no layer has used yet is better than one that was just released, its old entry may still be on screen
+    if ((slot < 0) || (palette_slots[i].colors == NULL)) slot = i;
+  }
+  if (slot < 0) {
+    if (!l->lbm_starved) {
+      printf("no free palette slot for %s, all %d hold other tables\n", l->name ? l->name : "layer", HVS_PALETTE_SLOTS);
+    }
+    // retried like a full LBM, another layer may release its table
+    l->lbm_starved = true;
+    return false;
+  }
+  palette_slots[slot].colors = colors;
+  palette_slots[slot].users++;
+  l->palette_slot = slot + 1;
+  l->lbm_starved = false;
+  return true;
+}
+
+static uint32_t scaled_lbm_words(unsigned int input_width, unsigned int input_height,
+                                 unsigned int screen_width, unsigned int screen_height) {
+  return lbm_words_needed(input_width, screen_width,
+                          hvs_entry_scaling_mode(input_width, screen_width),
+                          hvs_entry_scaling_mode(input_height, screen_height), false);
+}
+
 #ifdef RPI4
 void hvs_add_plane(gfx_surface *fb, int x, int y, bool hflip) {
   assert(fb);
@@ -128,20 +231,6 @@ void hvs_add_plane(hvs_layer *l, int x, int y, bool hflip) {
 #ifndef RPI4
 // VC4 only
 
-static uint32_t compute_ppf(unsigned int source, unsigned int dest) {
-  uint32_t scale = (1<<16) * source / dest;
-  printf("PPF 0x%x, scale %d/%d\n", scale, source, dest);
-  return SCALER_PPF_AGC | (scale << 8) | (0 << 0);
-}
-
-static void compute_tpz(unsigned int source, unsigned int dest, uint32_t *out) {
-  uint32_t scale = (1<<16) * source / dest;
-  uint32_t recip = ~0 / scale;
-  printf("TPZ 0x%x 0x%x\n", scale, recip);
-  out[0] = scale << 8;
-  out[1] = recip & 0xffff;
-}
-
 void hvs_regen_noscale_noviewport(hvs_layer *l) {
   assert(l->dlist_length >= 7);
   assert(l->premade_dlist);
@@ -168,112 +257,36 @@ void hvs_regen_noscale_noviewport(hvs_layer *l) {
 
 void hvs_regen_scale_noviewport(hvs_layer *l) {
   assert(l->fb);
-  enum hvs_pixel_format fmt = gfx_to_hvs_pixel_format(l->fb->format);
-  int alpha_mode = 1;
-
-  enum scaling_mode xmode, ymode;
-  const uint32_t input_width = l->fb->width;
-  const uint32_t input_height = l->fb->height;
-  const uint32_t screen_width = l->w;
-  const uint32_t screen_height = l->h;
-  bool any_scaling = true;
-  const uint32_t x = l->x;
-  const uint32_t y = l->y;
-  printf("drawing to %d,%d size %dx%x\n", x, y, screen_width, screen_height);
-  printf("source %dx%d\n", input_width, input_height);
-
-  if (input_width > screen_width) xmode = TPZ;
-  else if (input_width < screen_width) xmode = PPF;
-  else xmode = TPZ;
-
-  if (input_height > screen_height) ymode = TPZ;
-  else if (input_height < screen_height) ymode = PPF;
-  else ymode = TPZ;
-
-  int scl0;
-  switch ((xmode << 2) | ymode) {
-  case (PPF << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_PPF;     // 0
-    break;
-  case (TPZ << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_PPF;     // 1
-    break;
-  case (PPF << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_TPZ;     // 2
-    break;
-  case (TPZ << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_TPZ;     // 3
-    break;
-  case (PPF << 2) | scaling_none:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_NONE;    // 4
-    break;
-  case (scaling_none << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_NONE_V_PPF;    // 5
-    break;
-  case (scaling_none << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_NONE_V_TPZ;    // 6
-    break;
-  case (TPZ << 2) | scaling_none:
-    // randomly doesnt work right
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_NONE;    // 7
-    break;
-  default:
-    puts("unsupported scale combination");
-    //printf("rendering FB of size %dx%d at %dx%d, scaled down to %dx%d\n", input_width, input_height, x, y, screen_width, screen_height);
-    return;
-  }
-
-  uint32_t *d = l->premade_dlist;
-  int pos = 0;
-  // control word 0
-  d[pos++] = 0 // CONTROL_VALID
-    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_ABGR)
-//    | CONTROL0_VFLIP // makes the HVS addr count down instead, pointer word must be last line of image
-    | (false ? CONTROL0_HFLIP : 0)
-    | CONTROL_FORMAT(fmt)
-    | (scl0 << 5)
-    | (scl0 << 8); // SCL1
-  d[pos++] = POS0_X(x) | POS0_Y(y) | POS0_ALPHA(0xff);                                   // position word 0
-  if (any_scaling) {
-    d[pos++] = screen_width | (screen_height << 16);                                     // position word 1
-  }
-  d[pos++] = POS2_H(input_width) | POS2_W(input_height) | (alpha_mode << 30);            // position word 2
-  d[pos++] = 0xDEADBEEF;                                                                 // position word 3, dummy for HVS state
-  d[pos++] = (uint32_t)l->fb->ptr | 0xc0000000;                                          // pointer word 0
-  d[pos++] = 0xDEADBEEF;                                                                 // pointer context word 0 dummy for HVS state
-  d[pos++] = l->fb->stride * l->fb->pixelsize;                                           // pitch word 0
-  d[pos++] = (scaled_layer_count * 2400);         // LBM base addr, TODO, should be handled better
-
-  if (xmode == PPF) {
-    d[pos++] = compute_ppf(input_width, screen_width);
-  }
-
-  if (ymode == PPF) {
-    d[pos++] = compute_ppf(input_height, screen_height);
-    d[pos++] = 0xDEADBEEF; // context for scaling
-  }
-
-  if (xmode == TPZ) {
-    compute_tpz(input_width, screen_width, &d[pos]);
-    pos += 2;
+  assert(l->premade_dlist);
+  if (hvs_debug) {
+    printf("drawing to %d,%d size %dx%d\n", l->x, l->y, l->w, l->h);
+    printf("source %dx%d\n", l->fb->width, l->fb->height);
   }
-
-  if (ymode == TPZ) {
-    compute_tpz(input_height, screen_height, &d[pos]);
-    pos += 2;
-    d[pos++] = 0xDEADBEEF; // context for scaling
+  mutex_acquire(&lbm_lock);
+  if (!hvs_layer_lbm(l, scaled_lbm_words(l->fb->width, l->fb->height, l->w, l->h))) {
+    mutex_release(&lbm_lock);
+    return;
   }
+  l->lbm_word = HVS_ENTRY_SCALED_LBM_WORD;
+  int words = hvs_entry_scaled(l->premade_dlist, gfx_to_hvs_pixel_format(l->fb->format), alpha_mode_fixed,
+                               POS0_X(l->x) | POS0_Y(l->y) | POS0_ALPHA(0xff),
+                               l->fb->width, l->fb->height, l->w, l->h,
+                               (uint32_t)l->fb->ptr | 0xc0000000, l->fb->stride * l->fb->pixelsize, l->lbm_offset,
+                               scaling_kernel);
+  mutex_release(&lbm_lock);
+  if (words == 0) puts("unsupported scale combination");
+  assert((uint32_t)words <= l->dlist_length);
+}
 
-  if (ymode == PPF || xmode == PPF) {
-    // TODO, if PPF is in use, write 4 pointers to the scaling kernels
-    uint32_t kernel = scaling_kernel;
-    d[pos++] = kernel;
-    d[pos++] = kernel;
-    d[pos++] = kernel;
-    d[pos++] = kernel;
-  }
-  printf("entry size: %d\n", pos);
-  d[0] |= CONTROL_VALID | CONTROL_WORDS(pos);
+void hvs_layer_set_fb(hvs_layer *l, gfx_surface *fb) {
+  assert(l->premade_dlist);
+  // unity entries have no POS1, so PTR0 is one word earlier
+  int ptr0 = (l->premade_dlist[0] & CONTROL_UNITY) ? 4 : 5;
+  uint32_t addr = (uint32_t)fb->ptr | 0xc0000000;
+  l->fb = fb;
+  l->premade_dlist[ptr0] = addr;
+  // also patch the copy the hvs is scanning out, so we dont have to wait for a hvs_update_dlist()
+  if (l->dlist_slot >= 0) dlist_memory[l->dlist_slot + ptr0] = addr;
 }
 
 void hvs_regen_noscale_viewport_noalpha(hvs_layer *l) {
@@ -304,176 +317,183 @@ void hvs_regen_noscale_viewport_noalpha(hvs_layer *l) {
 }
 #endif
 
-static void write_tpz(unsigned int source, unsigned int dest) {
-  uint32_t scale = (1<<16) * source / dest;
-  uint32_t recip = ~0 / scale;
-  if (hvs_debug) printf("TPZ 0x%x 0x%x\n", scale, recip);
-  dlist_memory[display_slot++] = scale << 8;
-  dlist_memory[display_slot++] = recip & 0xffff;
+void hvs_terminate_list(void) {
+  //printf("adding termination at %d\n", display_slot);
+  dlist_memory[display_slot++] = CONTROL_END;
+}
+
+static void hvs_layer_make_key(const hvs_layer *l, hvs_layer_key *k) {
+  // memcmp'd, so the padding has to be zeroed too
+  memset(k, 0, sizeof(*k));
+  k->w = l->w;
+  k->h = l->h;
+  k->alpha_mode = l->alpha_mode;
+  k->src_w = l->viewport_w;
+  k->src_h = l->viewport_h;
+  k->viewport_x = l->viewport_x;
+  k->viewport_y = l->viewport_y;
+  if (l->yuv) {
+    k->format = hvs_yuv_pixel_format(l->yuv->format);
+    k->image = l->yuv->luma;
+    k->image2 = l->yuv->chroma;
+    k->image3 = l->yuv->chroma2;
+    k->pitch = l->yuv->luma_stride;
+    k->pitch2 = l->yuv->chroma_stride;
+    k->colorspace = l->yuv->colorspace;
+  } else {
+    if (l->fb) {
+      k->format = gfx_to_hvs_pixel_format(l->fb->format);
+      k->image = l->fb->ptr;
+      k->pitch = l->fb->stride * l->fb->pixelsize;
+    } else {
+      k->format = HVS_PIXEL_FORMAT_PALETTE;
+      k->image = l->rawImage;
+      k->pitch = l->strides[0];
+      k->palette_mode = l->palette_mode;
+      k->colors = l->colors;
+    }
+  }
 }
 
-static void write_ppf(unsigned int source, unsigned int dest) {
-  uint32_t scale = (1<<16) * source / dest;
-  if (hvs_debug) printf("PPF 0x%x\n", scale);
-  dlist_memory[display_slot++] = SCALER_PPF_AGC |
-    (scale << 8) | (0 << 0);
+static int hvs_build_yuv(hvs_layer *s, uint32_t *d) {
+  const hvs_yuv_image *i = s->yuv;
+  const unsigned int planes = hvs_yuv_planes(i->format);
+  unsigned int hsub, vsub;
+  hvs_yuv_subsampling(i->format, &hsub, &vsub);
+  // both planes are PPF scaled, and the chroma line is never wider than the luma one
+  if (!hvs_layer_lbm(s, lbm_words_needed(s->viewport_w, s->w, LBM_SCALE_PPF, LBM_SCALE_PPF, true))) return 0;
+  s->lbm_word = hvs_entry_yuv_lbm_word(i->format);
+
+  // the crop has to start on a chroma sample
+  const unsigned int vx = s->viewport_x - (s->viewport_x % hsub);
+  const unsigned int vy = s->viewport_y - (s->viewport_y % vsub);
+  const unsigned int chroma_x = (vx / hsub) * ((planes == 2) ? 2 : 1);
+  const unsigned int chroma_y = vy / vsub;
+
+  hvs_entry_yuv_params p = {
+    .format = i->format,
+    .colorspace = i->colorspace,
+    .alpha_mode = s->alpha_mode,
+    // POS0, patched by hvs_update_dlist()
+    .pos0 = 0,
+    .src_w = s->viewport_w,
+    .src_h = s->viewport_h,
+    .w = s->w,
+    .h = s->h,
+    .luma_pitch = i->luma_stride,
+    .chroma_pitch = i->chroma_stride,
+    .lbm_offset = s->lbm_offset,
+    .kernel = scaling_kernel,
+  };
+  p.ptr[0] = (uint32_t)(i->luma + (vy * i->luma_stride) + vx) | 0xc0000000;
+  p.ptr[1] = (uint32_t)(i->chroma + (chroma_y * i->chroma_stride) + chroma_x) | 0xc0000000;
+  if (planes == 3) p.ptr[2] = (uint32_t)(i->chroma2 + (chroma_y * i->chroma_stride) + chroma_x) | 0xc0000000;
+  return hvs_entry_yuv(d, &p);
 }
 
-// this variant has some bugs
-static void hvs_add_plane_scaled(hvs_layer *layer) {
-  int alpha_mode = 1;
-  int x = layer->x;
-  int y = layer->y;
-  uint input_width = layer->viewport_w;
-  uint input_height = layer->viewport_h;
-  unsigned int screen_width = layer->w;
-  unsigned int screen_height = layer->h;
-  const bool hflip = false;
+static int hvs_build_plane(hvs_layer *l, uint32_t *d) {
   enum hvs_pixel_format fmt;
-  bool any_scaling = true;
-
-  if (layer->fb) {
-    assert(layer->fb);
-    fmt = gfx_to_hvs_pixel_format(layer->fb->format);
-    if (layer->fb->format == GFX_FORMAT_ARGB_8888) alpha_mode = 0;
-  } else if (layer->palette_mode != palette_none) {
+  const uint8_t *image;
+  uint32_t pitch;
+  uint32_t palette = 0;
+
+  if (l->fb) {
+    fmt = gfx_to_hvs_pixel_format(l->fb->format);
+    pitch = l->fb->stride * l->fb->pixelsize;
+    image = l->fb->ptr + (pitch * l->viewport_y) + (l->viewport_x * l->fb->pixelsize);
+  } else if (l->palette_mode != palette_none) {
     fmt = HVS_PIXEL_FORMAT_PALETTE;
+    pitch = l->strides[0];
+    // only whole rows can be skipped, a viewport_x would need a sub-byte offset
+    image = (const uint8_t*)l->rawImage + (pitch * l->viewport_y);
+    if (!l->colors || !hvs_layer_palette(l, l->colors)) return 0;
+    palette = hvs_entry_palette_word(l->palette_mode, PALETTE_SLOT_BASE(l->palette_slot - 1));
   } else {
     puts("unsupported sprite");
-    return;
+    return 0;
   }
 
-  if (hvs_debug && layer->fb) {
-    printf("rendering FB of size %dx%d at %dx%d, scaled down to %dx%d\n", input_width, input_height, x, y, screen_width, screen_height);
-    printf("alpha mode %d\n", alpha_mode);
-    printf("format %d\n", layer->fb->format);
-  }
-
-
-  enum scaling_mode xmode, ymode;
-
-  if (layer->fb) {
-    if (input_width > screen_width) xmode = TPZ;
-    else if (input_width < screen_width) xmode = PPF;
-    else xmode = TPZ;
-
-    if (input_height > screen_height) ymode = TPZ;
-    else if (input_height < screen_height) ymode = PPF;
-    else ymode = TPZ;
-  } else {
-    xmode = scaling_none;
-    ymode = scaling_none;
-  }
-
-  int scl0;
-  switch ((xmode << 2) | ymode) {
-  case (PPF << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_PPF;     // 0
-    break;
-  case (TPZ << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_PPF;     // 1
-    break;
-  case (PPF << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_TPZ;     // 2
-    break;
-  case (TPZ << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_TPZ;     // 3
-    break;
-  case (PPF << 2) | scaling_none:
-    scl0 = SCALER_CTL0_SCL_H_PPF_V_NONE;    // 4
-    break;
-  case (scaling_none << 2) | PPF:
-    scl0 = SCALER_CTL0_SCL_H_NONE_V_PPF;    // 5
-    break;
-  case (scaling_none << 2) | TPZ:
-    scl0 = SCALER_CTL0_SCL_H_NONE_V_TPZ;    // 6
-    break;
-  case (TPZ << 2) | scaling_none:
-    // randomly doesnt work right
-    scl0 = SCALER_CTL0_SCL_H_TPZ_V_NONE;    // 7
-    break;
-  default:
-    puts("unsupported scale combination");
-    printf("rendering FB of size %dx%d at %dx%d, scaled down to %dx%d\n", input_width, input_height, x, y, screen_width, screen_height);
-    return;
-  }
-
-  if (hvs_debug) printf("scl0: %d\n", scl0);
-
-  int start = display_slot;
-  // control word 0
-  dlist_memory[display_slot++] = 0 // CONTROL_VALID
-    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_ABGR)
-//    | CONTROL0_VFLIP // makes the HVS addr count down instead, pointer word must be last line of image
-    | (hflip ? CONTROL0_HFLIP : 0)
-    | CONTROL_FORMAT(fmt)
-    | (scl0 << 5)
-    | (scl0 << 8); // SCL1
-
-  dlist_memory[display_slot++] = POS0_X(x) | POS0_Y(y) | POS0_ALPHA(0xff);                                   // position word 0
-  if (any_scaling) {
-    dlist_memory[display_slot++] = screen_width | (screen_height << 16);                                     // position word 1
-  }
-  dlist_memory[display_slot++] = POS2_H(input_width) | POS2_W(input_height) | (alpha_mode << 30);            // position word 2
-  dlist_memory[display_slot++] = 0xDEADBEEF;                                                                 // position word 3, dummy for HVS state
-
-  dlist_memory[display_slot++] = (uint32_t)layer->fb->ptr | 0x80000000;                                      // pointer word 0
-  dlist_memory[display_slot++] = 0xDEADBEEF;                                                                 // pointer context word 0 dummy for HVS state
-  dlist_memory[display_slot++] = layer->fb->stride * layer->fb->pixelsize;                                   // pitch word 0
-  if (layer->palette_mode != palette_none) {
-    // optional pointer to palette table
-    dlist_memory[display_slot++] = 0xc0000000 | (0x300 << 2);
-  }
-  dlist_memory[display_slot++] = (scaled_layer_count * 2400);         // LBM base addr
-  scaled_layer_count++;
-
-#if 0
-  bool ppf = false;
-  if (ppf) {
-    uint32_t xscale = (1<<16) * fb->width / width;
-    uint32_t yscale = (1<<16) * fb->height / height;
-
-    dlist_memory[display_slot++] = SCALER_PPF_AGC | (xscale << 8);
-    dlist_memory[display_slot++] = SCALER_PPF_AGC | (yscale << 8);
-    dlist_memory[display_slot++] = 0xDEADBEEF; //scaling context
-  }
-#endif
-
-  if (xmode == PPF) {
-    write_ppf(input_width, screen_width);
-  }
-
-  if (ymode == PPF) {
-    write_ppf(input_height, screen_height);
-    dlist_memory[display_slot++] = 0xDEADBEEF; // context for scaling
+  if ((l->viewport_w != l->w) || (l->viewport_h != l->h)) {
+    if (palette) {
+      puts("scaled palette layers are not supported");
+      return 0;
+    }
+    if (hvs_entry_scl(hvs_entry_scaling_mode(l->viewport_w, l->w), hvs_entry_scaling_mode(l->viewport_h, l->h)) < 0) {
+      printf("unsupported scale combination, %dx%d -> %dx%d\n", l->viewport_w, l->viewport_h, l->w, l->h);
+      return 0;
+    }
+    if (!hvs_layer_lbm(l, scaled_lbm_words(l->viewport_w, l->viewport_h, l->w, l->h))) return 0;
+    l->lbm_word = HVS_ENTRY_SCALED_LBM_WORD;
+    return hvs_entry_scaled(d, fmt, l->alpha_mode, 0, l->viewport_w, l->viewport_h, l->w, l->h,
+                            (uint32_t)image | 0x80000000, pitch, l->lbm_offset, scaling_kernel);
   }
 
-  if (xmode == TPZ) {
-    write_tpz(input_width, screen_width);
-  }
+  // unity entries dont use the LBM
+  hvs_layer_lbm(l, 0);
+  // POS0 is patched by hvs_update_dlist()
+  return hvs_entry_unity(d, fmt, l->alpha_mode, 0, l->viewport_w, l->viewport_h, (uint32_t)image | 0xc0000000, pitch, palette);
+}
 
-  if (ymode == TPZ) {
-    write_tpz(input_height, screen_height);
-    dlist_memory[display_slot++] = 0xDEADBEEF; // context for scaling
+// (re)builds l->premade_dlist if anything other than the position changed since the last build
+// returns false if the layer cant be shown, that result is cached too, so it only complains once
+// except when the LBM was full, that is retried every time, since other layers may have freed some
+static bool hvs_layer_compile(hvs_layer *l) {
+  hvs_layer_key key;
+  hvs_layer_make_key(l, &key);
+  if (l->premade_dlist && !l->lbm_starved && (memcmp(&key, &l->dlist_key, sizeof(key)) == 0)) return l->dlist_length > 0;
+
+  if (!l->premade_dlist) {
+    l->premade_dlist = malloc(COMPILED_WORDS * 4);
+    if (!l->premade_dlist) return false;
+    l->dlist_compiled = true;
   }
-
-  if (ymode == PPF || xmode == PPF) {
-    // TODO, if PPF is in use, write 4 pointers to the scaling kernels
-    uint32_t kernel = scaling_kernel;
-    dlist_memory[display_slot++] = kernel;
-    dlist_memory[display_slot++] = kernel;
-    dlist_memory[display_slot++] = kernel;
-    dlist_memory[display_slot++] = kernel;
+  l->dlist_key = key;
+  l->dlist_length = l->yuv ? hvs_build_yuv(l, l->premade_dlist) : hvs_build_plane(l, l->premade_dlist);
+  if (l->palette_slot && (l->yuv || l->fb || (l->dlist_length == 0))) {
+    hvs_layer_palette(l, NULL);
+  } else if (l->palette_slot) {
+    // reloaded on every build, so edits to the table show up once the layer is rebuilt
+    uint entries = 1 << palette_get_bpp(l->palette_mode);
+    for (uint i=0; i<entries; i++) {
+      dlist_memory[PALETTE_SLOT_BASE(l->palette_slot - 1) + i] = l->colors->table[i];
+    }
   }
+  hvs_layer_compiles++;
+  return l->dlist_length > 0;
+}
 
-  //printf("entry size: %d, spans 0x%x-0x%x\n", display_slot - start, start, display_slot);
-  dlist_memory[start] |= CONTROL_VALID | CONTROL_WORDS(display_slot - start);
+// keeps the LBM region, the rebuild will most likely want the same size again
+void hvs_layer_invalidate(hvs_layer *l) {
+  if (!l->dlist_compiled) return;
+  free(l->premade_dlist);
+  l->premade_dlist = NULL;
+  l->dlist_length = 0;
+  l->dlist_compiled = false;
 }
 
-void hvs_terminate_list(void) {
-  //printf("adding termination at %d\n", display_slot);
-  dlist_memory[display_slot++] = CONTROL_END;
-  if (scaled_layer_count > 10) scaled_layer_count = 1;
+// copies every visible layer into dlist_memory at display_slot
+// returns false if it ran into DLIST_LIMIT, the layers that didnt fit are left out
+static bool hvs_emit_layers(int channel) {
+  hvs_layer *layer;
+  list_for_every_entry(&channels[channel].layers, layer, hvs_layer, node) {
+    layer->dlist_slot = -1;
+    if (!layer->visible || layer->plan_dropped) continue;
+    if (!layer->premade_dlist || layer->dlist_compiled) {
+      if (!hvs_layer_compile(layer)) continue;
+      // the only word of a compiled entry that changes from frame to frame
+      layer->premade_dlist[1] = POS0_X(layer->x) | POS0_Y(layer->y) | POS0_ALPHA(layer->alpha);
+    } else if (layer->dlist_length == 0) {
+      continue;
+    }
+    uint32_t actual_length = (layer->premade_dlist[0] >> 24) & 0x3f;
+    // leave room for the CONTROL_END
+    if ((display_slot + actual_length + 1) > DLIST_LIMIT) return false;
+    layer->dlist_slot = display_slot;
+    for (unsigned int i=0; i < actual_length; i++) {
+      dlist_memory[display_slot++] = layer->premade_dlist[i];
+    }
+  }
+  return true;
 }
 
 static enum handler_return hvs_irq(void *unused) {
@@ -481,26 +501,6 @@ static enum handler_return hvs_irq(void *unused) {
   return INT_NO_RESCHEDULE;
 }
 
-//#define SD_IDL 0x7ee00018
-//#define SD_CYC 0x7ee00030
-
-static void check_sdram_usage(void) {
-  static double last_time = 1;
-  uint64_t idle = *REG32(SD_IDL);
-  uint64_t total = *REG32(SD_CYC);
-  *REG32(SD_IDL) = 0;
-  uint32_t idle_percent = (idle * 100) / (total);
-  double time = ((float)*REG32(ST_CLO)) / 1000000;
-  uint32_t clock = total / (time - last_time) / 1000 / 1000;
-  last_time = time;
-  printf("[%f] DDR2 was idle 0x%x / 0x%x cycles (%d%%) %dMHz\n", time, (uint32_t)idle, (uint32_t)total, idle_percent, clock);
-}
-
-static enum handler_return ddr2_checker(struct timer *unused1, unsigned int unused2,  void *unused3) {
-  check_sdram_usage();
-  return INT_NO_RESCHEDULE;
-}
-
 static void upload_scaling_kernel(void) {
   printf("uploading scaling kernel\n");
   int kernel_start = scaling_kernel;
@@ -523,9 +523,6 @@ void hvs_initialize() {
 
   puts("hvs_initialize()");
 
-  timer_initialize(&ddr2_monitor);
-  //timer_set_periodic(&ddr2_monitor, 500, ddr2_checker, NULL);
-
 #ifdef ENABLE_TEXT
   debugText = gfx_create_surface(NULL, FONT_X * 10, FONT_Y, FONT_X * 10, GFX_FORMAT_ARGB_8888);
   hvs_layer *debugTextLayer = malloc(sizeof(hvs_layer));
@@ -569,6 +566,104 @@ void hvs_setup_irq() {
 static uint32_t hsync, hbp, hact, hfp, vsync, vbp, vfps, last_vfps;
 #endif
 
+static uint32_t present_frame_us(const struct hvs_channel_config *c) {
+  return c->frame_us ? c->frame_us : 16667;
+}
+
+static bool present_due(const struct hvs_channel_config *c, const hvs_present_entry *e, uint32_t next_frame, uint32_t next_scanout) {
+  if (e->target_frame) return (int32_t)(next_frame - e->target_frame) >= 0;
+  if (e->target_us) return (int32_t)(next_scanout + (present_frame_us(c) / 2) - e->target_us) >= 0;
+  return true;
+}
+
+// called at the start of vfp, picks what the next frame will show
+static void present_latch(int channel, uint32_t now) {
+  struct hvs_channel_config *c = &channels[channel];
+  hvs_present_entry skipped[HVS_PRESENT_DEPTH];
+  int skips = 0;
+
+  spin_lock(&c->present_lock);
+  const uint32_t next_frame = c->frames + 1;
+  const uint32_t next_scanout = now + c->present_stats.blank_us;
+  bool found = false;
+  while (c->present_count) {
+    hvs_present_entry *e = &c->present_queue[c->present_head];
+    if (!present_due(c, e, next_frame, next_scanout)) break;
+    if (found) skipped[skips++] = c->present_latched;
+    c->present_latched = *e;
+    found = true;
+    c->present_head = (c->present_head + 1) % HVS_PRESENT_DEPTH;
+    c->present_count--;
+  }
+  if (found) {
+    // the one latched last frame never reached its first active line, which only happens if vact was missed
+    if (c->present_pending) c->present_stats.skipped++;
+    c->present_latched.latched = now;
+    c->present_pending = true;
+    c->dlist_target = c->present_latched.dlist;
+    c->dlist_target_words = c->present_latched.dlist_words;
+  }
+  c->present_stats.skipped += skips;
+  spin_unlock(&c->present_lock);
+
+  for (int i=0; i<skips; i++) {
+    if (!skipped[i].callback) continue;
+    hvs_present_info info = { .submitted = skipped[i].submitted, .skipped = true };
+    skipped[i].callback(channel, &info, skipped[i].arg);
+  }
+}
+
+// called at the start of the active period, the frame latched at vfp is now going out
+static void present_scanout(int channel, uint32_t now) {
+  struct hvs_channel_config *c = &channels[channel];
+  hvs_present_stats *st = &c->present_stats;
+
+  spin_lock(&c->present_lock);
+  c->frames++;
+  if (c->last_vfp) st->blank_us = now - c->last_vfp;
+  if (!c->present_pending) {
+    spin_unlock(&c->present_lock);
+    return;
+  }
+  const hvs_present_entry e = c->present_latched;
+  c->present_pending = false;
+  const uint32_t frame_us = present_frame_us(c);
+  hvs_present_info info = {
+    .frame = c->frames,
+    .submitted = e.submitted,
+    .latched = e.latched,
+    .scanout = now,
+  };
+  if (e.target_frame) info.missed = (int32_t)(c->frames - e.target_frame) > 0;
+  else if (e.target_us) info.missed = (int32_t)(now - e.target_us) > (int32_t)(frame_us / 2);
+
+  const uint32_t latency = now - e.submitted;
+  if ((st->presented == 0) || (latency < st->latency_min)) st->latency_min = latency;
+  if (latency > st->latency_max) st->latency_max = latency;
+  st->latency_sum += latency;
+  st->presented++;
+  if (info.missed) st->missed++;
+
+  // pacing, only between 2 flips that both asked for the same kind of target
+  const hvs_present_entry *last = &c->present_last;
+  int32_t wanted = -1;
+  if (c->present_last_valid && e.target_frame && last->target_frame) wanted = (e.target_frame - last->target_frame) * frame_us;
+  else if (c->present_last_valid && e.target_us && last->target_us) wanted = e.target_us - last->target_us;
+  if (wanted >= 0) {
+    const int32_t gap = now - c->present_last_scanout;
+    const uint32_t jitter = (gap > wanted) ? (gap - wanted) : (wanted - gap);
+    if (jitter > st->jitter_max) st->jitter_max = jitter;
+    st->jitter_sum += jitter;
+    st->jitter_samples++;
+  }
+  c->present_last = e;
+  c->present_last_scanout = now;
+  c->present_last_valid = true;
+  spin_unlock(&c->present_lock);
+
+  if (e.callback) e.callback(channel, &info, e.arg);
+}
+
 static enum handler_return pv_irq(void *arg) {
   int pvnr = (int)arg;
   enum handler_return ret = INT_NO_RESCHEDULE;
@@ -580,9 +675,7 @@ static enum handler_return pv_irq(void *arg) {
   else if (pvnr == 2) hvs_channel = 1;
 #endif
 
-#ifdef TIMESTAMP_TIMINGS
   uint32_t t = *REG32(ST_CLO);
-#endif
 
   struct pixel_valve *rawpv = getPvAddr((int)pvnr);
   uint32_t stat = rawpv->int_status;
@@ -631,6 +724,18 @@ static enum handler_return pv_irq(void *arg) {
   }
   if (stat & PV_INTEN_VACT_START) {
     ack |= PV_INTEN_VACT_START;
+    uint32_t now = *REG32(ST_CLO);
+#ifdef TIMESTAMP_TIMINGS
+    channels[hvs_channel].present_stats.vfp_us = vsync - vfps;
+    channels[hvs_channel].present_stats.vsync_us = vbp - vsync;
+    channels[hvs_channel].present_stats.vbp_us = t - vbp;
+#endif
+    present_scanout(hvs_channel, now);
+
+    THREAD_LOCK(state);
+    int woken = wait_queue_wake_all(&channels[hvs_channel].scanout, false, NO_ERROR);
+    if (woken > 0) ret = INT_RESCHEDULE;
+    THREAD_UNLOCK(state);
   }
   if (stat & PV_INTEN_VFP_START) {
     ack |= PV_INTEN_VFP_START;
@@ -638,6 +743,12 @@ static enum handler_return pv_irq(void *arg) {
     last_vfps = vfps;
     vfps = t;
 #endif
+    uint32_t now = *REG32(ST_CLO);
+    if (channels[hvs_channel].last_vsync) channels[hvs_channel].frame_us = now - channels[hvs_channel].last_vsync;
+    channels[hvs_channel].last_vsync = now;
+    channels[hvs_channel].last_vfp = now;
+
+    present_latch(hvs_channel, now);
 
     // actually do the page-flip
     if (hvs_channel == 0) {
@@ -645,6 +756,7 @@ static enum handler_return pv_irq(void *arg) {
     } else if (hvs_channel == 1) {
       *REG32(SCALER_DISPLIST1) = channels[hvs_channel].dlist_target;
     }
+    hvs_telemetry_frame(hvs_channel, t, channels[hvs_channel].dlist_target, channels[hvs_channel].dlist_target_words);
 
     THREAD_LOCK(state);
     int woken = wait_queue_wake_all(&channels[hvs_channel].vsync, false, NO_ERROR);
@@ -654,11 +766,6 @@ static enum handler_return pv_irq(void *arg) {
     //hvs_set_background_color(1, 0xff0000);
     //do_frame_update((stat1 >> 12) & 0x3f);
     //printf("line: %d frame: %2d start: %4d ", stat1 & 0xfff, (stat1 >> 12) & 0x3f, *REG32(SCALER_DISPLIST1));
-    //uint32_t idle = *REG32(SD_IDL);
-    //uint32_t total = *REG32(SD_CYC);
-    //*REG32(SD_IDL) = 0;
-    //uint64_t idle_percent = ((uint64_t)idle * 100) / ((uint64_t)total);
-    //printf("sdram usage: %d %d, %lld\n", idle, total, idle_percent);
     //printf("HSYNC:%5d HBP:%d HACT:%d HFP:%d VSYNC:%5d VBP:%5d VFPS:%d FRAME:%d\n", t - vsync, t-hbp, t-hact, t-hfp, t-vsync, t-vbp, t-vfps, t-last_vfps);
     //hvs_set_background_color(1, 0xffffff);
   }
@@ -678,6 +785,25 @@ void hvs_configure_channel(int channel, int width, int height, bool interlaced)
   channels[channel].height = height;
   channels[channel].interlaced = interlaced;
 
+  hvs_plan *plan = &channels[channel].plan;
+  free(plan->cycles);
+  free(plan->bytes);
+  uint32_t *cycles = malloc(height * sizeof(uint32_t));
+  uint32_t *bytes = malloc(height * sizeof(uint32_t));
+  if (!cycles || !bytes) {
+    // hvs_plan_update() skips a plan with no arrays, so the channel just runs without a budget
+    printf("no memory for the %d line plan of channel %d, not enforcing a budget\n", height, channel);
+    free(cycles);
+    free(bytes);
+    cycles = NULL;
+    bytes = NULL;
+  }
+  hvs_plan_init(plan, width, height, cycles, bytes);
+  channels[channel].plan_budget_fixed = false;
+  channels[channel].frame_us = 0;
+  channels[channel].last_vsync = 0;
+  channels[channel].last_vfp = 0;
+
   hvs_channels[channel].dispctrl = SCALER_DISPCTRLX_RESET;
   hvs_channels[channel].dispctrl = SCALER_DISPCTRLX_ENABLE | SCALER_DISPCTRL_W(width) | SCALER_DISPCTRL_H(height);
 
@@ -696,7 +822,12 @@ void hvs_configure_channel(int channel, int width, int height, bool interlaced)
     rawpv->int_enable = 0;
     rawpv->int_status = 0xff;
     setup_pv_interrupt(pvnr, pv_irq, (void*)pvnr);
-    rawpv->int_enable = PV_INTEN_VFP_START; // | 0x3f;
+    // vact is when a flip latched at vfp actually goes on screen, for the presentation queue
+    uint32_t inten = PV_INTEN_VFP_START | PV_INTEN_VACT_START;
+#ifdef TIMESTAMP_TIMINGS
+    inten |= PV_INTEN_VSYNC_START | PV_INTEN_VBP_START;
+#endif
+    rawpv->int_enable = inten; // | 0x3f;
     //hvs_setup_irq();
     //puts("done");
   }
@@ -923,6 +1054,68 @@ __WEAK status_t display_get_framebuffer(struct display_framebuffer *fb) {
   return NO_ERROR;
 }
 
+static int cmd_hvs_lbm(int argc, const console_cmd_args *argv) {
+  mutex_acquire(&lbm_lock);
+  printf("LBM: %d/%d words used, peak %d, largest gap %d, %d failed allocations, %d defrag moves\n",
+      lbm.used, lbm.size, lbm.peak, lbm_largest_free(&lbm), lbm.failures, lbm.moves);
+  for (uint32_t i=0; i < lbm.count; i++) {
+    const lbm_region *r = &lbm.regions[i];
+    const hvs_layer *l = r->owner;
+    printf("  %5d+%5d %s\n", r->offset, r->size, l ? (l->name ? l->name : "unnamed") : "(quarantined)");
+  }
+  mutex_release(&lbm_lock);
+  return 0;
+}
+
+static int cmd_hvs_plan(int argc, const console_cmd_args *argv) {
+  if (argc < 2) {
+    printf("usage: %s <channel> [report|drop|auto|budget <cycles> <bytes>]\n", argv[0].str);
+    return -1;
+  }
+  int channel = argv[1].u;
+  if ((channel < 0) || (channel > 2)) return -1;
+  struct hvs_channel_config *c = &channels[channel];
+  mutex_acquire(&c->lock);
+  if (argc >= 3) {
+    if (strcmp(argv[2].str, "report") == 0) c->plan_policy = HVS_PLAN_REPORT;
+    else if (strcmp(argv[2].str, "drop") == 0) c->plan_policy = HVS_PLAN_DROP;
+    else if (strcmp(argv[2].str, "auto") == 0) c->plan_budget_fixed = false;
+    else if ((strcmp(argv[2].str, "budget") == 0) && (argc >= 5)) {
+      c->plan.cycle_budget = argv[3].u;
+      c->plan.byte_budget = argv[4].u;
+      c->plan_budget_fixed = true;
+    } else {
+      printf("unknown option %s\n", argv[2].str);
+    }
+  }
+  const hvs_plan *p = &c->plan;
+  if (!p->cycles) printf("channel %d: no plan, hvs_configure_channel() couldnt allocate it\n", channel);
+  printf("channel %d: %s, budget %d cycles %d bytes per line (%s), frame %d us\n", channel,
+      c->plan_policy == HVS_PLAN_DROP ? "drop" : "report",
+      p->cycle_budget, p->byte_budget, c->plan_budget_fixed ? "fixed" : "auto", c->frame_us);
+  printf("last update: %d layers, peak %d cycles %d bytes at line %d, %d lines over budget, %d dropped\n",
+      p->layers, p->peak_cycles, p->peak_bytes, p->peak_line, p->over_lines, p->dropped);
+  mutex_release(&c->lock);
+  return 0;
+}
+
+// prints the layers the last update planned, as input for plan-sim, see platform/bcm28xx/hvs/Makefile
+static int cmd_hvs_plan_dump(int argc, const console_cmd_args *argv) {
+  int channel = 1;
+  if (argc >= 2) channel = argv[1].u;
+  if ((channel < 0) || (channel > 2)) return -1;
+  struct hvs_channel_config *c = &channels[channel];
+  mutex_acquire(&c->lock);
+  printf("screen %d %d\n", c->width, c->height);
+  printf("budget %d %d\n", c->plan.cycle_budget, c->plan.byte_budget);
+  for (uint32_t i=0; (i < c->plan.layers) && (i < c->plan_capacity); i++) {
+    const hvs_plan_layer *l = &c->plan_layers[i];
+    printf("layer %d %d %d %d %d %d %d %d %d\n", l->x, l->y, l->w, l->h, l->src_w, l->src_h, l->bits_per_pixel, l->scaled, l->priority);
+  }
+  mutex_release(&c->lock);
+  return 0;
+}
+
 static int cmd_hvs_update(int argc, const console_cmd_args *argv) {
   int channel = 1;
   if (argc >= 2) channel = argv[1].u;
@@ -934,36 +1127,163 @@ static int cmd_hvs_update(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
-void hvs_update_dlist(int channel) {
-  assert(is_mutex_held(&channels[channel].lock));
+static bool lbm_on_channel(const void *owner, void *arg) {
+  const int channel = *(const int*)arg;
+  hvs_layer *layer;
+  list_for_every_entry(&channels[channel].layers, layer, hvs_layer, node) {
+    if (layer == owner) return true;
+  }
+  return false;
+}
+
+// one defragmentation move per update, so the free LBM drifts to the top over a few frames
+// only layers on the channel being rebuilt are moved, their new offset goes out with the list being built
+// a layer on another channel would keep scanning out the old offset until that channel next updates, which can be long after the quarantine
+static void hvs_lbm_maintain(int channel) {
+  uint32_t now = *REG32(ST_CLO);
+  void *owner;
+  uint32_t offset;
+  lbm_reclaim(&lbm, now);
+  if (lbm_defrag_step(&lbm, now, lbm_on_channel, &channel, &owner, &offset)) {
+    hvs_layer *l = owner;
+    l->lbm_offset = offset;
+    // the old spot stays quarantined until the list still pointing at it is off the screen
+    if (l->premade_dlist) l->premade_dlist[l->lbm_word] = offset;
+  }
+}
+
+static uint32_t layer_bits_per_pixel(const hvs_layer *l) {
+  if (l->yuv) {
+    // a full res luma byte, plus a cb and cr byte shared by hsub x vsub pixels
+    unsigned int hsub, vsub;
+    hvs_yuv_subsampling(l->yuv->format, &hsub, &vsub);
+    return 8 + (16 / (hsub * vsub));
+  }
+  if (l->fb) return l->fb->pixelsize * 8;
+  return palette_get_bpp(l->palette_mode);
+}
+
+// the budget is whatever a line gets on average, between 2 vsyncs
+static void hvs_plan_budget(struct hvs_channel_config *c) {
+  if (c->plan_budget_fixed) return;
+  // assume 60hz until the pv irq has measured it
+  uint32_t frame_us = c->frame_us ? c->frame_us : 16667;
+  // an interlaced field only sends half the lines
+  uint32_t lines = c->interlaced ? (c->height / 2) : c->height;
+  c->plan.cycle_budget = ((uint64_t)frame_us * HVS_PLAN_CLOCK_MHZ) / lines;
+  c->plan.byte_budget = c->plan.cycle_budget * HVS_PLAN_BYTES_PER_CYCLE;
+}
+
+// estimates the cost of every scanline before the list is built, and applies the policy
+static void hvs_plan_update(int channel) {
+  struct hvs_channel_config *c = &channels[channel];
+  hvs_layer *layer;
+  uint32_t count = 0;
+
+  list_for_every_entry(&c->layers, layer, hvs_layer, node) {
+    layer->plan_dropped = false;
+    if (layer->visible) count++;
+  }
+  // not configured yet, or hvs_configure_channel() couldnt allocate the arrays
+  if (!c->plan.cycles || !c->plan.bytes) return;
+  if (count > c->plan_capacity) {
+    hvs_plan_layer *layers = realloc(c->plan_layers, count * sizeof(hvs_plan_layer));
+    if (layers) c->plan_layers = layers;
+    bool *drop = realloc(c->plan_drop, count * sizeof(bool));
+    if (drop) c->plan_drop = drop;
+    if (!layers || !drop) return;
+    c->plan_capacity = count;
+  }
+
+  hvs_plan_budget(c);
+  hvs_plan_begin(&c->plan);
+  uint32_t i = 0;
+  list_for_every_entry(&c->layers, layer, hvs_layer, node) {
+    if (!layer->visible) continue;
+    hvs_plan_layer *pl = &c->plan_layers[i++];
+    pl->x = layer->x;
+    pl->y = layer->y;
+    pl->w = layer->w;
+    pl->h = layer->h;
+    pl->src_w = layer->viewport_w;
+    pl->src_h = layer->viewport_h;
+    pl->bits_per_pixel = layer_bits_per_pixel(layer);
+    pl->scaled = layer->yuv || (pl->src_w != pl->w) || (pl->src_h != pl->h);
+    pl->priority = layer->layer;
+    hvs_plan_add(&c->plan, pl);
+  }
+  hvs_plan_finish(&c->plan);
+
+  if ((c->plan_policy != HVS_PLAN_DROP) || (c->plan.over_lines == 0)) return;
+  // the list is sorted by ->layer, so this drops from the bottom up
+  hvs_plan_drop(&c->plan, c->plan_layers, count, c->plan_drop);
+  i = 0;
+  list_for_every_entry(&c->layers, layer, hvs_layer, node) {
+    if (!layer->visible) continue;
+    layer->plan_dropped = c->plan_drop[i++];
+  }
+}
+
+// the most words the channels next list can take, compiled entries count at their largest, including the CONTROL_END
+static uint32_t hvs_dlist_estimate(int channel) {
   hvs_layer *layer;
+  uint32_t words = 1;
+  list_for_every_entry(&channels[channel].layers, layer, hvs_layer, node) {
+    if (!layer->visible) continue;
+    if (!layer->premade_dlist || layer->dlist_compiled) words += COMPILED_WORDS;
+    else if (layer->dlist_length) words += (layer->premade_dlist[0] >> 24) & 0x3f;
+  }
+  return words;
+}
+
+// if start+words misses the ring slots from live up to display_slot, which wrap around if live is past display_slot
+static bool hvs_dlist_range_free(uint32_t start, uint32_t words, uint32_t live) {
+  const uint32_t end = start + words;
+  if (live <= (uint32_t)display_slot) return (end <= live) || (start >= (uint32_t)display_slot);
+  return (start >= (uint32_t)display_slot) && (end <= live);
+}
+
+// the lists still queued on a channel were all written after the one it is showing, so everything from that one
+// up to display_slot is live, and a new list must fit in the rest of the ring
+// hvs_emit_layers() writes at display_slot, or at 0 if the list doesnt fit below DLIST_LIMIT, so both have to be free when it could go either way
+static bool hvs_dlist_room(int channel) {
+  struct hvs_channel_config *c = &channels[channel];
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&c->present_lock, irqstate);
+  const uint32_t live = c->dlist_target;
+  spin_unlock_irqrestore(&c->present_lock, irqstate);
+
+  const uint32_t words = hvs_dlist_estimate(channel);
+  if ((display_slot + words) <= DLIST_LIMIT) return hvs_dlist_range_free(display_slot, words, live);
+  return hvs_dlist_range_free(display_slot, DLIST_LIMIT - display_slot, live) && hvs_dlist_range_free(0, words, live);
+}
+
+// writes a new list for the channel into the ring, and fills in where it starts
+// with check_room, returns ERR_BUSY instead if it could overwrite a list the channel has queued or on screen
+static status_t hvs_build_dlist(int channel, bool check_room, uint32_t *start, uint32_t *words) {
+  assert(is_mutex_held(&channels[channel].lock));
+  mutex_acquire(&lbm_lock);
+  if (check_room && !hvs_dlist_room(channel)) {
+    mutex_release(&lbm_lock);
+    return ERR_BUSY;
+  }
+  hvs_lbm_maintain(channel);
+  hvs_plan_update(channel);
 
   //uint32_t t = *REG32(ST_CLO);
   //printf("doing dlist update at %d\n", t);
 
   int list_start = display_slot;
 
-  list_for_every_entry(&channels[channel].layers, layer, hvs_layer, node) {
-    if (layer->visible) {
-      if (layer->premade_dlist && (layer->dlist_length > 0)) {
-        uint32_t actual_length = (layer->premade_dlist[0] >> 24) & 0x3f;
-        for (unsigned int i=0; i < actual_length; i++) {
-          dlist_memory[display_slot++] = layer->premade_dlist[i];
-        }
-      } else
-#if 0
-      if ((layer->w == layer->viewport_w) && (layer->h == layer->viewport_h)) { // unity scale
-        hvs_add_plane(layer, layer->x, layer->y, false);
-      } else
-#endif
-      {
-        puts("legacy layer");
-        hvs_add_plane_scaled(layer);
-      }
-    }
+  if (!hvs_emit_layers(channel)) {
+    // didnt fit before the end of the ring, start over at the bottom
+    display_slot = 0;
+    list_start = 0;
+    if (!hvs_emit_layers(channel)) printf("dlist overflow!!!: some layers were left out\n");
   }
 
   hvs_terminate_list();
+  *words = display_slot - list_start;
 
 #ifdef ENABLE_TEXT
   if (1) {
@@ -984,15 +1304,11 @@ void hvs_update_dlist(int channel) {
   }
 #endif
 
-  if (display_slot > 4096) {
-    printf("dlist overflow!!!: %d\n", display_slot);
-    display_slot = 0;
-    hvs_update_dlist(channel);
-    return;
-  }
-
   if (hvs_debug) {
+    const hvs_plan *p = &channels[channel].plan;
     printf("channel %d will next display %d-%d\n", channel, list_start, display_slot);
+    printf("peak %d/%d cycles %d/%d bytes at line %d, %d lines over, %d dropped\n",
+        p->peak_cycles, p->cycle_budget, p->peak_bytes, p->byte_budget, p->peak_line, p->over_lines, p->dropped);
   }
 
   if (display_slot > 3000) {
@@ -1000,8 +1316,94 @@ void hvs_update_dlist(int channel) {
     //puts("dlist loop");
   }
 
-  channels[channel].dlist_target = list_start;
   hvs_debug = false;
+  mutex_release(&lbm_lock);
+  *start = list_start;
+  return NO_ERROR;
+}
+
+void hvs_update_dlist(int channel) {
+  uint32_t start, words;
+  hvs_build_dlist(channel, false, &start, &words);
+  channels[channel].dlist_target = start;
+  channels[channel].dlist_target_words = words;
+}
+
+status_t hvs_present(int channel, uint32_t target_frame, uint32_t target_us, hvs_present_callback callback, void *arg) {
+  struct hvs_channel_config *c = &channels[channel];
+  spin_lock_saved_state_t irqstate;
+  assert(is_mutex_held(&c->lock));
+
+  spin_lock_irqsave(&c->present_lock, irqstate);
+  bool full = c->present_count >= HVS_PRESENT_DEPTH;
+  spin_unlock_irqrestore(&c->present_lock, irqstate);
+  if (full) return ERR_BUSY;
+
+  hvs_present_entry e = {
+    .target_frame = target_frame,
+    .target_us = target_us,
+    .callback = callback,
+    .arg = arg,
+  };
+  status_t ret = hvs_build_dlist(channel, true, &e.dlist, &e.dlist_words);
+  if (ret != NO_ERROR) return ret;
+  e.submitted = *REG32(ST_CLO);
+
+  // only this thread adds, and the irq only takes away, so there is still room
+  spin_lock_irqsave(&c->present_lock, irqstate);
+  c->present_queue[(c->present_head + c->present_count) % HVS_PRESENT_DEPTH] = e;
+  c->present_count++;
+  spin_unlock_irqrestore(&c->present_lock, irqstate);
+  return NO_ERROR;
+}
+
+uint32_t hvs_frame_count(int channel) {
+  return channels[channel].frames;
+}
+
+void hvs_present_wait(int channel, uint32_t frame) {
+  THREAD_LOCK(state);
+  while ((int32_t)(channels[channel].frames - frame) < 0) {
+    wait_queue_block(&channels[channel].scanout, INFINITE_TIME);
+  }
+  THREAD_UNLOCK(state);
+}
+
+static int cmd_hvs_present(int argc, const console_cmd_args *argv) {
+  if (argc < 2) {
+    printf("usage: %s <channel> [reset]\n", argv[0].str);
+    return -1;
+  }
+  int channel = argv[1].u;
+  if ((channel < 0) || (channel > 2)) return -1;
+  struct hvs_channel_config *c = &channels[channel];
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&c->present_lock, irqstate);
+  hvs_present_stats st = c->present_stats;
+  uint32_t queued = c->present_count;
+  if ((argc >= 3) && (strcmp(argv[2].str, "reset") == 0)) {
+    uint32_t blank_us = c->present_stats.blank_us;
+    memset(&c->present_stats, 0, sizeof(c->present_stats));
+    c->present_stats.blank_us = blank_us;
+    c->present_last_valid = false;
+  }
+  spin_unlock_irqrestore(&c->present_lock, irqstate);
+
+  printf("channel %d: frame %d, %d us per frame, %d queued\n", channel, c->frames, c->frame_us, queued);
+  printf("presented %d, missed %d, skipped %d\n", st.presented, st.missed, st.skipped);
+  if (st.presented) {
+    printf("latency submit to scanout: min %d avg %d max %d us\n",
+        st.latency_min, (uint32_t)(st.latency_sum / st.presented), st.latency_max);
+  }
+  if (st.jitter_samples) {
+    printf("pacing jitter: avg %d max %d us over %d gaps\n",
+        (uint32_t)(st.jitter_sum / st.jitter_samples), st.jitter_max, st.jitter_samples);
+  }
+  printf("latched %d us before scanout\n", st.blank_us);
+#ifdef TIMESTAMP_TIMINGS
+  printf("blanking: vfp %d vsync %d vbp %d us\n", st.vfp_us, st.vsync_us, st.vbp_us);
+#endif
+  return 0;
 }
 
 int cmd_hvs_dump_dlist(int argc, const console_cmd_args *argv) {
@@ -1015,12 +1417,18 @@ int cmd_hvs_dump_dlist(int argc, const console_cmd_args *argv) {
     printf("hvs channel %d, dlist start %d\n", channel, channels[channel].dlist_target);
     hvs_layer *layer;
     list_for_every_entry(&channels[channel].layers, layer, hvs_layer, node) {
-      printf("%p %p screen %3d,%3d+%3dx%3d, viewport %3d,%3d+%3dx%3d, source: %3dx%3d layer: %d %s\n", layer, layer->fb->ptr
+      // palette and yuv layers have no fb
+      printf("%p %p screen %3d,%3d+%3dx%3d, viewport %3d,%3d+%3dx%3d, source: %3dx%3d layer: %d %s, %s %d words at %d\n", layer, layer->fb ? layer->fb->ptr : NULL
           , layer->x, layer->y, layer->w, layer->h
           , layer->viewport_x, layer->viewport_y, layer->viewport_w, layer->viewport_h
-          , layer->fb->width, layer->fb->height
-          , layer->layer, layer->name ? layer->name : "NULL");
+          , layer->fb ? layer->fb->width : layer->orig_w, layer->fb ? layer->fb->height : layer->orig_h
+          , layer->layer, layer->name ? layer->name : "NULL"
+          , layer->dlist_compiled ? "compiled" : "premade", layer->dlist_length, layer->dlist_slot);
     }
+    const hvs_plan *p = &channels[channel].plan;
+    printf("scanline peak %d/%d cycles, %d/%d bytes, %d lines over budget, %d layers dropped\n",
+        p->peak_cycles, p->cycle_budget, p->peak_bytes, p->byte_budget, p->over_lines, p->dropped);
+    printf("%d entries compiled so far\n", hvs_layer_compiles);
   }
   return 0;
 }
@@ -1044,13 +1452,29 @@ void hvs_dlist_add(int channel, hvs_layer *new_layer) {
   list_add_tail(&channels[channel].layers, &new_layer->node);
 }
 
+void hvs_dlist_remove(int channel, hvs_layer *layer) {
+  assert(is_mutex_held(&channels[channel].lock));
+  list_delete(&layer->node);
+  layer->dlist_slot = -1;
+  mutex_acquire(&lbm_lock);
+  hvs_layer_lbm(layer, 0);
+  hvs_layer_palette(layer, NULL);
+  layer->lbm_starved = false;
+  mutex_release(&lbm_lock);
+  // the compiled entry points at the LBM region that was just released
+  hvs_layer_invalidate(layer);
+}
+
 static void hvs_init_hook(uint level) {
   puts("hvs_init_hook()");
   for (int i=0; i<3; i++) {
     list_initialize(&channels[i].layers);
     mutex_init(&channels[i].lock);
     wait_queue_init(&channels[i].vsync);
+    wait_queue_init(&channels[i].scanout);
+    spin_lock_init(&channels[i].present_lock);
   }
+  lbm_init(&lbm, LBM_WORDS);
 }
 
 uint32_t hvs_wait_vsync(int hvs_channel) {
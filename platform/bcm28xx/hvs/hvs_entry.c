@@ -0,0 +1,232 @@
+#include <platform/bcm28xx/hvs_entry.h>
+
+// s2.8 fixed point, 256 is 1.0
+typedef struct {
+  int y_offset;
+  int y;
+  int cr_red;
+  int cb_green;
+  int cr_green;
+  int cb_blue;
+} csc_coeffs;
+
+static const csc_coeffs csc_table[] = {
+  [HVS_BT601]      = { -16, 298, 409, -100, -208, 516 },
+  [HVS_BT709]      = { -16, 298, 459,  -55, -136, 541 },
+  [HVS_BT601_FULL] = {   0, 256, 359,  -88, -183, 454 },
+  [HVS_BT709_FULL] = {   0, 256, 403,  -48, -120, 475 },
+};
+
+static uint32_t compute_ppf(unsigned int source, unsigned int dest) {
+  uint32_t scale = (1<<16) * source / dest;
+  return SCALER_PPF_AGC | (scale << 8) | (0 << 0);
+}
+
+static void compute_tpz(unsigned int source, unsigned int dest, uint32_t *out) {
+  uint32_t scale = (1<<16) * source / dest;
+  uint32_t recip = ~0 / scale;
+  out[0] = scale << 8;
+  out[1] = recip & 0xffff;
+}
+
+enum lbm_scaling hvs_entry_scaling_mode(unsigned int source, unsigned int dest) {
+  if (source < dest) return LBM_SCALE_PPF;
+  return LBM_SCALE_TPZ;
+}
+
+int hvs_entry_scl(enum lbm_scaling xmode, enum lbm_scaling ymode) {
+  switch ((xmode << 2) | ymode) {
+  case (LBM_SCALE_PPF << 2) | LBM_SCALE_PPF:
+    return SCALER_CTL0_SCL_H_PPF_V_PPF;     // 0
+  case (LBM_SCALE_TPZ << 2) | LBM_SCALE_PPF:
+    return SCALER_CTL0_SCL_H_TPZ_V_PPF;     // 1
+  case (LBM_SCALE_PPF << 2) | LBM_SCALE_TPZ:
+    return SCALER_CTL0_SCL_H_PPF_V_TPZ;     // 2
+  case (LBM_SCALE_TPZ << 2) | LBM_SCALE_TPZ:
+    return SCALER_CTL0_SCL_H_TPZ_V_TPZ;     // 3
+  case (LBM_SCALE_PPF << 2) | LBM_SCALE_NONE:
+    return SCALER_CTL0_SCL_H_PPF_V_NONE;    // 4
+  case (LBM_SCALE_NONE << 2) | LBM_SCALE_PPF:
+    return SCALER_CTL0_SCL_H_NONE_V_PPF;    // 5
+  case (LBM_SCALE_NONE << 2) | LBM_SCALE_TPZ:
+    return SCALER_CTL0_SCL_H_NONE_V_TPZ;    // 6
+  case (LBM_SCALE_TPZ << 2) | LBM_SCALE_NONE:
+    // randomly doesnt work right
+    return SCALER_CTL0_SCL_H_TPZ_V_NONE;    // 7
+  default:
+    return -1;
+  }
+}
+
+// 31:30 is log2 of the bpp, same layout bad-apple uses
+uint32_t hvs_entry_palette_word(enum palette_type type, uint32_t base) {
+  return ((type - palette_1bpp) << 30) | (1 << 26) | (base << 2);
+}
+
+int hvs_entry_unity(uint32_t *d, enum hvs_pixel_format fmt, enum alpha_mode alpha_mode, uint32_t pos0,
+                    unsigned int width, unsigned int height, uint32_t ptr0, uint32_t pitch, uint32_t palette) {
+  int pos = 0;
+  d[pos++] = CONTROL_VALID
+    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_ABGR)
+    | CONTROL_UNITY
+    | CONTROL_FORMAT(fmt);
+  d[pos++] = pos0;                                                    // POS0
+  d[pos++] = POS2_H(height) | POS2_W(width) | (alpha_mode << 30);
+  d[pos++] = 0xDEADBEEF;                                              // POS3, context
+  d[pos++] = ptr0;                                                    // PTR0
+  d[pos++] = 0xDEADBEEF;                                              // context 0
+  d[pos++] = pitch;                                                   // pitch 0
+  if (palette) d[pos++] = palette;
+  d[0] |= CONTROL_WORDS(pos);
+  return pos;
+}
+
+int hvs_entry_scaled(uint32_t *d, enum hvs_pixel_format fmt, enum alpha_mode alpha_mode, uint32_t pos0,
+                     unsigned int input_width, unsigned int input_height,
+                     unsigned int screen_width, unsigned int screen_height,
+                     uint32_t ptr0, uint32_t pitch, uint32_t lbm_offset, uint32_t kernel) {
+  const enum lbm_scaling xmode = hvs_entry_scaling_mode(input_width, screen_width);
+  const enum lbm_scaling ymode = hvs_entry_scaling_mode(input_height, screen_height);
+  const int scl0 = hvs_entry_scl(xmode, ymode);
+  if (scl0 < 0) return 0;
+
+  int pos = 0;
+  // control word 0
+  d[pos++] = 0 // CONTROL_VALID
+    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_ABGR)
+//    | CONTROL0_VFLIP // makes the HVS addr count down instead, pointer word must be last line of image
+    | CONTROL_FORMAT(fmt)
+    | CONTROL_SCL0(scl0)
+    | CONTROL_SCL1(scl0);
+  d[pos++] = pos0;                                                                       // position word 0
+  d[pos++] = screen_width | (screen_height << 16);                                       // position word 1
+  d[pos++] = POS2_H(input_height) | POS2_W(input_width) | (alpha_mode << 30);            // position word 2
+  d[pos++] = 0xDEADBEEF;                                                                 // position word 3, dummy for HVS state
+  d[pos++] = ptr0;                                                                       // pointer word 0
+  d[pos++] = 0xDEADBEEF;                                                                 // pointer context word 0 dummy for HVS state
+  d[pos++] = pitch;                                                                      // pitch word 0
+  d[pos++] = lbm_offset;                                                                 // LBM base addr
+
+  if (xmode == LBM_SCALE_PPF) {
+    d[pos++] = compute_ppf(input_width, screen_width);
+  }
+
+  if (ymode == LBM_SCALE_PPF) {
+    d[pos++] = compute_ppf(input_height, screen_height);
+    d[pos++] = 0xDEADBEEF; // context for scaling
+  }
+
+  if (xmode == LBM_SCALE_TPZ) {
+    compute_tpz(input_width, screen_width, &d[pos]);
+    pos += 2;
+  }
+
+  if (ymode == LBM_SCALE_TPZ) {
+    compute_tpz(input_height, screen_height, &d[pos]);
+    pos += 2;
+    d[pos++] = 0xDEADBEEF; // context for scaling
+  }
+
+  if (ymode == LBM_SCALE_PPF || xmode == LBM_SCALE_PPF) {
+    // TODO, if PPF is in use, write 4 pointers to the scaling kernels
+    d[pos++] = kernel;
+    d[pos++] = kernel;
+    d[pos++] = kernel;
+    d[pos++] = kernel;
+  }
+  d[0] |= CONTROL_VALID | CONTROL_WORDS(pos);
+  return pos;
+}
+
+void hvs_yuv_subsampling(enum hvs_yuv_format f, unsigned int *h, unsigned int *v) {
+  *h = 2;
+  *v = ((f == HVS_YUV420_2PLANE) || (f == HVS_YUV420_3PLANE)) ? 2 : 1;
+}
+
+unsigned int hvs_yuv_planes(enum hvs_yuv_format f) {
+  return ((f == HVS_YUV420_3PLANE) || (f == HVS_YUV422_3PLANE)) ? 3 : 2;
+}
+
+enum hvs_pixel_format hvs_yuv_pixel_format(enum hvs_yuv_format f) {
+  switch (f) {
+  case HVS_YUV420_2PLANE:
+    return HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE;
+  case HVS_YUV420_3PLANE:
+    return HVS_PIXEL_FORMAT_YCBCR_YUV420_3PLANE;
+  case HVS_YUV422_2PLANE:
+    return HVS_PIXEL_FORMAT_YCBCR_YUV422_2PLANE;
+  case HVS_YUV422_3PLANE:
+    return HVS_PIXEL_FORMAT_YCBCR_YUV422_3PLANE;
+  }
+  return HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE;
+}
+
+// bt601 limited packs to the 0x00f00000 0xe73304a8 0x00066604 that used to be hardcoded
+void hvs_yuv_csc(enum hvs_colorspace cs, uint32_t words[3]) {
+  const unsigned int count = sizeof(csc_table) / sizeof(csc_table[0]);
+  const csc_coeffs *c = &csc_table[((unsigned int)cs < count) ? cs : HVS_BT601];
+  words[0] = (c->y_offset & 0xff) << 16;
+  words[1] = ((c->cb_green & 0x3ff) << 22) | ((c->cr_green & 0x3ff) << 12) | ((c->y & 0x3ff) << 2);
+  words[2] = ((c->cr_red & 0x3ff) << 10) | (c->cb_blue & 0x3ff);
+}
+
+unsigned int hvs_entry_yuv_lbm_word(enum hvs_yuv_format f) {
+  return 8 + (hvs_yuv_planes(f) * 3);
+}
+
+int hvs_entry_yuv(uint32_t *d, const hvs_entry_yuv_params *p) {
+  const unsigned int planes = hvs_yuv_planes(p->format);
+  unsigned int hsub, vsub;
+  hvs_yuv_subsampling(p->format, &hsub, &vsub);
+  // the hardware is aware that the luma plane is the size specified in POS2, and the chroma plane is that over the subsampling
+  // but the scale parameters for luma and chroma are user supplied, and can violate those assumptions
+  // when doing a chroma lookup, it will follow the user-specified chroma scale, but then clamp to the assumed chroma size
+  // if the scale parameters lead to a lookup beyond the assumed chroma size, it will repeat whatever is at the edge of the chroma image
+
+  // UV scale
+  uint32_t scl0 = SCALER_CTL0_SCL_H_PPF_V_PPF;
+  // Y scale
+  uint32_t scl1 = SCALER_CTL0_SCL_H_PPF_V_PPF;
+
+  int pos = 0;
+  // CTL0, the word count is filled in at the end
+  d[pos++] = CONTROL_VALID
+    | CONTROL_PIXEL_ORDER(HVS_PIXEL_ORDER_XYCBCR)
+    | CONTROL_FORMAT(hvs_yuv_pixel_format(p->format))
+    | CONTROL_SCL0(scl0)
+    | CONTROL_SCL1(scl1);
+  // POS0
+  d[pos++] = p->pos0;
+  // POS1 optional scaled output size
+  d[pos++] = p->w | (p->h << 16);
+  // POS2, input size
+  d[pos++] = POS2_H(p->src_h) | POS2_W(p->src_w) | (p->alpha_mode << 30);
+  // POS3, context
+  d[pos++] = 0xDEADBEEF;
+  // PTR0-2
+  for (unsigned int i=0; i < planes; i++) d[pos++] = p->ptr[i];
+  // context 0-2
+  for (unsigned int i=0; i < planes; i++) d[pos++] = 0xDEADBEEF;
+  // pitch 0-2
+  d[pos++] = p->luma_pitch;
+  d[pos++] = p->chroma_pitch;
+  if (planes == 3) d[pos++] = p->chroma_pitch;
+  // colorspace conversion
+  hvs_yuv_csc(p->colorspace, &d[pos]);
+  pos += 3;
+  // LMB base addr
+  d[pos++] = p->lbm_offset;
+  // scaling parameters UV, the chroma source is the luma one over the subsampling, scaled to the same output
+  d[pos++] = gen_ppf_fixedpoint((p->src_w << 16) / hsub, p->w);
+  d[pos++] = gen_ppf_fixedpoint((p->src_h << 16) / vsub, p->h);
+  d[pos++] = 0xDEADBEEF;
+  // scaling parameters Y
+  d[pos++] = gen_ppf(p->src_w, p->w);
+  d[pos++] = gen_ppf(p->src_h, p->h);
+  d[pos++] = 0xDEADBEEF;
+
+  // scaling kernels
+  for (int k=0; k<4; k++) d[pos++] = p->kernel;
+  d[0] |= CONTROL_WORDS(pos);
+  return pos;
+}
@@ -0,0 +1,109 @@
+#include <platform/bcm28xx/hvs_plan.h>
+#include <string.h>
+
+void hvs_plan_init(hvs_plan *p, uint32_t width, uint32_t lines, uint32_t *cycles, uint32_t *bytes) {
+  memset(p, 0, sizeof(*p));
+  p->width = width;
+  p->lines = lines;
+  p->cycles = cycles;
+  p->bytes = bytes;
+}
+
+void hvs_plan_begin(hvs_plan *p) {
+  memset(p->cycles, 0, p->lines * sizeof(uint32_t));
+  memset(p->bytes, 0, p->lines * sizeof(uint32_t));
+  p->layers = 0;
+  p->dropped = 0;
+  p->over_lines = 0;
+}
+
+static bool line_over(const hvs_plan *p, uint32_t line) {
+  if (p->cycle_budget && (p->cycles[line] > p->cycle_budget)) return true;
+  if (p->byte_budget && (p->bytes[line] > p->byte_budget)) return true;
+  return false;
+}
+
+bool hvs_plan_layer_cost(const hvs_plan *p, const hvs_plan_layer *l, uint32_t *first, uint32_t *end, uint32_t *cycles, uint32_t *bytes) {
+  if ((l->w == 0) || (l->h == 0)) return false;
+  int64_t x0 = l->x, x1 = (int64_t)l->x + l->w;
+  int64_t y0 = l->y, y1 = (int64_t)l->y + l->h;
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > p->width) x1 = p->width;
+  if (y1 > p->lines) y1 = p->lines;
+  if ((x0 >= x1) || (y0 >= y1)) return false;
+  const uint32_t visible_w = x1 - x0;
+
+  // source pixels read per output line, 16.16
+  // horizontally only the visible part is fetched, vertically a downscale reads several source lines per output line
+  uint64_t src_pixels = ((uint64_t)l->src_w * visible_w << 16) / l->w;
+  if (l->src_h > l->h) src_pixels = src_pixels * l->src_h / l->h;
+
+  *first = y0;
+  *end = y1;
+  *bytes = (src_pixels * l->bits_per_pixel / 8) >> 16;
+  *cycles = visible_w * HVS_PLAN_CYCLES_PER_PIXEL;
+  if (l->scaled) *cycles += (src_pixels * HVS_PLAN_CYCLES_PER_SCALED_PIXEL) >> 16;
+  return true;
+}
+
+void hvs_plan_add(hvs_plan *p, const hvs_plan_layer *l) {
+  uint32_t first, end, cycles, bytes;
+  p->layers++;
+  if (!hvs_plan_layer_cost(p, l, &first, &end, &cycles, &bytes)) return;
+  for (uint32_t i=first; i<end; i++) {
+    p->cycles[i] += cycles;
+    p->bytes[i] += bytes;
+  }
+}
+
+void hvs_plan_finish(hvs_plan *p) {
+  p->peak_cycles = 0;
+  p->peak_bytes = 0;
+  p->peak_line = 0;
+  p->over_lines = 0;
+  for (uint32_t i=0; i < p->lines; i++) {
+    if (p->cycles[i] > p->peak_cycles) {
+      p->peak_cycles = p->cycles[i];
+      p->peak_line = i;
+    }
+    if (p->bytes[i] > p->peak_bytes) p->peak_bytes = p->bytes[i];
+    if (line_over(p, i)) p->over_lines++;
+  }
+}
+
+bool hvs_plan_overloads(const hvs_plan *p, const hvs_plan_layer *l) {
+  uint32_t first, end, cycles, bytes;
+  if (p->over_lines == 0) return false;
+  if (!hvs_plan_layer_cost(p, l, &first, &end, &cycles, &bytes)) return false;
+  for (uint32_t i=first; i<end; i++) {
+    if (line_over(p, i)) return true;
+  }
+  return false;
+}
+
+void hvs_plan_remove(hvs_plan *p, const hvs_plan_layer *l) {
+  uint32_t first, end, cycles, bytes;
+  p->dropped++;
+  if (!hvs_plan_layer_cost(p, l, &first, &end, &cycles, &bytes)) return;
+  for (uint32_t i=first; i<end; i++) {
+    bool was_over = line_over(p, i);
+    p->cycles[i] -= cycles;
+    p->bytes[i] -= bytes;
+    if (was_over && !line_over(p, i)) p->over_lines--;
+  }
+}
+
+uint32_t hvs_plan_drop(hvs_plan *p, const hvs_plan_layer *layers, uint32_t count, bool *drop) {
+  for (uint32_t i=0; i < count; i++) {
+    drop[i] = false;
+    if (p->over_lines == 0) continue;
+    if (hvs_plan_overloads(p, &layers[i])) {
+      hvs_plan_remove(p, &layers[i]);
+      drop[i] = true;
+    }
+  }
+  uint32_t dropped = p->dropped;
+  hvs_plan_finish(p);
+  return dropped;
+}
@@ -0,0 +1,518 @@
+#include <platform/bcm28xx/hvs_dlist.h>
+#include <platform/bcm28xx/hvs_entry.h>
+#include <platform/bcm28xx/hvs_ref.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a TPZ box never covers more source pixels than this, the scale field tops out at 64x anyway
+#define MAX_TAPS 66
+
+enum axis_mode {
+  AXIS_NONE,
+  AXIS_PPF,
+  AXIS_TPZ,
+};
+
+typedef struct {
+  enum axis_mode mode;
+  // source pixels per output pixel, 16.16
+  uint32_t scale;
+  unsigned int src_len;
+  unsigned int dst_len;
+} axis;
+
+typedef struct {
+  uint16_t index;
+  // 16.16, the taps of one output pixel add up to 1.0
+  uint32_t weight;
+} tap;
+
+// the taps of every output pixel along one axis, taps_per entries each
+typedef struct {
+  tap *taps;
+  uint8_t *count;
+  unsigned int taps_per;
+} tap_table;
+
+typedef struct {
+  const uint8_t *row0;
+  // negative with CONTROL0_VFLIP, the pointer is then the last line
+  int32_t pitch;
+} plane;
+
+typedef struct {
+  enum hvs_pixel_format fmt;
+  unsigned int order;
+  bool yuv;
+  plane planes[3];
+  unsigned int plane_count;
+  unsigned int bpp;
+  uint32_t palette_base;
+  // the yuv to rgb matrix
+  int y_offset, y, cr_red, cb_green, cr_green, cb_blue;
+} source;
+
+static const char *entry_error;
+
+static bool fail(const char *why) {
+  entry_error = why;
+  return false;
+}
+
+static uint32_t clamp8(int v) {
+  return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+static int sext10(uint32_t v) {
+  v &= 0x3ff;
+  return (v & 0x200) ? (int)v - 0x400 : (int)v;
+}
+
+// the SCL0/SCL1 values, the reverse of hvs_entry_scl()
+static void scl_modes(unsigned int scl, enum axis_mode *x, enum axis_mode *y) {
+  static const enum axis_mode xs[8] = { AXIS_PPF, AXIS_TPZ, AXIS_PPF, AXIS_TPZ, AXIS_PPF, AXIS_NONE, AXIS_NONE, AXIS_TPZ };
+  static const enum axis_mode ys[8] = { AXIS_PPF, AXIS_PPF, AXIS_TPZ, AXIS_TPZ, AXIS_NONE, AXIS_PPF, AXIS_TPZ, AXIS_NONE };
+  *x = xs[scl & 7];
+  *y = ys[scl & 7];
+}
+
+// reads the scaling words of one SCLn, in the order hvs_entry_scaled() writes them
+static bool parse_scaling(const uint32_t *e, unsigned int words, unsigned int *i, unsigned int scl, axis *x, axis *y) {
+  scl_modes(scl, &x->mode, &y->mode);
+  unsigned int need = ((x->mode == AXIS_PPF) ? 1 : 0) + ((y->mode == AXIS_PPF) ? 2 : 0)
+                    + ((x->mode == AXIS_TPZ) ? 2 : 0) + ((y->mode == AXIS_TPZ) ? 3 : 0);
+  if ((*i + need) > words) return fail("entry too short for its scaling words");
+  x->scale = y->scale = 1 << 16;
+  if (x->mode == AXIS_PPF) x->scale = (e[(*i)++] >> 8) & 0x3fffff;
+  if (y->mode == AXIS_PPF) {
+    y->scale = (e[(*i)++] >> 8) & 0x3fffff;
+    (*i)++;
+  }
+  if (x->mode == AXIS_TPZ) {
+    x->scale = (e[*i] >> 8) & 0x3fffff;
+    *i += 2;
+  }
+  if (y->mode == AXIS_TPZ) {
+    y->scale = (e[*i] >> 8) & 0x3fffff;
+    *i += 3;
+  }
+  if ((x->scale == 0) || (y->scale == 0)) return fail("zero scale factor");
+  return true;
+}
+
+// fills in the taps of output pixel o
+static unsigned int axis_taps(const axis *a, unsigned int o, tap *t) {
+  const unsigned int last = a->src_len - 1;
+  if (a->mode == AXIS_NONE) {
+    t[0].index = (o < last) ? o : last;
+    t[0].weight = 1 << 16;
+    return 1;
+  }
+  if (a->mode == AXIS_PPF) {
+    // bilinear, with the pixel centers lined up
+    int64_t pos = ((int64_t)o * a->scale) + (a->scale / 2) - (1 << 15);
+    if (pos < 0) pos = 0;
+    unsigned int i0 = pos >> 16;
+    uint32_t frac = pos & 0xffff;
+    if (i0 >= last) {
+      i0 = last;
+      frac = 0;
+    }
+    t[0].index = i0;
+    t[0].weight = (1 << 16) - frac;
+    if (frac == 0) return 1;
+    t[1].index = i0 + 1;
+    t[1].weight = frac;
+    return 2;
+  }
+  // TPZ, a box over every source pixel the output one covers
+  const uint64_t start = (uint64_t)o * a->scale;
+  const uint64_t end = start + a->scale;
+  unsigned int n = 0;
+  uint32_t total = 0;
+  for (uint64_t i = start >> 16; ((i << 16) < end) && (n < MAX_TAPS); i++) {
+    const uint64_t lo = (start > (i << 16)) ? start : (i << 16);
+    const uint64_t hi = (end < ((i + 1) << 16)) ? end : ((i + 1) << 16);
+    t[n].index = (i < last) ? i : last;
+    t[n].weight = ((hi - lo) << 16) / a->scale;
+    total += t[n].weight;
+    n++;
+  }
+  // rounding, so they still add up to exactly 1.0
+  t[n - 1].weight += (1 << 16) - total;
+  return n;
+}
+
+static bool taps_init(tap_table *tt, const axis *a) {
+  tt->taps_per = (a->mode == AXIS_TPZ) ? MAX_TAPS : 2;
+  tt->taps = malloc(a->dst_len * tt->taps_per * sizeof(tap));
+  tt->count = malloc(a->dst_len);
+  if (!tt->taps || !tt->count) {
+    free(tt->taps);
+    free(tt->count);
+    return fail("out of memory");
+  }
+  for (unsigned int o=0; o < a->dst_len; o++) tt->count[o] = axis_taps(a, o, &tt->taps[o * tt->taps_per]);
+  return true;
+}
+
+static void taps_free(tap_table *tt) {
+  free(tt->taps);
+  free(tt->count);
+}
+
+// points p at the rows of one plane, if they all lie within the sdram copy
+static bool plane_map(const hvs_ref *r, uint32_t ptr, uint32_t pitch, unsigned int rows, unsigned int row_bytes, bool vflip, plane *p) {
+  const uint64_t addr = ptr & 0x3fffffff;
+  const uint64_t span = (uint64_t)(rows - 1) * pitch;
+  const uint64_t hi = (vflip ? addr : (addr + span)) + row_bytes;
+  if ((addr < r->sdram_base) || (vflip && (span > (addr - r->sdram_base))) || (hi > ((uint64_t)r->sdram_base + r->sdram_size))) {
+    return fail("image outside of sdram");
+  }
+  p->row0 = r->sdram + (addr - r->sdram_base);
+  p->pitch = vflip ? -(int32_t)pitch : (int32_t)pitch;
+  return true;
+}
+
+static const uint8_t *plane_row(const plane *p, unsigned int y) {
+  return p->row0 + ((int64_t)y * p->pitch);
+}
+
+// one source pixel as a, r, g, b
+static void rgb_pixel(const hvs_ref *r, const source *s, unsigned int x, unsigned int y, uint32_t c[4]) {
+  const uint8_t *row = plane_row(&s->planes[0], y);
+  uint32_t a = 255, red, green, blue;
+  switch (s->fmt) {
+  case HVS_PIXEL_FORMAT_RGBA8888: {
+    const uint8_t *p = row + (x * 4);
+    blue = p[0];
+    green = p[1];
+    red = p[2];
+    a = p[3];
+    break;
+  }
+  case HVS_PIXEL_FORMAT_RGB565: {
+    const uint32_t v = row[x * 2] | (row[(x * 2) + 1] << 8);
+    red = ((v >> 11) << 3) | (v >> 13);
+    green = (((v >> 5) & 0x3f) << 2) | ((v >> 9) & 3);
+    blue = ((v & 0x1f) << 3) | ((v >> 2) & 7);
+    break;
+  }
+  case HVS_PIXEL_FORMAT_RGB332: {
+    const uint32_t v = row[x];
+    red = ((v >> 5) * 255) / 7;
+    green = (((v >> 2) & 7) * 255) / 7;
+    blue = (v & 3) * 85;
+    break;
+  }
+  default: {
+    // HVS_PIXEL_FORMAT_PALETTE
+    const unsigned int bit = x * s->bpp;
+    const unsigned int index = (row[bit / 8] >> (8 - s->bpp - (bit % 8))) & ((1 << s->bpp) - 1);
+    const uint32_t v = r->dlist[s->palette_base + index];
+    a = v >> 24;
+    red = (v >> 16) & 0xff;
+    green = (v >> 8) & 0xff;
+    blue = v & 0xff;
+    break;
+  }
+  }
+  if (s->order == HVS_PIXEL_ORDER_ARGB) {
+    const uint32_t swap = red;
+    red = blue;
+    blue = swap;
+  }
+  c[0] = a;
+  c[1] = red;
+  c[2] = green;
+  c[3] = blue;
+}
+
+static uint32_t sample_plane(const plane *p, unsigned int step, unsigned int offset, const tap *tx, unsigned int nx, const tap *ty, unsigned int ny) {
+  uint32_t acc = 0;
+  for (unsigned int j=0; j < ny; j++) {
+    const uint8_t *row = plane_row(p, ty[j].index);
+    for (unsigned int i=0; i < nx; i++) {
+      acc += row[(tx[i].index * step) + offset] * (uint32_t)(((uint64_t)tx[i].weight * ty[j].weight) >> 16);
+    }
+  }
+  return (acc + (1 << 15)) >> 16;
+}
+
+// parses one entry and blends it into r->out
+static bool render_entry(const hvs_ref *r, const uint32_t *e, unsigned int words) {
+  const uint32_t ctl0 = e[0];
+  source s;
+  memset(&s, 0, sizeof(s));
+  s.fmt = CONTROL_FORMAT(ctl0);
+  s.order = (ctl0 >> 13) & 3;
+  const bool unity = ctl0 & CONTROL_UNITY;
+  const bool hflip = ctl0 & CONTROL0_HFLIP;
+  const bool vflip = ctl0 & CONTROL0_VFLIP;
+  enum hvs_yuv_format yuv_format = HVS_YUV420_2PLANE;
+  switch (s.fmt) {
+  case HVS_PIXEL_FORMAT_RGB332:
+  case HVS_PIXEL_FORMAT_RGB565:
+  case HVS_PIXEL_FORMAT_RGBA8888:
+  case HVS_PIXEL_FORMAT_PALETTE:
+    if ((s.order != HVS_PIXEL_ORDER_ABGR) && (s.order != HVS_PIXEL_ORDER_ARGB)) return fail("unmodelled pixel order");
+    s.plane_count = 1;
+    break;
+  case HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE:
+  case HVS_PIXEL_FORMAT_YCBCR_YUV420_3PLANE:
+  case HVS_PIXEL_FORMAT_YCBCR_YUV422_2PLANE:
+  case HVS_PIXEL_FORMAT_YCBCR_YUV422_3PLANE:
+    if (s.order != HVS_PIXEL_ORDER_XYCBCR) return fail("unmodelled yuv order");
+    if (unity) return fail("yuv entries are always scaled");
+    s.yuv = true;
+    yuv_format = (s.fmt == HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE) ? HVS_YUV420_2PLANE
+               : (s.fmt == HVS_PIXEL_FORMAT_YCBCR_YUV420_3PLANE) ? HVS_YUV420_3PLANE
+               : (s.fmt == HVS_PIXEL_FORMAT_YCBCR_YUV422_2PLANE) ? HVS_YUV422_2PLANE : HVS_YUV422_3PLANE;
+    s.plane_count = hvs_yuv_planes(yuv_format);
+    break;
+  default:
+    return fail("unmodelled pixel format");
+  }
+
+  unsigned int i = 1;
+  // the fixed part, POS0 to the pitches
+  const unsigned int fixed = 1 + (unity ? 0 : 1) + 2 + (3 * s.plane_count);
+  if (words < (1 + fixed)) return fail("entry too short");
+  const uint32_t pos0 = e[i++];
+  const uint32_t pos1 = unity ? 0 : e[i++];
+  const uint32_t pos2 = e[i++];
+  i++;  // POS3, context
+  uint32_t ptr[3], pitch[3];
+  for (unsigned int p=0; p < s.plane_count; p++) ptr[p] = e[i++];
+  i += s.plane_count;  // contexts
+  for (unsigned int p=0; p < s.plane_count; p++) pitch[p] = e[i++];
+
+  const int x0 = pos0 & 0xfff;
+  const int y0 = (pos0 >> 12) & 0xfff;
+  const uint32_t fixed_alpha = pos0 >> 24;
+  const unsigned int src_w = pos2 & 0xffff;
+  const unsigned int src_h = (pos2 >> 16) & 0xfff;
+  const enum alpha_mode alpha_mode = pos2 >> 30;
+  const unsigned int dst_w = unity ? src_w : (pos1 & 0xfff);
+  const unsigned int dst_h = unity ? src_h : ((pos1 >> 16) & 0xfff);
+  if (!src_w || !src_h || !dst_w || !dst_h) return fail("zero sized entry");
+
+  if (s.fmt == HVS_PIXEL_FORMAT_PALETTE) {
+    if (i >= words) return fail("palette entry without a palette word");
+    const uint32_t pal = e[i++];
+    s.bpp = 1 << (pal >> 30);
+    s.palette_base = (pal & 0x03ffffff) >> 2;
+    if ((s.palette_base + (1 << s.bpp)) > HVS_REF_DLIST_WORDS) return fail("palette outside of dlist memory");
+  }
+  unsigned int hsub = 1, vsub = 1;
+  if (s.yuv) {
+    if ((i + 3) > words) return fail("entry too short for the csc words");
+    hvs_yuv_subsampling(yuv_format, &hsub, &vsub);
+    s.y_offset = (int8_t)((e[i] >> 16) & 0xff);
+    s.cb_green = sext10(e[i + 1] >> 22);
+    s.cr_green = sext10(e[i + 1] >> 12);
+    s.y = (e[i + 1] >> 2) & 0x3ff;
+    s.cr_red = (e[i + 2] >> 10) & 0x3ff;
+    s.cb_blue = e[i + 2] & 0x3ff;
+    i += 3;
+  }
+
+  // luma, or the whole image, and the chroma planes
+  axis lx = { AXIS_NONE, 1 << 16, src_w, dst_w }, ly = { AXIS_NONE, 1 << 16, src_h, dst_h };
+  axis cx = lx, cy = ly;
+  if (!unity) {
+    if (i >= words) return fail("entry too short for the lbm word");
+    i++;  // LBM, only the hardware needs it
+    const unsigned int scl0 = (ctl0 >> 5) & 7;
+    const unsigned int scl1 = (ctl0 >> 8) & 7;
+    if (s.yuv) {
+      cx.src_len = (src_w + hsub - 1) / hsub;
+      cy.src_len = (src_h + vsub - 1) / vsub;
+      if (!parse_scaling(e, words, &i, scl0, &cx, &cy)) return false;
+      if (!parse_scaling(e, words, &i, scl1, &lx, &ly)) return false;
+    } else {
+      if (scl0 != scl1) return fail("rgb entry with different SCL0 and SCL1");
+      if (!parse_scaling(e, words, &i, scl0, &lx, &ly)) return false;
+    }
+    const bool ppf = (lx.mode == AXIS_PPF) || (ly.mode == AXIS_PPF) || (cx.mode == AXIS_PPF) || (cy.mode == AXIS_PPF);
+    if (ppf) {
+      if ((i + 4) > words) return fail("entry too short for the kernel words");
+      for (int k=0; k<4; k++) {
+        if (e[i + k] > (HVS_REF_DLIST_WORDS - 11)) return fail("scaling kernel outside of dlist memory");
+      }
+      i += 4;
+    }
+  }
+  if (i != words) return fail("CONTROL_WORDS doesnt match the entry layout");
+
+  // every row of every plane the entry reads has to be in the sdram copy
+  static const unsigned int bytes_per_pixel[16] = { [HVS_PIXEL_FORMAT_RGB332] = 1, [HVS_PIXEL_FORMAT_RGB565] = 2, [HVS_PIXEL_FORMAT_RGBA8888] = 4 };
+  if (s.yuv) {
+    const unsigned int cw = (src_w + hsub - 1) / hsub, ch = (src_h + vsub - 1) / vsub;
+    if (!plane_map(r, ptr[0], pitch[0], src_h, src_w, vflip, &s.planes[0])) return false;
+    for (unsigned int p=1; p < s.plane_count; p++) {
+      if (!plane_map(r, ptr[p], pitch[p], ch, cw * ((s.plane_count == 2) ? 2 : 1), vflip, &s.planes[p])) return false;
+    }
+  } else {
+    const unsigned int row_bytes = (s.fmt == HVS_PIXEL_FORMAT_PALETTE) ? (((src_w * s.bpp) + 7) / 8) : (src_w * bytes_per_pixel[s.fmt]);
+    if (!plane_map(r, ptr[0], pitch[0], src_h, row_bytes, vflip, &s.planes[0])) return false;
+  }
+
+  tap_table tlx, tly, tcx, tcy;
+  if (!taps_init(&tlx, &lx)) return false;
+  if (!taps_init(&tly, &ly)) {
+    taps_free(&tlx);
+    return false;
+  }
+  if (s.yuv) {
+    if (!taps_init(&tcx, &cx)) {
+      taps_free(&tlx);
+      taps_free(&tly);
+      return false;
+    }
+    if (!taps_init(&tcy, &cy)) {
+      taps_free(&tlx);
+      taps_free(&tly);
+      taps_free(&tcx);
+      return false;
+    }
+  }
+
+  for (unsigned int oy=0; oy < dst_h; oy++) {
+    const int sy = y0 + oy;
+    if (sy >= (int)r->height) break;
+    const tap *ty = &tly.taps[oy * tly.taps_per];
+    for (unsigned int ox=0; ox < dst_w; ox++) {
+      const int sx = x0 + ox;
+      if (sx >= (int)r->width) break;
+      const unsigned int fx = hflip ? (dst_w - 1 - ox) : ox;
+      const tap *tx = &tlx.taps[fx * tlx.taps_per];
+      uint32_t c[4];
+      if (s.yuv) {
+        const int y = sample_plane(&s.planes[0], 1, 0, tx, tlx.count[fx], ty, tly.count[oy]);
+        const tap *ctx = &tcx.taps[fx * tcx.taps_per];
+        const tap *cty = &tcy.taps[oy * tcy.taps_per];
+        int cb, cr;
+        if (s.plane_count == 2) {
+          cb = sample_plane(&s.planes[1], 2, 0, ctx, tcx.count[fx], cty, tcy.count[oy]);
+          cr = sample_plane(&s.planes[1], 2, 1, ctx, tcx.count[fx], cty, tcy.count[oy]);
+        } else {
+          cb = sample_plane(&s.planes[1], 1, 0, ctx, tcx.count[fx], cty, tcy.count[oy]);
+          cr = sample_plane(&s.planes[2], 1, 0, ctx, tcx.count[fx], cty, tcy.count[oy]);
+        }
+        const int luma = (y + s.y_offset) * s.y;
+        c[0] = 255;
+        c[1] = clamp8((luma + (s.cr_red * (cr - 128)) + 128) >> 8);
+        c[2] = clamp8((luma + (s.cb_green * (cb - 128)) + (s.cr_green * (cr - 128)) + 128) >> 8);
+        c[3] = clamp8((luma + (s.cb_blue * (cb - 128)) + 128) >> 8);
+      } else {
+        uint32_t acc[4] = { 0, 0, 0, 0 };
+        for (unsigned int j=0; j < tly.count[oy]; j++) {
+          for (unsigned int k=0; k < tlx.count[fx]; k++) {
+            uint32_t p[4];
+            rgb_pixel(r, &s, tx[k].index, ty[j].index, p);
+            const uint32_t w = ((uint64_t)tx[k].weight * ty[j].weight) >> 16;
+            for (int ch=0; ch<4; ch++) acc[ch] += p[ch] * w;
+          }
+        }
+        for (int ch=0; ch<4; ch++) c[ch] = (acc[ch] + (1 << 15)) >> 16;
+      }
+
+      uint32_t a;
+      switch (alpha_mode) {
+      case alpha_mode_pipeline:
+        a = c[0];
+        break;
+      case alpha_mode_fixed:
+        a = fixed_alpha;
+        break;
+      case alpha_mode_fixed_nonzero:
+        a = (c[0] * fixed_alpha) / 255;
+        break;
+      default:
+        a = (c[0] > 7) ? fixed_alpha : 0;
+        break;
+      }
+      uint32_t *d = &r->out[(sy * r->width) + sx];
+      const uint32_t dst = *d;
+      uint32_t px = 0xff000000;
+      for (int ch=1; ch<4; ch++) {
+        const unsigned int shift = (3 - ch) * 8;
+        const uint32_t under = (dst >> shift) & 0xff;
+        px |= (((c[ch] * a) + (under * (255 - a)) + 127) / 255) << shift;
+      }
+      *d = px;
+    }
+  }
+
+  taps_free(&tlx);
+  taps_free(&tly);
+  if (s.yuv) {
+    taps_free(&tcx);
+    taps_free(&tcy);
+  }
+  return true;
+}
+
+bool hvs_ref_render(const hvs_ref *r, uint32_t start, hvs_ref_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  const uint32_t fill = 0xff000000 | (r->background & 0xffffff);
+  for (unsigned int i=0; i < (r->width * r->height); i++) r->out[i] = fill;
+
+  uint32_t pos = start;
+  while (true) {
+    if (pos >= HVS_REF_DLIST_WORDS) {
+      stats->errors++;
+      stats->last_error = "ran off the end of dlist memory";
+      stats->last_error_offset = pos;
+      return false;
+    }
+    const uint32_t ctl0 = r->dlist[pos];
+    if (ctl0 & CONTROL_END) break;
+    const unsigned int words = (ctl0 >> 24) & 0x3f;
+    if (!(ctl0 & CONTROL_VALID) || (words == 0) || ((pos + words) > HVS_REF_DLIST_WORDS)) {
+      // theres no way to find the next entry, so this ends the list
+      stats->errors++;
+      stats->last_error = (ctl0 & CONTROL_VALID) ? "bad entry length" : "entry without CONTROL_VALID";
+      stats->last_error_offset = pos;
+      return false;
+    }
+    stats->entries++;
+    stats->words += words;
+    if (!render_entry(r, &r->dlist[pos], words)) {
+      stats->errors++;
+      stats->last_error = entry_error;
+      stats->last_error_offset = pos;
+    }
+    pos += words;
+  }
+  return stats->errors == 0;
+}
+
+uint32_t hvs_ref_crc(const hvs_ref *r) {
+  uint32_t crc = ~0;
+  for (unsigned int i=0; i < (r->width * r->height); i++) {
+    for (int b=0; b<4; b++) {
+      crc ^= (r->out[i] >> (b * 8)) & 0xff;
+      for (int k=0; k<8; k++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+unsigned int hvs_ref_diff(const uint32_t *a, const uint32_t *b, unsigned int pixels, unsigned int *worst) {
+  unsigned int max = 0;
+  *worst = 0;
+  for (unsigned int i=0; i < pixels; i++) {
+    for (int ch=0; ch<4; ch++) {
+      const int da = (a[i] >> (ch * 8)) & 0xff;
+      const int db = (b[i] >> (ch * 8)) & 0xff;
+      const unsigned int d = (da > db) ? (da - db) : (db - da);
+      if (d > max) {
+        max = d;
+        *worst = i;
+      }
+    }
+  }
+  return max;
+}
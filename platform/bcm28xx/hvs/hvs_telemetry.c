@@ -0,0 +1,162 @@
+#include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/macros.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/hvs_telemetry.h>
+#include <stdio.h>
+#include <string.h>
+
+static hvs_telemetry_record records[HVS_TELEMETRY_RECORDS];
+// counts every record ever written, the ring holds the last HVS_TELEMETRY_RECORDS
+static uint32_t written;
+static hvs_telemetry_totals totals[3];
+// the sdram counters as of the last record of each channel
+static uint32_t last_idle[3], last_cycles[3];
+static spin_lock_t telemetry_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static int cmd_hvs_telemetry(int argc, const console_cmd_args *argv);
+
+STATIC_COMMAND_START
+STATIC_COMMAND("hvs_telemetry", "per frame display telemetry, [summary|dump [count]|clear]", &cmd_hvs_telemetry)
+STATIC_COMMAND_END(hvs_telemetry);
+
+void hvs_telemetry_frame(int channel, uint32_t irq_time, uint32_t dlist_start, uint32_t dlist_words) {
+  const uint32_t now = *REG32(ST_CLO);
+  const uint32_t stat = hvs_channels[channel].dispstat;
+  // the error bits are sticky, so clear them to see only the ones from this frame next time
+  const uint32_t dispstat = *REG32(SCALER_DISPSTAT);
+  const uint32_t error_bits = SCALER_DISPSTAT_EUFLOW(channel) | SCALER_DISPSTAT_ESLINE(channel)
+                            | SCALER_DISPSTAT_ESFRAME(channel) | SCALER_DISPSTAT_COBLOW(channel);
+  if (dispstat & error_bits) *REG32(SCALER_DISPSTAT) = dispstat & error_bits;
+  uint8_t errors = 0;
+  if (dispstat & SCALER_DISPSTAT_EUFLOW(channel)) errors |= HVS_TELEMETRY_UNDERFLOW;
+  if (dispstat & SCALER_DISPSTAT_ESLINE(channel)) errors |= HVS_TELEMETRY_SHORT_LINE;
+  if (dispstat & SCALER_DISPSTAT_ESFRAME(channel)) errors |= HVS_TELEMETRY_SHORT_FRAME;
+  if (dispstat & SCALER_DISPSTAT_COBLOW(channel)) errors |= HVS_TELEMETRY_COB_LOW;
+
+  // the counters are only read, other code zeroes them to measure itself, which just looks like a wrap here
+  const uint32_t idle = *REG32(SD_IDL);
+  const uint32_t cycles = *REG32(SD_CYC);
+
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&telemetry_lock, irqstate);
+  uint32_t didle = (idle >= last_idle[channel]) ? (idle - last_idle[channel]) : idle;
+  uint32_t dcycles = (cycles >= last_cycles[channel]) ? (cycles - last_cycles[channel]) : cycles;
+  last_idle[channel] = idle;
+  last_cycles[channel] = cycles;
+  if (didle > dcycles) didle = dcycles;
+
+  hvs_telemetry_record *r = &records[written % HVS_TELEMETRY_RECORDS];
+  r->time = irq_time;
+  r->frame = channels[channel].frames;
+  r->dispstat = stat;
+  r->sdram_cycles = dcycles;
+  r->dlist_start = dlist_start;
+  r->dlist_words = dlist_words;
+  r->flip_us = now - irq_time;
+  r->sdram_idle = dcycles ? (uint32_t)(((uint64_t)didle * 100) / dcycles) : 100;
+  r->channel = channel;
+  r->errors = errors;
+  written++;
+
+  hvs_telemetry_totals *t = &totals[channel];
+  if ((t->frames == 0) || (r->sdram_idle < t->sdram_idle_min)) t->sdram_idle_min = r->sdram_idle;
+  t->frames++;
+  if (r->flip_us > t->flip_us_max) t->flip_us_max = r->flip_us;
+  if (errors & HVS_TELEMETRY_UNDERFLOW) t->underflows++;
+  if (errors & HVS_TELEMETRY_SHORT_LINE) t->short_lines++;
+  if (errors & HVS_TELEMETRY_SHORT_FRAME) t->short_frames++;
+  if (errors & HVS_TELEMETRY_COB_LOW) t->cob_low++;
+  if (errors) t->last_error_frame = r->frame;
+  spin_unlock_irqrestore(&telemetry_lock, irqstate);
+}
+
+uint32_t hvs_telemetry_written(void) {
+  return written;
+}
+
+bool hvs_telemetry_get(uint32_t seq, hvs_telemetry_record *r) {
+  bool ok = false;
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&telemetry_lock, irqstate);
+  if ((seq < written) && ((written - seq) <= HVS_TELEMETRY_RECORDS)) {
+    *r = records[seq % HVS_TELEMETRY_RECORDS];
+    ok = true;
+  }
+  spin_unlock_irqrestore(&telemetry_lock, irqstate);
+  return ok;
+}
+
+void hvs_telemetry_totals_get(int channel, hvs_telemetry_totals *t) {
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&telemetry_lock, irqstate);
+  *t = totals[channel];
+  spin_unlock_irqrestore(&telemetry_lock, irqstate);
+}
+
+void hvs_telemetry_clear(void) {
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&telemetry_lock, irqstate);
+  written = 0;
+  memset(totals, 0, sizeof(totals));
+  spin_unlock_irqrestore(&telemetry_lock, irqstate);
+}
+
+static void telemetry_summary(void) {
+  for (int ch=0; ch<3; ch++) {
+    hvs_telemetry_totals t;
+    hvs_telemetry_totals_get(ch, &t);
+    if (t.frames == 0) continue;
+    printf("channel %d: %d frames, %d underflows, %d short lines, %d short frames, %d cob low",
+        ch, t.frames, t.underflows, t.short_lines, t.short_frames, t.cob_low);
+    if (t.underflows || t.short_lines || t.short_frames || t.cob_low) printf(", last at frame %d", t.last_error_frame);
+    printf("\n  flip latency max %d us, sdram idle min %d%%\n", t.flip_us_max, t.sdram_idle_min);
+  }
+  hvs_telemetry_record r;
+  const uint32_t end = hvs_telemetry_written();
+  if (end && hvs_telemetry_get(end - 1, &r)) {
+    const uint32_t frame_us = channels[r.channel].frame_us;
+    printf("last frame: channel %d, sdram idle %d%%, %d MHz, dlist %d words at %d\n", r.channel, r.sdram_idle,
+        frame_us ? (r.sdram_cycles / frame_us) : 0, r.dlist_words, r.dlist_start);
+  }
+}
+
+// one record per line, the field order only ever grows at the end, and the version goes up if it changes otherwise
+static void telemetry_dump(uint32_t count) {
+  hvs_telemetry_record r;
+  // fixed up front, so frames arriving during the dump dont make it run forever
+  const uint32_t end = hvs_telemetry_written();
+  const uint32_t held = MIN(end, HVS_TELEMETRY_RECORDS);
+  const uint32_t first = end - ((count && (count < held)) ? count : held);
+  printf("# hvs_telemetry 1\n");
+  printf("# seq channel frame time dispstat dlist_start dlist_words flip_us sdram_idle sdram_cycles errors\n");
+  uint32_t printed = 0, lost = 0;
+  for (uint32_t seq=first; seq < end; seq++) {
+    // the irq kept writing while the uart was busy, and lapped the dump
+    if (!hvs_telemetry_get(seq, &r)) {
+      lost++;
+      continue;
+    }
+    printf("T %u %d %u %u 0x%08x %d %d %d %d %u 0x%x\n", seq, r.channel, r.frame, r.time, r.dispstat,
+        r.dlist_start, r.dlist_words, r.flip_us, r.sdram_idle, r.sdram_cycles, r.errors);
+    printed++;
+  }
+  printf("# end %d %d\n", printed, lost);
+}
+
+static int cmd_hvs_telemetry(int argc, const console_cmd_args *argv) {
+  if ((argc < 2) || (strcmp(argv[1].str, "summary") == 0)) {
+    telemetry_summary();
+  } else if (strcmp(argv[1].str, "dump") == 0) {
+    telemetry_dump((argc >= 3) ? argv[2].u : 0);
+  } else if (strcmp(argv[1].str, "clear") == 0) {
+    hvs_telemetry_clear();
+  } else {
+    printf("usage: %s [summary|dump [count]|clear]\n", argv[0].str);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <arch/ops.h>
+#include <assert.h>
+#include <lk/err.h>
+#include <lk/macros.h>
+#include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/hvs_yuv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void plane_sizes(enum hvs_yuv_format f, unsigned int width, unsigned int height,
+                        unsigned int *luma_stride, unsigned int *chroma_stride, unsigned int *chroma_h) {
+  unsigned int hsub, vsub;
+  hvs_yuv_subsampling(f, &hsub, &vsub);
+  const unsigned int chroma_w = (width + hsub - 1) / hsub;
+  *luma_stride = ROUNDUP(width, HVS_YUV_ALIGN);
+  // a 2 plane image has cb and cr interleaved
+  *chroma_stride = ROUNDUP(chroma_w * ((hvs_yuv_planes(f) == 2) ? 2 : 1), HVS_YUV_ALIGN);
+  *chroma_h = (height + vsub - 1) / vsub;
+}
+
+size_t hvs_yuv_size(enum hvs_yuv_format f, unsigned int width, unsigned int height) {
+  unsigned int luma_stride, chroma_stride, chroma_h;
+  plane_sizes(f, width, height, &luma_stride, &chroma_stride, &chroma_h);
+  return (luma_stride * height) + ((hvs_yuv_planes(f) - 1) * chroma_stride * chroma_h);
+}
+
+void hvs_yuv_image_init(hvs_yuv_image *i, enum hvs_yuv_format f, enum hvs_colorspace cs,
+                        unsigned int width, unsigned int height, void *mem) {
+  unsigned int chroma_h;
+  plane_sizes(f, width, height, &i->luma_stride, &i->chroma_stride, &chroma_h);
+  i->format = f;
+  i->colorspace = cs;
+  i->width = width;
+  i->height = height;
+  i->luma = mem;
+  i->chroma = i->luma + (i->luma_stride * height);
+  i->chroma2 = (hvs_yuv_planes(f) == 3) ? (i->chroma + (i->chroma_stride * chroma_h)) : NULL;
+}
+
+hvs_yuv_image *hvs_yuv_alloc(enum hvs_yuv_format f, enum hvs_colorspace cs, unsigned int width, unsigned int height) {
+  hvs_yuv_image *i = malloc(sizeof(hvs_yuv_image));
+  void *mem = memalign(HVS_YUV_ALIGN, hvs_yuv_size(f, width, height));
+  if (!i || !mem) {
+    free(i);
+    free(mem);
+    return NULL;
+  }
+  hvs_yuv_image_init(i, f, cs, width, height, mem);
+  return i;
+}
+
+void hvs_yuv_free(hvs_yuv_image *i) {
+  if (!i) return;
+  // the planes are one block, starting at luma
+  free(i->luma);
+  free(i);
+}
+
+status_t hvs_yuv_pool_init(hvs_yuv_pool *p, uint32_t count, enum hvs_yuv_format f, enum hvs_colorspace cs,
+                           unsigned int width, unsigned int height) {
+  memset(p, 0, sizeof(*p));
+  // every frame is a multiple of HVS_YUV_ALIGN, so they stay aligned back to back
+  const size_t size = hvs_yuv_size(f, width, height);
+  p->frames = calloc(count, sizeof(hvs_yuv_frame));
+  p->mem = memalign(HVS_YUV_ALIGN, size * count);
+  if (!p->frames || !p->mem) {
+    printf("hvs_yuv_pool: out of memory for %d %dx%d frames\n", count, width, height);
+    free(p->frames);
+    free(p->mem);
+    return ERR_NO_MEMORY;
+  }
+  p->count = count;
+  for (uint32_t i=0; i < count; i++) {
+    hvs_yuv_frame *fr = &p->frames[i];
+    hvs_yuv_image_init(&fr->image, f, cs, width, height, (uint8_t*)p->mem + (i * size));
+    fr->pool = p;
+    fr->state = HVS_YUV_FREE;
+  }
+  spin_lock_init(&p->lock);
+  event_init(&p->freed, false, EVENT_FLAG_AUTOUNSIGNAL);
+  return NO_ERROR;
+}
+
+void hvs_yuv_pool_free(hvs_yuv_pool *p) {
+  for (uint32_t i=0; i < p->count; i++) {
+    assert((p->frames[i].state == HVS_YUV_FREE) || (p->frames[i].state == HVS_YUV_SHOWN));
+  }
+  free(p->frames);
+  free(p->mem);
+  p->frames = NULL;
+  p->mem = NULL;
+  p->count = 0;
+}
+
+hvs_yuv_frame *hvs_yuv_pool_get(hvs_yuv_pool *p, lk_time_t timeout) {
+  spin_lock_saved_state_t irqstate;
+  while (true) {
+    spin_lock_irqsave(&p->lock, irqstate);
+    for (uint32_t i=0; i < p->count; i++) {
+      if (p->frames[i].state != HVS_YUV_FREE) continue;
+      p->frames[i].state = HVS_YUV_FILLING;
+      spin_unlock_irqrestore(&p->lock, irqstate);
+      return &p->frames[i];
+    }
+    spin_unlock_irqrestore(&p->lock, irqstate);
+    // auto unsignal, so a frame freed since the scan above still wakes this
+    if (event_wait_timeout(&p->freed, timeout) != NO_ERROR) return NULL;
+  }
+}
+
+static void pool_release(hvs_yuv_frame *frame) {
+  frame->state = HVS_YUV_FREE;
+  event_signal(&frame->pool->freed, false);
+}
+
+void hvs_yuv_pool_put(hvs_yuv_frame *frame) {
+  hvs_yuv_pool *p = frame->pool;
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&p->lock, irqstate);
+  pool_release(frame);
+  spin_unlock_irqrestore(&p->lock, irqstate);
+}
+
+// from the pv irq, the frame is on screen now, so the one before it can be written again
+static void pool_presented(int channel, const hvs_present_info *info, void *arg) {
+  hvs_yuv_frame *frame = arg;
+  hvs_yuv_pool *p = frame->pool;
+  spin_lock(&p->lock);
+  if (info->skipped) {
+    p->skipped++;
+    pool_release(frame);
+  } else {
+    p->presented++;
+    if (info->missed) p->missed++;
+    if (p->shown && (p->shown != frame)) pool_release(p->shown);
+    p->shown = frame;
+    frame->state = HVS_YUV_SHOWN;
+    frame->shown_frame = info->frame;
+  }
+  spin_unlock(&p->lock);
+}
+
+status_t hvs_yuv_pool_present(hvs_yuv_frame *frame, int channel, hvs_layer *layer, uint32_t target_frame, uint32_t target_us) {
+  assert(frame->state == HVS_YUV_FILLING);
+  const hvs_yuv_image *i = &frame->image;
+  // the hvs reads it from the uncached alias
+  arch_clean_cache_range((addr_t)i->luma, hvs_yuv_size(i->format, i->width, i->height));
+
+  mutex_acquire(&channels[channel].lock);
+  hvs_yuv_image *old = layer->yuv;
+  layer->yuv = &frame->image;
+  frame->state = HVS_YUV_QUEUED;
+  status_t ret = hvs_present(channel, target_frame, target_us, pool_presented, frame);
+  if (ret != NO_ERROR) {
+    layer->yuv = old;
+    frame->state = HVS_YUV_FILLING;
+  }
+  mutex_release(&channels[channel].lock);
+  return ret;
+}
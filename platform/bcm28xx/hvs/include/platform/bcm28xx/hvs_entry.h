@@ -0,0 +1,62 @@
+#pragma once
+
+// encoders for single dlist entries, the words hvs_update_dlist() compiles a layer into
+// every address is already a bus address, so this only depends on libc, and hvs-ref builds the exact same words on the host
+
+#include <platform/bcm28xx/hvs_dlist.h>
+#include <platform/bcm28xx/lbm.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// where a scaled entry holds its LBM offset
+#define HVS_ENTRY_SCALED_LBM_WORD 8
+
+// PPF when growing, TPZ when shrinking or at 1:1
+enum lbm_scaling hvs_entry_scaling_mode(unsigned int source, unsigned int dest);
+// the SCL0/SCL1 value for a pair of scaling modes, or -1 if the hardware has no such mode
+int hvs_entry_scl(enum lbm_scaling xmode, enum lbm_scaling ymode);
+// the palette word of a palette entry, for a table at base in dlist memory
+uint32_t hvs_entry_palette_word(enum palette_type type, uint32_t base);
+
+// each writes an entry to d and returns its length in words, POS0 is left for the caller to patch
+// palette is the palette word, 0 for none
+int hvs_entry_unity(uint32_t *d, enum hvs_pixel_format fmt, enum alpha_mode alpha_mode, uint32_t pos0,
+                    unsigned int width, unsigned int height, uint32_t ptr0, uint32_t pitch, uint32_t palette);
+// 0 if the hardware cant do that scaling, kernel is the dlist memory offset of the PPF kernel
+int hvs_entry_scaled(uint32_t *d, enum hvs_pixel_format fmt, enum alpha_mode alpha_mode, uint32_t pos0,
+                     unsigned int input_width, unsigned int input_height,
+                     unsigned int screen_width, unsigned int screen_height,
+                     uint32_t ptr0, uint32_t pitch, uint32_t lbm_offset, uint32_t kernel);
+
+// how many luma pixels share a chroma sample, in each direction
+void hvs_yuv_subsampling(enum hvs_yuv_format f, unsigned int *h, unsigned int *v);
+unsigned int hvs_yuv_planes(enum hvs_yuv_format f);
+enum hvs_pixel_format hvs_yuv_pixel_format(enum hvs_yuv_format f);
+// the 3 colorspace conversion words of a yuv dlist entry
+void hvs_yuv_csc(enum hvs_colorspace cs, uint32_t words[3]);
+
+typedef struct {
+  enum hvs_yuv_format format;
+  enum hvs_colorspace colorspace;
+  enum alpha_mode alpha_mode;
+  uint32_t pos0;
+  // the cropped input, and the size on screen
+  unsigned int src_w, src_h;
+  unsigned int w, h;
+  // luma, then cbcr or cb, then cr, already offset to the crop
+  uint32_t ptr[3];
+  uint32_t luma_pitch, chroma_pitch;
+  uint32_t lbm_offset;
+  uint32_t kernel;
+} hvs_entry_yuv_params;
+
+// both planes are always PPF scaled, the LBM offset lands in d[hvs_entry_yuv_lbm_word()]
+int hvs_entry_yuv(uint32_t *d, const hvs_entry_yuv_params *p);
+unsigned int hvs_entry_yuv_lbm_word(enum hvs_yuv_format f);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+// per-scanline cost model for the hvs, to predict underflow before it tears
+// only depends on libc, so it also builds on the host, see platform/bcm28xx/hvs/Makefile
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the model: every output pixel costs a composition cycle
+// a scaled layer also pushes every source pixel it reads through the scaler, one more cycle each
+// fetch is the source bytes read per output line, so vertical downscaling multiplies it
+#define HVS_PLAN_CYCLES_PER_PIXEL 1
+#define HVS_PLAN_CYCLES_PER_SCALED_PIXEL 1
+
+enum hvs_plan_policy {
+  // only measure, the peak shows up in hvs_plan and hvs_dump_dlist
+  HVS_PLAN_REPORT,
+  // leave out the lowest priority layers that touch an overloaded line, until every line fits
+  HVS_PLAN_DROP,
+};
+
+typedef struct {
+  // on screen
+  int x, y;
+  uint32_t w, h;
+  // what is read from memory
+  uint32_t src_w, src_h;
+  uint32_t bits_per_pixel;
+  bool scaled;
+  // the hvs_layer->layer, higher is on top
+  int priority;
+} hvs_plan_layer;
+
+typedef struct {
+  uint32_t width;
+  uint32_t lines;
+  // per line budgets, 0 means unlimited
+  uint32_t cycle_budget;
+  uint32_t byte_budget;
+  // lines entries each, owned by the caller
+  uint32_t *cycles;
+  uint32_t *bytes;
+
+  // filled in by hvs_plan_finish()
+  uint32_t peak_cycles;
+  uint32_t peak_bytes;
+  uint32_t peak_line;
+  uint32_t over_lines;
+  uint32_t layers;
+  uint32_t dropped;
+} hvs_plan;
+
+void hvs_plan_init(hvs_plan *p, uint32_t width, uint32_t lines, uint32_t *cycles, uint32_t *bytes);
+// zeroes the per line totals, keeps the budgets
+void hvs_plan_begin(hvs_plan *p);
+// cost of one layer on each line it covers, after clipping to the screen
+// returns false if it is entirely off screen
+bool hvs_plan_layer_cost(const hvs_plan *p, const hvs_plan_layer *l, uint32_t *first, uint32_t *end, uint32_t *cycles, uint32_t *bytes);
+void hvs_plan_add(hvs_plan *p, const hvs_plan_layer *l);
+// updates the peaks and counts the lines over budget
+void hvs_plan_finish(hvs_plan *p);
+// true if l covers a line that is currently over budget
+bool hvs_plan_overloads(const hvs_plan *p, const hvs_plan_layer *l);
+// takes a layer back out, for HVS_PLAN_DROP, over_lines is kept up to date, the peaks need another hvs_plan_finish()
+void hvs_plan_remove(hvs_plan *p, const hvs_plan_layer *l);
+// the whole HVS_PLAN_DROP pass, on a plan that already has every layer added and finished
+// layers must be in priority order, lowest first, drop[i] is set for each layer left out
+// returns how many were dropped, the plan is finished again afterwards
+uint32_t hvs_plan_drop(hvs_plan *p, const hvs_plan_layer *layers, uint32_t count, bool *drop);
+
+#ifdef __cplusplus
+}
+#endif
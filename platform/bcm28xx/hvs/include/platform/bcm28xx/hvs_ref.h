@@ -0,0 +1,55 @@
+#pragma once
+
+// a software model of how the hvs composes one channel, for checking display lists on the host, see hvs-ref.c
+// it walks a dlist the way the hardware does, fetching pixels from a copy of sdram, and blends them into an argb framebuffer
+// only depends on libc, it is never built into the firmware
+//
+// what it models is what this tree emits, where the hardware is not documented it is a best guess:
+// - rgb332/565/8888 in HVS_PIXEL_ORDER_ABGR are the lib/gfx layouts, ARGB swaps red and blue, the other orders are rejected
+// - palette pixels are packed msb first, the table is 0xAARRGGBB words in dlist memory
+// - PPF is bilinear and TPZ is a box filter, so scaled output is only close to the hardware, not bit exact
+// - the yuv csc coefficients are s2.8, except y, cr->red and cb->blue which are unsigned
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// dlist memory, in words
+#define HVS_REF_DLIST_WORDS 4096
+
+typedef struct {
+  // all of dlist memory, entries, palettes and kernels
+  const uint32_t *dlist;
+  // a copy of sdram starting at bus address sdram_base, with the cache alias bits masked off
+  const uint8_t *sdram;
+  uint32_t sdram_base;
+  uint32_t sdram_size;
+  // the framebuffer it composes into, 0xAARRGGBB
+  uint32_t *out;
+  unsigned int width, height;
+  // the dispbkgnd fill, 0xRRGGBB
+  uint32_t background;
+} hvs_ref;
+
+typedef struct {
+  uint32_t entries;
+  uint32_t words;
+  // entries that were skipped, and why the last one was
+  uint32_t errors;
+  const char *last_error;
+  uint32_t last_error_offset;
+} hvs_ref_stats;
+
+// composes the list starting at dlist[start] until CONTROL_END, returns false if any entry had to be skipped
+bool hvs_ref_render(const hvs_ref *r, uint32_t start, hvs_ref_stats *stats);
+// crc32 of the framebuffer, what the built-in scenes are checked against
+uint32_t hvs_ref_crc(const hvs_ref *r);
+// the largest difference of any channel, between two framebuffers of the same size
+unsigned int hvs_ref_diff(const uint32_t *a, const uint32_t *b, unsigned int pixels, unsigned int *worst);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+// a record of every frame the pv irqs flip, to line display glitches up with memory load
+// cheap enough to always be on, the pv irq writes one record per frame into a ring, and the hvs_telemetry command reads it back
+// "hvs_telemetry dump" prints it in a line based format meant for scripts on the other end of the uart
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef HVS_TELEMETRY_RECORDS
+#define HVS_TELEMETRY_RECORDS 256
+#endif
+
+// hvs_telemetry_record.errors, from the per channel SCALER_DISPSTAT bits
+#define HVS_TELEMETRY_UNDERFLOW   (1<<0)  // the pv read from an empty fifo
+#define HVS_TELEMETRY_SHORT_LINE  (1<<1)  // hsync came before the line was done
+#define HVS_TELEMETRY_SHORT_FRAME (1<<2)  // vsync came before the frame was done
+#define HVS_TELEMETRY_COB_LOW     (1<<3)  // the composite output buffer ran low
+
+typedef struct {
+  uint32_t time;          // ST_CLO when the pv irq was entered, at the start of vfp
+  uint32_t frame;         // hvs_frame_count()
+  uint32_t dispstat;      // SCALER_DISPSTATn right after the flip, mode, fifo state and line
+  uint32_t sdram_cycles;  // sdram cycles since the last record of this channel
+  uint16_t dlist_start;   // the list that was just latched
+  uint16_t dlist_words;
+  uint16_t flip_us;       // irq entry to the SCALER_DISPLISTn write
+  uint8_t sdram_idle;     // percent of sdram_cycles that were idle
+  uint8_t channel : 4;
+  uint8_t errors : 4;     // HVS_TELEMETRY_*, seen since the last record of this channel
+} hvs_telemetry_record;
+
+typedef struct {
+  uint32_t frames;
+  uint32_t underflows;
+  uint32_t short_lines;
+  uint32_t short_frames;
+  uint32_t cob_low;
+  uint32_t flip_us_max;
+  uint32_t sdram_idle_min;
+  // the frame the last error was seen on
+  uint32_t last_error_frame;
+} hvs_telemetry_totals;
+
+// called by the pv irq right after the flip, irq_time is ST_CLO on entry
+void hvs_telemetry_frame(int channel, uint32_t irq_time, uint32_t dlist_start, uint32_t dlist_words);
+// how many records have been written since the last clear, the ring holds the last HVS_TELEMETRY_RECORDS of them
+uint32_t hvs_telemetry_written(void);
+// copies out record seq, counting from 0 at the last clear, returns false if it is not written yet or was overwritten
+bool hvs_telemetry_get(uint32_t seq, hvs_telemetry_record *r);
+void hvs_telemetry_totals_get(int channel, hvs_telemetry_totals *t);
+void hvs_telemetry_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+
+// allocating yuv images for mk_yuv_layer(), and a pool of them for video
+// the layout helpers, hvs_yuv_planes() and friends, are in hvs_entry.h
+// a producer takes a free frame from the pool, decodes into it, and presents it, the layer is pointed at it without copying
+// the frame comes back to the pool once a newer one has replaced it on screen, so a frame is never written while the hvs reads it
+
+#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <lk/err.h>
+#include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/hvs_entry.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// every plane and every row starts on this, so the hvs fetches whole bursts, and the planes never share a cache line
+#define HVS_YUV_ALIGN 64
+
+// the bytes hvs_yuv_image_init() lays the planes out in
+size_t hvs_yuv_size(enum hvs_yuv_format f, unsigned int width, unsigned int height);
+// mem must be HVS_YUV_ALIGN aligned, and hvs_yuv_size() long
+void hvs_yuv_image_init(hvs_yuv_image *i, enum hvs_yuv_format f, enum hvs_colorspace cs,
+                        unsigned int width, unsigned int height, void *mem);
+// the planes are left uninitialized, returns NULL if out of memory
+hvs_yuv_image *hvs_yuv_alloc(enum hvs_yuv_format f, enum hvs_colorspace cs, unsigned int width, unsigned int height);
+void hvs_yuv_free(hvs_yuv_image *i);
+
+enum hvs_yuv_frame_state {
+  HVS_YUV_FREE,
+  HVS_YUV_FILLING,    // handed out by hvs_yuv_pool_get()
+  HVS_YUV_QUEUED,     // waiting in the presentation queue
+  HVS_YUV_SHOWN,      // on screen, or latched to be
+};
+
+struct hvs_yuv_pool;
+
+typedef struct {
+  hvs_yuv_image image;
+  struct hvs_yuv_pool *pool;
+  enum hvs_yuv_frame_state state;
+  // the scanout count it went on screen at, 0 if it never has
+  uint32_t shown_frame;
+} hvs_yuv_frame;
+
+typedef struct hvs_yuv_pool {
+  hvs_yuv_frame *frames;
+  uint32_t count;
+  void *mem;
+  spin_lock_t lock;
+  // signalled whenever a frame goes back to HVS_YUV_FREE
+  event_t freed;
+  hvs_yuv_frame *shown;
+  // what a frame did after hvs_yuv_pool_present()
+  uint32_t presented;
+  uint32_t missed;
+  uint32_t skipped;
+} hvs_yuv_pool;
+
+// count frames of one format and size, in one aligned block
+// 3 is the least that lets a producer fill one while one is queued and one is on screen
+status_t hvs_yuv_pool_init(hvs_yuv_pool *p, uint32_t count, enum hvs_yuv_format f, enum hvs_colorspace cs,
+                           unsigned int width, unsigned int height);
+// nothing can be queued or being filled, and the layer must be off the screen, a frame still marked shown is fine
+void hvs_yuv_pool_free(hvs_yuv_pool *p);
+// a free frame to fill, blocks up to timeout for one, NULL if none came free
+hvs_yuv_frame *hvs_yuv_pool_get(hvs_yuv_pool *p, lk_time_t timeout);
+// hands a frame back without showing it
+void hvs_yuv_pool_put(hvs_yuv_frame *frame);
+// points layer at the frame, and queues the flip with hvs_present(), with the same targets
+// takes the channel lock itself, the layer must already be added to the channel
+// on error the layer is left as it was, and the frame stays with the caller
+status_t hvs_yuv_pool_present(hvs_yuv_frame *frame, int channel, hvs_layer *layer, uint32_t target_frame, uint32_t target_us);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+// allocator for the hvs line buffer memory (LBM), which every vertically scaled layer needs a private slice of
+// only depends on libc, so it also builds on the host, see platform/bcm28xx/hvs/Makefile
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// in LBM words, each word holds 2 pixels
+#define LBM_WORDS (48 * 1024)
+// the hvs wants every region 32 word aligned
+#define LBM_ALIGN 32
+// live regions plus freed ones waiting out the quarantine
+#define LBM_MAX_REGIONS 512
+// a freed region may still be in the list being scanned out, so it isnt reused until this much later
+// long enough for 2 frames at the slowest (25fps interlaced) mode
+#define LBM_QUARANTINE_US 80000
+
+enum lbm_scaling {
+  LBM_SCALE_NONE,
+  LBM_SCALE_PPF,
+  LBM_SCALE_TPZ,
+};
+
+typedef struct {
+  uint32_t offset;
+  uint32_t size;
+  // NULL once freed, the region is then only waiting for the quarantine to pass
+  void *owner;
+  uint32_t freed_at;
+} lbm_region;
+
+typedef struct {
+  uint32_t size;
+  // sorted by offset, never overlapping
+  lbm_region regions[LBM_MAX_REGIONS];
+  uint32_t count;
+
+  uint32_t used;
+  uint32_t peak;
+  uint32_t failures;
+  uint32_t moves;
+} lbm_pool;
+
+// how many LBM words a layer needs, src_w is the input width, dst_w the width on screen
+// 0 if it has no vertical scaling, and so needs no LBM
+uint32_t lbm_words_needed(uint32_t src_w, uint32_t dst_w, enum lbm_scaling xmode, enum lbm_scaling ymode, bool yuv);
+
+void lbm_init(lbm_pool *p, uint32_t size);
+// first fit, returns the offset in words, or -1 if there is no gap big enough
+int lbm_alloc(lbm_pool *p, uint32_t size, void *owner);
+// now is any microsecond clock, the region is held until lbm_reclaim() sees LBM_QUARANTINE_US pass
+void lbm_free(lbm_pool *p, uint32_t offset, uint32_t now);
+// forgets freed regions whose quarantine is over
+void lbm_reclaim(lbm_pool *p, uint32_t now);
+// says if a regions owner can be moved right now, see lbm_defrag_step()
+typedef bool (*lbm_movable_fn)(const void *owner, void *arg);
+
+// moves at most one live region into a lower free gap, so over many frames the free space collects at the top
+// only regions movable() accepts are considered, a NULL movable accepts all of them
+// the old place is quarantined like a free, returns true and fills in the owner and new offset if something moved
+bool lbm_defrag_step(lbm_pool *p, uint32_t now, lbm_movable_fn movable, void *arg, void **owner, uint32_t *new_offset);
+// the biggest single allocation that would currently succeed
+uint32_t lbm_largest_free(const lbm_pool *p);
+
+#ifdef __cplusplus
+}
+#endif
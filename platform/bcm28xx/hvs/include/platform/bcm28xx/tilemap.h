@@ -0,0 +1,101 @@
+#pragma once
+
+// a scrolling window onto a grid of tiles from a sprite sheet
+// it is shown one of 2 ways, and by default picks whichever its cost estimate says is cheaper on each update:
+//   sprites: one hvs layer per visible tile, viewporting into the sheet, nothing is drawn, but the dlist grows with the tile count
+//   surface: tiles are copied into a backing surface by the dma blitter, only when they change, and shown by up to 4 layers
+//            the backing is a ring in both directions like fasterconsole, so scrolling only draws the row/column that came into view
+
+#include <lib/gfx.h>
+#include <platform/bcm28xx/dma_blit.h>
+#include <platform/bcm28xx/hvs.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a map cell with nothing in it
+#define TILEMAP_EMPTY 0xffff
+
+// the cost model, in nanoseconds, the defaults are guesses to calibrate with tilemap_stats
+// (re)compiling one dlist entry
+#ifndef TILEMAP_NS_PER_COMPILE
+#define TILEMAP_NS_PER_COMPILE 3000
+#endif
+// copying one dlist word on every hvs_update_dlist()
+#ifndef TILEMAP_NS_PER_WORD
+#define TILEMAP_NS_PER_WORD 40
+#endif
+// the dma moving one KB of tile
+#ifndef TILEMAP_NS_PER_KB
+#define TILEMAP_NS_PER_KB 4000
+#endif
+// starting a blit batch at all
+#ifndef TILEMAP_NS_PER_BATCH
+#define TILEMAP_NS_PER_BATCH 5000
+#endif
+// the other mode has to be this many percent cheaper before it switches, so it doesnt flap between them
+#define TILEMAP_SWITCH_PERCENT 75
+
+enum tilemap_mode {
+  TILEMAP_AUTO,
+  TILEMAP_SPRITES,
+  TILEMAP_SURFACE,
+};
+
+typedef struct {
+  uint32_t updates;
+  // from the last tilemap_update()
+  uint32_t changed;         // sprites it recompiled, or tiles it drew
+  uint32_t words;           // dlist words of the layers it shows, from the last tilemap_dlist_words()
+  uint32_t update_us;
+  uint32_t sprites_ns;      // what each mode was estimated to cost
+  uint32_t surface_ns;
+  uint32_t switches;
+} tilemap_stats;
+
+typedef struct {
+  // set up by tilemap_init()
+  gfx_surface *sheet;
+  uint tile_w, tile_h;
+  uint sheet_columns;
+  uint map_w, map_h;
+  uint16_t *map;            // map_w x map_h sheet indexes, or TILEMAP_EMPTY, owned by the caller
+  int screen_x, screen_y;
+  uint view_w, view_h;
+  int layer;
+
+  // can be changed at any time, take effect on the next tilemap_update()
+  int scroll_x, scroll_y;   // in pixels, the map position of the top left of the window
+  enum tilemap_mode mode;
+
+  // internal
+  enum tilemap_mode active;
+  int channel;
+  // the window covers at most cells_x x cells_y tiles at once
+  uint cells_x, cells_y;
+  hvs_layer *sprites;       // cells_x x cells_y
+  gfx_surface *backing;     // cells_x x cells_y tiles
+  uint16_t *backing_tiles;  // what each backing slot holds, TILEMAP_EMPTY until drawn
+  hvs_layer quads[4];
+  dma_blit blit;
+
+  tilemap_stats stats;
+} tilemap;
+
+// the sheet is read as rows of sheet->width / tile_w tiles
+// the window is view_w x view_h pixels at screen_x,screen_y, on hvs priority layer
+status_t tilemap_init(tilemap *t, int channel, gfx_surface *sheet, uint tile_w, uint tile_h,
+                      uint16_t *map, uint map_w, uint map_h,
+                      int screen_x, int screen_y, uint view_w, uint view_h, int layer);
+// brings the layers in line with scroll_x/scroll_y and the map, then the caller does hvs_update_dlist()
+// must be called with the channel lock held
+void tilemap_update(tilemap *t);
+// the dlist words the tilemap layers take up, after a hvs_update_dlist(), also kept in stats.words
+uint32_t tilemap_dlist_words(tilemap *t);
+
+#ifdef __cplusplus
+}
+#endif
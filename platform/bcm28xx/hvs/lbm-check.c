@@ -0,0 +1,193 @@
+// host check for lbm.c, run with `make lbm-check && ./lbm-check`
+
+#include <platform/bcm28xx/lbm.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static lbm_pool pool;
+
+// sorted, aligned, inside the pool, not overlapping, and used matches the live regions
+static void check_invariants(const lbm_pool *p) {
+  uint32_t used = 0;
+  uint32_t end = 0;
+  for (uint32_t i=0; i < p->count; i++) {
+    const lbm_region *r = &p->regions[i];
+    CHECK((r->offset % LBM_ALIGN) == 0);
+    CHECK(r->offset >= end);
+    CHECK((r->offset + r->size) <= p->size);
+    end = r->offset + r->size;
+    if (r->owner) used += r->size;
+  }
+  CHECK(used == p->used);
+}
+
+static void test_sizes(void) {
+  // no vertical scaling, no LBM
+  CHECK(lbm_words_needed(1920, 1920, LBM_SCALE_PPF, LBM_SCALE_NONE, false) == 0);
+  // hvs-dance sprite, 150 wide shrunk to 37
+  CHECK(lbm_words_needed(150, 37, LBM_SCALE_TPZ, LBM_SCALE_TPZ, false) == 160);
+  // upscaling buffers the source line
+  CHECK(lbm_words_needed(1920, 3840, LBM_SCALE_PPF, LBM_SCALE_PPF, false) == 15360);
+  // yuv always needs the 16x multiplier
+  CHECK(lbm_words_needed(256, 256, LBM_SCALE_PPF, LBM_SCALE_TPZ, true) == 2048);
+  CHECK(lbm_words_needed(256, 256, LBM_SCALE_PPF, LBM_SCALE_TPZ, false) == 1024);
+}
+
+static void test_exhaustion(void) {
+  lbm_init(&pool, LBM_WORDS);
+  int count = 0;
+  while (lbm_alloc(&pool, 160, &pool) >= 0) count++;
+  // 160 words is 5 aligned blocks
+  CHECK(count == (LBM_WORDS / 160));
+  CHECK(pool.failures == 1);
+  // the 32 word tail is still usable
+  CHECK(lbm_alloc(&pool, 32, &pool) == (LBM_WORDS / 160) * 160);
+  CHECK(lbm_alloc(&pool, 32, &pool) == -1);
+  check_invariants(&pool);
+  printf("exhaustion: %d regions of 160 words, %d failures\n", count, pool.failures);
+}
+
+static void test_quarantine(void) {
+  lbm_init(&pool, 1024);
+  int a = lbm_alloc(&pool, 512, &pool);
+  int b = lbm_alloc(&pool, 512, &pool);
+  CHECK(a == 0);
+  CHECK(b == 512);
+  lbm_free(&pool, a, 1000);
+  // still in the list being scanned out
+  CHECK(lbm_alloc(&pool, 512, &pool) == -1);
+  lbm_reclaim(&pool, 1000 + LBM_QUARANTINE_US - 1);
+  CHECK(lbm_alloc(&pool, 512, &pool) == -1);
+  lbm_reclaim(&pool, 1000 + LBM_QUARANTINE_US);
+  CHECK(lbm_alloc(&pool, 512, &pool) == 0);
+  check_invariants(&pool);
+}
+
+static void test_defrag(void) {
+  int owners[4];
+  int offsets[4];
+  uint32_t now = 0;
+  lbm_init(&pool, 4096);
+  for (int i=0; i<4; i++) offsets[i] = lbm_alloc(&pool, 1024, &owners[i]);
+  lbm_free(&pool, offsets[0], now);
+  lbm_free(&pool, offsets[2], now);
+  now += LBM_QUARANTINE_US;
+  lbm_reclaim(&pool, now);
+  // 2048 free, but not in one piece
+  CHECK(lbm_largest_free(&pool) == 1024);
+  CHECK(lbm_alloc(&pool, 2048, &pool) == -1);
+
+  void *owner;
+  uint32_t moved_to;
+  int steps = 0;
+  while (lbm_defrag_step(&pool, now, NULL, NULL, &owner, &moved_to)) {
+    steps++;
+    check_invariants(&pool);
+    now += LBM_QUARANTINE_US;
+    lbm_reclaim(&pool, now);
+  }
+  CHECK(steps == 2);
+  CHECK(lbm_largest_free(&pool) == 2048);
+  CHECK(lbm_alloc(&pool, 2048, &pool) == 2048);
+  check_invariants(&pool);
+}
+
+static bool only_arg(const void *owner, void *arg) {
+  return owner == arg;
+}
+
+// like hvs_lbm_maintain(), only the owners on the channel being rebuilt may move
+static void test_defrag_filter(void) {
+  int owners[4];
+  int offsets[4];
+  uint32_t now = 0;
+  lbm_init(&pool, 4096);
+  for (int i=0; i<4; i++) offsets[i] = lbm_alloc(&pool, 1024, &owners[i]);
+  lbm_free(&pool, offsets[0], now);
+  lbm_free(&pool, offsets[2], now);
+  now += LBM_QUARANTINE_US;
+  lbm_reclaim(&pool, now);
+
+  void *owner;
+  uint32_t moved_to;
+  int steps = 0;
+  while (lbm_defrag_step(&pool, now, only_arg, &owners[3], &owner, &moved_to)) {
+    steps++;
+    CHECK(owner == &owners[3]);
+    check_invariants(&pool);
+    now += LBM_QUARANTINE_US;
+    lbm_reclaim(&pool, now);
+  }
+  // owners[1] stays at 1024, so owners[3] can only drop into the gap at 0
+  CHECK(steps == 1);
+  CHECK(moved_to == 0);
+  for (uint32_t i=0; i < pool.count; i++) {
+    if (pool.regions[i].owner == &owners[1]) CHECK(pool.regions[i].offset == (uint32_t)offsets[1]);
+  }
+}
+
+// random churn, like sprites coming and going with different sizes
+static void test_random(void) {
+  struct { int offset; uint32_t size; } live[LBM_MAX_REGIONS];
+  int nlive = 0;
+  uint32_t now = 0;
+  int allocs = 0, fails = 0;
+  lbm_init(&pool, LBM_WORDS);
+  srand(1234);
+  for (int step=0; step < 200000; step++) {
+    int op = rand() % 8;
+    if ((op < 4) && (nlive < (LBM_MAX_REGIONS / 2))) {
+      uint32_t w = 16 + (rand() % 1024);
+      uint32_t size = lbm_words_needed(w, w / 2, LBM_SCALE_TPZ, LBM_SCALE_TPZ, false);
+      int offset = lbm_alloc(&pool, size, &live[nlive]);
+      if (offset >= 0) {
+        live[nlive].offset = offset;
+        live[nlive].size = size;
+        nlive++;
+        allocs++;
+      } else {
+        fails++;
+      }
+    } else if ((op < 7) && nlive) {
+      int victim = rand() % nlive;
+      lbm_free(&pool, live[victim].offset, now);
+      live[victim] = live[--nlive];
+      // keep the owner pointers stable for defrag
+      for (uint32_t i=0; i < pool.count; i++) {
+        if (pool.regions[i].owner == &live[nlive]) pool.regions[i].owner = &live[victim];
+      }
+    } else {
+      void *owner;
+      uint32_t moved_to;
+      if (lbm_defrag_step(&pool, now, NULL, NULL, &owner, &moved_to)) {
+        int *offset = owner;
+        CHECK(moved_to < (uint32_t)*offset);
+        *offset = moved_to;
+      }
+    }
+    now += 16667;
+    lbm_reclaim(&pool, now);
+    check_invariants(&pool);
+    if (failures) break;
+  }
+  printf("random: %d allocs, %d failed, %d moves, peak %d words\n", allocs, fails, pool.moves, pool.peak);
+}
+
+int main(int argc, char **argv) {
+  test_sizes();
+  test_exhaustion();
+  test_quarantine();
+  test_defrag();
+  test_defrag_filter();
+  test_random();
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  puts("all ok");
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <platform/bcm28xx/lbm.h>
+#include <string.h>
+
+#define ALIGN_UP(n, a) (((n) + (a) - 1) & ~((a) - 1))
+
+// same sizing rules as the linux vc4 driver
+uint32_t lbm_words_needed(uint32_t src_w, uint32_t dst_w, enum lbm_scaling xmode, enum lbm_scaling ymode, bool yuv) {
+  if (ymode == LBM_SCALE_NONE) return 0;
+  // when TPZ shrinks the line first, only the output width has to be buffered
+  uint32_t pix_per_line = (xmode == LBM_SCALE_TPZ) ? dst_w : src_w;
+  uint32_t bytes;
+  if (!yuv && (ymode == LBM_SCALE_TPZ)) bytes = pix_per_line * 8;
+  else bytes = pix_per_line * 16;
+  // 64 byte aligned, 2 pixels per word
+  return ALIGN_UP(bytes, 64) / 2;
+}
+
+void lbm_init(lbm_pool *p, uint32_t size) {
+  memset(p, 0, sizeof(*p));
+  p->size = size;
+}
+
+// finds the lowest gap that can hold size words and ends at or before limit
+// returns the offset, and the index the new region should be inserted at, or -1
+static int find_gap(const lbm_pool *p, uint32_t size, uint32_t limit, uint32_t *index) {
+  uint32_t start = 0;
+  for (uint32_t i=0; i <= p->count; i++) {
+    uint32_t end = (i < p->count) ? p->regions[i].offset : p->size;
+    if (end > limit) end = limit;
+    if ((start + size) <= end) {
+      *index = i;
+      return start;
+    }
+    if (i == p->count) break;
+    start = ALIGN_UP(p->regions[i].offset + p->regions[i].size, LBM_ALIGN);
+    if (start >= limit) break;
+  }
+  return -1;
+}
+
+static void insert_region(lbm_pool *p, uint32_t index, uint32_t offset, uint32_t size, void *owner) {
+  memmove(&p->regions[index + 1], &p->regions[index], (p->count - index) * sizeof(lbm_region));
+  p->regions[index].offset = offset;
+  p->regions[index].size = size;
+  p->regions[index].owner = owner;
+  p->regions[index].freed_at = 0;
+  p->count++;
+}
+
+int lbm_alloc(lbm_pool *p, uint32_t size, void *owner) {
+  uint32_t index;
+  if ((size == 0) || (p->count == LBM_MAX_REGIONS)) {
+    p->failures++;
+    return -1;
+  }
+  int offset = find_gap(p, size, p->size, &index);
+  if (offset < 0) {
+    p->failures++;
+    return -1;
+  }
+  insert_region(p, index, offset, size, owner);
+  p->used += size;
+  if (p->used > p->peak) p->peak = p->used;
+  return offset;
+}
+
+void lbm_free(lbm_pool *p, uint32_t offset, uint32_t now) {
+  for (uint32_t i=0; i < p->count; i++) {
+    lbm_region *r = &p->regions[i];
+    if ((r->offset == offset) && r->owner) {
+      r->owner = NULL;
+      r->freed_at = now;
+      p->used -= r->size;
+      return;
+    }
+  }
+}
+
+void lbm_reclaim(lbm_pool *p, uint32_t now) {
+  uint32_t out = 0;
+  for (uint32_t i=0; i < p->count; i++) {
+    lbm_region *r = &p->regions[i];
+    if (!r->owner && ((now - r->freed_at) >= LBM_QUARANTINE_US)) continue;
+    if (out != i) p->regions[out] = *r;
+    out++;
+  }
+  p->count = out;
+}
+
+bool lbm_defrag_step(lbm_pool *p, uint32_t now, lbm_movable_fn movable, void *arg, void **owner, uint32_t *new_offset) {
+  if (p->count == LBM_MAX_REGIONS) return false;
+  for (uint32_t i=0; i < p->count; i++) {
+    lbm_region *r = &p->regions[i];
+    if (!r->owner) continue;
+    if (movable && !movable(r->owner, arg)) continue;
+    uint32_t index;
+    int offset = find_gap(p, r->size, r->offset, &index);
+    if (offset < 0) continue;
+    // the copy goes below the original, so the original shifts up by one slot
+    void *o = r->owner;
+    uint32_t size = r->size;
+    insert_region(p, index, offset, size, o);
+    r = &p->regions[i + 1];
+    r->owner = NULL;
+    r->freed_at = now;
+    p->moves++;
+    *owner = o;
+    *new_offset = offset;
+    return true;
+  }
+  return false;
+}
+
+uint32_t lbm_largest_free(const lbm_pool *p) {
+  uint32_t largest = 0;
+  uint32_t start = 0;
+  for (uint32_t i=0; i <= p->count; i++) {
+    uint32_t end = (i < p->count) ? p->regions[i].offset : p->size;
+    if ((end > start) && ((end - start) > largest)) largest = end - start;
+    if (i < p->count) start = ALIGN_UP(p->regions[i].offset + p->regions[i].size, LBM_ALIGN);
+  }
+  return largest;
+}
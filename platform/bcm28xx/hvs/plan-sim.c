@@ -0,0 +1,184 @@
+// host simulator for hvs_plan.c, run with `make plan-sim && ./plan-sim [recording...]`
+// without arguments it runs the built-in checks
+// a recording is what the hvs_plan_dump command prints on the console:
+//   screen <width> <height>
+//   budget <cycles per line> <bytes per line>
+//   layer <x> <y> <w> <h> <src_w> <src_h> <bits per pixel> <scaled> <priority>
+// layers must be listed lowest priority first, which is the order hvs_plan_dump prints them in
+
+#include <platform/bcm28xx/hvs_plan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINES 4096
+#define MAX_LAYERS 1024
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static uint32_t cycles[MAX_LINES];
+static uint32_t bytes[MAX_LINES];
+static hvs_plan_layer layers[MAX_LAYERS];
+static bool drop[MAX_LAYERS];
+
+static void plan_all(hvs_plan *p, uint32_t count) {
+  hvs_plan_begin(p);
+  for (uint32_t i=0; i < count; i++) hvs_plan_add(p, &layers[i]);
+  hvs_plan_finish(p);
+}
+
+static void print_plan(const char *name, const hvs_plan *p) {
+  printf("%s: %d layers, peak %d cycles (budget %d) %d bytes (budget %d) at line %d, %d lines over, %d dropped\n",
+      name, p->layers, p->peak_cycles, p->cycle_budget, p->peak_bytes, p->byte_budget, p->peak_line, p->over_lines, p->dropped);
+}
+
+static hvs_plan_layer mk_layer(int x, int y, uint32_t w, uint32_t h, uint32_t src_w, uint32_t src_h, uint32_t bpp, int priority) {
+  hvs_plan_layer l = {
+    .x = x, .y = y, .w = w, .h = h,
+    .src_w = src_w, .src_h = src_h,
+    .bits_per_pixel = bpp,
+    .scaled = (w != src_w) || (h != src_h),
+    .priority = priority,
+  };
+  return l;
+}
+
+static void test_single(void) {
+  hvs_plan p;
+  hvs_plan_init(&p, 720, 480, cycles, bytes);
+  layers[0] = mk_layer(10, 20, 100, 50, 100, 50, 32, 0);
+  plan_all(&p, 1);
+  CHECK(p.peak_cycles == 100);
+  CHECK(p.peak_bytes == 400);
+  CHECK(p.peak_line == 20);
+  CHECK(cycles[19] == 0);
+  CHECK(cycles[69] == 100);
+  CHECK(cycles[70] == 0);
+
+  // half off the left and bottom edges, only the visible part costs anything
+  layers[0] = mk_layer(-50, 460, 100, 50, 100, 50, 32, 0);
+  plan_all(&p, 1);
+  CHECK(p.peak_cycles == 50);
+  CHECK(p.peak_bytes == 200);
+  CHECK(cycles[479] == 50);
+
+  // 4x vertical downscale reads 4 source lines per output line
+  layers[0] = mk_layer(0, 0, 100, 50, 100, 200, 32, 0);
+  plan_all(&p, 1);
+  CHECK(p.peak_bytes == 1600);
+  CHECK(p.peak_cycles == 100 + 400);
+
+  // entirely off screen
+  layers[0] = mk_layer(800, 0, 100, 50, 100, 50, 32, 0);
+  plan_all(&p, 1);
+  CHECK(p.peak_cycles == 0);
+}
+
+// chips-challenge, 9x9 tiles of 34x34 from a sprite sheet
+static void test_tiles(void) {
+  hvs_plan p;
+  hvs_plan_init(&p, 720, 480, cycles, bytes);
+  uint32_t count = 0;
+  for (int y=0; y<9; y++) {
+    for (int x=0; x<9; x++) {
+      layers[count++] = mk_layer(50 + (x * 34), 60 + (y * 34), 34, 34, 34, 34, 32, 60);
+    }
+  }
+  plan_all(&p, count);
+  CHECK(p.layers == 81);
+  CHECK(p.peak_cycles == 9 * 34);
+  CHECK(p.peak_bytes == 9 * 34 * 4);
+  print_plan("tiles", &p);
+}
+
+// hvs-dance style pile up, everything on the same lines, then dropped down to the budget
+static void test_drop(void) {
+  hvs_plan p;
+  hvs_plan_init(&p, 720, 480, cycles, bytes);
+  p.cycle_budget = 2000;
+  p.byte_budget = 8000;
+  uint32_t count = 0;
+  for (int i=0; i<100; i++) {
+    layers[count++] = mk_layer((i * 7) % 680, 100 + (i % 5), 37, 37, 150, 150, 32, i);
+  }
+  plan_all(&p, count);
+  print_plan("pile up", &p);
+  CHECK(p.over_lines > 0);
+  uint32_t dropped = hvs_plan_drop(&p, layers, count, drop);
+  print_plan("pile up, dropped", &p);
+  CHECK(p.over_lines == 0);
+  CHECK(dropped > 0);
+  CHECK(p.peak_cycles <= p.cycle_budget);
+  CHECK(p.peak_bytes <= p.byte_budget);
+  // the survivors should be the high priority end
+  uint32_t last_dropped = 0;
+  for (uint32_t i=0; i < count; i++) if (drop[i]) last_dropped = i;
+  CHECK(last_dropped < (count - 1));
+
+  // the totals after dropping must match a plan of just the survivors
+  uint32_t peak = p.peak_cycles;
+  uint32_t kept = 0;
+  for (uint32_t i=0; i < count; i++) if (!drop[i]) layers[kept++] = layers[i];
+  plan_all(&p, kept);
+  CHECK(p.peak_cycles == peak);
+  CHECK(p.over_lines == 0);
+}
+
+static int run_recording(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+  hvs_plan p;
+  uint32_t width = 0, height = 0, cycle_budget = 0, byte_budget = 0;
+  uint32_t count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    hvs_plan_layer l;
+    int scaled;
+    if (sscanf(line, "screen %u %u", &width, &height) == 2) continue;
+    if (sscanf(line, "budget %u %u", &cycle_budget, &byte_budget) == 2) continue;
+    if (sscanf(line, "layer %d %d %u %u %u %u %u %d %d", &l.x, &l.y, &l.w, &l.h, &l.src_w, &l.src_h, &l.bits_per_pixel, &scaled, &l.priority) == 9) {
+      l.scaled = scaled;
+      if (count < MAX_LAYERS) layers[count++] = l;
+    }
+  }
+  fclose(f);
+  if ((height == 0) || (height > MAX_LINES)) {
+    printf("%s: no usable screen line\n", path);
+    return 1;
+  }
+  hvs_plan_init(&p, width, height, cycles, bytes);
+  p.cycle_budget = cycle_budget;
+  p.byte_budget = byte_budget;
+  plan_all(&p, count);
+  print_plan(path, &p);
+  if (p.over_lines) {
+    hvs_plan_drop(&p, layers, count, drop);
+    print_plan("  with HVS_PLAN_DROP", &p);
+    for (uint32_t i=0; i < count; i++) {
+      if (drop[i]) printf("  dropped layer %d: %dx%d at %d,%d priority %d\n", i, layers[i].w, layers[i].h, layers[i].x, layers[i].y, layers[i].priority);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    int ret = 0;
+    for (int i=1; i < argc; i++) ret |= run_recording(argv[i]);
+    return ret;
+  }
+  test_single();
+  test_tiles();
+  test_drop();
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  puts("all ok");
+  return 0;
+}
@@ -4,9 +4,16 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS += \
 	lib/gfx \
+	platform/bcm28xx/blit \
 	platform/bcm28xx/pixelvalve \
 
 MODULE_SRCS += \
-	$(LOCAL_DIR)/hvs.c
+	$(LOCAL_DIR)/hvs.c \
+	$(LOCAL_DIR)/hvs_entry.c \
+	$(LOCAL_DIR)/hvs_plan.c \
+	$(LOCAL_DIR)/hvs_telemetry.c \
+	$(LOCAL_DIR)/hvs_yuv.c \
+	$(LOCAL_DIR)/lbm.c \
+	$(LOCAL_DIR)/tilemap.c \
 
 include make/module.mk
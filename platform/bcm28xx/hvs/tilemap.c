@@ -0,0 +1,265 @@
+#include <assert.h>
+#include <lk/err.h>
+#include <lk/macros.h>
+#include <lk/reg.h>
+#include <platform/bcm28xx/clock.h>
+#include <platform/bcm28xx/dma_blit.h>
+#include <platform/bcm28xx/hvs.h>
+#include <platform/bcm28xx/tilemap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a compiled unity entry, see hvs_build_plane()
+#define UNITY_WORDS 7
+
+// rounds towards -infinity, so negative scroll offsets still land in the right tile
+static int floordiv(int a, int b) {
+  return (a >= 0) ? (a / b) : -(((-a) + b - 1) / b);
+}
+
+static int pmod(int a, int b) {
+  int r = a % b;
+  return (r < 0) ? r + b : r;
+}
+
+static uint16_t map_tile(const tilemap *t, int mx, int my) {
+  if ((mx < 0) || (my < 0) || ((uint)mx >= t->map_w) || ((uint)my >= t->map_h)) return TILEMAP_EMPTY;
+  uint16_t tile = t->map[(my * t->map_w) + mx];
+  // off the end of the sheet
+  if ((tile != TILEMAP_EMPTY) && (((tile / t->sheet_columns) + 1) * t->tile_h > t->sheet->height)) return TILEMAP_EMPTY;
+  return tile;
+}
+
+// cell cx,cy of the window, clipped to it
+typedef struct {
+  int mx, my;       // map cell
+  int x, y;         // within the window
+  uint w, h;
+  uint ox, oy;      // how much of the tile the clip cut off the top left
+  uint16_t tile;
+} cell;
+
+static bool window_cell(const tilemap *t, uint cx, uint cy, cell *c) {
+  const int first_mx = floordiv(t->scroll_x, t->tile_w);
+  const int first_my = floordiv(t->scroll_y, t->tile_h);
+  const int x0 = (cx * t->tile_w) - (t->scroll_x - (first_mx * (int)t->tile_w));
+  const int y0 = (cy * t->tile_h) - (t->scroll_y - (first_my * (int)t->tile_h));
+  const int x1 = MIN(x0 + (int)t->tile_w, (int)t->view_w);
+  const int y1 = MIN(y0 + (int)t->tile_h, (int)t->view_h);
+  c->x = MAX(x0, 0);
+  c->y = MAX(y0, 0);
+  if ((c->x >= x1) || (c->y >= y1)) return false;
+  c->w = x1 - c->x;
+  c->h = y1 - c->y;
+  c->ox = c->x - x0;
+  c->oy = c->y - y0;
+  c->mx = first_mx + cx;
+  c->my = first_my + cy;
+  c->tile = map_tile(t, c->mx, c->my);
+  return true;
+}
+
+// one pass over the sprites, counting how many would have to be recompiled, and doing it if apply is set
+static uint32_t sprites_pass(tilemap *t, bool apply, uint32_t *visible) {
+  uint32_t changed = 0;
+  *visible = 0;
+  for (uint cy=0; cy < t->cells_y; cy++) {
+    for (uint cx=0; cx < t->cells_x; cx++) {
+      hvs_layer *l = &t->sprites[(cy * t->cells_x) + cx];
+      cell c;
+      bool show = window_cell(t, cx, cy, &c) && (c.tile != TILEMAP_EMPTY);
+      if (!show) {
+        if (apply) l->visible = false;
+        continue;
+      }
+      (*visible)++;
+      const uint vx = ((c.tile % t->sheet_columns) * t->tile_w) + c.ox;
+      const uint vy = ((c.tile / t->sheet_columns) * t->tile_h) + c.oy;
+      // only the position changing is free, anything else is a new entry
+      if ((l->viewport_x != vx) || (l->viewport_y != vy) || (l->w != c.w) || (l->h != c.h)) changed++;
+      if (!apply) continue;
+      l->x = t->screen_x + c.x;
+      l->y = t->screen_y + c.y;
+      l->w = l->viewport_w = c.w;
+      l->h = l->viewport_h = c.h;
+      l->viewport_x = vx;
+      l->viewport_y = vy;
+      l->visible = true;
+    }
+  }
+  return changed;
+}
+
+// the same for the backing surface, counting or drawing the tiles that differ from what the slot holds
+static uint32_t surface_pass(tilemap *t, bool apply) {
+  uint32_t dirty = 0;
+  if (apply) dma_blit_reset(&t->blit);
+  for (uint cy=0; cy < t->cells_y; cy++) {
+    for (uint cx=0; cx < t->cells_x; cx++) {
+      cell c;
+      if (!window_cell(t, cx, cy, &c)) continue;
+      // map cells land in the backing mod its size, so neighbours never share a slot
+      const uint sx = pmod(c.mx, t->cells_x);
+      const uint sy = pmod(c.my, t->cells_y);
+      uint16_t *held = &t->backing_tiles[(sy * t->cells_x) + sx];
+      if (*held == c.tile) continue;
+      dirty++;
+      if (!apply) continue;
+      if (c.tile == TILEMAP_EMPTY) {
+        dma_blit_fill(&t->blit, t->backing, sx * t->tile_w, sy * t->tile_h, t->tile_w, t->tile_h, 0);
+      } else {
+        dma_blit_copy(&t->blit, t->backing, sx * t->tile_w, sy * t->tile_h, t->sheet,
+                      (c.tile % t->sheet_columns) * t->tile_w, (c.tile / t->sheet_columns) * t->tile_h, t->tile_w, t->tile_h);
+      }
+      *held = c.tile;
+    }
+  }
+  // the quads are about to point at these, so they have to be done before the next flip
+  if (apply && dirty) dma_blit_run(&t->blit);
+  return dirty;
+}
+
+// the window is at most 2x2 pieces of the backing, where it wraps around
+static uint32_t quads_pass(tilemap *t, bool apply) {
+  const uint backing_w = t->backing->width;
+  const uint backing_h = t->backing->height;
+  const uint bx = pmod(t->scroll_x, backing_w);
+  const uint by = pmod(t->scroll_y, backing_h);
+  const uint widths[2] = { MIN(t->view_w, backing_w - bx), t->view_w - MIN(t->view_w, backing_w - bx) };
+  const uint heights[2] = { MIN(t->view_h, backing_h - by), t->view_h - MIN(t->view_h, backing_h - by) };
+  uint32_t changed = 0;
+  for (int j=0; j<2; j++) {
+    for (int i=0; i<2; i++) {
+      hvs_layer *l = &t->quads[(j * 2) + i];
+      const uint vx = i ? 0 : bx;
+      const uint vy = j ? 0 : by;
+      const bool show = widths[i] && heights[j];
+      if (show && ((l->viewport_x != vx) || (l->viewport_y != vy) || (l->w != widths[i]) || (l->h != heights[j]))) changed++;
+      if (!apply) continue;
+      l->visible = show;
+      if (!show) continue;
+      l->x = t->screen_x + (i ? widths[0] : 0);
+      l->y = t->screen_y + (j ? heights[0] : 0);
+      l->w = l->viewport_w = widths[i];
+      l->h = l->viewport_h = heights[j];
+      l->viewport_x = vx;
+      l->viewport_y = vy;
+    }
+  }
+  return changed;
+}
+
+status_t tilemap_init(tilemap *t, int channel, gfx_surface *sheet, uint tile_w, uint tile_h,
+                      uint16_t *map, uint map_w, uint map_h,
+                      int screen_x, int screen_y, uint view_w, uint view_h, int layer) {
+  memset(t, 0, sizeof(*t));
+  t->channel = channel;
+  t->sheet = sheet;
+  t->tile_w = tile_w;
+  t->tile_h = tile_h;
+  t->sheet_columns = sheet->width / tile_w;
+  t->map = map;
+  t->map_w = map_w;
+  t->map_h = map_h;
+  t->screen_x = screen_x;
+  t->screen_y = screen_y;
+  t->view_w = view_w;
+  t->view_h = view_h;
+  t->layer = layer;
+  t->mode = TILEMAP_AUTO;
+  t->active = TILEMAP_AUTO;
+  if (t->sheet_columns == 0) return ERR_INVALID_ARGS;
+
+  // the most tiles a window can touch, when it is not aligned to the grid
+  t->cells_x = ((view_w + tile_w - 1) / tile_w) + 1;
+  t->cells_y = ((view_h + tile_h - 1) / tile_h) + 1;
+  const uint cells = t->cells_x * t->cells_y;
+
+  t->sprites = calloc(cells, sizeof(hvs_layer));
+  t->backing_tiles = malloc(cells * sizeof(uint16_t));
+  t->backing = gfx_create_surface(NULL, t->cells_x * tile_w, t->cells_y * tile_h, t->cells_x * tile_w, sheet->format);
+  if (!t->sprites || !t->backing_tiles || !t->backing || (dma_blit_init(&t->blit, cells) != NO_ERROR)) {
+    printf("tilemap: out of memory for %dx%d cells\n", t->cells_x, t->cells_y);
+    // whichever of them did get allocated, dma_blit_init() already cleans up after itself
+    free(t->sprites);
+    free(t->backing_tiles);
+    if (t->backing) gfx_surface_destroy(t->backing);
+    t->sprites = NULL;
+    t->backing_tiles = NULL;
+    t->backing = NULL;
+    return ERR_NO_MEMORY;
+  }
+  for (uint i=0; i < cells; i++) t->backing_tiles[i] = TILEMAP_EMPTY;
+  // an empty slot is transparent
+  memset(t->backing->ptr, 0, t->backing->len);
+
+  for (uint i=0; i < cells; i++) {
+    hvs_layer *l = &t->sprites[i];
+    mk_unity_layer(l, sheet, layer, 0, 0);
+    l->w = l->h = 0;
+    l->visible = false;
+    l->name = "tilemap sprite";
+    hvs_dlist_add(channel, l);
+  }
+  for (int i=0; i<4; i++) {
+    hvs_layer *l = &t->quads[i];
+    mk_unity_layer(l, t->backing, layer, 0, 0);
+    l->w = l->h = 0;
+    l->visible = false;
+    l->name = "tilemap surface";
+    hvs_dlist_add(channel, l);
+  }
+  return NO_ERROR;
+}
+
+void tilemap_update(tilemap *t) {
+  assert(is_mutex_held(&channels[t->channel].lock));
+  uint32_t start = *REG32(ST_CLO);
+  uint32_t visible;
+
+  // estimate both, the one not in use keeps its cached entries and backing, so switching back is often cheap
+  const uint32_t recompiles = sprites_pass(t, false, &visible);
+  const uint32_t sprites_ns = (recompiles * TILEMAP_NS_PER_COMPILE) + (visible * UNITY_WORDS * TILEMAP_NS_PER_WORD);
+  const uint32_t dirty = surface_pass(t, false);
+  const uint32_t tile_bytes = t->tile_w * t->tile_h * t->sheet->pixelsize;
+  uint32_t surface_ns = (quads_pass(t, false) * TILEMAP_NS_PER_COMPILE) + (4 * UNITY_WORDS * TILEMAP_NS_PER_WORD);
+  if (dirty) surface_ns += TILEMAP_NS_PER_BATCH + ((dirty * tile_bytes * TILEMAP_NS_PER_KB) / 1024);
+
+  enum tilemap_mode want = t->mode;
+  if (want == TILEMAP_AUTO) {
+    want = t->active;
+    if (want == TILEMAP_AUTO) want = (surface_ns < sprites_ns) ? TILEMAP_SURFACE : TILEMAP_SPRITES;
+    else if ((want == TILEMAP_SPRITES) && ((surface_ns * 100) < (sprites_ns * TILEMAP_SWITCH_PERCENT))) want = TILEMAP_SURFACE;
+    else if ((want == TILEMAP_SURFACE) && ((sprites_ns * 100) < (surface_ns * TILEMAP_SWITCH_PERCENT))) want = TILEMAP_SPRITES;
+  }
+  if ((want != t->active) && (t->active != TILEMAP_AUTO)) t->stats.switches++;
+  t->active = want;
+
+  if (want == TILEMAP_SPRITES) {
+    t->stats.changed = sprites_pass(t, true, &visible);
+    for (int i=0; i<4; i++) t->quads[i].visible = false;
+  } else {
+    t->stats.changed = surface_pass(t, true);
+    quads_pass(t, true);
+    for (uint i=0; i < (t->cells_x * t->cells_y); i++) t->sprites[i].visible = false;
+  }
+
+  t->stats.updates++;
+  t->stats.sprites_ns = sprites_ns;
+  t->stats.surface_ns = surface_ns;
+  t->stats.update_us = *REG32(ST_CLO) - start;
+}
+
+static uint32_t layer_words(const hvs_layer *l) {
+  if (!l->visible || (l->dlist_slot < 0) || !l->premade_dlist) return 0;
+  return (l->premade_dlist[0] >> 24) & 0x3f;
+}
+
+uint32_t tilemap_dlist_words(tilemap *t) {
+  uint32_t words = 0;
+  for (uint i=0; i < (t->cells_x * t->cells_y); i++) words += layer_words(&t->sprites[i]);
+  for (int i=0; i<4; i++) words += layer_words(&t->quads[i]);
+  t->stats.words = words;
+  return words;
+}
@@ -1,7 +1,14 @@
 #include <string.h>
+#include <stdlib.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+#include <lk/err.h>
+#include <lk/init.h>
 #include <lk/reg.h>
 #include <lk/console_cmd.h>
 #include <lk/debug.h>
+#include <platform/interrupts.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/i2c.h>
 #include <platform/bcm28xx/pll_read.h>
 
@@ -16,14 +23,32 @@ struct i2c_regs {
   uint32_t clkt;
 };
 
-static int cmd_i2c_set_rate(int argc, const cmd_args *argv);
-static int cmd_i2c_xfer(int argc, const cmd_args *argv);
+static int cmd_i2c_set_rate(int argc, const console_cmd_args *argv);
+static int cmd_i2c_xfer(int argc, const console_cmd_args *argv);
+static int cmd_i2c_bench(int argc, const console_cmd_args *argv);
+static int cmd_i2c_stats(int argc, const console_cmd_args *argv);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("i2c_xfer", "I2C transfer", &cmd_i2c_xfer)
 STATIC_COMMAND("i2c_set_rate", "Set I2C rate", &cmd_i2c_set_rate)
+STATIC_COMMAND("i2c_bench", "time queued I2C reads against the bus cycles they need", &cmd_i2c_bench)
+STATIC_COMMAND("i2c_stats", "I2C per bus counters", &cmd_i2c_stats)
 STATIC_COMMAND_END(i2c);
 
+// every bsc master shares the one irq, so the handler services each bus that has a txn running
+// the bsc masters have no DREQ, so the fifo is kept fed from the irq instead of by dma
+typedef struct {
+  spin_lock_t lock;
+  struct list_node queue;
+  i2c_txn *active;
+  timer_t timeout;
+  i2c_stats stats;
+  // what i2c_set_rate() was asked for, 0 if it never was, so the divider can follow the core clock
+  unsigned long rate;
+} i2c_bus;
+
+static i2c_bus buses[I2C_NUM_BUSES];
+
 static int unhex(char c) {
   if (c >= '0' && c <= '9')
     return c - '0';
@@ -50,9 +75,21 @@ void i2c_set_rate(unsigned busnum, unsigned long rate)
   uint32_t redl = (div >> 2) ?: 1;
   regs->div = div & 0xffffUL;
   regs->del = (fedl << 16) | redl;
+  buses[busnum].rate = rate;
 }
 
-static int cmd_i2c_set_rate(int argc, const cmd_args *argv) {
+void i2c_core_clock_changed(void) {
+  for (unsigned i=0; i < I2C_NUM_BUSES; i++) {
+    if (!buses[i].rate) continue;
+    // so a byte isnt clocked out half at the old rate
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&buses[i].lock, state);
+    i2c_set_rate(i, buses[i].rate);
+    spin_unlock_irqrestore(&buses[i].lock, state);
+  }
+}
+
+static int cmd_i2c_set_rate(int argc, const console_cmd_args *argv) {
   if (argc != 3) {
     printf("usage: i2c_set_rate <bus> <rate>\n");
     return -1;
@@ -68,84 +105,317 @@ static void i2c_clear_fifo(unsigned busnum) {
   regs->ctrl |= I2C_C_CLEAR0 | I2C_C_CLEAR1;
 }
 
-int i2c_xfer(unsigned busnum, unsigned addr,
-	     char *sendbuf, size_t sendsz,
-	     char *recvbuf, size_t recvsz) {
-  int ret = 0;
+// how long count bytes take on the wire, 9 clocks each plus the start and stop
+static uint32_t bus_time_us(unsigned busnum, uint32_t count) {
+  volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  uint32_t div = regs->div & 0xffff;
+  uint32_t base_freq = get_vpu_per_freq();
+  if (div == 0) div = 0x8000;
+  if (base_freq == 0) return 0;
+  return ((uint64_t)((count * 9) + 2) * div * 1000000) / base_freq;
+}
 
-  if (busnum > 7)
-    return -1;
+static uint32_t txn_bytes(const i2c_txn *txn) {
+  uint32_t total = 0;
+  for (unsigned i=0; i < txn->count; i++) total += txn->msgs[i].len + 1; // +1 for the address
+  return total;
+}
 
+static void start_msg(unsigned busnum, i2c_txn *txn);
+
+static void fill_fifo(volatile struct i2c_regs *regs, i2c_txn *txn) {
+  const i2c_msg *m = &txn->msgs[txn->msg];
+  while ((txn->pos < m->len) && (regs->stat & I2C_S_TXD)) regs->fifo = m->buf[txn->pos++];
+}
+
+static void drain_fifo(volatile struct i2c_regs *regs, i2c_txn *txn) {
+  const i2c_msg *m = &txn->msgs[txn->msg];
+  while ((txn->pos < m->len) && (regs->stat & I2C_S_RXD)) m->buf[txn->pos++] = regs->fifo;
+}
+
+// every byte of a write is in the fifo, either chain the next message on as a repeated start, or stop asking for TXW
+static void write_queued(unsigned busnum, i2c_txn *txn) {
   volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  const unsigned next = txn->msg + 1;
+  if ((next < txn->count) && !(txn->msgs[next].flags & I2C_MSG_STOP)) {
+    // the second ST has to land after the first start condition, and before the write drains
+    // that only takes a bit time, the write is already in the fifo
+    while (!(regs->stat & (I2C_S_TA | I2C_S_DONE | I2C_S_ERR | I2C_S_CLKT)))
+      ;
+    txn->msg = next;
+    start_msg(busnum, txn);
+  } else {
+    regs->ctrl = I2C_C_I2CEN | I2C_C_INTD;
+  }
+}
+
+static void start_msg(unsigned busnum, i2c_txn *txn) {
+  volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  const i2c_msg *m = &txn->msgs[txn->msg];
+  txn->pos = 0;
+  regs->addr = m->addr;
+  regs->dlen = m->len;
+  if (m->flags & I2C_MSG_READ) {
+    regs->ctrl = I2C_C_I2CEN | I2C_C_INTR | I2C_C_INTD | I2C_C_ST | I2C_C_READ;
+  } else {
+    // preloaded before ST, so the first 16 bytes go out back to back
+    fill_fifo(regs, txn);
+    regs->ctrl = I2C_C_I2CEN | I2C_C_INTT | I2C_C_INTD | I2C_C_ST;
+    if (txn->pos == m->len) write_queued(busnum, txn);
+  }
+}
+
+static enum handler_return i2c_timeout(timer_t *t, lk_time_t now, void *arg);
+
+// bus lock held
+static void start_txn(unsigned busnum) {
+  i2c_bus *b = &buses[busnum];
+  volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  i2c_txn *txn = list_remove_head_type(&b->queue, i2c_txn, node);
+  b->active = txn;
+  if (!txn) return;
 
   regs->ctrl = I2C_C_I2CEN;
   regs->stat = I2C_S_CLKT | I2C_S_ERR | I2C_S_DONE;
   i2c_clear_fifo(busnum);
-  regs->addr = addr;
+  txn->msg = 0;
+  txn->started_at = *REG32(ST_CLO);
+  // CLKT only catches a slave holding scl, this catches everything else
+  timer_set_oneshot(&b->timeout, 10 + (bus_time_us(busnum, txn_bytes(txn)) / 500), i2c_timeout, (void*)(uintptr_t)busnum);
+  start_msg(busnum, txn);
+}
 
-  // Send bytes
-  if (sendsz) {
-    regs->dlen = sendsz;
-    regs->ctrl |= I2C_C_ST;
-    while (!(regs->stat & (I2C_S_ERR | I2C_S_TA)))
-      ;
+// bus lock held, the caller signals the returned txn once the lock is dropped
+static i2c_txn *finish_txn(unsigned busnum, int status) {
+  i2c_bus *b = &buses[busnum];
+  volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  i2c_txn *txn = b->active;
+
+  timer_cancel(&b->timeout);
+  regs->stat = I2C_S_CLKT | I2C_S_ERR | I2C_S_DONE;
+  i2c_clear_fifo(busnum);
+  regs->ctrl = 0;
 
-    while(sendsz--) {
-      while (!(regs->stat & (I2C_S_CLKT | I2C_S_ERR | I2C_S_TXD)))
-	;
-      if (regs->stat & (I2C_S_CLKT | I2C_S_ERR)) {
-	regs->stat = I2C_S_CLKT | I2C_S_ERR | I2C_S_DONE;
-	return -1;
+  txn->finished_at = *REG32(ST_CLO);
+  txn->status = status;
+  b->stats.txns++;
+  b->stats.bus_us += txn->finished_at - txn->started_at;
+  if (status == NO_ERROR) b->stats.bytes += txn_bytes(txn);
+  else if (status == ERR_TIMED_OUT) b->stats.timeouts++;
+  else b->stats.errors++;
+
+  start_txn(busnum);
+  return txn;
+}
+
+static bool signal_txn(i2c_txn *txn) {
+  if (!txn) return false;
+  if (txn->callback) txn->callback(txn, txn->arg);
+  event_signal(&txn->done, false);
+  return true;
+}
+
+static enum handler_return i2c_timeout(timer_t *t, lk_time_t now, void *arg) {
+  unsigned busnum = (uintptr_t)arg;
+  i2c_bus *b = &buses[busnum];
+  i2c_txn *done = NULL;
+  spin_lock(&b->lock);
+  if (b->active) done = finish_txn(busnum, ERR_TIMED_OUT);
+  spin_unlock(&b->lock);
+  return signal_txn(done) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+static bool service_bus(unsigned busnum) {
+  i2c_bus *b = &buses[busnum];
+  volatile struct i2c_regs *regs = (struct i2c_regs*) i2c_base[busnum];
+  const uint32_t t0 = *REG32(ST_CLO);
+  i2c_txn *done = NULL;
+
+  spin_lock(&b->lock);
+  i2c_txn *txn = b->active;
+  if (txn) {
+    const uint32_t stat = regs->stat;
+    const i2c_msg *m = &txn->msgs[txn->msg];
+    txn->irqs++;
+    b->stats.irqs++;
+    if (stat & (I2C_S_ERR | I2C_S_CLKT)) {
+      done = finish_txn(busnum, (stat & I2C_S_CLKT) ? ERR_TIMED_OUT : ERR_I2C_NACK);
+    } else if (m->flags & I2C_MSG_READ) {
+      drain_fifo(regs, txn);
+    } else if (txn->pos < m->len) {
+      fill_fifo(regs, txn);
+      if (txn->pos == m->len) write_queued(busnum, txn);
+    }
+    // a write chained onto by a repeated start runs straight into the next message, only the last one raises DONE
+    if (!done && (stat & I2C_S_DONE)) {
+      m = &txn->msgs[txn->msg];
+      if (m->flags & I2C_MSG_READ) drain_fifo(regs, txn);
+      regs->stat = I2C_S_DONE;
+      if (txn->pos != m->len) {
+        done = finish_txn(busnum, ERR_IO);
+      } else if ((txn->msg + 1) < txn->count) {
+        txn->msg++;
+        start_msg(busnum, txn);
+      } else {
+        done = finish_txn(busnum, NO_ERROR);
       }
-      regs->fifo = *sendbuf++;
     }
+  }
+  b->stats.irq_us += *REG32(ST_CLO) - t0;
+  spin_unlock(&b->lock);
+  return signal_txn(done);
+}
 
-    while (!(regs->stat & ( (I2C_S_CLKT | I2C_S_ERR | I2C_S_DONE))))
-      ;
-    if ((regs->stat & (I2C_S_CLKT | I2C_S_ERR))) {
-      while ((regs->stat & I2C_S_TA))
-	;
-      dprintf(INFO, "Write failed, status 0x%08x\n", regs->stat);
-      recvsz = 0;
-      ret = -1;
-    }
+static enum handler_return i2c_irq(void *arg) {
+  bool resched = false;
+  for (unsigned i=0; i < I2C_NUM_BUSES; i++) {
+    if (buses[i].active) resched |= service_bus(i);
   }
+  return resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
 
-  // Receive bytes
-  if (recvsz) {
-    regs->dlen = recvsz;
-    regs->ctrl |= I2C_C_ST | I2C_C_READ;
-    while (!(regs->stat & (I2C_S_ERR | I2C_S_DONE | I2C_S_TA)))
-      ;
+void i2c_txn_init(i2c_txn *txn, unsigned busnum, i2c_msg *msgs, unsigned count) {
+  memset(txn, 0, sizeof(*txn));
+  list_clear_node(&txn->node);
+  txn->busnum = busnum;
+  txn->msgs = msgs;
+  txn->count = count;
+  event_init(&txn->done, false, EVENT_FLAG_AUTOUNSIGNAL);
+}
 
-    while(!(regs->stat & I2C_S_ERR)) {
-      if ((regs->stat & I2C_S_RXD)) {
-	*recvbuf++ = regs->fifo;
-	if (--recvsz == 0)
-	  break;
-      }
-    }
-    if (!recvsz && !regs->dlen) {
-      while (!(regs->stat & I2C_S_DONE))
-	;
-    } else {
-      dprintf(INFO, "Read failed, status 0x%08x\n", regs->stat);
-      ret = -1;
-    }
+status_t i2c_submit(i2c_txn *txn) {
+  if ((txn->busnum >= I2C_NUM_BUSES) || (txn->count == 0)) return ERR_INVALID_ARGS;
+  for (unsigned i=1; i < txn->count; i++) {
+    const i2c_msg *prev = &txn->msgs[i - 1];
+    if (txn->msgs[i].flags & I2C_MSG_STOP) continue;
+    if ((prev->flags & I2C_MSG_READ) || (prev->len > I2C_FIFO_SIZE)) return ERR_NOT_SUPPORTED;
   }
 
-  if ((regs->stat & (I2C_S_CLKT | I2C_S_ERR))) {
-    while ((regs->stat & I2C_S_TA) && !(regs->stat & I2C_S_RXD))
-      ;
+  i2c_bus *b = &buses[txn->busnum];
+  spin_lock_saved_state_t irqstate;
+  txn->status = ERR_BUSY;
+  txn->irqs = 0;
+  txn->queued_at = *REG32(ST_CLO);
+  event_unsignal(&txn->done);
+  spin_lock_irqsave(&b->lock, irqstate);
+  list_add_tail(&b->queue, &txn->node);
+  if (!b->active) start_txn(txn->busnum);
+  spin_unlock_irqrestore(&b->lock, irqstate);
+  return NO_ERROR;
+}
+
+status_t i2c_wait(i2c_txn *txn, lk_time_t timeout) {
+  if (txn->status == ERR_BUSY) {
+    status_t ret = event_wait_timeout(&txn->done, timeout);
+    if (ret != NO_ERROR) return ret;
   }
+  return txn->status;
+}
 
-  regs->stat = I2C_S_CLKT | I2C_S_ERR | I2C_S_DONE;
-  i2c_clear_fifo(busnum);
-  regs->ctrl = 0;
+void i2c_get_stats(unsigned busnum, i2c_stats *stats) {
+  i2c_bus *b = &buses[busnum];
+  spin_lock_saved_state_t irqstate;
+  spin_lock_irqsave(&b->lock, irqstate);
+  *stats = b->stats;
+  spin_unlock_irqrestore(&b->lock, irqstate);
+}
+
+int i2c_xfer(unsigned busnum, unsigned addr,
+	     char *sendbuf, size_t sendsz,
+	     char *recvbuf, size_t recvsz) {
+  i2c_msg msgs[2];
+  unsigned count = 0;
+  i2c_txn txn;
+
+  if (busnum >= I2C_NUM_BUSES)
+    return -1;
+
+  if (sendsz || !recvsz) {
+    msgs[count++] = (i2c_msg){ .addr = addr, .flags = 0, .len = sendsz, .buf = (uint8_t*)sendbuf };
+  }
+  if (recvsz) {
+    // too long to restart after, so a stop in between like it always had
+    uint16_t flags = I2C_MSG_READ | ((sendsz > I2C_FIFO_SIZE) ? I2C_MSG_STOP : 0);
+    msgs[count++] = (i2c_msg){ .addr = addr, .flags = flags, .len = recvsz, .buf = (uint8_t*)recvbuf };
+  }
+  i2c_txn_init(&txn, busnum, msgs, count);
+  int ret = i2c_submit(&txn);
+  if (ret < 0) return ret;
+  ret = i2c_wait(&txn, INFINITE_TIME);
+  if (ret < 0) dprintf(INFO, "I2C transfer to 0x%02x on bus %u failed: %d\n", addr, busnum, ret);
   return ret;
 }
 
-static int cmd_i2c_xfer(int argc, const cmd_args *argv) {
+static int cmd_i2c_stats(int argc, const console_cmd_args *argv) {
+  for (unsigned i=0; i < I2C_NUM_BUSES; i++) {
+    i2c_stats s;
+    i2c_get_stats(i, &s);
+    if (!s.txns) continue;
+    printf("bus %u: %u txns, %u bytes, %u errors, %u timeouts, %u irqs, %u uSec in irq, %u uSec on the bus\n",
+           i, s.txns, s.bytes, s.errors, s.timeouts, s.irqs, s.irq_us, s.bus_us);
+  }
+  return 0;
+}
+
+// queues count register reads at once, then compares the time they took with the clocks they needed,
+// and how much of that the cpu spent in the irq handler, the old polled driver spent all of it
+static int cmd_i2c_bench(int argc, const console_cmd_args *argv) {
+  if (argc < 4) {
+    printf("usage: i2c_bench <bus> <addr> <len> [count]\n");
+    return -1;
+  }
+  const unsigned busnum = argv[1].u;
+  const unsigned addr = argv[2].u;
+  const unsigned len = argv[3].u;
+  const unsigned count = (argc >= 5) ? argv[4].u : 16;
+  if ((busnum >= I2C_NUM_BUSES) || (len == 0) || (len > 0xffff) || (count == 0)) {
+    printf("bad args\n");
+    return -1;
+  }
+
+  i2c_txn *txns = calloc(count, sizeof(i2c_txn));
+  i2c_msg *msgs = calloc(count * 2, sizeof(i2c_msg));
+  uint8_t *data = malloc(len);
+  uint8_t reg = 0;
+  if (!txns || !msgs || !data) {
+    free(txns);
+    free(msgs);
+    free(data);
+    return ERR_NO_MEMORY;
+  }
+
+  i2c_stats before, after;
+  i2c_get_stats(busnum, &before);
+  const uint32_t start = *REG32(ST_CLO);
+  unsigned queued = 0;
+  for (; queued < count; queued++) {
+    msgs[queued * 2] = (i2c_msg){ .addr = addr, .flags = 0, .len = 1, .buf = &reg };
+    msgs[(queued * 2) + 1] = (i2c_msg){ .addr = addr, .flags = I2C_MSG_READ, .len = len, .buf = data };
+    i2c_txn_init(&txns[queued], busnum, &msgs[queued * 2], 2);
+    if (i2c_submit(&txns[queued]) < 0) break;
+  }
+  const uint32_t submitted = *REG32(ST_CLO);
+  unsigned failed = 0;
+  for (unsigned i=0; i < queued; i++) {
+    if (i2c_wait(&txns[i], INFINITE_TIME) < 0) failed++;
+  }
+  const uint32_t wall = *REG32(ST_CLO) - start;
+  i2c_get_stats(busnum, &after);
+
+  const uint32_t ideal = queued * (bus_time_us(busnum, 1 + 1) + bus_time_us(busnum, len + 1));
+  const uint32_t irq_us = after.irq_us - before.irq_us;
+  const uint32_t irqs = after.irqs - before.irqs;
+  printf("%u txns of %u bytes, %u failed, queued in %u uSec\n", queued, len + 3, failed, submitted - start);
+  printf("wall %u uSec, bus cycles need %u uSec, %u%% of the wire used\n", wall, ideal, wall ? (uint32_t)(((uint64_t)ideal * 100) / wall) : 0);
+  printf("%u irqs, %u per txn, %u uSec in irq, %u%% of the cpu\n", irqs, queued ? irqs / queued : 0, irq_us, wall ? (uint32_t)(((uint64_t)irq_us * 100) / wall) : 0);
+
+  free(txns);
+  free(msgs);
+  free(data);
+  return 0;
+}
+
+static int cmd_i2c_xfer(int argc, const console_cmd_args *argv) {
   if (argc != 5) {
     printf("usage: i2c_xfer <bus> <addr> <hex_str> <recv_len>\n");
     return -1;
@@ -177,3 +447,15 @@ static int cmd_i2c_xfer(int argc, const cmd_args *argv) {
   }
   return 0;
 }
+
+static void i2c_init(uint level) {
+  for (unsigned i=0; i < I2C_NUM_BUSES; i++) {
+    spin_lock_init(&buses[i].lock);
+    list_initialize(&buses[i].queue);
+    timer_initialize(&buses[i].timeout);
+  }
+  register_int_handler(INTERRUPT_VC_I2C, &i2c_irq, NULL);
+  unmask_interrupt(INTERRUPT_VC_I2C);
+}
+
+LK_INIT_HOOK(i2c, &i2c_init, LK_INIT_LEVEL_PLATFORM);
@@ -0,0 +1,89 @@
+#pragma once
+
+// a ring of ST_CLO stamped boot events, that follows the boot from the bootcode to the arm
+// ST_CLO counts from power on and the arm can read it too, so every stage stamps on the same clock
+// each image keeps its own ring, and pulls in the one from the stage before it:
+//   stage1 -> stage2, a mailbox at BOOT_TRACE_HANDOFF_ADDR, in the first 1mb of dram that autoram keeps out of the heap
+//     it is written after stage2 is loaded, so stage1 skips it if a stage2 segment covers it, and start.ld asserts stage2 doesnt
+//   stage2 -> arm, the "ring" property of the /boot-trace node in the inter-arch dtb
+// boot-trace.py turns a `boot_trace dump`, or the raw ring, into a timeline
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_TRACE_MAGIC 0x54427462 // "btBT"
+#define BOOT_TRACE_VERSION 1
+#define BOOT_TRACE_ENTRIES 128
+
+// under the sdram memtest scratch at 0xff000, start.ld has a copy of it
+#define BOOT_TRACE_HANDOFF_ADDR 0x000fe000
+// stage2 only takes the mailbox if stage1 wrote it this recently, so a stale one from an older boot is ignored
+#define BOOT_TRACE_HANDOFF_MAX_US 1000000
+
+// the top byte of an id is the stage, the decoder groups on it
+#define BOOT_TRACE_STAGE(id) ((id) >> 8)
+
+enum boot_trace_id {
+  // the first image, from L2 before and while dram comes up
+  BT_BOOTCODE_ARCH_INIT = 0x100,
+  BT_BOOTCODE_SDRAM_START,
+  BT_BOOTCODE_SDRAM_DONE,         // arg is the dram size in MB
+
+  // the stage1 app in the same image, looking for and loading stage2
+  BT_STAGE1_START = 0x200,
+  BT_STAGE1_SCRIPT_DONE,          // arg is how many targets init.lua added
+  BT_STAGE1_TRY_TARGET,           // arg is how many targets were tried before this one
+  BT_STAGE1_ELF_LOADED,
+  BT_STAGE1_CHAINLOAD,
+
+  // stage2 on the vpu, bringing up and starting the arm
+  BT_STAGE2_ARCH_INIT = 0x300,
+  BT_STAGE2_HANDOFF,              // arg is how many events came from stage1
+  BT_STAGE2_ARM_INIT,
+  BT_STAGE2_PAYLOAD_COPY_START,   // arg is the payload size in KB
+  BT_STAGE2_PAYLOAD_COPIED,       // arg is 1 if the crc matched
+  BT_STAGE2_ARM_START,            // same stamp as 4stage2_arm_start, the last event the arm gets
+  BT_STAGE2_ARM_RELEASED,         // only in the vpu ring, the arm already has its copy
+
+  // lk on the arm
+  BT_ARM_PLATFORM_INIT = 0x400,
+  BT_ARM_INTER_ARCH,              // arg is how many events came from the vpu
+  BT_ARM_LINUX_LOADED,            // arg is the initrd size in KB
+  BT_ARM_LINUX_SOON,              // same stamp as 6arm_linux_soon, the last event linux gets
+};
+
+typedef struct {
+  uint32_t stamp;                 // ST_CLO
+  uint16_t id;                    // enum boot_trace_id
+  uint16_t arg;
+} boot_trace_event;
+
+// this is also the dump format, little endian, as both sides are
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t capacity;
+  // every event recorded in this ring, the oldest count - capacity were overwritten
+  uint32_t count;
+  // events an older stage overwrote before handing its ring over
+  uint32_t dropped;
+  boot_trace_event events[BOOT_TRACE_ENTRIES];
+} boot_trace_ring;
+
+// from platform_early_init(), records the arch or platform init, and on stage2 takes the mailbox
+void boot_trace_early_init(void);
+
+void boot_trace(uint16_t id, uint16_t arg);
+// for events stamped earlier, like arch_init_timestamp
+void boot_trace_at(uint32_t stamp, uint16_t id, uint16_t arg);
+
+const boot_trace_ring *boot_trace_get(void);
+// puts the events from an older stage in front of the ones already recorded, returns how many it took
+int boot_trace_import(const void *buf, size_t len);
+
+#ifdef ARCH_VPU
+// records BT_STAGE1_CHAINLOAD and leaves the ring in the mailbox, right before jumping to stage2
+void boot_trace_handoff(void);
+// for every segment of the stage2 being loaded, addr is any alias, if one overlaps the mailbox boot_trace_handoff() leaves it alone
+void boot_trace_handoff_check(uint32_t addr, uint32_t len);
+#endif
@@ -7,6 +7,8 @@
 #define CM_VPUCTL_BUSY_SET                                 0x00000080
 #define CM_VPUCTL_GATE_SET                                 0x00000040
 #define CM_VPUDIV               (CM_BASE + 0x00c)
+#define CM_V3DCTL               (CM_BASE + 0x038)
+#define CM_V3DDIV               (CM_BASE + 0x03c)
 #define CM_PERIICTL             (CM_BASE + 0x020)
 #define CM_PERIIDIV             (CM_BASE + 0x024)
 #define CM_DPICTL               (CM_BASE + 0x068)
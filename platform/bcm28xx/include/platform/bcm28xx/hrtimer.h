@@ -0,0 +1,44 @@
+#pragma once
+
+// microsecond one-shot timers on a system timer compare channel that LK and the arm side dont use
+// C0 drives the LK timer on the vpu and C1 on the arm, linux on the arm1176 takes C3, so the vpu gets C2
+// callbacks run in irq context, deadlines are ST_CLO values and compared with wrap in mind
+
+#include <lk/list.h>
+#include <platform/interrupts.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef HRTIMER_CHANNEL
+  #ifdef ARCH_VPU
+    #define HRTIMER_CHANNEL 2
+  #else
+    #define HRTIMER_CHANNEL 3
+  #endif
+#endif
+
+// a compare closer than this may be passed before it is written, so nothing sooner is programmed
+#define HRTIMER_MIN_US 4
+
+struct hrtimer;
+typedef enum handler_return (*hrtimer_callback)(struct hrtimer *t, uint32_t now, void *arg);
+
+typedef struct hrtimer {
+  struct list_node node;
+  uint32_t deadline;
+  hrtimer_callback callback;
+  void *arg;
+} hrtimer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void hrtimer_init(hrtimer_t *t);
+// re-arming a pending timer moves it
+void hrtimer_set_oneshot(hrtimer_t *t, uint32_t delay_us, hrtimer_callback callback, void *arg);
+void hrtimer_set_deadline(hrtimer_t *t, uint32_t deadline, hrtimer_callback callback, void *arg);
+void hrtimer_cancel(hrtimer_t *t);
+bool hrtimer_pending(hrtimer_t *t);
+#ifdef __cplusplus
+}
+#endif
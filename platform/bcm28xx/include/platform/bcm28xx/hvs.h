@@ -1,16 +1,26 @@
 #pragma once
 
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <lib/gfx.h>
 #include <lk/console_cmd.h>
 #include <lk/list.h>
 #include <platform/bcm28xx.h>
+#include <platform/bcm28xx/hvs_dlist.h>
+#include <platform/bcm28xx/hvs_plan.h>
 #include <stdlib.h>
 
 #define SCALER_BASE (BCM_PERIPH_BASE_VIRT + 0x400000)
 
 #define SCALER_DISPCTRL     (SCALER_BASE + 0x00)
 #define SCALER_DISPSTAT     (SCALER_BASE + 0x04)
+// per channel status bits, write 1 to clear
+#define SCALER_DISPSTAT_EOF(x)      (1 << (8 + ((x) * 8)))
+#define SCALER_DISPSTAT_EUFLOW(x)   (1 << (9 + ((x) * 8)))
+#define SCALER_DISPSTAT_ESLINE(x)   (1 << (10 + ((x) * 8)))
+#define SCALER_DISPSTAT_ESFRAME(x)  (1 << (11 + ((x) * 8)))
+#define SCALER_DISPSTAT_EOLN(x)     (1 << (12 + ((x) * 8)))
+#define SCALER_DISPSTAT_COBLOW(x)   (1 << (13 + ((x) * 8)))
 #define SCALER_DISPCTRL_ENABLE  (1<<31)
 #define SCALER_DISPECTRL    (SCALER_BASE + 0x0c)
 #define SCALER_DISPECTRL_SECURE_MODE    (1<<31)
@@ -34,6 +44,53 @@ struct hvs_channel {
 
 extern volatile struct hvs_channel *hvs_channels;
 
+// how many flips can be waiting in a channels presentation queue
+// every queued list has to still be intact in the dlist ring when it is latched, so keep this small
+#ifndef HVS_PRESENT_DEPTH
+#define HVS_PRESENT_DEPTH 4
+#endif
+
+// what happened to a queued flip, all times are ST_CLO
+typedef struct {
+  uint32_t frame;       // the scanout count it went on screen at, see hvs_frame_count()
+  uint32_t submitted;   // when hvs_present() queued it
+  uint32_t latched;     // when the pv irq wrote it to SCALER_DISPLISTn, at the start of vfp
+  uint32_t scanout;     // when the first active line of it started
+  bool missed;          // it went on screen later than its target
+  bool skipped;         // a newer flip was due at the same vsync, so this one never went on screen
+} hvs_present_info;
+
+// runs in the pv irq, so it must not block
+typedef void (*hvs_present_callback)(int channel, const hvs_present_info *info, void *arg);
+
+typedef struct {
+  uint32_t dlist;
+  uint32_t dlist_words;
+  uint32_t target_frame;
+  uint32_t target_us;
+  uint32_t submitted;
+  uint32_t latched;
+  hvs_present_callback callback;
+  void *arg;
+} hvs_present_entry;
+
+typedef struct {
+  uint32_t presented;
+  uint32_t missed;
+  uint32_t skipped;
+  // submit to scanout
+  uint32_t latency_min, latency_max;
+  uint64_t latency_sum;
+  // how far the gap between 2 targeted flips was from the gap that was asked for
+  uint32_t jitter_max;
+  uint64_t jitter_sum;
+  uint32_t jitter_samples;
+  // vfp to the first active line, which is how far ahead of scanout the flip is latched
+  uint32_t blank_us;
+  // the blanking broken down, only filled in when built with TIMESTAMP_TIMINGS
+  uint32_t vfp_us, vsync_us, vbp_us;
+} hvs_present_stats;
+
 struct hvs_channel_config {
   uint32_t width;
   uint32_t height;
@@ -42,65 +99,83 @@ struct hvs_channel_config {
   mutex_t lock;
   struct list_node layers;
   uint32_t dlist_target;
+  uint32_t dlist_target_words;
   wait_queue_t vsync;
+
+  // time between the last 2 vsyncs, measured by the pv irq, 0 until it has seen 2
+  uint32_t frame_us;
+  uint32_t last_vsync;
+
+  // the scanline cost estimate from the last hvs_update_dlist(), see hvs_plan.h
+  hvs_plan plan;
+  enum hvs_plan_policy plan_policy;
+  // set by the hvs_plan command, otherwise the budget follows frame_us
+  bool plan_budget_fixed;
+  // scratch for hvs_update_dlist(), one entry per layer, grown as needed
+  hvs_plan_layer *plan_layers;
+  bool *plan_drop;
+  uint32_t plan_capacity;
+
+  // the presentation queue, see hvs_present()
+  spin_lock_t present_lock;
+  hvs_present_entry present_queue[HVS_PRESENT_DEPTH];
+  uint32_t present_head;
+  uint32_t present_count;
+  // latched at the last vfp, waiting for the first active line
+  hvs_present_entry present_latched;
+  bool present_pending;
+  // the last flip that went on screen, to measure the gap to the next
+  hvs_present_entry present_last;
+  uint32_t present_last_scanout;
+  bool present_last_valid;
+  hvs_present_stats present_stats;
+  // counts the frames sent, bumped at the start of every active period
+  uint32_t frames;
+  uint32_t last_vfp;
+  wait_queue_t scanout;
 };
 
 extern struct hvs_channel_config channels[3];
 
-enum hvs_pixel_format {
-	/* 8bpp */
-	HVS_PIXEL_FORMAT_RGB332 = 0,
-	/* 16bpp */
-	HVS_PIXEL_FORMAT_RGBA4444 = 1,
-	HVS_PIXEL_FORMAT_RGB555 = 2,
-	HVS_PIXEL_FORMAT_RGBA5551 = 3,
-	HVS_PIXEL_FORMAT_RGB565 = 4,
-	/* 24bpp */
-	HVS_PIXEL_FORMAT_RGB888 = 5,
-	HVS_PIXEL_FORMAT_RGBA6666 = 6,
-	/* 32bpp */
-	HVS_PIXEL_FORMAT_RGBA8888 = 7,
-
-	HVS_PIXEL_FORMAT_YCBCR_YUV420_3PLANE = 8,
-	HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE = 9,
-	HVS_PIXEL_FORMAT_YCBCR_YUV422_3PLANE = 10,
-	HVS_PIXEL_FORMAT_YCBCR_YUV422_2PLANE = 11,
-	HVS_PIXEL_FORMAT_H264 = 12,
-	HVS_PIXEL_FORMAT_PALETTE = 13,
-	HVS_PIXEL_FORMAT_YUV444_RGB = 14,
-	HVS_PIXEL_FORMAT_AYUV444_RGB = 15,
-	HVS_PIXEL_FORMAT_RGBA1010102 = 16,
-	HVS_PIXEL_FORMAT_YCBCR_10BIT = 17,
-};
-
-enum palette_type {
-  palette_none = 0,
-  palette_1bpp = 1,
-  palette_2bpp = 2,
-  palette_4bpp = 3,
-  palette_8bpp = 4,
-};
-
-enum alpha_mode {
-  alpha_mode_pipeline = 0,      // per-pixel alpha allowed, POS0_ALPHA ignored
-  alpha_mode_fixed = 1,         // use POS0_ALPHA() for entire sprite
-  alpha_mode_fixed_nonzero = 2, // POS0_ALPHA() and per-pixel both have an effect
-  alpha_mode_fixed_over_7 = 3,
-};
 
 typedef struct {
   uint32_t table[256];
   enum palette_type type;
 } palette_table;
 
+
 typedef struct {
+  enum hvs_yuv_format format;
+  enum hvs_colorspace colorspace;
+  unsigned int width;
+  unsigned int height;
   uint8_t *luma;
+  // the cbcr plane, or the cb plane of a 3 plane image
   uint8_t *chroma;
+  // the cr plane of a 3 plane image
+  uint8_t *chroma2;
   unsigned int luma_stride;
+  // shared by both chroma planes of a 3 plane image
   unsigned int chroma_stride;
-  unsigned int chroma_hscale;
-  unsigned int chroma_vscale;
-} yuv_image_2plane;
+} hvs_yuv_image;
+
+// everything a compiled entry depends on, other than the position
+// if any of this changes, hvs_update_dlist() rebuilds the entry, otherwise it only patches POS0
+typedef struct {
+  const void *image;
+  const void *image2;
+  const void *image3;
+  uint32_t format;
+  uint32_t pitch;
+  uint32_t pitch2;
+  unsigned int w, h;
+  unsigned int src_w, src_h;
+  unsigned int viewport_x, viewport_y;
+  enum hvs_colorspace colorspace;
+  enum alpha_mode alpha_mode;
+  enum palette_type palette_mode;
+  const palette_table *colors;
+} hvs_layer_key;
 
 typedef struct {
   struct list_node node;
@@ -130,8 +205,27 @@ typedef struct {
   uint strides[2];
   const palette_table *colors;
 
+  // a yuv image to show instead of fb, see mk_yuv_layer()
+  hvs_yuv_image *yuv;
+
   uint32_t *premade_dlist;
   uint32_t dlist_length;
+  // where hvs_update_dlist() last copied premade_dlist to in dlist_memory, -1 if nowhere
+  int dlist_slot;
+  // premade_dlist was compiled by hvs_update_dlist() from the fields above, rather than filled in by the caller
+  bool dlist_compiled;
+  hvs_layer_key dlist_key;
+  // the line buffer memory region a scaled layer needs, lbm_size is 0 if it has none
+  // lbm_word is where the entry holds the offset, so it can be patched when the region moves
+  uint32_t lbm_offset;
+  uint32_t lbm_size;
+  uint8_t lbm_word;
+  // 1 + the palette slot the compiled entry points at, 0 if it has none
+  uint8_t palette_slot;
+  // the last compile failed because the LBM or the palette slots were full, it will be retried on every hvs_update_dlist()
+  bool lbm_starved;
+  // left out of the last dlist by HVS_PLAN_DROP, to keep the scanlines within budget
+  bool plan_dropped;
   enum alpha_mode alpha_mode;
   uint8_t alpha;
 } hvs_layer;
@@ -165,54 +259,12 @@ typedef struct {
 #define SCALER5_LIST_MEMORY  (SCALER_BASE + 0x4000)
 
 
-#define CONTROL_FORMAT(n)       (n & 0xf)
-#define CONTROL_END             (1<<31)
-#define CONTROL_VALID           (1<<30)
-#define CONTROL_WORDS(n)        (((n) & 0x3f) << 24)
-#define CONTROL0_FIXED_ALPHA    (1<<19)
-#define CONTROL0_HFLIP          (1<<16)
-#define CONTROL0_VFLIP          (1<<15)
-#define CONTROL_PIXEL_ORDER(n)  ((n & 3) << 13)
-#define CONTROL_SCL1(scl)       (scl << 8)
-#define CONTROL_SCL0(scl)       (scl << 5)
-#define CONTROL_UNITY           (1<<4)
-
-#define HVS_PIXEL_ORDER_RGBA			0
-#define HVS_PIXEL_ORDER_BGRA			1
-#define HVS_PIXEL_ORDER_ARGB			2
-#define HVS_PIXEL_ORDER_ABGR			3
-
-#define HVS_PIXEL_ORDER_XBRG			0
-#define HVS_PIXEL_ORDER_XRBG			1
-#define HVS_PIXEL_ORDER_XRGB			2
-#define HVS_PIXEL_ORDER_XBGR			3
-
-#define HVS_PIXEL_ORDER_XYCBCR			0
-#define HVS_PIXEL_ORDER_XYCRCB			1
-#define HVS_PIXEL_ORDER_YXCBCR			2
-#define HVS_PIXEL_ORDER_YXCRCB			3
-
-#define SCALER_CTL0_SCL_H_PPF_V_PPF		0
-#define SCALER_CTL0_SCL_H_TPZ_V_PPF		1
-#define SCALER_CTL0_SCL_H_PPF_V_TPZ		2
-#define SCALER_CTL0_SCL_H_TPZ_V_TPZ		3
-#define SCALER_CTL0_SCL_H_PPF_V_NONE		4
-#define SCALER_CTL0_SCL_H_NONE_V_PPF		5
-#define SCALER_CTL0_SCL_H_NONE_V_TPZ		6
-#define SCALER_CTL0_SCL_H_TPZ_V_NONE		7
-
-#define POS0_X(n) (n & 0xfff)
-#define POS0_Y(n) ((n & 0xfff) << 12)
-#define POS0_ALPHA(n) ((n & 0xff) << 24)
-
-#define POS2_W(n) (n & 0xffff)
-#define POS2_H(n) ((n & 0xffff) << 16)
-
-#define SCALER_PPF_AGC (1<<30)
 
 extern int display_slot;
 extern volatile uint32_t* dlist_memory;
 extern const int scaling_kernel;
+// how many times hvs_update_dlist() has had to (re)build a layer's entry
+extern uint32_t hvs_layer_compiles;
 
 //void hvs_add_plane(gfx_surface *fb, int x, int y, bool hflip);
 //void hvs_add_plane_scaled(gfx_surface *fb, int x, int y, unsigned int width, unsigned int height, bool hflip);
@@ -229,13 +281,33 @@ void hvs_update_dlist(int channel);
 // adds an hvs_layer to the layer list
 // do not change the ->layer while an hvs_layer is added
 // x/y/w/h can be changed, and will take effect next time hvs_update_dlist is ran
+// layers without a premade_dlist get one compiled on the first hvs_update_dlist(), and cached
+// after that, moving the layer only costs a POS0 patch, changing the size/format/buffer/viewport recompiles it
 void hvs_dlist_add(int channel, hvs_layer *new_layer);
+// removes a layer again, and gives back its line buffer memory
+// a caller-premade scaled layer must be regenerated before it is added again
+// must be called with channel lock held
+void hvs_dlist_remove(int channel, hvs_layer *layer);
+// forces a compiled layer to be rebuilt on the next hvs_update_dlist()
+void hvs_layer_invalidate(hvs_layer *l);
 // blocks the current thread until after a vsync has occured
 // thread resumes too late for any page-flip actions
 // but then you have an entire frametime to schedule a pageflip
 // flip will happen at the NEXT vsync
 // returns the value of the SCALER_DISPSTATn register, which holds the current frame and scanline#
 uint32_t hvs_wait_vsync(int channel);
+// queues a pageflip, based on the current state of the layers list, to be latched by the pv irq
+// target_frame: go on screen as frame target_frame of hvs_frame_count(), 0 for no frame target
+// target_us: otherwise, go on screen at the vsync nearest this ST_CLO time, 0 for the next vsync
+// if several are due at one vsync, the newest is shown and the rest are reported as skipped
+// callback (can be NULL) is ran from the irq once it is on screen or skipped
+// returns ERR_BUSY if HVS_PRESENT_DEPTH flips are already waiting, or the dlist ring has no room left past them
+// must be called with channel lock held, and not mixed with hvs_update_dlist() on one channel
+status_t hvs_present(int channel, uint32_t target_frame, uint32_t target_us, hvs_present_callback callback, void *arg);
+// the number of frames the channel has started sending, the next flip can go on screen as hvs_frame_count() + 1
+uint32_t hvs_frame_count(int channel);
+// blocks until frame has started sending, returns right away if it already has
+void hvs_present_wait(int channel, uint32_t frame);
 int cmd_hvs_dump_dlist(int argc, const console_cmd_args *argv);
 // returns the recommended xywh of the framebuffer
 void hvs_get_framebuffer_pos(int channel, framebuffer_pos *pos);
@@ -246,15 +318,10 @@ void hvs_get_framebuffer_pos(int channel, framebuffer_pos *pos);
 void hvs_regen_noscale_noviewport(hvs_layer *l);
 void hvs_regen_noscale_viewport_noalpha(hvs_layer *l);
 void hvs_regen_scale_noviewport(hvs_layer *l);
+// points a premade, non-viewport layer at a new image of the same size and format
+// safe to call from irq context, the hvs only loads PTR0 at the start of a frame, so the flip lands on the next frame without tearing
+void hvs_layer_set_fb(hvs_layer *l, gfx_surface *fb);
 
-inline uint32_t gen_ppf_fixedpoint(uint32_t source, uint32_t dest) {
-  uint32_t scale = source / dest;
-  return SCALER_PPF_AGC | (scale << 8) | (0 << 0);
-}
-
-inline uint32_t gen_ppf(unsigned int source, unsigned int dest) {
-  return gen_ppf_fixedpoint(source << 16, dest);
-}
 
 // 0xRRGGBB
 inline __attribute__((always_inline)) void hvs_set_background_color(int channel, uint32_t color) {
@@ -294,8 +361,53 @@ static inline void mk_unity_layer(hvs_layer *l, gfx_surface *fb, int layer, unsi
 
   l->palette_mode = palette_none;
 
+  l->yuv = NULL;
+  // only argb has a usable per-pixel alpha
+  l->alpha_mode = (fb->format == GFX_FORMAT_ARGB_8888) ? alpha_mode_pipeline : alpha_mode_fixed;
+  l->alpha = 0xff;
+
   l->premade_dlist = NULL;
   l->dlist_length = 0;
+  l->dlist_slot = -1;
+  l->dlist_compiled = false;
+  l->lbm_size = 0;
+  l->palette_slot = 0;
+  l->lbm_starved = false;
+  l->plan_dropped = false;
+}
+
+// the viewport crops the image, and w/h can scale it to any size, the chroma planes are scaled to match
+static inline void mk_yuv_layer(hvs_layer *l, hvs_yuv_image *img, int layer, unsigned int x, unsigned int y) {
+  l->fb = NULL;
+  l->layer = layer;
+  l->x = x;
+  l->y = y;
+  l->w = img->width;
+  l->h = img->height;
+  l->orig_w = img->width;
+  l->orig_h = img->height;
+
+  l->viewport_w = img->width;
+  l->viewport_h = img->height;
+  l->viewport_x = 0;
+  l->viewport_y = 0;
+
+  l->visible = true;
+
+  l->palette_mode = palette_none;
+
+  l->yuv = img;
+  l->alpha_mode = alpha_mode_fixed;
+  l->alpha = 0xff;
+
+  l->premade_dlist = NULL;
+  l->dlist_length = 0;
+  l->dlist_slot = -1;
+  l->dlist_compiled = false;
+  l->lbm_size = 0;
+  l->palette_slot = 0;
+  l->lbm_starved = false;
+  l->plan_dropped = false;
 }
 
 static inline void hvs_allocate_premade(hvs_layer *l, int words) {
@@ -303,21 +415,6 @@ static inline void hvs_allocate_premade(hvs_layer *l, int words) {
   l->premade_dlist = malloc(words * 4);
 }
 
-static inline uint palette_get_bpp(enum palette_type type) {
-  switch (type) {
-  case palette_none:
-    return 0;
-  case palette_1bpp:
-    return 1;
-  case palette_2bpp:
-    return 2;
-  case palette_4bpp:
-    return 4;
-  case palette_8bpp:
-    return 8;
-  }
-  return 0;
-}
 
 static inline void mk_palette_layer(hvs_layer *l, int layer, unsigned int x, unsigned int y, uint width, uint height, enum palette_type type, const palette_table *colors) {
   l->fb = NULL;
@@ -334,6 +431,19 @@ static inline void mk_palette_layer(hvs_layer *l, int layer, unsigned int x, uns
 
   l->visible = true;
 
+  l->yuv = NULL;
+  l->alpha_mode = alpha_mode_fixed;
+  l->alpha = 0xff;
+
+  l->premade_dlist = NULL;
+  l->dlist_length = 0;
+  l->dlist_slot = -1;
+  l->dlist_compiled = false;
+  l->lbm_size = 0;
+  l->palette_slot = 0;
+  l->lbm_starved = false;
+  l->plan_dropped = false;
+
   l->palette_mode = type;
   l->strides[0] = ((width * palette_get_bpp(type)) + 7) / 8;
   l->rawImage = malloc(l->strides[0] * height);
@@ -0,0 +1,132 @@
+#pragma once
+
+// the display list entry format, split out of hvs.h so host tools (hvs-ref) can use it with only libc
+
+#include <stdint.h>
+
+enum hvs_pixel_format {
+	/* 8bpp */
+	HVS_PIXEL_FORMAT_RGB332 = 0,
+	/* 16bpp */
+	HVS_PIXEL_FORMAT_RGBA4444 = 1,
+	HVS_PIXEL_FORMAT_RGB555 = 2,
+	HVS_PIXEL_FORMAT_RGBA5551 = 3,
+	HVS_PIXEL_FORMAT_RGB565 = 4,
+	/* 24bpp */
+	HVS_PIXEL_FORMAT_RGB888 = 5,
+	HVS_PIXEL_FORMAT_RGBA6666 = 6,
+	/* 32bpp */
+	HVS_PIXEL_FORMAT_RGBA8888 = 7,
+
+	HVS_PIXEL_FORMAT_YCBCR_YUV420_3PLANE = 8,
+	HVS_PIXEL_FORMAT_YCBCR_YUV420_2PLANE = 9,
+	HVS_PIXEL_FORMAT_YCBCR_YUV422_3PLANE = 10,
+	HVS_PIXEL_FORMAT_YCBCR_YUV422_2PLANE = 11,
+	HVS_PIXEL_FORMAT_H264 = 12,
+	HVS_PIXEL_FORMAT_PALETTE = 13,
+	HVS_PIXEL_FORMAT_YUV444_RGB = 14,
+	HVS_PIXEL_FORMAT_AYUV444_RGB = 15,
+	HVS_PIXEL_FORMAT_RGBA1010102 = 16,
+	HVS_PIXEL_FORMAT_YCBCR_10BIT = 17,
+};
+
+enum palette_type {
+  palette_none = 0,
+  palette_1bpp = 1,
+  palette_2bpp = 2,
+  palette_4bpp = 3,
+  palette_8bpp = 4,
+};
+
+enum alpha_mode {
+  alpha_mode_pipeline = 0,      // per-pixel alpha allowed, POS0_ALPHA ignored
+  alpha_mode_fixed = 1,         // use POS0_ALPHA() for entire sprite
+  alpha_mode_fixed_nonzero = 2, // POS0_ALPHA() and per-pixel both have an effect
+  alpha_mode_fixed_over_7 = 3,
+};
+
+// the yuv layouts a layer can show, see hvs_yuv.h for allocating them
+enum hvs_yuv_format {
+  HVS_YUV420_2PLANE,  // y, then interleaved cbcr at half width and half height
+  HVS_YUV420_3PLANE,  // y, cb, cr, the chroma planes at half width and half height
+  HVS_YUV422_2PLANE,  // y, then interleaved cbcr at half width and full height
+  HVS_YUV422_3PLANE,  // y, cb, cr, the chroma planes at half width and full height
+};
+
+// the matrix used to turn it back into rgb
+enum hvs_colorspace {
+  HVS_BT601,          // limited range, sd video
+  HVS_BT709,          // limited range, hd video
+  HVS_BT601_FULL,     // full range, jpeg
+  HVS_BT709_FULL,     // full range
+};
+
+#define CONTROL_FORMAT(n)       (n & 0xf)
+#define CONTROL_END             (1<<31)
+#define CONTROL_VALID           (1<<30)
+#define CONTROL_WORDS(n)        (((n) & 0x3f) << 24)
+#define CONTROL0_FIXED_ALPHA    (1<<19)
+#define CONTROL0_HFLIP          (1<<16)
+#define CONTROL0_VFLIP          (1<<15)
+#define CONTROL_PIXEL_ORDER(n)  ((n & 3) << 13)
+#define CONTROL_SCL1(scl)       (scl << 8)
+#define CONTROL_SCL0(scl)       (scl << 5)
+#define CONTROL_UNITY           (1<<4)
+
+#define HVS_PIXEL_ORDER_RGBA			0
+#define HVS_PIXEL_ORDER_BGRA			1
+#define HVS_PIXEL_ORDER_ARGB			2
+#define HVS_PIXEL_ORDER_ABGR			3
+
+#define HVS_PIXEL_ORDER_XBRG			0
+#define HVS_PIXEL_ORDER_XRBG			1
+#define HVS_PIXEL_ORDER_XRGB			2
+#define HVS_PIXEL_ORDER_XBGR			3
+
+#define HVS_PIXEL_ORDER_XYCBCR			0
+#define HVS_PIXEL_ORDER_XYCRCB			1
+#define HVS_PIXEL_ORDER_YXCBCR			2
+#define HVS_PIXEL_ORDER_YXCRCB			3
+
+#define SCALER_CTL0_SCL_H_PPF_V_PPF		0
+#define SCALER_CTL0_SCL_H_TPZ_V_PPF		1
+#define SCALER_CTL0_SCL_H_PPF_V_TPZ		2
+#define SCALER_CTL0_SCL_H_TPZ_V_TPZ		3
+#define SCALER_CTL0_SCL_H_PPF_V_NONE		4
+#define SCALER_CTL0_SCL_H_NONE_V_PPF		5
+#define SCALER_CTL0_SCL_H_NONE_V_TPZ		6
+#define SCALER_CTL0_SCL_H_TPZ_V_NONE		7
+
+#define POS0_X(n) (n & 0xfff)
+#define POS0_Y(n) ((n & 0xfff) << 12)
+#define POS0_ALPHA(n) ((n & 0xff) << 24)
+
+#define POS2_W(n) (n & 0xffff)
+#define POS2_H(n) ((n & 0xffff) << 16)
+
+#define SCALER_PPF_AGC (1<<30)
+
+static inline uint32_t gen_ppf_fixedpoint(uint32_t source, uint32_t dest) {
+  uint32_t scale = source / dest;
+  return SCALER_PPF_AGC | (scale << 8) | (0 << 0);
+}
+
+static inline uint32_t gen_ppf(unsigned int source, unsigned int dest) {
+  return gen_ppf_fixedpoint(source << 16, dest);
+}
+
+static inline unsigned int palette_get_bpp(enum palette_type type) {
+  switch (type) {
+  case palette_none:
+    return 0;
+  case palette_1bpp:
+    return 1;
+  case palette_2bpp:
+    return 2;
+  case palette_4bpp:
+    return 4;
+  case palette_8bpp:
+    return 8;
+  }
+  return 0;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <kernel/event.h>
+#include <lk/list.h>
 #include <platform/bcm28xx.h>
+#include <stdint.h>
 
 #define I2C0_BASE               (BCM_PERIPH_BASE_VIRT + 0x205000)
 #define I2C1_BASE               (BCM_PERIPH_BASE_VIRT + 0x804000)
@@ -11,23 +14,92 @@
 #define I2C6_BASE               (BCM_PERIPH_BASE_VIRT + 0x205c00)
 #define I2C7_BASE               (BCM_PERIPH_BASE_VIRT + 0x205e00)
 
+#define I2C_NUM_BUSES           8
+#define I2C_FIFO_SIZE           16
+
 #define I2C_C_READ              0x00000001
 #define I2C_C_CLEAR0            0x00000010
 #define I2C_C_CLEAR1            0x00000020
 #define I2C_C_ST                0x00000080
+#define I2C_C_INTD              0x00000100
+#define I2C_C_INTT              0x00000200
+#define I2C_C_INTR              0x00000400
 #define I2C_C_I2CEN             0x00008000
 
 #define I2C_S_TA                0x00000001
 #define I2C_S_DONE              0x00000002
+// the fifo wants more bytes, or has bytes to read, while a transfer is running
+#define I2C_S_TXW               0x00000004
+#define I2C_S_RXR               0x00000008
 #define I2C_S_TXD               0x00000010
 #define I2C_S_RXD               0x00000020
+#define I2C_S_TXE               0x00000040
+#define I2C_S_RXF               0x00000080
 #define I2C_S_ERR               0x00000100
 #define I2C_S_CLKT              0x00000200
 
+// i2c_msg.flags
+#define I2C_MSG_READ            0x0001
+// end the previous message with a stop, instead of a repeated start
+// without it, the previous message must be a write that fits in the fifo, the bsc can only restart after one of those
+#define I2C_MSG_STOP            0x0002
+
+typedef struct {
+  uint16_t addr;
+  uint16_t flags;
+  uint16_t len;
+  uint8_t *buf;
+} i2c_msg;
+
+struct i2c_txn;
+// called from the irq handler, before done is signaled
+typedef void (*i2c_done_callback)(struct i2c_txn *txn, void *arg);
+
+// one or more messages, sent back to back with repeated starts, and a stop at the end
+// the txn and its messages belong to the driver from i2c_submit() until done is signaled
+typedef struct i2c_txn {
+  struct list_node node;
+  unsigned busnum;
+  i2c_msg *msgs;
+  unsigned count;
+  i2c_done_callback callback;
+  void *arg;
+  event_t done;
+  // ERR_BUSY while queued or running, then NO_ERROR, ERR_I2C_NACK, ERR_TIMED_OUT or ERR_IO
+  volatile int status;
+  // driver state, and ST_CLO stamps
+  unsigned msg;
+  uint16_t pos;
+  uint32_t queued_at;
+  uint32_t started_at;
+  uint32_t finished_at;
+  uint32_t irqs;
+} i2c_txn;
+
+typedef struct {
+  uint32_t txns;
+  uint32_t bytes;
+  uint32_t errors;
+  uint32_t timeouts;
+  uint32_t irqs;
+  // cpu time spent in the irq handler, and time from start condition to stop, uSec
+  uint32_t irq_us;
+  uint32_t bus_us;
+} i2c_stats;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 void i2c_set_rate(unsigned busnum, unsigned long rate);
+// the bsc dividers count the core clock, so whatever changes that calls this to put every bus back at its rate
+void i2c_core_clock_changed(void);
+void i2c_txn_init(i2c_txn *txn, unsigned busnum, i2c_msg *msgs, unsigned count);
+// queues txn behind any others on the same bus, each bus runs on its own
+status_t i2c_submit(i2c_txn *txn);
+// the status of txn, or ERR_TIMED_OUT if it isnt done yet, in which case it still belongs to the driver
+status_t i2c_wait(i2c_txn *txn, lk_time_t timeout);
+void i2c_get_stats(unsigned busnum, i2c_stats *stats);
+// a write then a read, with a repeated start when the write fits in the fifo
 int i2c_xfer(unsigned busnum, unsigned addr,
 	     char *sendbuf, size_t sendsz,
 	     char *recvbuf, size_t recvsz);
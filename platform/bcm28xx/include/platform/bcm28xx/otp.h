@@ -1,10 +1,29 @@
 #pragma once
 
+#include <stdint.h>
+
+#define OTP_ROWS 128
+
+// served from a copy of all the rows, read in one go at LK_INIT_LEVEL_PLATFORM_EARLY, or by the first call
 uint32_t otp_read(uint8_t addr);
+// rereads every row into the shadow
+void otp_shadow_load(void);
 void otp_pretty_print(void);
 
+typedef struct {
+  // the bulk read, and one read the old way, open/read/close
+  uint32_t load_us;
+  uint32_t single_read_us;
+  uint32_t shadow_reads;
+  // rows that had to go to the hardware, because their shadow read failed
+  uint32_t direct_reads;
+} otp_shadow_stats;
+
+void otp_get_shadow_stats(otp_shadow_stats *out);
+
 #define OTP_ERR_PROGRAM -1
 #define OTP_ERR_ENABLE  -2
 #define OTP_ERR_DISABLE -3
 
+// also refreshes that row in the shadow
 int otp_write(uint8_t addr, uint32_t val);
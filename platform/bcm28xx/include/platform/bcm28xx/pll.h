@@ -86,10 +86,20 @@ extern uint32_t freq_pllc_per;
 extern uint32_t vpu_clock;
 extern const struct pll_chan_def pll_chan_def[PLL_CHAN_NUM];
 
+// the 12.20 A2W_PLLx_CTRL/FRAC divider for freq, without the prescaler
+uint32_t pll_compute_divisor(uint32_t freq);
 void setup_plla(uint32_t freq, int core_div, int per_div);
 void setup_pllc(uint32_t freq, int core0_div, int per_div);
 void setup_pllh(uint32_t freq, int aux_div, int pix_div);
 void switch_vpu_to_src(int src);
+// the clocks under PLLC_CORE0 that can be slowed at runtime, the hvs runs on the vpu clock
+enum core_clock {
+  CORE_CLOCK_VPU,
+  CORE_CLOCK_V3D,
+};
+// the integer divider from PLLC_CORE0, false if that clock isnt running from it
+bool clock_set_core_div(enum core_clock clk, uint32_t div);
+uint32_t clock_get_core_div(enum core_clock clk);
 bool clock_set_pwm(int freq, enum peripheral_clock_tap source);
 bool clock_set_vec(int freq, enum peripheral_clock_tap source);
 bool clock_set_hsm(int freq, enum peripheral_clock_tap source);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void sdram_init(void);
 
 enum RamSize {
@@ -11,3 +14,34 @@ enum RamSize {
   kRamSize4GB = 5,
   kRamSizeUnknown
 };
+
+extern enum RamSize g_RAMSize;
+
+// bytes of dram the vpu can reach, 0 before sdram_init(), capped at the 1GB the uncached alias covers
+uint32_t sdram_size(void);
+
+// dma scratch for sdram_memtest(), a control block and a pattern, kept out of every range it tests
+// it sits at the top of the first 1MB, above the 128kb of dram that the bootcode in L2 shadows
+#define SDRAM_MEMTEST_SCRATCH 0x000ff000
+#define SDRAM_MEMTEST_SCRATCH_SIZE 0x1000
+
+typedef struct {
+  uint32_t errors;
+  // of the first mismatch, 0xffffffff and 0 if there wasnt one
+  uint32_t first_bad_addr;
+  uint32_t first_bad_value;
+  // dma fill and cpu verify, over every pass, in MB/s
+  uint32_t write_mbps;
+  uint32_t read_mbps;
+} sdram_memtest_result;
+
+// fills [start, start + len) with each pattern by dma and reads it back over the uncached alias
+// address_pass adds a cpu-written pass where every word holds its own address, to catch aliasing rows and columns
+// destroys the range, which must not hold the heap, the scratch page, or the bootcode shadow
+// start and len are physical, 16 byte aligned, true if every word matched
+bool sdram_memtest(uint32_t start, uint32_t len, const uint32_t *patterns, unsigned int count, bool address_pass, sdram_memtest_result *out);
+
+// marks a physical range as in use, like a heap arena, the sdram_memtest command refuses any range overlapping one
+void sdram_protect(uint32_t start, uint32_t len);
+// true if [start, start + len) overlaps a range given to sdram_protect()
+bool sdram_protected(uint32_t start, uint32_t len);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// the internal TSENS reading, in thousandths of a degree C
+int32_t temp_get_millicelsius(void);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// uart_putc() queues into a ring that the tx fifo interrupt drains, even with interrupts off, only a full ring is polled
+// until uart_init() has hooked the irq it writes the fifo directly, and uart_pputc() (panic) always drains the ring and polls
+// UART_TX_BUFFERED=0 builds the old always-spinning path, to compare boot times against
+#ifndef UART_TX_BUFFERED
+#define UART_TX_BUFFERED 1
+#endif
+
+typedef struct {
+  // chars that went through the ring, and chars written to the fifo by the caller
+  uint32_t queued;
+  uint32_t direct;
+  // times a putc found the ring full, and the chars lost to that in drop mode
+  uint32_t overflows;
+  uint32_t dropped;
+  // how long callers spent spinning on a full fifo or ring, uSec
+  uint32_t stalled_us;
+  uint32_t high_water;
+} uart_tx_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void uart_tx_get_stats(int port, uart_tx_stats *stats);
+// false (the default) waits for room when the ring is full, true drops the char and counts it
+void uart_tx_set_drop(int port, bool drop);
+#ifdef __cplusplus
+}
+#endif
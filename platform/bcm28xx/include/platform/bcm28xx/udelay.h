@@ -2,10 +2,16 @@
 
 #include <stdint.h>
 
+// below this, usleep() spins, a block and wake costs about as much as the wait
+#define USLEEP_SPIN_MAX_US 100
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+// always spins, safe from irqs and with interrupts off
 void udelay(uint32_t usec);
+// blocks the calling thread on an hrtimer, and falls back to udelay() when it is short or blocking isnt allowed
+void usleep(uint32_t usec);
 #ifdef __cplusplus
 }
 #endif
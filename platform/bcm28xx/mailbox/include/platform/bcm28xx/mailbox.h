@@ -8,6 +8,8 @@ __BEGIN_CDECLS
 
 void mailbox_init(void);
 uint32_t mailbox_fifo_pop(void);
+// blocks until at least 1 word is available, then returns up to max words
+size_t mailbox_fifo_pop_all(uint32_t *words, size_t max);
 void mailbox_send(uint32_t word);
 
 typedef struct mailbox_fifo {
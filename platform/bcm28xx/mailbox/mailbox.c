@@ -57,32 +57,41 @@ static int cmd_mailbox_dump(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
+struct mailbox_fifo fifo;
+
+static void mailbox_fifo_push_locked(uint32_t word) {
+  if (mailbox_fifo_space_avail() > 0) {
+    fifo.buf[fifo.head] = word;
+    fifo.head = modpow2(fifo.head + 1, fifo.len_pow2);
+  } else {
+    puts("fifo overflow");
+  }
+}
+
 static enum handler_return mailbox_irq(void *arg) {
+  // drain the whole hw fifo under one lock, and wake the reader once
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&fifo.lock, state);
   uint32_t status = *REG32(MAILBOX_STATUS(1));
   do {
     uint pending = status & 0xff;
     for (uint i=0; i<pending; i++) {
       uint32_t msg = *REG32(MAILBOX_DATA(1));
-      mailbox_fifo_push(msg);
+      mailbox_fifo_push_locked(msg);
     }
     status = *REG32(MAILBOX_STATUS(1));
   } while ((status&ARM_MS_EMPTY) == 0);
+  if (fifo.tail != fifo.head) event_signal(&fifo.event, false);
+  spin_unlock_irqrestore(&fifo.lock, state);
 
   return INT_RESCHEDULE;
 }
 
-struct mailbox_fifo fifo;
-
 void mailbox_fifo_push(uint32_t word) {
   spin_lock_saved_state_t state;
   spin_lock_irqsave(&fifo.lock, state);
-  if (mailbox_fifo_space_avail() > 0) {
-    fifo.buf[fifo.head] = word;
-    fifo.head = modpow2(fifo.head + 1, fifo.len_pow2);
-    event_signal(&fifo.event, false);
-  } else {
-    puts("fifo overflow");
-  }
+  mailbox_fifo_push_locked(word);
+  if (fifo.tail != fifo.head) event_signal(&fifo.event, false);
   spin_unlock_irqrestore(&fifo.lock, state);
 }
 
@@ -109,6 +118,27 @@ retry:
   return result;
 }
 
+size_t mailbox_fifo_pop_all(uint32_t *words, size_t max) {
+  size_t count = 0;
+retry:
+  // work around https://github.com/itszor/gcc-vc4/issues/7
+  __asm__ volatile ("nop");
+  event_wait(&fifo.event);
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&fifo.lock, state);
+  while ((fifo.tail != fifo.head) && (count < max)) {
+    words[count++] = fifo.buf[fifo.tail];
+    fifo.tail = modpow2(fifo.tail + 1, fifo.len_pow2);
+  }
+  if (fifo.tail == fifo.head) {
+    // we've emptied the buffer, unsignal the event
+    event_unsignal(&fifo.event);
+  }
+  spin_unlock_irqrestore(&fifo.lock, state);
+  if (count == 0) goto retry;
+  return count;
+}
+
 size_t mailbox_fifo_space_avail(void) {
     uint consumed = modpow2((uint)(fifo.head - fifo.tail), fifo.len_pow2);
     return valpow2(fifo.len_pow2) - consumed - 1;
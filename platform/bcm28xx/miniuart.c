@@ -94,6 +94,11 @@ int uart_putc(int port, char c) {
     return 1;
 }
 
+// there is no tx ring here, so uart_putc() already writes the fifo directly
+int uart_pputc(int port, char c) {
+    return uart_putc(port, c);
+}
+
 void uart_init(void) {
     volatile struct bcm283x_mu_regs *mu_regs =
         (struct bcm283x_mu_regs *)MINIUART_BASE;
@@ -1,10 +1,13 @@
 #include <stdint.h>
 #include <inttypes.h>
+#include <lk/init.h>
 #include <lk/reg.h>
 #include <platform/bcm28xx.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/otp.h>
 #include <platform/bcm28xx/udelay.h>
 #include <stdio.h>
+#include <string.h>
 #include <lk/console_cmd.h>
 
 #define OTP_MAX_CMD_WAIT 1000
@@ -45,10 +48,12 @@ enum otp_command {
 static int cmd_otp_pretty(int argc, const console_cmd_args *argv);
 static int cmd_otp_full(int argc, const console_cmd_args *argv);
 static int cmd_otp_write(int argc, const console_cmd_args *argv);
+static int cmd_otp_shadow(int argc, const console_cmd_args *argv);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("otp_pretty_print", "pretty-print all known otp values", &cmd_otp_pretty)
 STATIC_COMMAND("otp_dump_all","dump all OTP values", &cmd_otp_full)
+STATIC_COMMAND("otp_shadow", "otp shadow stats, `otp_shadow verify` compares it against the hardware", &cmd_otp_shadow)
 //STATIC_COMMAND("otp_write","write new OTP value", &cmd_otp_write)
 STATIC_COMMAND_END(otp);
 #endif
@@ -100,14 +105,76 @@ static uint32_t otp_read_open(uint8_t addr) {
   return (uint32_t) otp_set_command(0, OTP_CMD_READ) ?: *REG32(OTP_DATA);
 }
 
-uint32_t otp_read(uint8_t addr) {
+// every row, read once in a single open/close, so otp_read() doesnt pay for a whole cycle each time
+// a row that failed to read isnt marked valid, and gets retried directly
+static uint32_t shadow[OTP_ROWS];
+static uint32_t shadow_valid[OTP_ROWS / 32];
+static bool shadow_loaded;
+static otp_shadow_stats stats;
+
+static bool row_valid(uint8_t addr) {
+  return shadow_valid[addr / 32] & (1u << (addr % 32));
+}
+
+static void shadow_set(uint8_t addr, uint32_t val) {
+  if (addr >= OTP_ROWS) return;
+  if (val == 0xffffffff) {
+    shadow_valid[addr / 32] &= ~(1u << (addr % 32));
+  } else {
+    shadow[addr] = val;
+    shadow_valid[addr / 32] |= 1u << (addr % 32);
+  }
+}
+
+static uint32_t otp_read_direct(uint8_t addr) {
   uint32_t val;
   otp_open();
   val = otp_read_open(addr);
   otp_close();
+  stats.direct_reads++;
   return val;
 }
 
+void otp_shadow_load(void) {
+  uint32_t start = *REG32(ST_CLO);
+  // what the old per-read path costs, for otp_shadow to weigh the bulk read against
+  otp_open();
+  otp_read_open(0);
+  otp_close();
+  uint32_t mid = *REG32(ST_CLO);
+  otp_open();
+  for (unsigned int addr = 0; addr < OTP_ROWS; addr++) {
+    shadow_set(addr, otp_read_open(addr));
+  }
+  otp_close();
+  uint32_t end = *REG32(ST_CLO);
+  stats.single_read_us = mid - start;
+  stats.load_us = end - mid;
+  shadow_loaded = true;
+}
+
+uint32_t otp_read(uint8_t addr) {
+  if (addr >= OTP_ROWS) return 0xffffffff;
+  if (!shadow_loaded) otp_shadow_load();
+  if (row_valid(addr)) {
+    stats.shadow_reads++;
+    return shadow[addr];
+  }
+  uint32_t val = otp_read_direct(addr);
+  shadow_set(addr, val);
+  return val;
+}
+
+void otp_get_shadow_stats(otp_shadow_stats *out) {
+  *out = stats;
+}
+
+static void otp_shadow_init(uint level) {
+  if (!shadow_loaded) otp_shadow_load();
+}
+
+LK_INIT_HOOK(otp_shadow, &otp_shadow_init, LK_INIT_LEVEL_PLATFORM_EARLY);
+
 static int otp_enable_program(void)
 {
   static const uint32_t seq[] = OTP_PROG_EN_SEQ;
@@ -219,6 +286,8 @@ int otp_write(uint8_t addr, uint32_t val)
   int err;
   otp_open();
   err = otp_write_open(addr, val);
+  // even a failed write can have set some bits, so the row is always read back
+  shadow_set(addr, otp_read_open(addr));
   otp_close();
   return err;
 }
@@ -315,7 +384,36 @@ static int cmd_otp_write(int argc, const console_cmd_args *argv) {
       printf("%d bits failed\n", err);
 #endif
   }
-  printf("new value: 0x%08"PRIx32"\n", otp_read_open(addr));
+  uint32_t newval = otp_read_open(addr);
+  shadow_set(addr, newval);
+  printf("new value: 0x%08"PRIx32"\n", newval);
   otp_close();
   return 0;
 }
+
+static int cmd_otp_shadow(int argc, const console_cmd_args *argv) {
+  if ((argc == 2) && (strcmp(argv[1].str, "verify") == 0)) {
+    int bad = 0;
+    otp_open();
+    for (unsigned int addr = 0; addr < OTP_ROWS; addr++) {
+      uint32_t val = otp_read_open(addr);
+      if (row_valid(addr) && (val != shadow[addr])) {
+        printf("row %d: shadow 0x%08x, otp 0x%08x\n", addr, shadow[addr], val);
+        bad++;
+      } else if (!row_valid(addr)) {
+        printf("row %d: not in the shadow\n", addr);
+      }
+    }
+    otp_close();
+    printf("%d rows differ\n", bad);
+    return bad ? -1 : 0;
+  }
+  otp_shadow_stats s;
+  otp_get_shadow_stats(&s);
+  printf("%d rows loaded in %u uSec, one otp_read() used to take %u uSec\n", OTP_ROWS, s.load_us, s.single_read_us);
+  printf("%u reads from the shadow, %u direct\n", s.shadow_reads, s.direct_reads);
+  // every shadow read would have been a full open/read/close before
+  int64_t saved = ((int64_t)s.shadow_reads * s.single_read_us) - s.load_us;
+  printf("saved %lld uSec so far\n", saved);
+  return 0;
+}
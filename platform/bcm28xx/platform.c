@@ -20,6 +20,7 @@
 #include <platform.h>
 #include <platform/bcm28xx.h>
 #include <platform/bcm28xx/a2w.h>
+#include <platform/bcm28xx/boot_trace.h>
 #include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/cm.h>
 #include <platform/bcm28xx/gpio.h>
@@ -270,10 +271,6 @@ static void vpu_clock_updated(int core0_div, int vpu_divisor) {
 #define PM_AVS_EVENT    0x7e100084
 #define A2W_PLLC_FRACR  0x7e102a20
 
-uint32_t do_clock_math(float mult, int shift) {
-  return (mult * (1 << shift)) + 8;
-}
-
 static void platform_setup_pllc_taps(int per_div, int core0_div) {
 #ifdef RPI4
   *REG32(A2W_PLLC_CORE0R) = CM_PASSWORD | 6;
@@ -309,7 +306,7 @@ static void platform_setup_pllc_taps(int per_div, int core0_div) {
 #endif
 }
 
-static void platform_setup_pllc(float pllc_mhz) {
+static void platform_setup_pllc(uint32_t pllc_mhz) {
 
   //uint64_t pllc_mhz = 108 * per_div * 4;
 #ifdef RPI4
@@ -320,7 +317,7 @@ static void platform_setup_pllc(float pllc_mhz) {
   *REG32(UNK2) = 0;
   *REG32(UNK3) = 3;
 
-  uint32_t pll_mult = do_clock_math(((float)pllc_mhz) / 54, 0x14);
+  uint32_t pll_mult = pll_compute_divisor(MHZ_TO_HZ(pllc_mhz));
   printf("pll_mult: 0x%x\n", pll_mult);
 
   *REG32(PM_AVS_EVENT) = 0x5a800004;
@@ -431,6 +428,7 @@ static void pi4_pllc(void) {
 
 void platform_early_init(void) {
     platform_init_timestamp = *REG32(ST_CLO);
+    boot_trace_early_init();
     uart_init_early();
     logf("b\n");
 
@@ -699,6 +697,13 @@ void platform_dputc(char c) {
     uart_putc(DEBUG_UART, c);
 }
 
+// panic and halt output, straight to the fifo behind anything still queued
+void platform_pputc(char c) {
+    if (c == '\n')
+        uart_pputc(DEBUG_UART, '\r');
+    uart_pputc(DEBUG_UART, c);
+}
+
 int platform_dgetc(char *c, bool wait) {
     int ret = uart_getc(DEBUG_UART, wait);
     if (ret == -1)
@@ -721,6 +726,8 @@ void platform_halt(platform_halt_action suggested_action,
     for (;;);
   }
   dprintf(ALWAYS, "HALT: spinning forever... (reason = %d)\n", reason);
+  // nothing drains the tx ring once interrupts are off
+  uart_flush_tx(0);
   arch_disable_ints();
   for (;;);
 }
@@ -11,14 +11,17 @@
 #include <platform/bcm28xx/udelay.h>
 #include <stdint.h>
 
+#include <fixed-point/clock_plan.h>
 #include <fixed-point/util.h>
 
 #define PLL_MAX_LOCKWAIT 1000
 
 static int cmd_set_pll_freq(int argc, const console_cmd_args *argv);
+static int cmd_clock_plan(int argc, const console_cmd_args *argv);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("set_pll_freq", "set pll frequency", &cmd_set_pll_freq)
+STATIC_COMMAND("clock_plan", "plan PLLC for a set of rates, without applying it", &cmd_clock_plan)
 STATIC_COMMAND_END(pll_control);
 
 uint64_t freq_plla_dsi0;
@@ -313,7 +316,7 @@ static int set_pll_freq(enum pll pll, uint32_t freq) {
 #endif
 
   // Divider is a fixed-point number with a 20-bit fractional part.
-  uint32_t div = (((uint64_t)freq << 20) + xtal_freq / 2) / xtal_freq;
+  uint32_t div = pll_compute_divisor(freq);
 
 #if RPI4
   is_prescaled = freq > MHZ_TO_HZ(1600);
@@ -478,6 +481,10 @@ void configure_pll_b(uint32_t freq) {
   *REG32(CM_ARMCTL) = CM_PASSWORD | 4 | CM_ARMCTL_ENAB_SET;
 }
 
+uint32_t pll_compute_divisor(uint32_t freq) {
+  return computePllDivisorRounded(xtal_freq, freq);
+}
+
 static int cmd_set_pll_freq(int argc, const console_cmd_args *argv) {
   if (argc != 3) {
     printf("usage: set_pll_freq <pll> <freq>\n");
@@ -488,6 +495,30 @@ static int cmd_set_pll_freq(int argc, const console_cmd_args *argv) {
   return set_pll_freq(pll, freq);
 }
 
+static int cmd_clock_plan(int argc, const console_cmd_args *argv) {
+  if (argc < 6) {
+    printf("usage: clock_plan <vpu> <v3d> <pixel> <per> <pwm> [tolerance ppm]\n");
+    printf("rates in Hz, 0 for dont care\n");
+    return -1;
+  }
+  clock_plan_request req = {
+    .xtal = xtal_freq,
+    .vpu = argv[1].u,
+    .v3d = argv[2].u,
+    .pixel = argv[3].u,
+    .per = argv[4].u,
+    .pwm = argv[5].u,
+    .tolerance_ppm = (argc >= 7) ? argv[6].u : 0,
+  };
+  clock_plan plan;
+  if (!clock_plan_solve(&req, &plan)) {
+    printf("no plan can make those rates\n");
+    return -1;
+  }
+  clock_plan_dump(&plan);
+  return 0;
+}
+
 // in A2W_PLLC_CTRL
 #define PDIV(n) ((n & 7) << 12)
 // in A2W_PLLC_ANA1
@@ -518,19 +549,13 @@ void setup_pllc(uint32_t target_freq, int core0_div, int per_div) {
   // if over 1.75ghz, enable an extra /2 stage
   if (prediv) goal_freq /= 2;
 
-  uint32_t other_division = computePllDivisor(xtal_in/1000, goal_freq/1000);
-
   printf("goal_freq = %llu\n", goal_freq);
-  //uint32_t divisor = (goal_freq<<20) / xtal_in;
-  uint32_t divisor = other_division;
+  uint32_t divisor = pll_compute_divisor(goal_freq);
   int div = divisor >> 20;
   int frac = divisor & 0xfffff;
   printf("divisor 0x%x -> %d+(%d/2^20)\n", divisor, div, frac);
-  printf("other divisor: 0x%x\n", other_division);
   //printf("ctrl: 0x%x\nfrac: 0x%x\n", *REG32(A2W_PLLC_CTRL), *REG32(A2W_PLLC_FRAC));
 
-  assert(other_division == divisor);
-
   const bool core0_enable = true;
   const bool core1_enable = false;
   // which clocks to keep held when turning it all on
@@ -610,11 +635,8 @@ void setup_plla(uint32_t target_freq, int core_div, int per_div) {
   // if over 1.75ghz, enable an extra /2 stage
   if (prediv) goal_freq /= 2;
 
-  uint32_t other_division = computePllDivisor(xtal_in/1000, goal_freq/1000);
-
   printf("goal_freq = %llu\n", goal_freq);
-  //uint32_t divisor = (goal_freq<<20) / xtal_in;
-  uint32_t divisor = other_division;
+  uint32_t divisor = pll_compute_divisor(goal_freq);
   int div = divisor >> 20;
   int frac = divisor & 0xfffff;
   printf("divisor 0x%x -> %d+(%d/2^20)\n", divisor, div, frac);
@@ -696,7 +718,7 @@ void setup_pllh(uint32_t target_freq, int aux_div, int pix_div) {
   printf("xtal_in = %u\n", xtal_in);
   uint64_t goal_freq = target_freq;
   printf("goal_freq = %llu\n", goal_freq);
-  uint32_t divisor = (goal_freq<<20) / xtal_in;
+  uint32_t divisor = pll_compute_divisor(goal_freq);
   int div = divisor >> 20;
   int frac = divisor & 0xfffff;
   printf("divisor 0x%x -> %d+(%d/2^20)\n", divisor, div, frac);
@@ -769,65 +791,60 @@ int get_peripheral_parent(enum peripheral_clock_tap source) {
   }
 }
 
-bool clock_set_pwm(int freq, enum peripheral_clock_tap source) {
-  int reference = get_peripheral_parent(source);
-  float desired_divider = (float)reference / freq;
-  int divisor_fixed = desired_divider * 4096;
-  int mash = 0;
-  printf("ref: %d, target: %d, divisor(f): %f, divisor(fixed): 0x%x\n", reference, freq, (double)desired_divider, divisor_fixed);
-  if (divisor_fixed < 0x2000) {
-    puts("divisor too low, abort!");
+// the CM_*DIV/CM_*CTL pairs all take a 12.12 divider, MASH 1 smooths out a fractional one
+static bool clock_set_cm(volatile uint32_t *ctl, volatile uint32_t *div, int freq, enum peripheral_clock_tap source, bool mash_allowed) {
+  uint32_t reference = get_peripheral_parent(source);
+  clock_plan_cm cm;
+  if (!clock_plan_cm_divider(reference, freq, 2, mash_allowed, &cm)) {
+    printf("ref: %u, target: %d, divisor out of range, abort!\n", reference, freq);
     return false;
   }
-  if (divisor_fixed >= 0x1000000) {
-    puts("divisor too high, abort!");
+  printf("ref: %u, target: %d, divisor(fixed): 0x%x, actual: %u (%u ppm)\n", reference, freq, cm.div, cm.hz, cm.ppm);
+  if (!mash_allowed && cm.ppm) {
+    puts("mash not allowed on this clock");
     return false;
   }
-  if (divisor_fixed & 0xfff) mash = 1;
-  *REG32(CM_PWMDIV) = CM_PASSWORD | divisor_fixed;
-  *REG32(CM_PWMCTL) = CM_PASSWORD | CM_PWMCTL_ENABLE | source | mash<<CM_PWMCTL_MASH_LSB;
+  *div = CM_PASSWORD | cm.div;
+  *ctl = CM_PASSWORD | CM_PWMCTL_ENABLE | source | cm.mash<<CM_PWMCTL_MASH_LSB;
   return true;
 }
 
-bool clock_set_vec(int freq, enum peripheral_clock_tap source) {
-  int reference = get_peripheral_parent(source);
-  float desired_divider = (float)reference / freq;
-  int divisor_fixed = desired_divider * 4096;
-  int mash = 0;
-  printf("ref: %d, target: %d, divisor(f): %f, divisor(fixed): 0x%x\n", reference, freq, (double)desired_divider, divisor_fixed);
-  if (divisor_fixed < 0x2000) {
-    puts("divisor too low, abort!");
-    return false;
-  }
-  if (divisor_fixed >= 0x1000000) {
-    puts("divisor too high, abort!");
-    return false;
-  }
-  if (divisor_fixed & 0xfff) {
-    puts("mash not allowed on VEC");
-    return false;
+static volatile uint32_t *core_clock_ctl(enum core_clock clk) {
+  return (clk == CORE_CLOCK_VPU) ? REG32(CM_VPUCTL) : REG32(CM_V3DCTL);
+}
+
+static volatile uint32_t *core_clock_div(enum core_clock clk) {
+  return (clk == CORE_CLOCK_VPU) ? REG32(CM_VPUDIV) : REG32(CM_V3DDIV);
+}
+
+uint32_t clock_get_core_div(enum core_clock clk) {
+  return (*core_clock_div(clk) >> 12) & 0xfff;
+}
+
+bool clock_set_core_div(enum core_clock clk, uint32_t div) {
+  if ((div == 0) || (div > 0xfff)) return false;
+  if ((*core_clock_ctl(clk) & 0xf) != CM_SRC_PLLC_CORE0) return false;
+  if (clk == CORE_CLOCK_VPU) {
+    // the vpu is running on this clock, so it waits on the crystal while the divider changes
+    switch_vpu_to_src(CM_SRC_OSC);
+    *REG32(CM_VPUDIV) = CM_PASSWORD | (div << 12);
+    switch_vpu_to_src(CM_SRC_PLLC_CORE0);
+    if (freq_pllc_core0) vpu_clock = freq_pllc_core0 / div / 1000 / 1000;
+  } else {
+    // nothing runs code on v3d, so like linux, the integer divider is just rewritten
+    *core_clock_div(clk) = CM_PASSWORD | (div << 12);
   }
-  *REG32(CM_VECDIV) = CM_PASSWORD | divisor_fixed;
-  *REG32(CM_VECCTL) = CM_PASSWORD | CM_PWMCTL_ENABLE | source | mash<<CM_PWMCTL_MASH_LSB;
   return true;
 }
 
+bool clock_set_pwm(int freq, enum peripheral_clock_tap source) {
+  return clock_set_cm(REG32(CM_PWMCTL), REG32(CM_PWMDIV), freq, source, true);
+}
+
+bool clock_set_vec(int freq, enum peripheral_clock_tap source) {
+  return clock_set_cm(REG32(CM_VECCTL), REG32(CM_VECDIV), freq, source, false);
+}
+
 bool clock_set_hsm(int freq, enum peripheral_clock_tap source) {
-  int reference = get_peripheral_parent(source);
-  float desired_divider = (float)reference / freq;
-  int divisor_fixed = desired_divider * 4096;
-  int mash = 0;
-  printf("ref: %d, target: %d, divisor(f): %f, divisor(fixed): 0x%x\n", reference, freq, (double)desired_divider, divisor_fixed);
-  if (divisor_fixed < 0x2000) {
-    puts("divisor too low, abort!");
-    return false;
-  }
-  if (divisor_fixed >= 0x1000000) {
-    puts("divisor too high, abort!");
-    return false;
-  }
-  if (divisor_fixed & 0xfff) mash = 1;
-  *REG32(CM_HSMDIV) = CM_PASSWORD | divisor_fixed;
-  *REG32(CM_HSMCTL) = CM_PASSWORD | CM_PWMCTL_ENABLE | source | mash<<CM_PWMCTL_MASH_LSB;
-  return true;
+  return clock_set_cm(REG32(CM_HSMCTL), REG32(CM_HSMDIV), freq, source, true);
 }
@@ -49,7 +49,6 @@ uint32_t get_pll_freq(enum pll pll) {
 
 uint32_t get_pll_chan_freq(enum pll_chan chan) {
   const struct pll_chan_def *def = &pll_chan_def[chan];
-  printf("def is 0x%x\n", (uint32_t)def);
   uint32_t ctrl_val = *def->ctrl;
   uint32_t div = ctrl_val & def->div_mask;
   if (BIT_SET(ctrl_val, def->chenb_bit) || div == 0)
@@ -1,14 +1,59 @@
 #include <kernel/novm.h>
+#include <lk/debug.h>
 #include <lk/init.h>
+#include <platform/bcm28xx/boot_trace.h>
+#include <platform/bcm28xx/print_timestamp.h>
 #include <platform/bcm28xx/sdram.h>
+#include <stdio.h>
 
 #define UNCACHED_RAM 0xc0000000
 #define MB (1024*1024)
 
+#define logf(fmt, ...) print_timestamp(); printf("[AUTORAM:%s]: " fmt, __FUNCTION__, ##__VA_ARGS__);
+
+// the bootcode runs from L2 as the first 128kb of dram, and the memtest scratch is at the top of the first 1mb
+#define HEAP_START (1 * MB)
+// the arena the heap always had, it is searched first, so small allocations land where they used to
+#define LOW_ARENA_SIZE (20 * MB)
+
+#ifndef AUTORAM_RESERVE_TOP_MB
+#define AUTORAM_RESERVE_TOP_MB 0
+#endif
+
+#ifndef AUTORAM_MEMTEST
+#define AUTORAM_MEMTEST 0
+#endif
+
+#if AUTORAM_MEMTEST
+static void autoram_memtest(uint32_t start, uint32_t end) {
+  static const uint32_t patterns[] = { 0x00000000, 0xffffffff, 0xaaaaaaaa, 0x55555555 };
+  sdram_memtest_result result;
+  logf("testing 0x%x to 0x%x\n", start, end);
+  if (!sdram_memtest(start, end - start, patterns, sizeof(patterns) / sizeof(patterns[0]), true, &result)) {
+    panic("SDRAM memtest failed, %d errors, first at 0x%x (0x%x)\n", result.errors, result.first_bad_addr, result.first_bad_value);
+  }
+  logf("passed, dma write %d MB/s, cpu read %d MB/s\n", result.write_mbps, result.read_mbps);
+}
+#endif
+
 static void autoram_dram_init(uint level) {
+  boot_trace(BT_BOOTCODE_SDRAM_START, 0);
   sdram_init();
-  uint32_t start = UNCACHED_RAM | (1 * MB);
-  uint32_t length = 20 * MB;
-  novm_add_arena("dram", start, length);
+  boot_trace(BT_BOOTCODE_SDRAM_DONE, sdram_size() / MB);
+  const uint32_t end = sdram_size() - (AUTORAM_RESERVE_TOP_MB * MB);
+#if AUTORAM_MEMTEST
+  // before the heap moves in, so all of it can be tested
+  autoram_memtest(HEAP_START, end);
+#endif
+  uint32_t length = LOW_ARENA_SIZE;
+  if ((HEAP_START + length) > end) length = end - HEAP_START;
+  novm_add_arena("dram", UNCACHED_RAM | HEAP_START, length);
+  sdram_protect(HEAP_START, length);
+  // the rest goes in the second arena, for the big users
+  if ((HEAP_START + length) < end) {
+    novm_add_arena("dram-high", UNCACHED_RAM | (HEAP_START + length), end - (HEAP_START + length));
+    sdram_protect(HEAP_START + length, end - (HEAP_START + length));
+  }
+  logf("%d MB of heap, %d MB reserved at the top\n", (end - HEAP_START) / MB, AUTORAM_RESERVE_TOP_MB);
 }
 LK_INIT_HOOK(autoram, &autoram_dram_init, LK_INIT_LEVEL_PLATFORM_EARLY + 1);
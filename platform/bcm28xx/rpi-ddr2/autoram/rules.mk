@@ -6,6 +6,13 @@ MODULE_DEPS += platform/bcm28xx/rpi-ddr2
 
 MODULE_SRCS += $(LOCAL_DIR)/autoram.c
 
+# dram kept out of the heap at the top, in MB
+AUTORAM_RESERVE_TOP_MB ?= 0
+# 1 runs sdram_memtest() over all of the heap before handing it out, several seconds on a 1GB part
+AUTORAM_MEMTEST ?= 0
+
+MODULE_DEFINES += AUTORAM_RESERVE_TOP_MB=$(AUTORAM_RESERVE_TOP_MB) AUTORAM_MEMTEST=$(AUTORAM_MEMTEST)
+
 GLOBAL_DEFINES += NOVM_MAX_ARENAS=2 NOVM_DEFAULT_ARENA=0
 
 include make/module.mk
@@ -2,6 +2,8 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
+MODULE_DEPS += platform/bcm28xx/dma
+
 MODULE_SRCS += $(LOCAL_DIR)/sdram.c
 
 include make/module.mk
@@ -20,11 +20,14 @@ VideoCoreIV SDRAM initialization code.
 
 #include "ddr2.h"
 #include <app.h>
+#include <lk/console_cmd.h>
 #include <lk/debug.h>
 #include <lk/reg.h>
 #include <platform/bcm28xx.h>
 #include <platform/bcm28xx/a2w.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/cm.h>
+#include <platform/bcm28xx/dma.h>
 #include <platform/bcm28xx/pll.h>
 #include <platform/bcm28xx/power.h>
 #include <platform/bcm28xx/print_timestamp.h>
@@ -517,6 +520,183 @@ static void selftest(void) {
 
 #undef RT_ASSERT
 
+/*****************************************************************************
+ * Full range test
+ *****************************************************************************/
+
+// channel 5 is the blitter, and nothing else is running this early
+#define MEMTEST_DMA_CHANNEL 4
+// reported per pass
+#define MEMTEST_MAX_REPORTS 4
+
+uint32_t sdram_size(void) {
+  switch (g_RAMSize) {
+  case kRamSize128MB: return 128 * 1024 * 1024;
+  case kRamSize256MB: return 256 * 1024 * 1024;
+  case kRamSize512MB: return 512 * 1024 * 1024;
+  case kRamSize1GB:
+  case kRamSize2GB:
+  case kRamSize4GB:
+    return 1024 * 1024 * 1024;
+  default:
+    return 0;
+  }
+}
+
+static uint32_t mbps(uint64_t bytes, uint32_t usec) {
+  return usec ? (uint32_t)(bytes / usec) : 0;
+}
+
+// one control block, reading the same 16 bytes over and over, does the whole range
+static uint32_t memtest_fill(uint32_t start, uint32_t len, uint32_t pattern) {
+  volatile dma_cb *cb = (volatile dma_cb*)(RT_BASE | SDRAM_MEMTEST_SCRATCH);
+  volatile uint32_t *src = (volatile uint32_t*)(RT_BASE | (SDRAM_MEMTEST_SCRATCH + 32));
+  for (int i = 0; i < 4; i++) src[i] = pattern;
+
+  cb->ti = DMA_TI_DEST_INC | DMA_TI_DEST_WIDE | DMA_TI_SRC_WIDE | DMA_TI_BURST(8) | DMA_TI_WAIT_RESP;
+  cb->source = dma_bus_addr((void*)src);
+  cb->dest = RT_BASE | start;
+  cb->length = len;
+  cb->stride = 0;
+  cb->next_block = 0;
+
+  dma_controller *chan = get_dma(MEMTEST_DMA_CHANNEL);
+  chan->cs = DMA_CS_RESET;
+  chan->conblk_ad = dma_bus_addr((void*)cb);
+  const uint32_t t0 = *REG32(ST_CLO);
+  chan->cs = DMA_CS_ACTIVE | DMA_CS_PRIORITY(8) | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_WAIT_WRITES;
+  while (chan->cs & DMA_CS_ACTIVE) {}
+  const uint32_t took = *REG32(ST_CLO) - t0;
+  if (chan->cs & DMA_CS_ERROR) {
+    logf("dma error, CS 0x%X\n", chan->cs);
+  }
+  chan->cs = DMA_CS_END;
+  return took;
+}
+
+static void memtest_bad(sdram_memtest_result *out, uint32_t *reports, volatile uint32_t *at, uint32_t expected, uint32_t got) {
+  if (out->errors++ == 0) {
+    out->first_bad_addr = (uint32_t)at & ~RT_BASE;
+    out->first_bad_value = got;
+  }
+  if ((*reports)++ < MEMTEST_MAX_REPORTS) {
+    logf("0x%08X: wanted 0x%08X, got 0x%08X, bits 0x%08X\n", (uint32_t)at & ~RT_BASE, expected, got, expected ^ got);
+  }
+}
+
+static uint32_t memtest_verify(uint32_t start, uint32_t len, uint32_t pattern, bool address, sdram_memtest_result *out) {
+  volatile uint32_t *ram = (volatile uint32_t*)(RT_BASE | start);
+  const uint32_t words = len / 4;
+  uint32_t reports = 0;
+  const uint32_t t0 = *REG32(ST_CLO);
+  for (uint32_t i = 0; i < words; i++) {
+    const uint32_t expected = address ? (start + (i * 4)) : pattern;
+    const uint32_t got = ram[i];
+    if (got != expected) memtest_bad(out, &reports, &ram[i], expected, got);
+  }
+  return *REG32(ST_CLO) - t0;
+}
+
+bool sdram_memtest(uint32_t start, uint32_t len, const uint32_t *patterns, unsigned int count, bool address_pass, sdram_memtest_result *out) {
+  uint64_t written = 0, read = 0;
+  uint32_t write_us = 0, read_us = 0;
+
+  out->errors = 0;
+  out->first_bad_addr = 0xffffffff;
+  out->first_bad_value = 0;
+  out->write_mbps = 0;
+  out->read_mbps = 0;
+  if ((start | len) & 0xf) return false;
+  if ((start < (SDRAM_MEMTEST_SCRATCH + SDRAM_MEMTEST_SCRATCH_SIZE)) && ((start + len) > SDRAM_MEMTEST_SCRATCH)) return false;
+
+  for (unsigned int p = 0; p < count; p++) {
+    const uint32_t errors = out->errors;
+    const uint32_t w = memtest_fill(start, len, patterns[p]);
+    const uint32_t r = memtest_verify(start, len, patterns[p], false, out);
+    logf("0x%08X: %d errors, dma fill %d MB/s, cpu verify %d MB/s\n", patterns[p], out->errors - errors, mbps(len, w), mbps(len, r));
+    write_us += w;
+    read_us += r;
+    written += len;
+    read += len;
+  }
+
+  if (address_pass) {
+    volatile uint32_t *ram = (volatile uint32_t*)(RT_BASE | start);
+    const uint32_t errors = out->errors;
+    for (uint32_t i = 0; i < (len / 4); i++) ram[i] = start + (i * 4);
+    const uint32_t r = memtest_verify(start, len, 0, true, out);
+    logf("address in address: %d errors\n", out->errors - errors);
+    read_us += r;
+    read += len;
+  }
+
+  out->write_mbps = mbps(written, write_us);
+  out->read_mbps = mbps(read, read_us);
+  return out->errors == 0;
+}
+
+#define MEMTEST_MAX_PATTERNS 8
+// the heap arenas, autoram registers 2
+#define MAX_PROTECTED 4
+
+static struct {
+  uint32_t start;
+  uint32_t len;
+} protected_ranges[MAX_PROTECTED];
+static unsigned int protected_count;
+
+void sdram_protect(uint32_t start, uint32_t len) {
+  if (protected_count == MAX_PROTECTED) panic("too many protected dram ranges\n");
+  protected_ranges[protected_count].start = start;
+  protected_ranges[protected_count].len = len;
+  protected_count++;
+}
+
+bool sdram_protected(uint32_t start, uint32_t len) {
+  for (unsigned int i = 0; i < protected_count; i++) {
+    const uint32_t pstart = protected_ranges[i].start;
+    const uint32_t plen = protected_ranges[i].len;
+    // written as differences, so nothing wraps at the top of the 32bit space
+    if ((start < pstart) ? ((pstart - start) < len) : ((start - pstart) < plen)) return true;
+  }
+  return false;
+}
+
+// destructive, only for ranges nothing lives in
+static int cmd_sdram_memtest(int argc, const console_cmd_args *argv) {
+  static const uint32_t defaults[] = { 0x00000000, 0xffffffff, 0xaaaaaaaa, 0x55555555 };
+  uint32_t patterns[MEMTEST_MAX_PATTERNS];
+  const uint32_t *use = defaults;
+  unsigned int count = sizeof(defaults) / sizeof(defaults[0]);
+  sdram_memtest_result result;
+
+  if (argc < 3) {
+    printf("usage: sdram_memtest <phys start> <len> [pattern ...]\n");
+    printf("wipes the range, %d MB of dram\n", sdram_size() >> 20);
+    return -1;
+  }
+  if (argc > 3) {
+    count = 0;
+    for (int i = 3; (i < argc) && (count < MEMTEST_MAX_PATTERNS); i++) patterns[count++] = argv[i].u;
+    use = patterns;
+  }
+  if ((argv[1].u > sdram_size()) || (argv[2].u > (sdram_size() - argv[1].u))) {
+    printf("past the end of dram\n");
+    return -1;
+  }
+  if (sdram_protected(argv[1].u, argv[2].u)) {
+    printf("overlaps the heap, pick a range outside it\n");
+    return -1;
+  }
+  bool ok = sdram_memtest(argv[1].u, argv[2].u, use, count, true, &result);
+  printf("%s, %d errors, dma write %d MB/s, cpu read %d MB/s\n", ok ? "passed" : "FAILED", result.errors, result.write_mbps, result.read_mbps);
+  return ok ? 0 : -1;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("sdram_memtest", "dma pattern test of a dram range, destroys it", &cmd_sdram_memtest)
+STATIC_COMMAND_END(sdram);
+
 void sdram_init() {
   uint32_t vendor_id, bc;
 
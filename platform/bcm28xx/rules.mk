@@ -31,6 +31,7 @@ ifeq ($(ARCH),vpu)
     MEMBASE := 0xc0000000
     MEMSIZE ?= 0x01400000 # 20MB
     LINKER_SCRIPT += $(LOCAL_DIR)/start.ld
+    MODULE_SRCS += $(LOCAL_DIR)/i2c.c
   endif
   GLOBAL_DEFINES += SMP_MAX_CPUS=1
 else # it must be arm32 or arm64
@@ -59,10 +60,11 @@ MODULE_FLOAT_SRCS += \
 	$(LOCAL_DIR)/platform.c \
 
 MODULE_SRCS += \
+	$(LOCAL_DIR)/boot_trace.c \
 	$(LOCAL_DIR)/gpio.c \
 	$(LOCAL_DIR)/udelay.c \
+	$(LOCAL_DIR)/hrtimer.c \
 	$(LOCAL_DIR)/print_timestamp.c \
-	#$(LOCAL_DIR)/i2c.c \
 
 
 ifeq ($(TARGET),rpi1)
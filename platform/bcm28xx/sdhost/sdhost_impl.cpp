@@ -252,11 +252,11 @@ struct BCM2708SDHost : BlockDevice {
 		        (SAFE_WRITE_THRESHOLD << SDEDM_WRITE_THRESHOLD_SHIFT);
 
 		*REG32(SH_EDM) = temp;
-		udelay(300);
+		usleep(300);
 
 		set_power(true);
 
-		udelay(300);
+		usleep(300);
 		mfence();
 	}
 
@@ -645,7 +645,7 @@ struct BCM2708SDHost : BlockDevice {
     *REG32(SH_HCFG) = SH_HCFG_SLOW_CARD_SET | SH_HCFG_WIDE_INT_BUS_SET;
     *REG32(SH_CDIV) = (vpu_clock * 1000) / 125;
 
-    udelay(300);
+    usleep(300);
     mfence();
 
     if (init_card()) {
@@ -677,7 +677,7 @@ struct BCM2708SDHost : BlockDevice {
 			udelay(150);
 
 			send_no_resp(MMC_GO_IDLE_STATE);
-			udelay(500);
+			usleep(500);
 		}
 
 		logf("stopping sdhost controller driver ...\n");
@@ -0,0 +1,70 @@
+#pragma once
+
+// the thermal governor control loop, and the TSENS count to temperature conversion
+// integer math and libc only, so thermal-sim can run the same code on the host against a model
+// temp.c feeds it samples and applies the level it picks to the clocks
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THERMAL_GOV_MAX_LEVELS 8
+
+// indexed by the processor field of the otp revision word, bcm2835/6/7 and bcm2711
+#define TSENS_CHIPS 4
+
+// millidegrees for a 10 bit TS_TSENSSTAT reading, unknown chips get the bcm2835 line
+int32_t tsens_to_millicelsius(uint32_t raw, uint32_t chip);
+
+typedef struct {
+  // above trip the clocks step down a level, at or above critical they go straight to the slowest
+  int32_t trip_mc;
+  int32_t critical_mc;
+  // they only step back up once the temperature has been under release for dwell_ms
+  int32_t release_mc;
+  uint32_t dwell_ms;
+  // level 0 is full speed, levels - 1 the slowest, at most THERMAL_GOV_MAX_LEVELS
+  uint32_t levels;
+} thermal_gov_config;
+
+enum thermal_gov_event {
+  THERMAL_GOV_NONE,
+  THERMAL_GOV_THROTTLE,
+  THERMAL_GOV_CRITICAL,
+  THERMAL_GOV_RELEASE,
+};
+
+typedef struct {
+  thermal_gov_config cfg;
+  uint32_t level;
+  // decisions are made on the samples smoothed over about 4 periods, the raw one is only checked against critical
+  int32_t filtered_mc;
+  int32_t last_mc;
+  int32_t max_mc;
+  bool started;
+  uint32_t last_sample_ms;
+  // from going over trip until it is back under release, the last step down and the coolest it has been since
+  bool hot;
+  uint32_t step_ms;
+  int32_t low_mc;
+  // when the temperature last went under release, or the level last went up, whichever is later
+  uint32_t cool_since_ms;
+  // ms spent at each level, and how often it moved
+  uint64_t residency_ms[THERMAL_GOV_MAX_LEVELS];
+  uint32_t throttles;
+  uint32_t criticals;
+  uint32_t releases;
+} thermal_gov;
+
+// false if the config doesnt make sense, release has to be under trip and trip under critical
+bool thermal_gov_init(thermal_gov *g, const thermal_gov_config *cfg);
+// one sample taken at now_ms, moves g->level and says why it moved
+enum thermal_gov_event thermal_gov_sample(thermal_gov *g, uint32_t now_ms, int32_t millicelsius);
+const char *thermal_gov_event_name(enum thermal_gov_event e);
+
+#ifdef __cplusplus
+}
+#endif
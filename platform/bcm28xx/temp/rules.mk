@@ -4,6 +4,32 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/temp.c \
+	$(LOCAL_DIR)/thermal_gov.c \
 
+# the governor needs the pll code, and a thread stack the 128kb bootcode cant spare
+ifeq ($(ARCH),vpu)
+  ifneq ($(BOOTCODE),1)
+    THERMAL_GOVERNOR ?= 1
+  endif
+endif
+THERMAL_GOVERNOR ?= 0
+# in millidegrees, above trip the clocks step down, and they step back up after THERMAL_DWELL_MS under release
+THERMAL_TRIP_MC ?= 80000
+THERMAL_RELEASE_MC ?= 75000
+THERMAL_CRITICAL_MC ?= 85000
+THERMAL_DWELL_MS ?= 5000
+THERMAL_PERIOD_MS ?= 250
+# level n adds n to the vpu and v3d dividers
+THERMAL_LEVELS ?= 4
+# the vpu divider is never raised past where this would be crossed, the hvs runs on the vpu clock and wants 116-350mhz
+# for v-scaling, so at the default a nominal 500mhz vpu can only go to /2, and one at 250mhz or under is never slowed
+THERMAL_MIN_VPU_MHZ ?= 250
+
+MODULE_DEFINES += THERMAL_GOVERNOR=$(THERMAL_GOVERNOR) THERMAL_LEVELS=$(THERMAL_LEVELS) THERMAL_PERIOD_MS=$(THERMAL_PERIOD_MS) THERMAL_MIN_VPU_MHZ=$(THERMAL_MIN_VPU_MHZ)
+MODULE_DEFINES += THERMAL_TRIP_MC=$(THERMAL_TRIP_MC) THERMAL_RELEASE_MC=$(THERMAL_RELEASE_MC) THERMAL_CRITICAL_MC=$(THERMAL_CRITICAL_MC) THERMAL_DWELL_MS=$(THERMAL_DWELL_MS)
+
+ifeq ($(THERMAL_GOVERNOR),1)
+  MODULE_DEPS += platform/bcm28xx/pll
+endif
 
 include make/module.mk
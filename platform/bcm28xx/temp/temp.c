@@ -1,10 +1,27 @@
 #include <app.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lk/console_cmd.h>
 #include <lk/reg.h>
+#include <platform.h>
 #include <platform/bcm28xx/cm.h>
 #include <platform/bcm28xx/otp.h>
+#include <platform/bcm28xx/temp.h>
+#include <platform/bcm28xx/thermal_gov.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_APP_MAILBOX_PROPERTY_SERVER
+#include <property_tags.h>
+#endif
+
+#if THERMAL_GOVERNOR
+#include <lk/macros.h>
+#include <platform/bcm28xx/i2c.h>
+#include <platform/bcm28xx/pll.h>
+#endif
 
 #define CM_TSENSCTL   0x7e1010e0
 #define CM_TSENSCTL_ENAB_SET 0x00000010
@@ -17,51 +34,34 @@
 static int cmd_show_temp(int argc, const console_cmd_args *argv);
 static void setup_tsens(void);
 bool tsens_setup = false;
+static uint32_t tsens_chip;
+
+#if THERMAL_GOVERNOR
+static int cmd_thermal(int argc, const console_cmd_args *argv);
+
+static mutex_t gov_lock = MUTEX_INITIAL_VALUE(gov_lock);
+static thermal_gov gov;
+// the dividers found at the first throttle, level n runs them at nominal + n
+static uint32_t nominal_div[2];
+#else
 timer_t poller;
-float increment, offset;
+#endif
 
 STATIC_COMMAND_START
 STATIC_COMMAND("show_temp", "print internal temp sensor", &cmd_show_temp)
+#if THERMAL_GOVERNOR
+STATIC_COMMAND("thermal", "thermal governor stats, or `thermal limits <trip> <release> <critical>` in C", &cmd_thermal)
+#endif
 STATIC_COMMAND_END(temp);
 
-typedef struct {
-  float increment;
-  float offset;
-} coefficients_t;
-
-coefficients_t coefficients[] = {
-  [0] = { // bcm2835
-    .increment = 0.538,
-    .offset = 407
-  },
-  [1] = { // bcm2836
-    .increment = 0.538,
-    .offset = 407
-  },
-  [2] = { // bcm2837
-    .increment = 0.538,
-    .offset = 412
-  },
-  [3] = { // bcm2711
-    .increment = 0.487,
-    .offset = 410.04
-  },
-};
-
 static uint32_t get_raw_temp(void) {
   if (!tsens_setup) setup_tsens();
   return *REG32(TS_TSENSSTAT);
 }
 
-static float convert_temp(uint32_t raw) {
-  float converted = offset - (raw & 0x3ff) * increment;
-  return converted;
-}
-
-static float get_converted_temp(void) {
+int32_t temp_get_millicelsius(void) {
   uint32_t raw = get_raw_temp();
-  //printf("raw %d\n", raw);
-  return convert_temp(raw);
+  return tsens_to_millicelsius(raw, tsens_chip);
 }
 
 static void setup_tsens() {
@@ -76,20 +76,120 @@ static void setup_tsens() {
   *REG32(TS_TSENSCTL) |= 2;
 
   uint32_t revision = otp_read(30);
-  uint32_t proc = (revision >> 12) & 0xf;
-  increment = coefficients[proc].increment;
-  offset = coefficients[proc].offset;
+  tsens_chip = (revision >> 12) & 0xf;
 
   tsens_setup = true;
 }
 
+static void print_mc(const char *prefix, int32_t mc) {
+  printf("%s%d.%03dC", prefix, mc / 1000, abs(mc % 1000));
+}
+
 static int cmd_show_temp(int argc, const console_cmd_args *argv) {
-  double converted = get_converted_temp();
   uint32_t raw = get_raw_temp();
-  printf("Temp: %f\nRaw: %d\n", converted, raw);
+  print_mc("Temp: ", tsens_to_millicelsius(raw, tsens_chip));
+  printf("\nRaw: %d\n", raw);
+  return 0;
+}
+
+#if THERMAL_GOVERNOR
+static const thermal_gov_config default_config = {
+  .trip_mc = THERMAL_TRIP_MC,
+  .critical_mc = THERMAL_CRITICAL_MC,
+  .release_mc = THERMAL_RELEASE_MC,
+  .dwell_ms = THERMAL_DWELL_MS,
+  .levels = THERMAL_LEVELS,
+};
+
+// the largest vpu divider that keeps it at or above THERMAL_MIN_VPU_MHZ, never below the nominal one
+static uint32_t vpu_max_div(void) {
+  uint32_t max = freq_pllc_core0 / (THERMAL_MIN_VPU_MHZ * 1000 * 1000);
+  return MAX(max, nominal_div[CORE_CLOCK_VPU]);
+}
+
+// a clock that isnt running from PLLC_CORE0 (v3d before v3d_init) is left alone
+static void apply_level(uint32_t level) {
+  const uint32_t old_vpu = clock_get_core_div(CORE_CLOCK_VPU);
+  for (int clk = CORE_CLOCK_VPU; clk <= CORE_CLOCK_V3D; clk++) {
+    if (nominal_div[clk] == 0) nominal_div[clk] = clock_get_core_div(clk);
+    if (nominal_div[clk] == 0) continue;
+    uint32_t div = nominal_div[clk] + level;
+    if (clk == CORE_CLOCK_VPU) div = MIN(div, vpu_max_div());
+    clock_set_core_div(clk, div);
+  }
+  // the bsc dividers were worked out against the old vpu clock
+  if (clock_get_core_div(CORE_CLOCK_VPU) != old_vpu) i2c_core_clock_changed();
+}
+
+static void log_event(enum thermal_gov_event e, int32_t mc) {
+  printf("thermal: %s to level %u", thermal_gov_event_name(e), gov.level);
+  print_mc(" at ", mc);
+  printf(", vpu /%u, v3d /%u\n", clock_get_core_div(CORE_CLOCK_VPU), clock_get_core_div(CORE_CLOCK_V3D));
+}
+
+static void temp_entry(const struct app_descriptor *app, void *args) {
+  for (;;) {
+    const int32_t mc = temp_get_millicelsius();
+    mutex_acquire(&gov_lock);
+    enum thermal_gov_event e = thermal_gov_sample(&gov, current_time(), mc);
+    if (e != THERMAL_GOV_NONE) {
+      apply_level(gov.level);
+      log_event(e, mc);
+    }
+    mutex_release(&gov_lock);
+    thread_sleep(THERMAL_PERIOD_MS);
+  }
+}
+
+static void print_stats(void) {
+  print_mc("now ", gov.last_mc);
+  print_mc(", filtered ", gov.filtered_mc);
+  print_mc(", max ", gov.max_mc);
+  printf("\nlevel %u of %u", gov.level, gov.cfg.levels);
+  print_mc(", trip ", gov.cfg.trip_mc);
+  print_mc(", release ", gov.cfg.release_mc);
+  print_mc(", critical ", gov.cfg.critical_mc);
+  printf("\n%u throttles, %u criticals, %u releases\n", gov.throttles, gov.criticals, gov.releases);
+  if (nominal_div[CORE_CLOCK_VPU]) printf("vpu held at %u MHz or more, div at most %u\n", THERMAL_MIN_VPU_MHZ, vpu_max_div());
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < gov.cfg.levels; i++) total += gov.residency_ms[i];
+  for (uint32_t i = 0; i < gov.cfg.levels; i++) {
+    const uint32_t permille = total ? (gov.residency_ms[i] * 1000) / total : 0;
+    printf("  level %u (div +%u): %llu ms, %u.%u%%\n", i, i, gov.residency_ms[i], permille / 10, permille % 10);
+  }
+}
+
+static int cmd_thermal(int argc, const console_cmd_args *argv) {
+  if ((argc == 5) && (strcmp(argv[1].str, "limits") == 0)) {
+    thermal_gov_config cfg = default_config;
+    cfg.trip_mc = argv[2].i * 1000;
+    cfg.release_mc = argv[3].i * 1000;
+    cfg.critical_mc = argv[4].i * 1000;
+    thermal_gov fresh;
+    if (!thermal_gov_init(&fresh, &cfg)) {
+      puts("release < trip < critical");
+      return -1;
+    }
+    // a fresh governor starts at full speed, and with fresh stats
+    mutex_acquire(&gov_lock);
+    gov = fresh;
+    apply_level(0);
+    mutex_release(&gov_lock);
+    return 0;
+  } else if (argc != 1) {
+    printf("usage: %s [limits <trip> <release> <critical>]\n", argv[0].str);
+    return -1;
+  }
+  mutex_acquire(&gov_lock);
+  print_stats();
+  mutex_release(&gov_lock);
   return 0;
 }
 
+static void temp_init(const struct app_descriptor *app) {
+  thermal_gov_init(&gov, &default_config);
+}
+#else
 static int32_t abs32(int32_t a) {
   if (a < 0) return a * -1;
   else return a;
@@ -100,7 +200,9 @@ static enum handler_return poller_entry(struct timer *t, lk_time_t now, void *ar
   int32_t temp = get_raw_temp();
   uint32_t diff = abs32(temp - last_temp);
   if (diff > 3) {
-    printf("temp changed %f -> %f\n", (double)convert_temp(last_temp), (double)convert_temp(temp));
+    print_mc("temp changed ", tsens_to_millicelsius(last_temp, tsens_chip));
+    print_mc(" -> ", tsens_to_millicelsius(temp, tsens_chip));
+    puts("");
     last_temp = temp;
   }
   return INT_NO_RESCHEDULE;
@@ -110,7 +212,41 @@ static void temp_init(const struct app_descriptor *app) {
   timer_initialize(&poller);
   timer_set_periodic(&poller, 1000, poller_entry, NULL);
 }
+#endif
+
+#ifdef WITH_APP_MAILBOX_PROPERTY_SERVER
+static bool tag_temperature(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  // only sensor 0 exists
+  uint32_t reply[2] = { value32[0], 0 };
+  if (value32[0] == 0) reply[1] = temp_get_millicelsius();
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+static bool tag_max_temperature(struct tagged_packet *packet) {
+  uint32_t *value32 = (uint32_t*)(&packet->value[0]);
+  uint32_t reply[2] = { value32[0], THERMAL_CRITICAL_MC };
+  property_reply(packet, reply, sizeof(reply));
+  return false;
+}
+
+PROPERTY_TAG_START(get_temperature) // RPI_FIRMWARE_GET_TEMPERATURE
+  .tag = 0x00030006,
+  .handler = tag_temperature,
+  .request_len = 4,
+PROPERTY_TAG_END
+
+PROPERTY_TAG_START(get_max_temperature) // RPI_FIRMWARE_GET_MAX_TEMPERATURE
+  .tag = 0x0003000a,
+  .handler = tag_max_temperature,
+  .request_len = 4,
+PROPERTY_TAG_END
+#endif
 
 APP_START(temp)
   .init = temp_init,
+#if THERMAL_GOVERNOR
+  .entry = temp_entry,
+#endif
 APP_END
@@ -0,0 +1,232 @@
+// host simulator for thermal_gov.c, run with `make thermal-sim && ./thermal-sim [ambient_c load_c seconds]`
+// without arguments it runs the built-in checks, with them it prints a trace of one run
+//
+// the soc is modelled as a single thermal mass with a first order response:
+//   steady state = ambient + static rise + load rise * speed
+//   T += (steady state - T) * dt / tau
+// speed is what temp.c does to the clocks, level n adds n to an integer divider of 1
+// samples go through the TSENS quantization, and optionally some counts of noise
+
+#include <platform/bcm28xx/thermal_gov.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+#define PERIOD_MS 250
+#define TAU_MS 20000
+#define STATIC_RISE_MC 10000
+// what the first throttle has to be settled by before the temperature limits are checked
+#define SETTLE_MS 60000
+
+static const thermal_gov_config config = {
+  .trip_mc = 80000,
+  .critical_mc = 85000,
+  .release_mc = 75000,
+  .dwell_ms = 5000,
+  .levels = 4,
+};
+
+typedef struct {
+  int32_t ambient_mc;
+  int32_t load_mc;
+  // the load changes to this at load_change_ms, if that isnt 0
+  int32_t load_after_mc;
+  uint32_t load_change_ms;
+  uint32_t duration_ms;
+  // peak TSENS counts of noise added to each sample
+  uint32_t noise;
+  bool trace;
+} scenario;
+
+typedef struct {
+  thermal_gov gov;
+  // the hottest the model got after SETTLE_MS, and the work done as a share of full speed
+  int32_t settled_max_mc;
+  uint32_t work_permille;
+  uint32_t deepest;
+} result;
+
+static uint32_t rng = 1;
+
+static int32_t noise(uint32_t counts) {
+  if (counts == 0) return 0;
+  rng = rng * 1103515245 + 12345;
+  return (int32_t)((rng >> 16) % (2 * counts + 1)) - (int32_t)counts;
+}
+
+// what the bcm2835 sensor would read at mc, the nearest count
+static int32_t sensor(int32_t mc, uint32_t noise_counts) {
+  int32_t raw = (407000 - mc + 269) / 538 + noise(noise_counts);
+  if (raw < 0) raw = 0;
+  if (raw > 0x3ff) raw = 0x3ff;
+  return tsens_to_millicelsius(raw, 0);
+}
+
+static void run(const char *name, const scenario *s, result *r) {
+  CHECK(thermal_gov_init(&r->gov, &config));
+  r->settled_max_mc = -1000000;
+  r->deepest = 0;
+  int32_t temp_mc = s->ambient_mc;
+  uint64_t work = 0;
+  for (uint32_t now = 0; now < s->duration_ms; now += PERIOD_MS) {
+    const int32_t load = (s->load_change_ms && (now >= s->load_change_ms)) ? s->load_after_mc : s->load_mc;
+    const uint32_t divider = 1 + r->gov.level;
+    const int32_t steady = s->ambient_mc + STATIC_RISE_MC + (load / (int32_t)divider);
+    temp_mc += (int32_t)(((int64_t)(steady - temp_mc) * PERIOD_MS) / TAU_MS);
+    work += 1000 / divider;
+
+    enum thermal_gov_event e = thermal_gov_sample(&r->gov, now, sensor(temp_mc, s->noise));
+    if (r->gov.level > r->deepest) r->deepest = r->gov.level;
+    if ((now >= SETTLE_MS) && (temp_mc > r->settled_max_mc)) r->settled_max_mc = temp_mc;
+    if (s->trace && ((e != THERMAL_GOV_NONE) || ((now % 1000) == 0))) {
+      printf("%6u.%03us %3d.%03dC level %u %s\n", now / 1000, now % 1000, temp_mc / 1000, abs(temp_mc % 1000), r->gov.level,
+          (e != THERMAL_GOV_NONE) ? thermal_gov_event_name(e) : "");
+    }
+  }
+  r->work_permille = work / (s->duration_ms / PERIOD_MS);
+
+  const thermal_gov *g = &r->gov;
+  printf("%s: max %d mC, settled max %d mC, %u throttles, %u criticals, %u releases, %u.%u%% of full speed\n",
+      name, g->max_mc, r->settled_max_mc, g->throttles, g->criticals, g->releases, r->work_permille / 10, r->work_permille % 10);
+  for (uint32_t i = 0; i < config.levels; i++) {
+    printf("  level %u: %llu ms\n", i, (unsigned long long)g->residency_ms[i]);
+  }
+}
+
+static uint64_t total_residency(const thermal_gov *g) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < THERMAL_GOV_MAX_LEVELS; i++) total += g->residency_ms[i];
+  return total;
+}
+
+// the integer lines have to match the float ones temp.c used, to the millidegree
+static void check_conversion(void) {
+  static const double increment[TSENS_CHIPS] = { 0.538, 0.538, 0.538, 0.487 };
+  static const double offset[TSENS_CHIPS] = { 407, 407, 412, 410.04 };
+  int worst = 0;
+  for (uint32_t chip = 0; chip < TSENS_CHIPS; chip++) {
+    for (uint32_t raw = 0; raw < 0x400; raw++) {
+      const double want = (offset[chip] - raw * increment[chip]) * 1000;
+      const int diff = abs(tsens_to_millicelsius(raw, chip) - (int)(want + ((want < 0) ? -0.5 : 0.5)));
+      if (diff > worst) worst = diff;
+    }
+  }
+  printf("conversion: worst error %d mC\n", worst);
+  CHECK(worst == 0);
+  CHECK(tsens_to_millicelsius(0x400 | 10, 0) == tsens_to_millicelsius(10, 0));
+  CHECK(tsens_to_millicelsius(10, 9) == tsens_to_millicelsius(10, 0));
+}
+
+static void check_config(void) {
+  thermal_gov g;
+  thermal_gov_config c = config;
+  CHECK(thermal_gov_init(&g, &c));
+  c.release_mc = c.trip_mc;
+  CHECK(!thermal_gov_init(&g, &c));
+  c = config;
+  c.critical_mc = c.trip_mc;
+  CHECK(!thermal_gov_init(&g, &c));
+  c = config;
+  c.levels = 0;
+  CHECK(!thermal_gov_init(&g, &c));
+  c.levels = THERMAL_GOV_MAX_LEVELS + 1;
+  CHECK(!thermal_gov_init(&g, &c));
+}
+
+static void check_model(void) {
+  result r;
+
+  // never gets near trip, so it never leaves full speed
+  scenario idle = { .ambient_mc = 25000, .load_mc = 20000, .duration_ms = 300000 };
+  run("idle", &idle, &r);
+  CHECK(r.gov.throttles == 0 && r.gov.criticals == 0 && r.deepest == 0);
+  CHECK(r.gov.residency_ms[0] == total_residency(&r.gov));
+  CHECK(total_residency(&r.gov) == idle.duration_ms - PERIOD_MS);
+
+  // 95C flat out, it has to hold it under trip with a little overshoot, without chattering
+  scenario sustained = { .ambient_mc = 25000, .load_mc = 60000, .duration_ms = 600000 };
+  run("sustained", &sustained, &r);
+  CHECK(r.gov.criticals == 0);
+  CHECK(r.gov.throttles > 0 && r.gov.releases > 0);
+  CHECK(r.settled_max_mc <= config.trip_mc + 2000);
+  CHECK((r.gov.throttles + r.gov.releases) <= (sustained.duration_ms / config.dwell_ms));
+  CHECK(r.gov.residency_ms[0] > 0 && r.gov.residency_ms[1] > 0);
+  // one level down already holds it, so it shouldnt go deeper and waste speed
+  CHECK(r.deepest == 1);
+  CHECK(r.work_permille > 600);
+
+  // the same with 3 counts of noise on every sample
+  scenario noisy = sustained;
+  noisy.noise = 3;
+  run("noisy", &noisy, &r);
+  CHECK(r.gov.criticals == 0);
+  CHECK(r.settled_max_mc <= config.trip_mc + 2000);
+  CHECK((r.gov.throttles + r.gov.releases) <= (noisy.duration_ms / config.dwell_ms));
+  CHECK(r.deepest == 1);
+
+  // a hot case, one level isnt enough
+  scenario hot = { .ambient_mc = 45000, .load_mc = 60000, .duration_ms = 600000 };
+  run("hot ambient", &hot, &r);
+  CHECK(r.gov.criticals == 0);
+  CHECK(r.deepest >= 2);
+  CHECK(r.settled_max_mc <= config.trip_mc + 3000);
+
+  // once the load goes away it has to work its way back to full speed
+  scenario drop = { .ambient_mc = 25000, .load_mc = 60000, .load_after_mc = 10000, .load_change_ms = 120000, .duration_ms = 300000 };
+  run("load drop", &drop, &r);
+  CHECK(r.gov.throttles > 0);
+  CHECK(r.gov.level == 0);
+}
+
+// samples fed straight in, for the paths the model doesnt reach
+static void check_critical(void) {
+  thermal_gov g;
+  CHECK(thermal_gov_init(&g, &config));
+  uint32_t now = 0;
+  CHECK(thermal_gov_sample(&g, now, 50000) == THERMAL_GOV_NONE);
+  now += PERIOD_MS;
+  // one raw sample at critical is enough, even though the filtered one is nowhere near trip
+  CHECK(thermal_gov_sample(&g, now, config.critical_mc) == THERMAL_GOV_CRITICAL);
+  CHECK(g.level == config.levels - 1 && g.criticals == 1);
+  now += PERIOD_MS;
+  CHECK(thermal_gov_sample(&g, now, config.critical_mc + 5000) == THERMAL_GOV_NONE);
+  CHECK(g.criticals == 1);
+
+  // the filter has to come down under release before the dwell even starts
+  uint32_t released_at[THERMAL_GOV_MAX_LEVELS] = { 0 };
+  while (g.level > 0 && now < 120000) {
+    now += PERIOD_MS;
+    if (thermal_gov_sample(&g, now, 40000) == THERMAL_GOV_RELEASE) released_at[g.level] = now;
+  }
+  CHECK(g.level == 0);
+  CHECK(g.releases == config.levels - 1);
+  for (uint32_t i = 0; i + 1 < config.levels - 1; i++) {
+    CHECK((released_at[i] - released_at[i + 1]) >= config.dwell_ms);
+  }
+  CHECK(total_residency(&g) == now);
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 4) {
+    scenario s = {
+      .ambient_mc = atoi(argv[1]) * 1000,
+      .load_mc = atoi(argv[2]) * 1000,
+      .duration_ms = (uint32_t)atoi(argv[3]) * 1000,
+      .trace = true,
+    };
+    result r;
+    run("trace", &s, &r);
+    return 0;
+  }
+
+  check_conversion();
+  check_config();
+  check_model();
+  check_critical();
+
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
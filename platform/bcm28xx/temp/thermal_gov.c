@@ -0,0 +1,102 @@
+#include <platform/bcm28xx/thermal_gov.h>
+#include <string.h>
+
+// once over trip, another step down happens if it climbs this far above the coolest it got since the last one
+#define RISE_MC 1000
+
+// the float increment/offset pairs temp.c used to have, scaled by 1000
+static const struct {
+  int32_t increment_mc;
+  int32_t offset_mc;
+} coefficients[TSENS_CHIPS] = {
+  [0] = { 538, 407000 }, // bcm2835
+  [1] = { 538, 407000 }, // bcm2836
+  [2] = { 538, 412000 }, // bcm2837
+  [3] = { 487, 410040 }, // bcm2711
+};
+
+int32_t tsens_to_millicelsius(uint32_t raw, uint32_t chip) {
+  if (chip >= TSENS_CHIPS) chip = 0;
+  return coefficients[chip].offset_mc - (int32_t)(raw & 0x3ff) * coefficients[chip].increment_mc;
+}
+
+bool thermal_gov_init(thermal_gov *g, const thermal_gov_config *cfg) {
+  memset(g, 0, sizeof(*g));
+  if ((cfg->levels == 0) || (cfg->levels > THERMAL_GOV_MAX_LEVELS)) return false;
+  if ((cfg->release_mc >= cfg->trip_mc) || (cfg->trip_mc >= cfg->critical_mc)) return false;
+  g->cfg = *cfg;
+  return true;
+}
+
+static enum thermal_gov_event step_down(thermal_gov *g, uint32_t now_ms, uint32_t level) {
+  g->level = level;
+  g->step_ms = now_ms;
+  g->low_mc = g->filtered_mc;
+  return THERMAL_GOV_THROTTLE;
+}
+
+enum thermal_gov_event thermal_gov_sample(thermal_gov *g, uint32_t now_ms, int32_t millicelsius) {
+  const uint32_t slowest = g->cfg.levels - 1;
+
+  if (!g->started) {
+    g->started = true;
+    g->filtered_mc = millicelsius;
+    g->max_mc = millicelsius;
+    g->cool_since_ms = now_ms;
+  } else {
+    g->residency_ms[g->level] += now_ms - g->last_sample_ms;
+    // an iir filter with a weight of 1/4, so one noisy reading doesnt move the clocks
+    g->filtered_mc += (millicelsius - g->filtered_mc) / 4;
+  }
+  g->last_sample_ms = now_ms;
+  g->last_mc = millicelsius;
+  if (millicelsius > g->max_mc) g->max_mc = millicelsius;
+
+  if (millicelsius >= g->cfg.critical_mc) {
+    g->hot = true;
+    g->cool_since_ms = now_ms;
+    if (g->level == slowest) return THERMAL_GOV_NONE;
+    g->criticals++;
+    step_down(g, now_ms, slowest);
+    return THERMAL_GOV_CRITICAL;
+  }
+
+  if (g->filtered_mc > g->cfg.trip_mc) {
+    // the first step is taken right away, later ones only if the last didnt turn it around in time
+    const bool first = !g->hot;
+    g->hot = true;
+    g->cool_since_ms = now_ms;
+    if (g->filtered_mc < g->low_mc) g->low_mc = g->filtered_mc;
+    const bool rising = g->filtered_mc > (g->low_mc + RISE_MC);
+    const bool stuck = (now_ms - g->step_ms) >= g->cfg.dwell_ms;
+    if ((g->level == slowest) || !(first || rising || stuck)) return THERMAL_GOV_NONE;
+    g->throttles++;
+    return step_down(g, now_ms, g->level + 1);
+  }
+
+  if (g->filtered_mc >= g->cfg.release_mc) {
+    // still hot, so noise around trip doesnt count as a fresh first step
+    if (g->filtered_mc < g->low_mc) g->low_mc = g->filtered_mc;
+    g->cool_since_ms = now_ms;
+    return THERMAL_GOV_NONE;
+  }
+  g->hot = false;
+  if ((g->level == 0) || ((now_ms - g->cool_since_ms) < g->cfg.dwell_ms)) return THERMAL_GOV_NONE;
+  g->level--;
+  g->releases++;
+  g->cool_since_ms = now_ms;
+  return THERMAL_GOV_RELEASE;
+}
+
+const char *thermal_gov_event_name(enum thermal_gov_event e) {
+  switch (e) {
+  case THERMAL_GOV_THROTTLE:
+    return "throttle";
+  case THERMAL_GOV_CRITICAL:
+    return "critical";
+  case THERMAL_GOV_RELEASE:
+    return "release";
+  default:
+    return "none";
+  }
+}
@@ -7,15 +7,19 @@
  */
 #include <lk/reg.h>
 #include <stdio.h>
+#include <string.h>
 #include <lk/trace.h>
 #include <lk/console_cmd.h>
 #include <lib/cbuf.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <platform/interrupts.h>
 #include <platform/debug.h>
 #include <platform/bcm28xx.h>
+#include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/cm.h>
 #include <platform/bcm28xx/pll_read.h>
+#include <platform/bcm28xx/uart.h>
 #include <assert.h>
 #include <dev/gpio.h>
 
@@ -39,17 +43,38 @@
 
 #define UARTREG(base, reg)  (*REG32((base)  + (reg)))
 
+#define UART_TFR_TXFF (1<<5)
+#define UART_IMSC_TXIM (1<<5)
+
 #define RXBUF_SIZE 16
+// a power of 2, about 350ms of text at 115200
+#define TXBUF_SIZE 4096
 #define NUM_UART 1
 
 static cbuf_t uart_rx_buf[NUM_UART];
 
+// head and tail run freely, head - tail is how much is queued
+typedef struct {
+  spin_lock_t lock;
+  bool ready;
+  bool drop;
+  uint32_t head;
+  uint32_t tail;
+  uart_tx_stats stats;
+  char buf[TXBUF_SIZE];
+} uart_tx_ring;
+
+static uart_tx_ring uart_tx[NUM_UART];
+
 static int cmd_uart_dump(int argc, const console_cmd_args *argv);
+static int cmd_uart_tx(int argc, const console_cmd_args *argv);
 int uart_putc(int port, char c);
+int uart_pputc(int port, char c);
 void udelay(uint32_t t);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("dump_uart_state", "print uart state relating to baud", &cmd_uart_dump)
+STATIC_COMMAND("uart_tx", "uart tx ring counters, uart_tx drop|block to pick what a full ring does", &cmd_uart_tx)
 STATIC_COMMAND_END(uart);
 
 static inline uintptr_t uart_to_ptr(unsigned int n) {
@@ -67,6 +92,36 @@ static uint32_t calculate_baud_divisor(uint32_t baud) {
   return divisor;
 }
 
+// spins until the fifo has room, and counts the time spent doing it
+static void uart_tx_wait(uart_tx_ring *tx, uintptr_t base) {
+    if (!(UARTREG(base, UART_TFR) & UART_TFR_TXFF)) return;
+    uint32_t start = *REG32(ST_CLO);
+    while (UARTREG(base, UART_TFR) & UART_TFR_TXFF)
+        ;
+    tx->stats.stalled_us += *REG32(ST_CLO) - start;
+}
+
+// moves queued chars into the fifo until either runs out, tx lock held
+static void uart_tx_pump(uart_tx_ring *tx, uintptr_t base) {
+    while ((tx->head != tx->tail) && !(UARTREG(base, UART_TFR) & UART_TFR_TXFF)) {
+        UARTREG(base, UART_DR) = tx->buf[tx->tail++ % TXBUF_SIZE];
+    }
+    // the tx irq only fires as the fifo drains past the trigger level, so its only wanted while the fifo is full
+    if (tx->head != tx->tail) {
+        UARTREG(base, UART_IMSC) |= UART_IMSC_TXIM;
+    } else {
+        UARTREG(base, UART_IMSC) &= ~UART_IMSC_TXIM;
+    }
+}
+
+// empties the ring by polling, for when nothing else will, tx lock held
+static void uart_tx_drain(uart_tx_ring *tx, uintptr_t base) {
+    while (tx->head != tx->tail) {
+        uart_tx_wait(tx, base);
+        uart_tx_pump(tx, base);
+    }
+}
+
 static enum handler_return uart_irq(void *arg) {
     bool resched = false;
     uint port = (vaddr_t)arg;
@@ -75,6 +130,13 @@ static enum handler_return uart_irq(void *arg) {
     /* read interrupt status and mask */
     uint32_t isr = UARTREG(base, UART_TMIS);
 
+    if (isr & UART_IMSC_TXIM) {
+        uart_tx_ring *tx = &uart_tx[port];
+        spin_lock(&tx->lock);
+        uart_tx_pump(tx, base);
+        spin_unlock(&tx->lock);
+    }
+
     if (isr & ((1<<6) | (1<<4))) { // rtmis, rxmis
         UARTREG(base, UART_ICR) = (1<<4);
         cbuf_t *rxbuf = &uart_rx_buf[port];
@@ -119,6 +181,7 @@ void uart_init(void) {
         // create circular buffer to hold received data
         cbuf_initialize(&uart_rx_buf[i], RXBUF_SIZE);
         DEBUG_ASSERT(uart_rx_buf[i].event.magic == EVENT_MAGIC);
+        spin_lock_init(&uart_tx[i].lock);
 
 #if !defined(PL011_TX_ONLY)
         //puts("registering irq");
@@ -158,6 +221,10 @@ void uart_init(void) {
         // enable interrupt
         unmask_interrupt(INTERRUPT_VC_UART + i);
         //puts("unmasked");
+#if UART_TX_BUFFERED && defined(ARCH_VPU)
+        // the irq is live, so anything queued from here on will get drained
+        uart_tx[i].ready = true;
+#endif
 #endif
     }
 }
@@ -197,15 +264,69 @@ void uart_init_early(void) {
 
 int uart_putc(int port, char c) {
     uintptr_t base = uart_to_ptr(port);
+    uart_tx_ring *tx = &uart_tx[port];
+
+    if (!tx->ready) {
+        /* spin while fifo is full */
+        uart_tx_wait(tx, base);
+        UARTREG(base, UART_DR) = c;
+        tx->stats.direct++;
+        return 1;
+    }
 
-    /* spin while fifo is full */
-    while (UARTREG(base, UART_TFR) & (1<<5))
-        ;
+    // printf gets here under the print spinlock, so interrupts are usually off, it still only queues
+    // the tx irq drains the tail once they are back on, and a full ring is polled below, so it never waits on the irq
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&tx->lock, state);
+    if ((tx->head - tx->tail) == TXBUF_SIZE) {
+        tx->stats.overflows++;
+        if (tx->drop) {
+            tx->stats.dropped++;
+            spin_unlock_irqrestore(&tx->lock, state);
+            return 1;
+        }
+        // do the irqs job for one char, this is what keeps things moving with interrupts off
+        uart_tx_wait(tx, base);
+        uart_tx_pump(tx, base);
+    }
+    tx->buf[tx->head++ % TXBUF_SIZE] = c;
+    tx->stats.queued++;
+    if ((tx->head - tx->tail) > tx->stats.high_water) tx->stats.high_water = tx->head - tx->tail;
+    uart_tx_pump(tx, base);
+    spin_unlock_irqrestore(&tx->lock, state);
+
+    return 1;
+}
+
+/* panic-time putc, everything queued goes out first so it stays in order */
+int uart_pputc(int port, char c) {
+    uintptr_t base = uart_to_ptr(port);
+    uart_tx_ring *tx = &uart_tx[port];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&tx->lock, state);
+    uart_tx_drain(tx, base);
+    uart_tx_wait(tx, base);
     UARTREG(base, UART_DR) = c;
+    tx->stats.direct++;
+    spin_unlock_irqrestore(&tx->lock, state);
 
     return 1;
 }
 
+void uart_tx_get_stats(int port, uart_tx_stats *stats) {
+    uart_tx_ring *tx = &uart_tx[port];
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&tx->lock, state);
+    *stats = tx->stats;
+    spin_unlock_irqrestore(&tx->lock, state);
+}
+
+void uart_tx_set_drop(int port, bool drop) {
+    uart_tx[port].drop = drop;
+}
+
 int uart_getc(int port, bool wait) {
     cbuf_t *rxbuf = &uart_rx_buf[port];
 
@@ -220,6 +341,11 @@ int uart_getc(int port, bool wait) {
 void uart_flush_tx(int port) {
   // waits until FIFO is empty and the final stop bit has been sent
   uintptr_t base = uart_to_ptr(port);
+  uart_tx_ring *tx = &uart_tx[port];
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&tx->lock, state);
+  uart_tx_drain(tx, base);
+  spin_unlock_irqrestore(&tx->lock, state);
   while (!(UARTREG(base, UART_TFR) & 0x80));
   while (UARTREG(base, UART_TFR) & 0x8);
   //udelay(250); // ugly hack
@@ -248,3 +374,21 @@ static int cmd_uart_dump(int argc, const console_cmd_args *argv) {
   dprintf(INFO, "want a uart divisor of 0x%x / 64\n", divisor);
   return 0;
 }
+
+static int cmd_uart_tx(int argc, const console_cmd_args *argv) {
+  if (argc >= 2) {
+    if (!strcmp(argv[1].str, "drop")) uart_tx_set_drop(0, true);
+    else if (!strcmp(argv[1].str, "block")) uart_tx_set_drop(0, false);
+    else {
+      printf("usage: uart_tx [drop|block]\n");
+      return -1;
+    }
+  }
+  uart_tx_stats s;
+  uart_tx_get_stats(0, &s);
+  // printing this queues more, so grab the numbers first
+  printf("%s, %s when full, ring %d bytes\n", uart_tx[0].ready ? "buffered" : "direct", uart_tx[0].drop ? "drop" : "block", TXBUF_SIZE);
+  printf("queued %u, direct %u, high water %u\n", s.queued, s.direct, s.high_water);
+  printf("overflows %u, dropped %u, stalled %u uSec\n", s.overflows, s.dropped, s.stalled_us);
+  return 0;
+}
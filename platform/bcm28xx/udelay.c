@@ -5,9 +5,8 @@
 #include <stdint.h>
 
 void udelay(uint32_t t) {
-  uint32_t tv = *REG32(ST_CLO);
-  uint32_t goal = tv + t;
-  for (;;) {
-    if ((*REG32(ST_CLO)) > goal) return;
-  }
+  uint32_t start = *REG32(ST_CLO);
+  // the subtraction wraps with the counter, a compare against start + t doesnt
+  while ((*REG32(ST_CLO) - start) <= t)
+    ;
 }
@@ -140,7 +140,7 @@ static void usbphy_init(uint level) {
 
   *REG32(USB_GMDIOCSR) = BV(18);
 
-  udelay(1000);
+  usleep(1000);
 
   usb_write(0x15, devmode ? 4369 : 272);
   usb_write(0x19, 0x4);
@@ -168,7 +168,7 @@ static void usbphy_init(uint level) {
 
   // from here
   *REG32(USB_GVBUSDRV) = (*REG32(USB_GVBUSDRV) & 0xFFF0FFFF) | 0xD0000; // axi priority
-  udelay(300);
+  usleep(300);
   if (devmode) {
     *REG32(USB_GUSBCFG) =
       USB_GUSBCFG_FORCE_DEV_MODE_SET |
@@ -179,11 +179,11 @@ static void usbphy_init(uint level) {
   } else {
     if (0) {
       *REG32(0x7E980400 + 3084) = 0x20402700; // USB_HCFG + something
-      udelay(300);
+      usleep(300);
       *REG32(USB_HCFG) = 1;
-      udelay(300);
+      usleep(300);
       *REG32(USB_HFIR) = 0xBB80; // 48mhz / 0xBB80 == 1ms frame interval
-      udelay(300);
+      usleep(300);
     }
   }
   /* to here
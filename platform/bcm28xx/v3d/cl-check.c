@@ -0,0 +1,139 @@
+// host check for v3d_cl.c, run with `make cl-check && ./cl-check`
+// the golden lists are what makeBinner/makeRenderer/makeShaderRecord produced before the encoder existed
+
+#include <platform/bcm28xx/v3d_cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 100x50 pixels, so 2x1 tiles
+#define TILE_ALLOC 0x1000
+#define TILE_ALLOC_SIZE 0x8000
+#define TILE_STATE 0x2000
+#define SHADER_RECORD 0x3000
+#define PRIMITIVE_LIST 0x4000
+#define FRAMEBUFFER 0x5000
+#define WIDTH 100
+#define HEIGHT 50
+
+static const uint8_t golden_binner[59] = {
+  0x70, 0x00, 0x10, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x20, 0x00,
+  0x00, 0x02, 0x01, 0x04, 0x06, 0x38, 0x32, 0x66, 0x00, 0x00, 0x00, 0x00,
+  0x64, 0x00, 0x32, 0x00, 0x60, 0x03, 0x00, 0x02, 0x67, 0x00, 0x00, 0x00,
+  0x00, 0x41, 0x00, 0x30, 0x00, 0x00, 0x20, 0x04, 0x03, 0x00, 0x00, 0x00,
+  0x00, 0x40, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x05, 0x01, 0x01,
+};
+static const uint8_t golden_render[53] = {
+  0x72, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x71, 0x00, 0x50, 0x00, 0x00, 0x64, 0x00, 0x32, 0x00, 0x04,
+  0x00, 0x73, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x73,
+  0x00, 0x00, 0x11, 0x00, 0x10, 0x00, 0x00, 0x18, 0x73, 0x01, 0x00, 0x11,
+  0x20, 0x10, 0x00, 0x00, 0x19,
+};
+static const uint8_t golden_shader_record[16] = {
+  0x01, 0x18, 0xcc, 0x03, 0x00, 0x60, 0x00, 0x00, 0x00, 0x70, 0x00, 0x00,
+  0x00, 0x80, 0x00, 0x00,
+};
+
+static int failures;
+
+static void compare(const char *name, const v3d_cl *cl, const uint8_t *golden, size_t size) {
+  size_t length = v3d_cl_length(cl);
+  if (cl->overflow) {
+    printf("%s: overflow\n", name);
+    failures++;
+    return;
+  }
+  if (length != size) {
+    printf("%s: length %zu, expected %zu\n", name, length, size);
+    failures++;
+    return;
+  }
+  for (size_t i=0; i<size; i++) {
+    if (cl->start[i] != golden[i]) {
+      printf("%s: byte %zu is 0x%02x, expected 0x%02x\n", name, i, cl->start[i], golden[i]);
+      failures++;
+      return;
+    }
+  }
+  printf("%s: %zu bytes ok\n", name, size);
+}
+
+static void check_binner(void) {
+  uint8_t buffer[sizeof(golden_binner)];
+  v3d_cl cl;
+  v3d_cl_init(&cl, buffer, sizeof(buffer));
+  v3d_cl_tile_binning_mode_config(&cl, TILE_ALLOC, TILE_ALLOC_SIZE, TILE_STATE, V3D_TILES(WIDTH), V3D_TILES(HEIGHT), 0, true);
+  v3d_cl_start_tile_binning(&cl);
+  v3d_cl_primitive_list_format(&cl, 0x32);
+  v3d_cl_clip_window(&cl, 0, 0, WIDTH, HEIGHT);
+  v3d_cl_configuration_bits(&cl, 0x03, 0x00, 0x02);
+  v3d_cl_viewport_offset(&cl, 0, 0);
+  v3d_cl_nv_shader_state(&cl, SHADER_RECORD);
+  v3d_cl_indexed_primitive_list(&cl, 0x04, 3, PRIMITIVE_LIST, 2);
+  v3d_cl_flush(&cl);
+  v3d_cl_nop(&cl);
+  v3d_cl_nop(&cl);
+  compare("binner", &cl, golden_binner, sizeof(golden_binner));
+}
+
+static void check_render(void) {
+  size_t size = v3d_cl_render_size(V3D_TILES(WIDTH), V3D_TILES(HEIGHT));
+  uint8_t *buffer = malloc(size);
+  v3d_cl cl;
+  v3d_cl_init(&cl, buffer, size);
+  v3d_cl_render_tiles(&cl, FRAMEBUFFER, WIDTH, HEIGHT, 0, TILE_ALLOC, 32);
+  compare("render", &cl, golden_render, sizeof(golden_render));
+
+  // one byte short must fail cleanly, not write past the end
+  v3d_cl_init(&cl, buffer, size - 1);
+  v3d_cl_render_tiles(&cl, FRAMEBUFFER, WIDTH, HEIGHT, 0, TILE_ALLOC, 32);
+  if (!cl.overflow || v3d_cl_length(&cl)) {
+    printf("render: short buffer not detected\n");
+    failures++;
+  }
+  free(buffer);
+}
+
+static void check_shader_record(void) {
+  uint8_t buffer[V3D_NV_SHADER_RECORD_SIZE];
+  v3d_cl cl;
+  v3d_cl_init(&cl, buffer, sizeof(buffer));
+  v3d_nv_shader_record(&cl, 0x01, 6*4, 0xcc, 3, 0x6000, 0x7000, 0x8000);
+  compare("shader record", &cl, golden_shader_record, sizeof(golden_shader_record));
+}
+
+static void bench_render(uint16_t width, uint16_t height) {
+  const int rounds = 10000;
+  uint32_t tiles = V3D_TILES(width) * V3D_TILES(height);
+  size_t size = v3d_cl_render_size(V3D_TILES(width), V3D_TILES(height));
+  uint8_t *buffer = malloc(size);
+  v3d_cl cl;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i=0; i<rounds; i++) {
+    v3d_cl_init(&cl, buffer, size);
+    v3d_cl_render_tiles(&cl, FRAMEBUFFER, width, height, 0, TILE_ALLOC, 32);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / rounds;
+  if (cl.overflow || (v3d_cl_length(&cl) != size)) {
+    printf("%dx%d: list is %zu bytes, expected %zu\n", width, height, v3d_cl_length(&cl), size);
+    failures++;
+  }
+  printf("%4dx%-4d %4d tiles, %6zu byte render list, %8.0f ns per list, %5.1f ns per tile\n", width, height, tiles, size, ns, ns / tiles);
+  free(buffer);
+}
+
+int main(int argc, char **argv) {
+  check_binner();
+  check_render();
+  check_shader_record();
+  bench_render(720, 480);
+  bench_render(1280, 720);
+  bench_render(1920, 1080);
+  bench_render(3840, 2160);
+  if (failures) printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
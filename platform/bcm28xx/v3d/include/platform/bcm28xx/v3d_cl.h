@@ -0,0 +1,116 @@
+#pragma once
+
+// typed encoder for v3d (vc4) control lists
+// only depends on libc, so it also builds on the host, see platform/bcm28xx/v3d/Makefile
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum v3d_cl_opcode {
+  V3D_CL_HALT = 0,
+  V3D_CL_NOP = 1,
+  V3D_CL_FLUSH = 5,
+  V3D_CL_START_TILE_BINNING = 6,
+  V3D_CL_BRANCH_TO_SUBLIST = 17,
+  V3D_CL_STORE_MS_TILE_BUFFER = 24,
+  V3D_CL_STORE_MS_TILE_BUFFER_AND_EOF = 25,
+  V3D_CL_STORE_TILE_BUFFER_GENERAL = 28,
+  V3D_CL_INDEXED_PRIMITIVE_LIST = 32,
+  V3D_CL_PRIMITIVE_LIST_FORMAT = 56,
+  V3D_CL_NV_SHADER_STATE = 65,
+  V3D_CL_CONFIGURATION_BITS = 96,
+  V3D_CL_CLIP_WINDOW = 102,
+  V3D_CL_VIEWPORT_OFFSET = 103,
+  V3D_CL_TILE_BINNING_MODE_CONFIG = 112,
+  V3D_CL_TILE_RENDERING_MODE_CONFIG = 113,
+  V3D_CL_CLEAR_COLORS = 114,
+  V3D_CL_TILE_COORDINATES = 115,
+};
+
+// packet sizes in bytes, including the opcode
+#define V3D_CL_HALT_SIZE                          1
+#define V3D_CL_NOP_SIZE                           1
+#define V3D_CL_FLUSH_SIZE                         1
+#define V3D_CL_START_TILE_BINNING_SIZE            1
+#define V3D_CL_BRANCH_TO_SUBLIST_SIZE             5
+#define V3D_CL_STORE_MS_TILE_BUFFER_SIZE          1
+#define V3D_CL_STORE_MS_TILE_BUFFER_AND_EOF_SIZE  1
+#define V3D_CL_STORE_TILE_BUFFER_GENERAL_SIZE     7
+#define V3D_CL_INDEXED_PRIMITIVE_LIST_SIZE        14
+#define V3D_CL_PRIMITIVE_LIST_FORMAT_SIZE         2
+#define V3D_CL_NV_SHADER_STATE_SIZE               5
+#define V3D_CL_CONFIGURATION_BITS_SIZE            4
+#define V3D_CL_CLIP_WINDOW_SIZE                   9
+#define V3D_CL_VIEWPORT_OFFSET_SIZE               5
+#define V3D_CL_TILE_BINNING_MODE_CONFIG_SIZE      16
+#define V3D_CL_TILE_RENDERING_MODE_CONFIG_SIZE    11
+#define V3D_CL_CLEAR_COLORS_SIZE                  14
+#define V3D_CL_TILE_COORDINATES_SIZE              3
+
+// not a control list packet, but built the same way
+#define V3D_NV_SHADER_RECORD_SIZE                 16
+
+// the hardware tiles are always 64x64 for non-multisampled rendering
+#define V3D_TILE_SIZE 64
+#define V3D_TILES(pixels) (((pixels) + V3D_TILE_SIZE - 1) / V3D_TILE_SIZE)
+
+// each packet is written byte at a time, the hardware doesnt align them
+// if a packet doesnt fit, nothing is written and overflow is set, so callers can check once at the end
+typedef struct {
+  uint8_t *start;
+  uint8_t *next;
+  uint8_t *end;
+  bool overflow;
+} v3d_cl;
+
+void v3d_cl_init(v3d_cl *cl, void *buffer, size_t size);
+
+static inline size_t v3d_cl_length(const v3d_cl *cl) {
+  return cl->next - cl->start;
+}
+
+void v3d_cl_halt(v3d_cl *cl);
+void v3d_cl_nop(v3d_cl *cl);
+void v3d_cl_flush(v3d_cl *cl);
+void v3d_cl_start_tile_binning(v3d_cl *cl);
+void v3d_cl_branch_to_sublist(v3d_cl *cl, uint32_t addr);
+void v3d_cl_store_ms_tile_buffer(v3d_cl *cl, bool eof);
+void v3d_cl_store_tile_buffer_general(v3d_cl *cl, uint16_t flags, uint32_t addr);
+// index_type: 0x04 8bit triangles, 0x14 16bit triangles
+void v3d_cl_indexed_primitive_list(v3d_cl *cl, uint8_t index_type, uint32_t length, uint32_t addr, uint32_t max_index);
+void v3d_cl_primitive_list_format(v3d_cl *cl, uint8_t format);
+void v3d_cl_nv_shader_state(v3d_cl *cl, uint32_t record_addr);
+void v3d_cl_configuration_bits(v3d_cl *cl, uint8_t flags0, uint8_t flags1, uint8_t flags2);
+void v3d_cl_clip_window(v3d_cl *cl, uint16_t left, uint16_t bottom, uint16_t width, uint16_t height);
+void v3d_cl_viewport_offset(v3d_cl *cl, int16_t x, int16_t y);
+// block_size is the log2(size/32) of the tile allocation blocks, used for both the initial and the extra blocks
+void v3d_cl_tile_binning_mode_config(v3d_cl *cl, uint32_t tile_alloc, uint32_t tile_alloc_size, uint32_t tile_state,
+                                     uint8_t tilewidth, uint8_t tileheight, uint8_t block_size, bool auto_init);
+void v3d_cl_tile_rendering_mode_config(v3d_cl *cl, uint32_t framebuffer, uint16_t width, uint16_t height, uint8_t flags0, uint8_t flags1);
+void v3d_cl_clear_colors(v3d_cl *cl, uint32_t color, uint32_t clear_zs, uint8_t clear_stencil);
+void v3d_cl_tile_coordinates(v3d_cl *cl, uint8_t column, uint8_t row);
+
+void v3d_nv_shader_record(v3d_cl *cl, uint8_t flags, uint8_t stride, uint8_t uniforms, uint8_t varyings,
+                          uint32_t code, uint32_t uniform_addr, uint32_t vertex_addr);
+
+// the render list v3d_cl_render_tiles() makes: clear, config, a dummy store to clear the tile buffer, then one sublist per tile
+static inline size_t v3d_cl_render_size(uint32_t tilewidth, uint32_t tileheight) {
+  return V3D_CL_CLEAR_COLORS_SIZE
+    + V3D_CL_TILE_RENDERING_MODE_CONFIG_SIZE
+    + V3D_CL_TILE_COORDINATES_SIZE
+    + V3D_CL_STORE_TILE_BUFFER_GENERAL_SIZE
+    + (tilewidth * tileheight) * (V3D_CL_TILE_COORDINATES_SIZE + V3D_CL_BRANCH_TO_SUBLIST_SIZE + V3D_CL_STORE_MS_TILE_BUFFER_SIZE);
+}
+
+// renders every tile the binner wrote to tile_alloc, slot_size bytes per tile, into a t-format rgba8888 framebuffer
+void v3d_cl_render_tiles(v3d_cl *cl, uint32_t framebuffer, uint16_t width, uint16_t height, uint32_t clear_color,
+                         uint32_t tile_alloc, uint32_t slot_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,7 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/v3d.c \
+	$(LOCAL_DIR)/v3d_cl.c \
 
 MODULES += external/lib/libm
 
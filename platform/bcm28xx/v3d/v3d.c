@@ -1,17 +1,20 @@
 #include <app.h>
 #include <assert.h>
-#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/wait.h>
 #include <lib/gfx.h>
+#include <lib/hexdump.h>
 #include <lk/console_cmd.h>
 #include <lk/reg.h>
 #include <math.h>
 #include <platform/bcm28xx/clock.h>
 #include <platform/bcm28xx/cm.h>
-#include <platform/bcm28xx/hexdump.h>
 #include <platform/bcm28xx/hvs.h>
 #include <platform/bcm28xx/pll_read.h>
 #include <platform/bcm28xx/udelay.h>
 #include <platform/bcm28xx/v3d.h>
+#include <platform/bcm28xx/v3d_cl.h>
 #include <platform/interrupts.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,52 +34,80 @@
 #define PM_GRAFX_ISFUNC_SET  0x00000020
 #define PM_GRAFX_V3DRSTN_SET 0x00000040
 
-#define CM_V3DCTL      0x7e101038
-#define CM_V3DDIV      0x7e10103c
 
-uint32_t control_start;
 uint32_t last_state;
 
+// how many frames can be between submission and completion
+// each job owns its own tile memory and control lists, so job N+1 can bin while job N renders
+#define V3D_JOBS 2
+// plus one frame being scanned out, and one the hvs hasnt latched yet
+// so nothing ever renders into a visible frame
+#define V3D_FRAMES (V3D_JOBS + 2)
+// how many samples the timing histograms cover
+#define TIMING_HISTORY 64
+#define TIMING_BUCKETS 12
+
 static int getTileAllocationSize(int n) {
   return 1 << (5 + n);
 }
 
 static int cmd_v3d_probe(int argc, const console_cmd_args *argv);
 static int cmd_v3d(int argc, const console_cmd_args *argv);
+static int cmd_v3d_stats(int argc, const console_cmd_args *argv);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("v3d_probe", "probe for v3d hw", &cmd_v3d_probe)
 STATIC_COMMAND("v3d_probe2", "probe for v3d hw", &cmd_v3d_probe2)
 STATIC_COMMAND("v3d", "do a full frame render", &cmd_v3d)
+STATIC_COMMAND("v3d_stats", "show binner/render time histograms", &cmd_v3d_stats)
 STATIC_COMMAND_END(v3d);
 
+// everything the hardware reads while a frame is in flight
 typedef struct {
   void *tileAllocation;
+  void *tileState;
+  void *vertexData;
+  void *shaderRecord;
+  void *binner;
+  uint32_t binnerSize;
+  void *renderer;
+  uint32_t renderSize;
+  gfx_surface *target;
+} v3d_job;
+
+typedef struct {
   uint32_t tileAllocationSize;
   uint32_t width;
   uint32_t height;
   uint32_t tilewidth;
   uint32_t tileheight;
-  void *tileState;
   uint32_t *shaderCode;
   void *uniforms;
-  void *vertexData;
-  void *shaderRecord;
   uint8_t *primitiveList;
-  void *binner;
-  uint32_t binnerSize;
-  void *renderer;
-  uint32_t renderSize;
   hvs_layer layer;
-  gfx_surface *frameA;
-  gfx_surface *frameB;
-  bool frameANext;
+  gfx_surface *frames[V3D_FRAMES];
+  int nextFrame;
   uint8_t tileAllocationEntrySize;
+
+  v3d_job jobs[V3D_JOBS];
+  // job n lives in jobs[n % V3D_JOBS], and they bin and render strictly in order
+  // submitted >= binned >= rendered, and submitted - rendered <= V3D_JOBS
+  uint32_t submitted;
+  uint32_t binned;
+  uint32_t rendered;
+  bool binning;
+  bool rendering;
+  uint32_t bin_start;
+  uint32_t render_start;
+  spin_lock_t lock;
 } v3d_client_state;
 
-v3d_client_state state;
+typedef struct {
+  uint32_t samples[TIMING_HISTORY];
+  uint32_t count;
+} v3d_timing;
 
-#define DIV_CIEL(x,y) ( ((x)+(y-1)) / y)
+v3d_client_state state;
 
 static int cmd_v3d_probe(int argc, const console_cmd_args *argv) {
   printf("ASB_V3D_M_CTRL: 0x%x\n", *REG32(ASB_V3D_M_CTRL));
@@ -124,13 +155,14 @@ int cmd_v3d_probe2(int argc, const console_cmd_args *argv) {
   x(V3D_ERRSTAT);
 
   printf("last_state: %d\n", last_state);
+  printf("jobs submitted: %d, binned: %d, rendered: %d\n", s->submitted, s->binned, s->rendered);
 
   //hexdump_ram(state.tileAllocationAligned - 32, (uint32_t)state.tileAllocationAligned - 32, 0x200);
   if (0) {
     uint32_t slotSize = getTileAllocationSize(s->tileAllocationEntrySize);
     for (uint32_t y=0; y < state.tileheight; y++) {
       for (uint32_t x=0; x < state.tilewidth; x++) {
-        uint32_t slot = (uint32_t)(((uint32_t)state.tileAllocation) + (y * state.tilewidth + x) * slotSize);
+        uint32_t slot = (uint32_t)(((uint32_t)state.jobs[0].tileAllocation) + (y * state.tilewidth + x) * slotSize);
         printf("tile x:%d y:%d\n", x, y);
         hexdump_ram((void*)slot, slot, slotSize);
       }
@@ -152,19 +184,10 @@ uint32_t shaderCode[] __attribute__((aligned(32))) = {
   0x009e7000, 0x500009e7, /* nop; nop; sbdone */
 };
 
-static inline void addbyte(uint8_t **list, uint8_t d) {
-  *((*list)++) = d;
-}
 static inline void addshort(uint8_t **list, uint16_t d) {
   *((*list)++) = (d) & 0xff;
   *((*list)++) = (d >> 8)  & 0xff;
 }
-static inline void addword(uint8_t **list, uint32_t d) {
-  *((*list)++) = (d) & 0xff;
-  *((*list)++) = (d >> 8)  & 0xff;
-  *((*list)++) = (d >> 16) & 0xff;
-  *((*list)++) = (d >> 24) & 0xff;
-}
 static inline void addfloat(uint8_t **list, float f) {
   uint32_t d = *((uint32_t *)&f);
   *((*list)++) = (d) & 0xff;
@@ -173,163 +196,101 @@ static inline void addfloat(uint8_t **list, float f) {
   *((*list)++) = (d >> 24) & 0xff;
 }
 
-void makeShaderRecord(v3d_client_state *s) {
+void makeShaderRecord(v3d_client_state *s, v3d_job *job) {
   // NV shader state record
-  uint8_t *shaderRecord = memalign(16, 0x20);
-  uint8_t *p = shaderRecord;
-  addbyte(&p, 0x01);                    // flags
-  addbyte(&p, 6*4);                     // vertex data stride, in bytes
-  addbyte(&p, 0xcc);                    // num uniforms (not used)
-  addbyte(&p, 3);                       // num varyings
-  addword(&p, (uint32_t)s->shaderCode); // Fragment shader code, must be aligned to ???
-  addword(&p, (uint32_t)s->uniforms);   // Fragment shader uniforms
-  addword(&p, (uint32_t)s->vertexData); // Vertex Data
-  assert((p - shaderRecord) < 0x20);
-  s->shaderRecord = shaderRecord;
+  uint8_t *shaderRecord = memalign(16, V3D_NV_SHADER_RECORD_SIZE);
+  v3d_cl cl;
+  v3d_cl_init(&cl, shaderRecord, V3D_NV_SHADER_RECORD_SIZE);
+  v3d_nv_shader_record(&cl,
+      0x01,                         // flags
+      6*4,                          // vertex data stride, in bytes
+      0xcc,                         // num uniforms (not used)
+      3,                            // num varyings
+      (uint32_t)s->shaderCode,      // Fragment shader code, must be aligned to ???
+      (uint32_t)s->uniforms,        // Fragment shader uniforms
+      (uint32_t)job->vertexData);   // Vertex Data
+  assert(!cl.overflow);
+  job->shaderRecord = shaderRecord;
 }
 
-void makeBinner(v3d_client_state *s) {
-  uint8_t *binner = malloc(0x80);
-  uint8_t *p = binner;
+// every packet makeBinner() emits, so the buffer is exactly the right size
+#define BINNER_SIZE (V3D_CL_TILE_BINNING_MODE_CONFIG_SIZE \
+    + V3D_CL_START_TILE_BINNING_SIZE \
+    + V3D_CL_PRIMITIVE_LIST_FORMAT_SIZE \
+    + V3D_CL_CLIP_WINDOW_SIZE \
+    + V3D_CL_CONFIGURATION_BITS_SIZE \
+    + V3D_CL_VIEWPORT_OFFSET_SIZE \
+    + V3D_CL_NV_SHADER_STATE_SIZE \
+    + V3D_CL_INDEXED_PRIMITIVE_LIST_SIZE \
+    + V3D_CL_FLUSH_SIZE \
+    + (2 * V3D_CL_NOP_SIZE))
+
+void makeBinner(v3d_client_state *s, v3d_job *job) {
+  uint8_t *binner = malloc(BINNER_SIZE);
+  v3d_cl cl;
+  v3d_cl_init(&cl, binner, BINNER_SIZE);
   // Configuration stuff
   // Tile Binning Configuration.
   //   Tile state data is 48 bytes per tile, I think it can be thrown away
   //   as soon as binning is finished.
-  addbyte(&p, 112);
-  addword(&p, (uint32_t)s->tileAllocation);        // 0-31  tile allocation memory address, must be 256 byte aligned
-  addword(&p, s->tileAllocationSize);              // 31-63 tile allocation memory size
-  addword(&p, (uint32_t)s->tileState);             // 64-95 Tile state data address, must be 16 byte aligned
-  addbyte(&p, s->tilewidth);                       // 96-103
-  addbyte(&p, s->tileheight);                      // 104-111
-  addbyte(&p, 0x04 | // auto-initialise tile state data array
-        (s->tileAllocationEntrySize << 3) |        // 115-116 tile allocation initial block size
-        (s->tileAllocationEntrySize << 5));        // 117-118 tile allocation block size
-  printf("112 tile binning configuration, tile allocation at %p+0x%x", s->tileAllocation, s->tileAllocationSize);
+  v3d_cl_tile_binning_mode_config(&cl, (uint32_t)job->tileAllocation, s->tileAllocationSize, (uint32_t)job->tileState,
+      s->tilewidth, s->tileheight, s->tileAllocationEntrySize, true);
+  printf("112 tile binning configuration, tile allocation at %p+0x%x", job->tileAllocation, s->tileAllocationSize);
   printf(", size (in tiles) %dx%x\n", s->tilewidth, s->tileheight);
-  printf("tile state: %p\n", s->tileState);
+  printf("tile state: %p\n", job->tileState);
 
   // Start tile binning.
-  addbyte(&p, 6);
+  v3d_cl_start_tile_binning(&cl);
 
   // Primitive type
-  addbyte(&p, 56);
-  addbyte(&p, 0x32); // 16 bit triangle
+  v3d_cl_primitive_list_format(&cl, 0x32); // 16 bit triangle
 
   // Clip Window
-  addbyte(&p, 102);
-  addshort(&p, 0);
-  addshort(&p, 0);
-  addshort(&p, s->width); // width
-  addshort(&p, s->height); // height
+  v3d_cl_clip_window(&cl, 0, 0, s->width, s->height);
   printf("102, clip window %dx%d\n", s->width, s->height);
 
   // State
-  addbyte(&p, 96);
-  addbyte(&p, 0x03); // enable both foward and back facing polygons
-  addbyte(&p, 0x00); // depth testing disabled
-  addbyte(&p, 0x02); // enable early depth write
+  v3d_cl_configuration_bits(&cl,
+      0x03,  // enable both foward and back facing polygons
+      0x00,  // depth testing disabled
+      0x02); // enable early depth write
 
   // Viewport offset
-  addbyte(&p, 103);
-  addshort(&p, 0);
-  addshort(&p, 0);
+  v3d_cl_viewport_offset(&cl, 0, 0);
 
   // The triangle
   // No Vertex Shader state (takes pre-transformed vertexes,
   // so we don't have to supply a working coordinate shader to test the binner.
-  addbyte(&p, 65);
-  addword(&p, (uint32_t)s->shaderRecord); // Shader Record
-  printf("65 NV shader state, 0x%p\n", s->shaderRecord);
+  v3d_cl_nv_shader_state(&cl, (uint32_t)job->shaderRecord);
+  printf("65 NV shader state, 0x%p\n", job->shaderRecord);
 
   // primitive index list
-  addbyte(&p, 32);
-  addbyte(&p, 0x04); // 8bit index, triangles
-  addword(&p, 3); // Length
-  addword(&p, (uint32_t)s->primitiveList); // address
-  addword(&p, 2); // Maximum index
+  v3d_cl_indexed_primitive_list(&cl, 0x04, 3, (uint32_t)s->primitiveList, 2); // 8bit index, triangles, length 3, max index 2
   printf("32, indexed primitive list, 0x%p\n", s->primitiveList);
 
   // End of bin list
-  // Flush
-  addbyte(&p, 5);
-  // Nop
-  addbyte(&p, 1);
-  // Nop
-  addbyte(&p, 1);
-
-  int length = p - binner;
-  s->binnerSize = length;
-  s->binner = binner;
-  assert(length < 0x80);
+  v3d_cl_flush(&cl);
+  v3d_cl_nop(&cl);
+  v3d_cl_nop(&cl);
+
+  assert(!cl.overflow);
+  job->binnerSize = v3d_cl_length(&cl);
+  job->binner = binner;
 }
 
-void makeRenderer(void *outputFrame, v3d_client_state *s, bool allocate) {
+void makeRenderer(void *outputFrame, v3d_client_state *s, v3d_job *job, bool allocate) {
+  // sized from the tile count, so any resolution fits
+  uint32_t size = v3d_cl_render_size(s->tilewidth, s->tileheight);
   if (allocate) {
-    uint8_t *render = malloc(0x2000);
-    s->renderer = render;
+    job->renderer = malloc(size);
   }
-  uint8_t *p = s->renderer;
-  // Render control list
-
-  // Clear color
-  addbyte(&p, 114);
-  // 0xAARRGGBB
-  addword(&p, 0x00000000); // transparent Black
-  addword(&p, 0x00000000); // 32 bit clear colours need to be repeated twice
-  addword(&p, 0); // clear zs and clear vg mask
-  addbyte(&p, 0); // clear stencil
-
-  // Tile Rendering Mode Configuration
-  // linear rgba8888 == VC_IMAGE_RGBA32
-  // t-format rgba8888 = VC_IMAGE_TF_RGBA32
-  addbyte(&p, 113);
-  addword(&p, (uint32_t)outputFrame);	//  0->31 framebuffer addresss
-  addshort(&p, s->width);	// 32->47 width
-  addshort(&p, s->height);	// 48->63 height
-  addbyte(&p, 0x4);		// 64 multisample mpe
-                                  // 65 tilebuffer depth
-                                  // 66->67 framebuffer mode (t-format rgba8888)
-                                  // 68->69 decimate mode
-                                  // 70->71 memory format
-  addbyte(&p, 0x00); // vg mask, coverage mode, early-z update, early-z cov, double-buffer
-
-  // Do a store of the first tile to force the tile buffer to be cleared
-  // Tile Coordinates
-  addbyte(&p, 115);
-  addbyte(&p, 0);
-  addbyte(&p, 0);
-
-  // Store Tile Buffer General
-  addbyte(&p, 28);
-  addshort(&p, 0); // Store nothing (just clear)
-  addword(&p, 0); // no address is needed
-
-  uint32_t slotSize = getTileAllocationSize(s->tileAllocationEntrySize);
-
-  // Link all binned lists together
-  for(uint32_t y = 0; y < s->tileheight; y++) {
-    for(uint32_t x = 0; x < s->tilewidth; x++) {
-      // Tile Coordinates
-      addbyte(&p, 115);
-      addbyte(&p, x); // column
-      addbyte(&p, y); // row
-
-      // Call Tile sublist
-      addbyte(&p, 17);
-      addword(&p, (uint32_t)(s->tileAllocation + (y * s->tilewidth + x) * slotSize)); // 2d array of $slotSize byte objects
-
-      // Last tile needs a special store instruction
-      if ((x == (s->tilewidth-1)) && (y == (s->tileheight-1))) {
-        // Store resolved tile color buffer and signal end of frame
-        addbyte(&p, 25);
-      } else {
-        // Store resolved tile color buffer
-        addbyte(&p, 24);
-      }
-    }
-  }
-  s->renderSize = p - (uint8_t*)s->renderer;
-  assert(s->renderSize < 0x2000);
+  v3d_cl cl;
+  v3d_cl_init(&cl, job->renderer, size);
+  v3d_cl_render_tiles(&cl, (uint32_t)outputFrame, s->width, s->height,
+      0x00000000, // transparent Black
+      (uint32_t)job->tileAllocation, getTileAllocationSize(s->tileAllocationEntrySize));
+  assert(!cl.overflow);
+  job->renderSize = v3d_cl_length(&cl);
 }
 
 static void makeVertexData(uint8_t *vertexvirt,int width,int height, int degrees) {
@@ -391,83 +352,134 @@ static void v3d_allocate(void) {
   // each object, is a control-list bytecode, describing how to render a single tile
   v3d_client_state *s = &state;
   s->tileAllocationEntrySize = 0;
-  state.tileAllocationSize = 0x8000;
-  state.tileAllocation = memalign(256, state.tileAllocationSize);
   state.width = 720;
   state.height = 480;
-  state.tilewidth = DIV_CIEL(state.width, 64);
-  state.tileheight = DIV_CIEL(state.height, 64);
+  state.tilewidth = V3D_TILES(state.width);
+  state.tileheight = V3D_TILES(state.height);
+  // the initial block for every tile, plus room for the binner to chain on overflow blocks
+  state.tileAllocationSize = state.tilewidth * state.tileheight * getTileAllocationSize(s->tileAllocationEntrySize) * 8;
+  if (state.tileAllocationSize < 0x8000) state.tileAllocationSize = 0x8000;
   printf("%d x %d (pixels)\n", state.width, state.height);
   printf("%d x %d (tiles)\n", state.tilewidth, state.tileheight);
-  state.tileState = memalign(16, 48 * state.tilewidth * state.tileheight);
   state.shaderCode = shaderCode;
   state.uniforms = malloc(0x10);
-  state.vertexData = malloc(0x60);
-  makeShaderRecord(s);
-  printf("shader record %p\n", state.shaderRecord);
   state.primitiveList = malloc(3);
   state.primitiveList[0] = 0;
   state.primitiveList[1] = 1;
   state.primitiveList[2] = 2;
-  makeBinner(&state);
-  s->frameA = gfx_create_surface(NULL, state.width, state.height, state.width, GFX_FORMAT_ARGB_8888);
-  s->frameB = gfx_create_surface(NULL, state.width, state.height, state.width, GFX_FORMAT_ARGB_8888);;
-  MK_UNITY_LAYER(&state.layer, s->frameA, 40, 0, 0);
+  for (int i=0; i<V3D_FRAMES; i++) {
+    s->frames[i] = gfx_create_surface(NULL, state.width, state.height, state.width, GFX_FORMAT_ARGB_8888);
+  }
+  for (int i=0; i<V3D_JOBS; i++) {
+    v3d_job *job = &s->jobs[i];
+    job->tileAllocation = memalign(256, state.tileAllocationSize);
+    job->tileState = memalign(16, 48 * state.tilewidth * state.tileheight);
+    job->vertexData = malloc(0x60);
+    makeVertexData(job->vertexData, state.width, state.height, 0);
+    makeShaderRecord(s, job);
+    printf("shader record %p\n", job->shaderRecord);
+    makeBinner(s, job);
+    job->target = s->frames[0];
+    makeRenderer(job->target->ptr, s, job, true);
+  }
+  mk_unity_layer(&state.layer, s->frames[0], 40, 0, 0);
   state.layer.name = "v3d";
-  s->frameANext = true;
+  // premade, so v3d_irq can flip it with hvs_layer_set_fb()
+  hvs_allocate_premade(&state.layer, 7);
+  hvs_regen_noscale_noviewport(&state.layer);
+  s->nextFrame = 1;
+  spin_lock_init(&s->lock);
+}
+
+static void v3d_start_bin(v3d_client_state *s, v3d_job *job) {
+  *REG32(V3D_CT0CS) = 0x8000; // reset control thread
+  *REG32(V3D_CT0CA) = (uint32_t)job->binner;
+  s->bin_start = *REG32(ST_CLO);
+  *REG32(V3D_CT0EA) = (uint32_t)((job->binner + job->binnerSize) - 1);
+}
 
-  makeRenderer(state.frameA->ptr, &state, true);
+static void v3d_start_render(v3d_client_state *s, v3d_job *job) {
+  *REG32(V3D_CT1CS) = 0x8000; // reset control thread
+  *REG32(V3D_CT1CA) = (uint32_t)job->renderer;
+  s->render_start = *REG32(ST_CLO);
+  *REG32(V3D_CT1EA) = (uint32_t)((job->renderer + job->renderSize));
+}
 
-  makeVertexData(state.vertexData, state.width, state.height, 0);
+// starts whatever the binner and renderer are free to do next, must be called with s->lock held
+static void v3d_kick(v3d_client_state *s) {
+  if (!s->rendering && (s->rendered != s->binned)) {
+    v3d_start_render(s, &s->jobs[s->rendered % V3D_JOBS]);
+    s->rendering = true;
+  }
+  if (!s->binning && (s->binned != s->submitted)) {
+    v3d_start_bin(s, &s->jobs[s->binned % V3D_JOBS]);
+    s->binning = true;
+  }
 }
 
 static int cmd_v3d_bin(int argc, const console_cmd_args *argv) {
-  printf("running job that spans %p to %p\n", state.binner, state.binner + state.binnerSize);
-  *REG32(V3D_CT0CS) = 0x8000; // reset control thread
-  *REG32(V3D_CT0CA) = (uint32_t)state.binner;
-  control_start = *REG32(ST_CLO);
-  *REG32(V3D_CT0EA) = (uint32_t)((state.binner + state.binnerSize) - 1);
+  v3d_job *job = &state.jobs[0];
+  printf("running job that spans %p to %p\n", job->binner, job->binner + job->binnerSize);
+  v3d_start_bin(&state, job);
   printf("V3D_CT0CS: 0x%x\n", *REG32(V3D_CT0CS));
-  bzero(state.layer.fb->ptr, state.layer.fb->len);
+  bzero(job->target->ptr, job->target->len);
   hvs_set_background_color(1, 0x0);
   return 0;
 }
 
 static int cmd_v3d_render(int argc, const console_cmd_args *argv) {
-  printf("running job that spans %p to %p\n", state.renderer, state.renderer + state.renderSize);
-  *REG32(V3D_CT1CS) = 0x8000; // reset control thread
-  *REG32(V3D_CT1CA) = (uint32_t)state.renderer;
-  control_start = *REG32(ST_CLO);
-  *REG32(V3D_CT1EA) = (uint32_t)((state.renderer + state.renderSize));
+  v3d_job *job = &state.jobs[0];
+  printf("running job that spans %p to %p\n", job->renderer, job->renderer + job->renderSize);
+  v3d_start_render(&state, job);
   printf("V3D_CT1CS: 0x%x\n", *REG32(V3D_CT1CS));
   return 0;
 }
 
-bool render_pending;
-uint32_t render_pending_addr, render_pending_size;
-event_t frame_done_event;
+// woken from v3d_irq on every finished frame, waiters recheck their own condition under THREAD_LOCK
+// slot_free is for v3d_submit(), idle for v3d_wait_idle(), so neither can eat the wakeup the other needs
+static wait_queue_t slot_free_queue;
+static wait_queue_t idle_queue;
 uint32_t binner_time, render_time;
+static v3d_timing binner_times, render_times;
+
+static void timing_add(v3d_timing *t, uint32_t usec) {
+  t->samples[t->count % TIMING_HISTORY] = usec;
+  t->count++;
+}
 
 enum handler_return v3d_irq(void *arg) {
+  v3d_client_state *s = &state;
   uint32_t control_end = *REG32(ST_CLO);
   uint32_t status = *REG32(V3D_INTCTL);
+  bool frame_done = false;
   *REG32(V3D_INTCTL) = ~0;
   //printf("V3D_INTCTL: 0x%x\n", status);
-  uint32_t deltat = control_end - control_start;
-  //printf("delta-t: %d\n", control_end - control_start);
-  if (status & 2) { // binner finished
-    binner_time = deltat;
-    if (render_pending) {
-      render_pending = false;
-      *REG32(V3D_CT1CS) = 0x8000; // reset control thread
-      *REG32(V3D_CT1CA) = render_pending_addr;
-      control_start = *REG32(ST_CLO);
-      *REG32(V3D_CT1EA) = render_pending_size;
-    }
+  spin_lock(&s->lock);
+  if ((status & 2) && s->binning) { // binner finished
+    binner_time = control_end - s->bin_start;
+    timing_add(&binner_times, binner_time);
+    s->binning = false;
+    s->binned++;
+  }
+  if ((status & 1) && s->rendering) { // render finished
+    render_time = control_end - s->render_start;
+    timing_add(&render_times, render_time);
+    s->rendering = false;
+    v3d_job *job = &s->jobs[s->rendered % V3D_JOBS];
+    s->rendered++;
+    // flip straight from here, no need to wake a thread and take the channel lock
+    hvs_layer_set_fb(&s->layer, job->target);
+    frame_done = true;
   }
-  if (status & 1) { // render finished
-    render_time = deltat;
-    event_signal(&frame_done_event, false);
+  // the next job can start binning while this one renders
+  v3d_kick(s);
+  const bool idle = s->rendered == s->submitted;
+  spin_unlock(&s->lock);
+  if (frame_done) {
+    THREAD_LOCK(state);
+    wait_queue_wake_all(&slot_free_queue, false, NO_ERROR);
+    if (idle) wait_queue_wake_all(&idle_queue, false, NO_ERROR);
+    THREAD_UNLOCK(state);
   }
   return INT_RESCHEDULE;
 }
@@ -516,10 +528,10 @@ static void v3d_init(const struct app_descriptor *app) {
   udelay(100);
 
   *REG32(PM_GRAFX) = CM_PASSWORD | (*REG32(PM_GRAFX) | 0x40); // enable v3d
-  render_pending = false;
   v3d_freq = (float)measure_clock(4) / 1000000;
 
-  event_init(&frame_done_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+  wait_queue_init(&slot_free_queue);
+  wait_queue_init(&idle_queue);
 
   udelay(1000);
   cmd_v3d_probe(0, 0);
@@ -536,62 +548,99 @@ static void v3d_init(const struct app_descriptor *app) {
   unmask_interrupt(10);
 }
 
-bool shown;
 int rotation = 0;
+static mutex_t submit_lock = MUTEX_INITIAL_VALUE(submit_lock);
+
+// queues one frame, only blocks if V3D_JOBS frames are already in flight
+static void v3d_submit(v3d_client_state *s, int degrees) {
+  spin_lock_saved_state_t irqstate;
+  mutex_acquire(&submit_lock);
+  // only v3d_irq moves rendered, and it cant run while THREAD_LOCK has irqs off, so the check and the block are atomic
+  THREAD_LOCK(state);
+  while ((s->submitted - s->rendered) >= V3D_JOBS) {
+    wait_queue_block(&slot_free_queue, INFINITE_TIME);
+  }
+  THREAD_UNLOCK(state);
+  v3d_job *job = &s->jobs[s->submitted % V3D_JOBS];
+
+  // the hardware is done with this slot, so it can be rebuilt without the lock
+  job->target = s->frames[s->nextFrame];
+  s->nextFrame = (s->nextFrame + 1) % V3D_FRAMES;
+  makeRenderer(job->target->ptr, s, job, false);
+  makeVertexData(job->vertexData, s->width, s->height, degrees);
+
+  spin_lock_irqsave(&s->lock, irqstate);
+  s->submitted++;
+  v3d_kick(s);
+  spin_unlock_irqrestore(&s->lock, irqstate);
+  mutex_release(&submit_lock);
+}
 
-static int cmd_v3d(int argc, const console_cmd_args *argv) {
-  gfx_surface *next = state.frameANext ? state.frameA : state.frameB;
-
-  // change which buffer we render into
-  makeRenderer(next->ptr, &state, false);
-  // update the xy coords
-  makeVertexData(state.vertexData, state.width, state.height, rotation++);
-
-  render_pending_addr = (uint32_t)state.renderer;
-  render_pending_size = (uint32_t)((state.renderer + state.renderSize));
-  render_pending = true;
+static void v3d_wait_idle(v3d_client_state *s) {
+  THREAD_LOCK(state);
+  while (s->rendered != s->submitted) {
+    wait_queue_block(&idle_queue, INFINITE_TIME);
+  }
+  THREAD_UNLOCK(state);
+}
 
-  //printf("running job that spans %p to %p\n", state.binner, state.binner + state.binnerSize);
-  *REG32(V3D_CT0CS) = 0x8000; // reset control thread
-  *REG32(V3D_CT0CA) = (uint32_t)state.binner;
-  control_start = *REG32(ST_CLO);
-  *REG32(V3D_CT0EA) = (uint32_t)((state.binner + state.binnerSize) - 1);
-  //printf("V3D_CT0CS: 0x%x\n", *REG32(V3D_CT0CS));
-  //bzero(state.surface->ptr, state.surface->len);
-  //puts("waiting");
+static int cmd_v3d(int argc, const console_cmd_args *argv) {
+  v3d_submit(&state, rotation++);
   last_state = 6;
-  event_wait(&frame_done_event);
+  v3d_wait_idle(&state);
   last_state = 7;
   //printf("binning took %d uSec(%f) and rendering took %d uSec(%f) @ %f MHz\n", binner_time, binner_time * v3d_freq, render_time, render_time * v3d_freq, v3d_freq);
+  return 0;
+}
 
-  int channel = 1;
-  mutex_acquire(&channels[channel].lock);
-  state.layer.fb = next;
-  state.frameANext = !state.frameANext;
-  if (!shown) {
-    hvs_dlist_add(channel, &state.layer);
-    shown = true;
+static void timing_dump(const char *name, const v3d_timing *t) {
+  uint32_t count = (t->count < TIMING_HISTORY) ? t->count : TIMING_HISTORY;
+  uint32_t buckets[TIMING_BUCKETS] = { 0 };
+  uint32_t min = ~0, max = 0, total = 0;
+  if (count == 0) {
+    printf("%s: no samples\n", name);
+    return;
+  }
+  for (uint32_t i=0; i<count; i++) {
+    uint32_t usec = t->samples[i];
+    if (usec < min) min = usec;
+    if (usec > max) max = usec;
+    total += usec;
+    // bucket n holds everything under 16<<n uSec, the last bucket catches the rest
+    int bucket = 0;
+    while ((bucket < (TIMING_BUCKETS - 1)) && (usec >= (16u << bucket))) bucket++;
+    buckets[bucket]++;
   }
-  hvs_update_dlist(channel);
-  mutex_release(&channels[channel].lock);
+  printf("%s, last %d frames: min %d, avg %d, max %d uSec\n", name, count, min, total / count, max);
+  for (int i=0; i<TIMING_BUCKETS; i++) {
+    if (buckets[i] == 0) continue;
+    if (i == (TIMING_BUCKETS - 1)) printf("  >= %6d uSec: %d\n", 16 << (i - 1), buckets[i]);
+    else printf("  <  %6d uSec: %d\n", 16 << i, buckets[i]);
+  }
+}
+
+static int cmd_v3d_stats(int argc, const console_cmd_args *argv) {
+  printf("v3d @ %f MHz, %d frames rendered, %d in flight\n", v3d_freq, state.rendered, state.submitted - state.rendered);
+  timing_dump("binner", &binner_times);
+  timing_dump("render", &render_times);
   return 0;
 }
 
 static void v3d_entry(const struct app_descriptor *app, void *args) {
   int hvs_channel = 1;
   last_state = 1;
+  mutex_acquire(&channels[hvs_channel].lock);
+  hvs_dlist_add(hvs_channel, &state.layer);
+  hvs_update_dlist(hvs_channel);
+  mutex_release(&channels[hvs_channel].lock);
   while (true) {
     last_state = 2;
     hvs_wait_vsync(hvs_channel);
     last_state = 3;
 
-    cmd_v3d(0, NULL);
+    // finished frames are flipped by v3d_irq, so this never waits on the gpu unless it falls V3D_JOBS frames behind
+    v3d_submit(&state, rotation++);
     last_state = 4;
-
-    mutex_acquire(&channels[hvs_channel].lock);
-    hvs_update_dlist(hvs_channel);
-    mutex_release(&channels[hvs_channel].lock);
-    last_state = 5;
   }
 }
 
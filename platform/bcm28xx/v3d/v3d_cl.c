@@ -0,0 +1,209 @@
+#include <platform/bcm28xx/v3d_cl.h>
+
+void v3d_cl_init(v3d_cl *cl, void *buffer, size_t size) {
+  cl->start = buffer;
+  cl->next = buffer;
+  cl->end = cl->start + size;
+  cl->overflow = false;
+}
+
+// reserves a whole packet up front, so a packet is either written completely or not at all
+static inline uint8_t *cl_packet(v3d_cl *cl, uint8_t opcode, size_t size) {
+  if ((size_t)(cl->end - cl->next) < size) {
+    cl->overflow = true;
+    return NULL;
+  }
+  uint8_t *p = cl->next;
+  cl->next += size;
+  *p++ = opcode;
+  return p;
+}
+
+static inline void put8(uint8_t **p, uint8_t d) {
+  *((*p)++) = d;
+}
+
+static inline void put16(uint8_t **p, uint16_t d) {
+  *((*p)++) = (d) & 0xff;
+  *((*p)++) = (d >> 8)  & 0xff;
+}
+
+static inline void put32(uint8_t **p, uint32_t d) {
+  *((*p)++) = (d) & 0xff;
+  *((*p)++) = (d >> 8)  & 0xff;
+  *((*p)++) = (d >> 16) & 0xff;
+  *((*p)++) = (d >> 24) & 0xff;
+}
+
+static void cl_opcode_only(v3d_cl *cl, uint8_t opcode) {
+  cl_packet(cl, opcode, 1);
+}
+
+void v3d_cl_halt(v3d_cl *cl) {
+  cl_opcode_only(cl, V3D_CL_HALT);
+}
+
+void v3d_cl_nop(v3d_cl *cl) {
+  cl_opcode_only(cl, V3D_CL_NOP);
+}
+
+void v3d_cl_flush(v3d_cl *cl) {
+  cl_opcode_only(cl, V3D_CL_FLUSH);
+}
+
+void v3d_cl_start_tile_binning(v3d_cl *cl) {
+  cl_opcode_only(cl, V3D_CL_START_TILE_BINNING);
+}
+
+void v3d_cl_branch_to_sublist(v3d_cl *cl, uint32_t addr) {
+  uint8_t *p = cl_packet(cl, V3D_CL_BRANCH_TO_SUBLIST, V3D_CL_BRANCH_TO_SUBLIST_SIZE);
+  if (!p) return;
+  put32(&p, addr);
+}
+
+void v3d_cl_store_ms_tile_buffer(v3d_cl *cl, bool eof) {
+  cl_opcode_only(cl, eof ? V3D_CL_STORE_MS_TILE_BUFFER_AND_EOF : V3D_CL_STORE_MS_TILE_BUFFER);
+}
+
+void v3d_cl_store_tile_buffer_general(v3d_cl *cl, uint16_t flags, uint32_t addr) {
+  uint8_t *p = cl_packet(cl, V3D_CL_STORE_TILE_BUFFER_GENERAL, V3D_CL_STORE_TILE_BUFFER_GENERAL_SIZE);
+  if (!p) return;
+  put16(&p, flags);
+  put32(&p, addr);
+}
+
+void v3d_cl_indexed_primitive_list(v3d_cl *cl, uint8_t index_type, uint32_t length, uint32_t addr, uint32_t max_index) {
+  uint8_t *p = cl_packet(cl, V3D_CL_INDEXED_PRIMITIVE_LIST, V3D_CL_INDEXED_PRIMITIVE_LIST_SIZE);
+  if (!p) return;
+  put8(&p, index_type);
+  put32(&p, length);
+  put32(&p, addr);
+  put32(&p, max_index);
+}
+
+void v3d_cl_primitive_list_format(v3d_cl *cl, uint8_t format) {
+  uint8_t *p = cl_packet(cl, V3D_CL_PRIMITIVE_LIST_FORMAT, V3D_CL_PRIMITIVE_LIST_FORMAT_SIZE);
+  if (!p) return;
+  put8(&p, format);
+}
+
+void v3d_cl_nv_shader_state(v3d_cl *cl, uint32_t record_addr) {
+  uint8_t *p = cl_packet(cl, V3D_CL_NV_SHADER_STATE, V3D_CL_NV_SHADER_STATE_SIZE);
+  if (!p) return;
+  put32(&p, record_addr);
+}
+
+void v3d_cl_configuration_bits(v3d_cl *cl, uint8_t flags0, uint8_t flags1, uint8_t flags2) {
+  uint8_t *p = cl_packet(cl, V3D_CL_CONFIGURATION_BITS, V3D_CL_CONFIGURATION_BITS_SIZE);
+  if (!p) return;
+  put8(&p, flags0);
+  put8(&p, flags1);
+  put8(&p, flags2);
+}
+
+void v3d_cl_clip_window(v3d_cl *cl, uint16_t left, uint16_t bottom, uint16_t width, uint16_t height) {
+  uint8_t *p = cl_packet(cl, V3D_CL_CLIP_WINDOW, V3D_CL_CLIP_WINDOW_SIZE);
+  if (!p) return;
+  put16(&p, left);
+  put16(&p, bottom);
+  put16(&p, width);
+  put16(&p, height);
+}
+
+void v3d_cl_viewport_offset(v3d_cl *cl, int16_t x, int16_t y) {
+  uint8_t *p = cl_packet(cl, V3D_CL_VIEWPORT_OFFSET, V3D_CL_VIEWPORT_OFFSET_SIZE);
+  if (!p) return;
+  put16(&p, x);
+  put16(&p, y);
+}
+
+void v3d_cl_tile_binning_mode_config(v3d_cl *cl, uint32_t tile_alloc, uint32_t tile_alloc_size, uint32_t tile_state,
+                                     uint8_t tilewidth, uint8_t tileheight, uint8_t block_size, bool auto_init) {
+  uint8_t *p = cl_packet(cl, V3D_CL_TILE_BINNING_MODE_CONFIG, V3D_CL_TILE_BINNING_MODE_CONFIG_SIZE);
+  if (!p) return;
+  put32(&p, tile_alloc);        // 0-31  tile allocation memory address, must be 256 byte aligned
+  put32(&p, tile_alloc_size);   // 31-63 tile allocation memory size
+  put32(&p, tile_state);        // 64-95 tile state data address, must be 16 byte aligned, 48 bytes per tile
+  put8(&p, tilewidth);          // 96-103
+  put8(&p, tileheight);         // 104-111
+  put8(&p, (auto_init ? 0x04 : 0) |
+        ((block_size & 3) << 3) |   // 115-116 tile allocation initial block size
+        ((block_size & 3) << 5));   // 117-118 tile allocation block size
+}
+
+void v3d_cl_tile_rendering_mode_config(v3d_cl *cl, uint32_t framebuffer, uint16_t width, uint16_t height, uint8_t flags0, uint8_t flags1) {
+  uint8_t *p = cl_packet(cl, V3D_CL_TILE_RENDERING_MODE_CONFIG, V3D_CL_TILE_RENDERING_MODE_CONFIG_SIZE);
+  if (!p) return;
+  put32(&p, framebuffer);       //  0->31 framebuffer addresss
+  put16(&p, width);             // 32->47 width
+  put16(&p, height);            // 48->63 height
+  put8(&p, flags0);             // 64 multisample mode, 65 tilebuffer depth, 66->67 framebuffer mode, 68->69 decimate mode, 70->71 memory format
+  put8(&p, flags1);             // vg mask, coverage mode, early-z update, early-z cov, double-buffer
+}
+
+void v3d_cl_clear_colors(v3d_cl *cl, uint32_t color, uint32_t clear_zs, uint8_t clear_stencil) {
+  uint8_t *p = cl_packet(cl, V3D_CL_CLEAR_COLORS, V3D_CL_CLEAR_COLORS_SIZE);
+  if (!p) return;
+  // 0xAARRGGBB, 32 bit clear colours need to be repeated twice
+  put32(&p, color);
+  put32(&p, color);
+  put32(&p, clear_zs);          // clear zs and clear vg mask
+  put8(&p, clear_stencil);
+}
+
+void v3d_cl_tile_coordinates(v3d_cl *cl, uint8_t column, uint8_t row) {
+  uint8_t *p = cl_packet(cl, V3D_CL_TILE_COORDINATES, V3D_CL_TILE_COORDINATES_SIZE);
+  if (!p) return;
+  put8(&p, column);
+  put8(&p, row);
+}
+
+void v3d_nv_shader_record(v3d_cl *cl, uint8_t flags, uint8_t stride, uint8_t uniforms, uint8_t varyings,
+                          uint32_t code, uint32_t uniform_addr, uint32_t vertex_addr) {
+  // no opcode, so the first field goes where the opcode would
+  uint8_t *p = cl_packet(cl, flags, V3D_NV_SHADER_RECORD_SIZE);
+  if (!p) return;
+  put8(&p, stride);             // vertex data stride, in bytes
+  put8(&p, uniforms);           // num uniforms (not used)
+  put8(&p, varyings);           // num varyings
+  put32(&p, code);              // fragment shader code
+  put32(&p, uniform_addr);      // fragment shader uniforms
+  put32(&p, vertex_addr);       // vertex data
+}
+
+void v3d_cl_render_tiles(v3d_cl *cl, uint32_t framebuffer, uint16_t width, uint16_t height, uint32_t clear_color,
+                         uint32_t tile_alloc, uint32_t slot_size) {
+  const uint32_t tilewidth = V3D_TILES(width);
+  const uint32_t tileheight = V3D_TILES(height);
+  // the tile loop is most of the list at high resolutions, so check the space once rather than per packet
+  if ((size_t)(cl->end - cl->next) < v3d_cl_render_size(tilewidth, tileheight)) {
+    cl->overflow = true;
+    return;
+  }
+  v3d_cl_clear_colors(cl, clear_color, 0, 0);
+  // linear rgba8888 == VC_IMAGE_RGBA32
+  // t-format rgba8888 = VC_IMAGE_TF_RGBA32
+  v3d_cl_tile_rendering_mode_config(cl, framebuffer, width, height, 0x4, 0x00);
+
+  // do a store of the first tile to force the tile buffer to be cleared
+  v3d_cl_tile_coordinates(cl, 0, 0);
+  v3d_cl_store_tile_buffer_general(cl, 0, 0); // store nothing (just clear), no address is needed
+
+  // link all binned lists together
+  uint8_t *p = cl->next;
+  uint32_t slot = tile_alloc;
+  for (uint32_t y = 0; y < tileheight; y++) {
+    for (uint32_t x = 0; x < tilewidth; x++) {
+      put8(&p, V3D_CL_TILE_COORDINATES);
+      put8(&p, x); // column
+      put8(&p, y); // row
+      put8(&p, V3D_CL_BRANCH_TO_SUBLIST);
+      put32(&p, slot); // 2d array of slot_size byte objects
+      slot += slot_size;
+      // last tile needs a special store instruction, that signals end of frame
+      put8(&p, V3D_CL_STORE_MS_TILE_BUFFER);
+    }
+  }
+  if (p != cl->next) p[-1] = V3D_CL_STORE_MS_TILE_BUFFER_AND_EOF;
+  cl->next = p;
+}
@@ -8,17 +8,169 @@
 #include <platform.h>
 #include <stdbool.h>
 
+#if WITH_LIB_MINIP
+#include <lib/minip.h>
+#endif
+
+// what platform_init() used before the FDT was parsed for them
+#define DEFAULT_PLIC_BASE 0x10400000
+#define DEFAULT_PLIC_IRQS 32
+#define DEFAULT_UART_BASE 0x10000000
+#define DEFAULT_UART_IRQ 1
+
+// virtio_mmio_detect() takes one evenly spaced run of slots, and can only be called once
+#define MAX_VIRTIO 8
+
 extern ulong lk_boot_args[4];
 
+static struct {
+  uint32_t plic_base;
+  uint32_t plic_irqs;
+  uint32_t plic_phandle;
+  uint32_t uart_base;
+  uint32_t uart_irq;
+  int virtio_count;
+  uint32_t virtio_base[MAX_VIRTIO];
+  uint32_t virtio_irq[MAX_VIRTIO];
+} board = {
+  .plic_base = DEFAULT_PLIC_BASE,
+  .plic_irqs = DEFAULT_PLIC_IRQS,
+  .uart_base = DEFAULT_UART_BASE,
+  .uart_irq = DEFAULT_UART_IRQ,
+};
+
+static uint32_t fdt_u32(const void *fdt, int offset, const char *prop, uint32_t fallback) {
+  int len;
+  const uint32_t *p = fdt_getprop(fdt, offset, prop, &len);
+  if (!p || (len < 4)) return fallback;
+  return fdt32_to_cpu(p[0]);
+}
+
+// the first address in reg, which is #address-cells of the parent wide, qemu virt uses 2
+// this is a 32bit machine, so only the low cell is kept
+static uint32_t fdt_reg_base(const void *fdt, int offset, uint32_t fallback) {
+  int cells = fdt_address_cells(fdt, fdt_parent_offset(fdt, offset));
+  if (cells < 1) return fallback;
+  int len;
+  const uint32_t *p = fdt_getprop(fdt, offset, "reg", &len);
+  if (!p || (len < (cells * 4))) return fallback;
+  for (int i = 0; i < (cells - 1); i++) {
+    if (p[i]) {
+      printf("reg in %s is above 4gig, ignoring it\n", fdt_get_name(fdt, offset, NULL));
+      return fallback;
+    }
+  }
+  return fdt32_to_cpu(p[cells - 1]);
+}
+
+// interrupt-parent is inherited, usually from the root node
+static uint32_t interrupt_parent(const void *fdt, int offset) {
+  while (offset >= 0) {
+    uint32_t phandle = fdt_u32(fdt, offset, "interrupt-parent", 0);
+    if (phandle) return phandle;
+    offset = fdt_parent_offset(fdt, offset);
+  }
+  return 0;
+}
+
+static void add_virtio(const void *fdt, int offset) {
+  const uint32_t base = fdt_reg_base(fdt, offset, 0);
+  const uint32_t irq = fdt_u32(fdt, offset, "interrupts", 0);
+  const uint32_t parent = interrupt_parent(fdt, offset);
+  if (base == 0) {
+    printf("virtio %s has no usable reg, skipping\n", fdt_get_name(fdt, offset, NULL));
+    return;
+  }
+  if (board.plic_phandle && (parent != board.plic_phandle)) {
+    printf("virtio at 0x%x routes irq %d to phandle %d, not the plic, skipping\n", base, irq, parent);
+    return;
+  }
+  if ((irq == 0) || (irq >= board.plic_irqs)) {
+    printf("virtio at 0x%x has irq %d, the plic has %d, skipping\n", base, irq, board.plic_irqs);
+    return;
+  }
+  if (board.virtio_count == MAX_VIRTIO) {
+    printf("virtio at 0x%x is over MAX_VIRTIO, skipping\n", base);
+    return;
+  }
+  // kept sorted by address, qemu style dtbs list them backwards
+  int i = board.virtio_count++;
+  for (; (i > 0) && (board.virtio_base[i - 1] > base); i--) {
+    board.virtio_base[i] = board.virtio_base[i - 1];
+    board.virtio_irq[i] = board.virtio_irq[i - 1];
+  }
+  board.virtio_base[i] = base;
+  board.virtio_irq[i] = irq;
+}
+
+// the plic has to be found before the virtio nodes can be checked against it, so this is 2 passes
+static void parse_fdt(const void *fdt) {
+  int offset = fdt_node_offset_by_compatible(fdt, -1, "riscv,plic0");
+  if (offset < 0) offset = fdt_node_offset_by_compatible(fdt, -1, "sifive,plic-1.0.0");
+  if (offset >= 0) {
+    board.plic_base = fdt_reg_base(fdt, offset, DEFAULT_PLIC_BASE);
+    // sources are numbered from 1, source 0 doesnt exist
+    board.plic_irqs = fdt_u32(fdt, offset, "riscv,ndev", DEFAULT_PLIC_IRQS - 1) + 1;
+    board.plic_phandle = fdt_get_phandle(fdt, offset);
+  } else {
+    puts("no plic in the DTB, using the default");
+  }
+
+  offset = fdt_node_offset_by_compatible(fdt, -1, "arm,pl011");
+  if (offset >= 0) {
+    board.uart_base = fdt_reg_base(fdt, offset, DEFAULT_UART_BASE);
+    board.uart_irq = fdt_u32(fdt, offset, "interrupts", DEFAULT_UART_IRQ);
+  }
+
+  for (offset = fdt_node_offset_by_compatible(fdt, -1, "virtio,mmio"); offset >= 0;
+      offset = fdt_node_offset_by_compatible(fdt, offset, "virtio,mmio")) {
+    add_virtio(fdt, offset);
+  }
+}
+
 void platform_early_init(void) {
-  plic_early_init(0x10400000, 32, false);
+  const void *fdt = (void*)lk_boot_args[1];
+  if (fdt_check_header(fdt) >= 0) parse_fdt(fdt);
+  plic_early_init(board.plic_base, board.plic_irqs, false);
 }
 
 bool uart_online = false;
 
+// the longest evenly spaced run from the first slot, what virtio_mmio_detect() can take in one call
+static void start_virtio(void) {
+  if (board.virtio_count == 0) return;
+  int count = 1;
+  size_t stride = 0;
+  if (board.virtio_count > 1) {
+    stride = board.virtio_base[1] - board.virtio_base[0];
+    for (count = 2; count < board.virtio_count; count++) {
+      if ((board.virtio_base[count] - board.virtio_base[count - 1]) != stride) break;
+    }
+  }
+  if (count < board.virtio_count) {
+    printf("virtio slots past 0x%x arent evenly spaced, ignoring %d\n", board.virtio_base[count - 1], board.virtio_count - count);
+  }
+  uint irqs[MAX_VIRTIO];
+  for (int i = 0; i < count; i++) {
+    irqs[i] = board.virtio_irq[i];
+    printf("virtio at 0x%x irq %d\n", board.virtio_base[i], irqs[i]);
+  }
+  virtio_mmio_detect((void*)board.virtio_base[0], count, irqs, stride);
+
+#if WITH_LIB_MINIP
+  if (virtio_net_found() > 0) {
+    uint8_t mac_addr[6];
+    virtio_net_get_mac_addr(mac_addr);
+    minip_set_macaddr(mac_addr);
+    minip_init_dhcp(virtio_net_send_minip_pkt, NULL);
+    virtio_net_start();
+  }
+#endif
+}
+
 void platform_init() {
-  pl011_uart_register(0, 0x10000000);
-  pl011_uart_init(0, 1); // TODO, assumes uart is on irq1
+  pl011_uart_register(0, board.uart_base);
+  pl011_uart_init(0, board.uart_irq);
   uart_online = true;
 
   printf("0x%lx\n", lk_boot_args[1]);
@@ -26,41 +178,8 @@ void platform_init() {
   int err = fdt_check_header(fdt);
   if (err >= 0) {
     puts("valid DTB found");
-    /* walk the nodes, looking for 'memory' */
-    int depth = 0;
-    int offset = 0;
-    for (;;) {
-      offset = fdt_next_node(fdt, offset, &depth);
-      if (offset < 0)
-        break;
-
-      /* get the name */
-      const char *name = fdt_get_name(fdt, offset, NULL);
-      if (!name)
-        continue;
-
-      printf("%d %d %s\n", depth, offset, name);
-      int lenp;
-      const char *prop_ptr = fdt_getprop(fdt, offset, "compatible", &lenp);
-      if (prop_ptr) { // has a compatible=
-        //printf("prop %p %d %s\n", prop_ptr, lenp, prop_ptr);
-        if (strcmp(prop_ptr, "virtio,mmio") == 0) {
-          const uint32_t *reg = fdt_getprop(fdt, offset, "reg", NULL);
-          uint32_t mmio_base = fdt32_to_cpu(reg[0]);
-          reg = fdt_getprop(fdt, offset, "interrupts", NULL);
-          uint32_t irq = fdt32_to_cpu(reg[0]);
-          printf("virtio at 0x%x %d\n", mmio_base, irq);
-          //virtio_mmio_detect((void*)mmio_base, 1, &irq, 0);
-        } else if (strcmp(prop_ptr, "arm,pl011") == 0) {
-          const uint32_t *prop = fdt_getprop(fdt, offset, "interrupts", NULL);
-          uint32_t irq = fdt32_to_cpu(prop[0]);
-          printf("uart irq is %d\n", irq);
-        } else {
-          printf("unknown %s\n", prop_ptr);
-        }
-      } else {
-      }
-    }
+    printf("plic at 0x%x with %d irqs, uart at 0x%x irq %d\n", board.plic_base, board.plic_irqs, board.uart_base, board.uart_irq);
+    start_virtio();
   } else {
     printf("DTB invalid: %d %s\n", err, fdt_strerror(err));
   }
@@ -70,7 +189,7 @@ void platform_dputc(char c) {
   if (uart_online) {
     pl011_uart_putc(0, c);
   } else {
-    *REG32(0x10000000) = c;
+    *REG32(board.uart_base) = c;
   }
 }
 
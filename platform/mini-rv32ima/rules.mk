@@ -7,7 +7,7 @@ SUBARCH ?= 32
 
 PL011_UART_COUNT := 4
 
-MODULE_DEPS += dev/interrupt/riscv_plic lib/fdt dev/virtio dev/virtio/net \
+MODULE_DEPS += dev/interrupt/riscv_plic lib/fdt dev/virtio dev/virtio/block dev/virtio/net \
   dev/uart/pl011 \
   app/shell \
 
@@ -0,0 +1,9 @@
+# the emulator target with the virtio benchmarks, they run at boot and the emulator exits after
+# give it an ext2 image as the first virtio-blk device, the `bench <name>:` lines are the results
+VIRT_BENCH_AUTORUN := 1
+# the 1MB default is too small for the ext2 walk
+MEMSIZE := 0x04000000
+
+MODULES += app/virt-bench
+
+include project/mini-rv32ima.mk